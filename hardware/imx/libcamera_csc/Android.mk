@@ -0,0 +1,51 @@
+# Copyright (C) 2008 The Android Open Source Project
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+ifeq ($(BOARD_HAVE_IMX_CAMERA),true)
+LOCAL_PATH:= $(call my-dir)
+
+# Colour space conversion kernels linked into the mx5x and mx6 camera HALs
+include $(CLEAR_VARS)
+LOCAL_SRC_FILES := camera_csc.c camera_csc_neon.c
+ifeq ($(ARCH_ARM_HAVE_NEON),true)
+LOCAL_ARM_NEON := true
+endif
+LOCAL_CFLAGS += -O3
+LOCAL_MODULE := libcamera_csc
+LOCAL_MODULE_TAGS := optional
+include $(BUILD_STATIC_LIBRARY)
+
+include $(CLEAR_VARS)
+LOCAL_SRC_FILES := camera_csc.c camera_csc_sse2.c
+LOCAL_CFLAGS += -O3 -msse2
+LOCAL_MODULE := libcamera_csc
+LOCAL_MODULE_TAGS := optional
+include $(BUILD_HOST_STATIC_LIBRARY)
+
+# Bit exactness test and benchmark, on target and on the build host
+include $(CLEAR_VARS)
+LOCAL_SRC_FILES := camera_csc_test.c
+LOCAL_STATIC_LIBRARIES := libcamera_csc
+LOCAL_MODULE := camera_csc_test
+LOCAL_MODULE_TAGS := optional tests
+include $(BUILD_EXECUTABLE)
+
+include $(CLEAR_VARS)
+LOCAL_SRC_FILES := camera_csc_test.c
+LOCAL_STATIC_LIBRARIES := libcamera_csc
+LOCAL_LDLIBS += -lrt
+LOCAL_MODULE := camera_csc_test
+LOCAL_MODULE_TAGS := optional tests
+include $(BUILD_HOST_EXECUTABLE)
+endif
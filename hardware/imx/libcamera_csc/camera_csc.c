@@ -0,0 +1,397 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Copyright 2009-2012 Freescale Semiconductor, Inc.
+ */
+
+#include <string.h>
+
+#include "camera_csc.h"
+#include "camera_csc_priv.h"
+
+#if defined(__ARM_NEON__)
+#define CSC_SIMD_OPS (&csc_row_ops_neon)
+#elif defined(__SSE2__)
+#define CSC_SIMD_OPS (&csc_row_ops_sse2)
+#else
+#define CSC_SIMD_OPS (&csc_row_ops_c)
+#endif
+
+/* YUYV to RGB565 rows are split through a stack buffer this many pixels at a time */
+#define CSC_CHUNK_PIXELS 512
+
+static const struct csc_row_ops *s_ops = CSC_SIMD_OPS;
+
+void csc_yuyv_row_c(const uint8_t *src, uint8_t *y, uint8_t *u, uint8_t *v,
+                    int uv_step, int width)
+{
+    int i;
+
+    if (u == NULL) {
+        for (i = 0; i < width; i += 2) {
+            y[i] = src[0];
+            y[i + 1] = src[2];
+            src += 4;
+        }
+        return;
+    }
+
+    for (i = 0; i < width; i += 2) {
+        y[i] = src[0];
+        y[i + 1] = src[2];
+        *u = src[1];
+        *v = src[3];
+        u += uv_step;
+        v += uv_step;
+        src += 4;
+    }
+}
+
+void csc_uv_row_c(const uint8_t *su, const uint8_t *sv, int src_step,
+                  uint8_t *du, uint8_t *dv, int dst_step, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++) {
+        uint8_t u = *su;
+        uint8_t v = *sv;
+        *du = u;
+        *dv = v;
+        su += src_step;
+        sv += src_step;
+        du += dst_step;
+        dv += dst_step;
+    }
+}
+
+void csc_rgb565_row_c(const uint8_t *y, const uint8_t *u, const uint8_t *v,
+                      int uv_step, uint16_t *dst, int width)
+{
+    int i;
+
+    for (i = 0; i < width; i += 2) {
+        dst[i] = csc_yuv_to_rgb565(y[i], *u, *v);
+        dst[i + 1] = csc_yuv_to_rgb565(y[i + 1], *u, *v);
+        u += uv_step;
+        v += uv_step;
+    }
+}
+
+const struct csc_row_ops csc_row_ops_c = {
+    "c",
+    csc_yuyv_row_c,
+    csc_uv_row_c,
+    csc_rgb565_row_c,
+};
+
+/* Plane pointers of a 4:2:0 frame, chroma rows are uv_stride bytes apart */
+struct csc_planes {
+    uint8_t *y;
+    uint8_t *u;
+    uint8_t *v;
+    int uv_step;
+    int uv_stride;
+};
+
+static void csc_get_planes(unsigned int format, const unsigned char *base,
+                           int width, int height, struct csc_planes *p)
+{
+    uint8_t *chroma = (uint8_t *)base + width * height;
+
+    p->y = (uint8_t *)base;
+    switch (format) {
+        case CSC_FMT_NV12:
+            p->u = chroma;
+            p->v = chroma + 1;
+            p->uv_step = 2;
+            p->uv_stride = width;
+            break;
+        case CSC_FMT_NV21:
+            p->v = chroma;
+            p->u = chroma + 1;
+            p->uv_step = 2;
+            p->uv_stride = width;
+            break;
+        default:
+            p->u = chroma;
+            p->v = chroma + (width >> 1) * (height >> 1);
+            p->uv_step = 1;
+            p->uv_stride = width >> 1;
+            break;
+    }
+}
+
+/*
+ * Chroma of each output row pair comes from the upper row only, as the UVC
+ * path always did.
+ */
+static void csc_yuyv_to_420(unsigned int dst_format, const unsigned char *src,
+                            unsigned char *dst, int width, int height)
+{
+    struct csc_planes d;
+    int row;
+
+    csc_get_planes(dst_format, dst, width, height, &d);
+    for (row = 0; row < height; row += 2) {
+        const uint8_t *s = src + row * (width << 1);
+        s_ops->yuyv(s, d.y + row * width, d.u, d.v, d.uv_step, width);
+        s_ops->yuyv(s + (width << 1), d.y + (row + 1) * width,
+                    NULL, NULL, 0, width);
+        d.u += d.uv_stride;
+        d.v += d.uv_stride;
+    }
+}
+
+static void csc_yuyv_to_rgb565(const unsigned char *src, unsigned char *dst,
+                               int width, int height)
+{
+    uint8_t y[CSC_CHUNK_PIXELS];
+    uint8_t u[CSC_CHUNK_PIXELS / 2];
+    uint8_t v[CSC_CHUNK_PIXELS / 2];
+    uint16_t *d = (uint16_t *)dst;
+    int row, x, n;
+
+    for (row = 0; row < height; row++) {
+        for (x = 0; x < width; x += n) {
+            n = width - x;
+            if (n > CSC_CHUNK_PIXELS)
+                n = CSC_CHUNK_PIXELS;
+            s_ops->yuyv(src + (x << 1), y, u, v, 1, n);
+            s_ops->rgb565(y, u, v, 1, d + x, n);
+        }
+        src += width << 1;
+        d += width;
+    }
+}
+
+static void csc_420_to_420(unsigned int src_format, unsigned int dst_format,
+                           const unsigned char *src, unsigned char *dst,
+                           int width, int height)
+{
+    struct csc_planes s, d;
+    int row;
+
+    csc_get_planes(src_format, src, width, height, &s);
+    csc_get_planes(dst_format, dst, width, height, &d);
+    memcpy(d.y, s.y, width * height);
+    for (row = 0; row < (height >> 1); row++) {
+        s_ops->uv(s.u, s.v, s.uv_step, d.u, d.v, d.uv_step, width >> 1);
+        s.u += s.uv_stride;
+        s.v += s.uv_stride;
+        d.u += d.uv_stride;
+        d.v += d.uv_stride;
+    }
+}
+
+static void csc_420_to_rgb565(unsigned int src_format,
+                              const unsigned char *src, unsigned char *dst,
+                              int width, int height)
+{
+    struct csc_planes s;
+    uint16_t *d = (uint16_t *)dst;
+    int row;
+
+    csc_get_planes(src_format, src, width, height, &s);
+    for (row = 0; row < height; row++) {
+        int offset = (row >> 1) * s.uv_stride;
+        s_ops->rgb565(s.y, s.u + offset, s.v + offset, s.uv_step, d, width);
+        s.y += width;
+        d += width;
+    }
+}
+
+static void yuyv_to_nv12(const unsigned char *src, unsigned char *dst, int w, int h)
+{
+    csc_yuyv_to_420(CSC_FMT_NV12, src, dst, w, h);
+}
+
+static void yuyv_to_nv21(const unsigned char *src, unsigned char *dst, int w, int h)
+{
+    csc_yuyv_to_420(CSC_FMT_NV21, src, dst, w, h);
+}
+
+static void yuyv_to_i420(const unsigned char *src, unsigned char *dst, int w, int h)
+{
+    csc_yuyv_to_420(CSC_FMT_I420, src, dst, w, h);
+}
+
+static void nv12_to_nv21(const unsigned char *src, unsigned char *dst, int w, int h)
+{
+    csc_420_to_420(CSC_FMT_NV12, CSC_FMT_NV21, src, dst, w, h);
+}
+
+static void nv12_to_i420(const unsigned char *src, unsigned char *dst, int w, int h)
+{
+    csc_420_to_420(CSC_FMT_NV12, CSC_FMT_I420, src, dst, w, h);
+}
+
+static void nv21_to_nv12(const unsigned char *src, unsigned char *dst, int w, int h)
+{
+    csc_420_to_420(CSC_FMT_NV21, CSC_FMT_NV12, src, dst, w, h);
+}
+
+static void nv21_to_i420(const unsigned char *src, unsigned char *dst, int w, int h)
+{
+    csc_420_to_420(CSC_FMT_NV21, CSC_FMT_I420, src, dst, w, h);
+}
+
+static void i420_to_nv12(const unsigned char *src, unsigned char *dst, int w, int h)
+{
+    csc_420_to_420(CSC_FMT_I420, CSC_FMT_NV12, src, dst, w, h);
+}
+
+static void i420_to_nv21(const unsigned char *src, unsigned char *dst, int w, int h)
+{
+    csc_420_to_420(CSC_FMT_I420, CSC_FMT_NV21, src, dst, w, h);
+}
+
+static void nv12_to_rgb565(const unsigned char *src, unsigned char *dst, int w, int h)
+{
+    csc_420_to_rgb565(CSC_FMT_NV12, src, dst, w, h);
+}
+
+static void nv21_to_rgb565(const unsigned char *src, unsigned char *dst, int w, int h)
+{
+    csc_420_to_rgb565(CSC_FMT_NV21, src, dst, w, h);
+}
+
+static void i420_to_rgb565(const unsigned char *src, unsigned char *dst, int w, int h)
+{
+    csc_420_to_rgb565(CSC_FMT_I420, src, dst, w, h);
+}
+
+static const struct camera_csc s_conversions[] = {
+    { CSC_FMT_YUYV, CSC_FMT_NV12,   "yuyv->nv12",   yuyv_to_nv12 },
+    { CSC_FMT_YUYV, CSC_FMT_NV21,   "yuyv->nv21",   yuyv_to_nv21 },
+    { CSC_FMT_YUYV, CSC_FMT_I420,   "yuyv->i420",   yuyv_to_i420 },
+    { CSC_FMT_YUYV, CSC_FMT_RGB565, "yuyv->rgb565", csc_yuyv_to_rgb565 },
+    { CSC_FMT_NV12, CSC_FMT_NV21,   "nv12->nv21",   nv12_to_nv21 },
+    { CSC_FMT_NV12, CSC_FMT_I420,   "nv12->i420",   nv12_to_i420 },
+    { CSC_FMT_NV12, CSC_FMT_RGB565, "nv12->rgb565", nv12_to_rgb565 },
+    { CSC_FMT_NV21, CSC_FMT_NV12,   "nv21->nv12",   nv21_to_nv12 },
+    { CSC_FMT_NV21, CSC_FMT_I420,   "nv21->i420",   nv21_to_i420 },
+    { CSC_FMT_NV21, CSC_FMT_RGB565, "nv21->rgb565", nv21_to_rgb565 },
+    { CSC_FMT_I420, CSC_FMT_NV12,   "i420->nv12",   i420_to_nv12 },
+    { CSC_FMT_I420, CSC_FMT_NV21,   "i420->nv21",   i420_to_nv21 },
+    { CSC_FMT_I420, CSC_FMT_RGB565, "i420->rgb565", i420_to_rgb565 },
+};
+
+const struct camera_csc *camera_csc_find(unsigned int src_format,
+                                         unsigned int dst_format)
+{
+    unsigned int i;
+
+    for (i = 0; i < sizeof(s_conversions) / sizeof(s_conversions[0]); i++) {
+        if (s_conversions[i].src_format == src_format &&
+                s_conversions[i].dst_format == dst_format)
+            return &s_conversions[i];
+    }
+    return NULL;
+}
+
+int camera_csc_convert(unsigned int src_format, unsigned int dst_format,
+                       const void *src, void *dst, int width, int height)
+{
+    const struct camera_csc *csc;
+
+    if (width <= 0 || height <= 0 || (width & 1) || (height & 1))
+        return -1;
+
+    csc = camera_csc_find(src_format, dst_format);
+    if (csc == NULL)
+        return -1;
+
+    csc->convert((const unsigned char *)src, (unsigned char *)dst, width, height);
+    return 0;
+}
+
+size_t camera_csc_frame_size(unsigned int format, int width, int height)
+{
+    switch (format) {
+        case CSC_FMT_YUYV:
+        case CSC_FMT_RGB565:
+            return (size_t)width * height * 2;
+        case CSC_FMT_NV12:
+        case CSC_FMT_NV21:
+        case CSC_FMT_I420:
+            return (size_t)width * height * 3 / 2;
+        default:
+            return 0;
+    }
+}
+
+static int csc_resize_plane(uint8_t *dst, int dst_width, int dst_height,
+                            const uint8_t *src, int src_width, int src_height)
+{
+    int h_ratio, v_ratio, h_offset, v_offset;
+    int i, j;
+
+    if (!dst_width || !dst_height)
+        return -1;
+
+    h_ratio = src_width / dst_width;
+    v_ratio = src_height / dst_height;
+    if (!h_ratio || !v_ratio)
+        return -1;
+
+    h_offset = (src_width - dst_width * h_ratio) / 2;
+    v_offset = (src_height - dst_height * v_ratio) / 2;
+
+    src += v_offset * src_width + h_offset;
+    for (i = 0; i < dst_height; i++) {
+        const uint8_t *s = src + i * v_ratio * src_width;
+        for (j = 0; j < dst_width; j++)
+            dst[j] = s[j * h_ratio];
+        dst += dst_width;
+    }
+    return 0;
+}
+
+int camera_csc_resize_i420(unsigned char *dst, int dst_width, int dst_height,
+                           const unsigned char *src, int src_width,
+                           int src_height)
+{
+    int plane;
+
+    if (csc_resize_plane(dst, dst_width, dst_height, src, src_width, src_height))
+        return -1;
+
+    src += src_width * src_height;
+    dst += dst_width * dst_height;
+    src_width >>= 1;
+    src_height >>= 1;
+    dst_width >>= 1;
+    dst_height >>= 1;
+
+    for (plane = 0; plane < 2; plane++) {
+        if (csc_resize_plane(dst, dst_width, dst_height, src, src_width, src_height))
+            return -1;
+        src += src_width * src_height;
+        dst += dst_width * dst_height;
+    }
+    return 0;
+}
+
+void camera_csc_set_impl(CSC_IMPL impl)
+{
+    s_ops = (impl == CSC_IMPL_SIMD) ? CSC_SIMD_OPS : &csc_row_ops_c;
+}
+
+const char *camera_csc_impl_name(void)
+{
+    return s_ops->name;
+}
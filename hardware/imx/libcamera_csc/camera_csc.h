@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Copyright 2009-2012 Freescale Semiconductor, Inc.
+ */
+
+/*
+ * Colour space conversion and scaling shared by the mx5x and mx6 camera
+ * HALs. Conversions are looked up by (source, destination) format pair and
+ * run on NEON when the library is built for it, SSE2 on x86 hosts and
+ * plain C elsewhere. All buffers are tightly packed, width and height must
+ * be even.
+ */
+#ifndef CAMERA_CSC_H
+#define CAMERA_CSC_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Same values as the V4L2 fourcc codes so HAL formats can be passed as is */
+#define CSC_FOURCC(a, b, c, d) \
+    ((unsigned int)(a) | ((unsigned int)(b) << 8) | \
+     ((unsigned int)(c) << 16) | ((unsigned int)(d) << 24))
+
+#define CSC_FMT_YUYV    CSC_FOURCC('Y', 'U', 'Y', 'V')
+#define CSC_FMT_NV12    CSC_FOURCC('N', 'V', '1', '2')
+#define CSC_FMT_NV21    CSC_FOURCC('N', 'V', '2', '1')
+#define CSC_FMT_I420    CSC_FOURCC('Y', 'U', '1', '2')
+#define CSC_FMT_RGB565  CSC_FOURCC('R', 'G', 'B', 'P')
+
+typedef enum {
+    CSC_IMPL_C = 0,
+    CSC_IMPL_SIMD = 1,
+} CSC_IMPL;
+
+typedef void (*camera_csc_func)(const unsigned char *src, unsigned char *dst,
+                                int width, int height);
+
+struct camera_csc {
+    unsigned int src_format;
+    unsigned int dst_format;
+    const char *name;
+    camera_csc_func convert;
+};
+
+/*
+ * Return the conversion for a format pair, NULL if it is not supported.
+ * The returned entry is static and may be kept by the caller.
+ */
+const struct camera_csc *camera_csc_find(unsigned int src_format,
+                                         unsigned int dst_format);
+
+/*
+ * Convert one frame. Returns 0 on success, -1 if the format pair is not
+ * supported or the size is invalid.
+ */
+int camera_csc_convert(unsigned int src_format, unsigned int dst_format,
+                       const void *src, void *dst, int width, int height);
+
+/* Bytes needed for a width x height frame, 0 for unknown formats */
+size_t camera_csc_frame_size(unsigned int format, int width, int height);
+
+/*
+ * Nearest neighbour downscale of an I420 frame by the integer ratios
+ * src / dst in each direction, centred on the source. Returns -1 if the
+ * destination is larger than the source.
+ */
+int camera_csc_resize_i420(unsigned char *dst, int dst_width, int dst_height,
+                           const unsigned char *src, int src_width,
+                           int src_height);
+
+/*
+ * Select the row kernels used by every conversion. CSC_IMPL_SIMD is the
+ * default and falls back to C when the library was built without SIMD.
+ * Only meant for tests and benchmarks, not thread safe.
+ */
+void camera_csc_set_impl(CSC_IMPL impl);
+
+/* Name of the kernels in use: "neon", "sse2" or "c" */
+const char *camera_csc_impl_name(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,171 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Copyright 2009-2012 Freescale Semiconductor, Inc.
+ */
+
+#include "camera_csc_priv.h"
+
+#if defined(__ARM_NEON__)
+
+#include <arm_neon.h>
+
+/* 32 pixels per iteration */
+static void csc_yuyv_row_neon(const uint8_t *src, uint8_t *y, uint8_t *u,
+                              uint8_t *v, int uv_step, int width)
+{
+    int i = 0;
+
+    for (; i + 32 <= width; i += 32) {
+        uint8x16x4_t p = vld4q_u8(src);
+        uint8x16x2_t yy;
+
+        yy.val[0] = p.val[0];
+        yy.val[1] = p.val[2];
+        vst2q_u8(y + i, yy);
+
+        if (u != NULL && uv_step == 1) {
+            vst1q_u8(u, p.val[1]);
+            vst1q_u8(v, p.val[3]);
+            u += 16;
+            v += 16;
+        } else if (u != NULL) {
+            uint8x16x2_t uv;
+            if (u < v) {
+                uv.val[0] = p.val[1];
+                uv.val[1] = p.val[3];
+                vst2q_u8(u, uv);
+            } else {
+                uv.val[0] = p.val[3];
+                uv.val[1] = p.val[1];
+                vst2q_u8(v, uv);
+            }
+            u += 32;
+            v += 32;
+        }
+        src += 64;
+    }
+
+    if (i < width)
+        csc_yuyv_row_c(src, y + i, u, v, uv_step, width - i);
+}
+
+/* 16 pairs per iteration */
+static void csc_uv_row_neon(const uint8_t *su, const uint8_t *sv, int src_step,
+                            uint8_t *du, uint8_t *dv, int dst_step, int n)
+{
+    int i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        uint8x16_t cu, cv;
+
+        if (src_step == 1) {
+            cu = vld1q_u8(su);
+            cv = vld1q_u8(sv);
+        } else {
+            uint8x16x2_t p = vld2q_u8(su < sv ? su : sv);
+            cu = su < sv ? p.val[0] : p.val[1];
+            cv = su < sv ? p.val[1] : p.val[0];
+        }
+
+        if (dst_step == 1) {
+            vst1q_u8(du, cu);
+            vst1q_u8(dv, cv);
+        } else {
+            uint8x16x2_t p;
+            p.val[0] = du < dv ? cu : cv;
+            p.val[1] = du < dv ? cv : cu;
+            vst2q_u8(du < dv ? du : dv, p);
+        }
+
+        su += src_step << 4;
+        sv += src_step << 4;
+        du += dst_step << 4;
+        dv += dst_step << 4;
+    }
+
+    if (i < n)
+        csc_uv_row_c(su, sv, src_step, du, dv, dst_step, n - i);
+}
+
+/* Eight pixels of RGB565 with the saturating order described in camera_csc_priv.h */
+static inline uint16x8_t csc_rgb565_8_neon(uint8x8_t y8, uint8x8_t u8, uint8x8_t v8)
+{
+    int16x8_t c = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(y8)), vdupq_n_s16(16));
+    int16x8_t d = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(u8)), vdupq_n_s16(128));
+    int16x8_t e = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(v8)), vdupq_n_s16(128));
+    int16x8_t round = vdupq_n_s16(CSC_ROUND);
+    int16x8_t r, g, b;
+    uint16x8_t rgb;
+
+    c = vmulq_n_s16(c, CSC_Y_COEF);
+    r = vqaddq_s16(vqaddq_s16(c, vmulq_n_s16(e, CSC_VR_COEF)), round);
+    g = vqsubq_s16(vqsubq_s16(c, vmulq_n_s16(d, CSC_UG_COEF)),
+                   vmulq_n_s16(e, CSC_VG_COEF));
+    g = vqaddq_s16(g, round);
+    b = vqaddq_s16(vqaddq_s16(c, vmulq_n_s16(d, CSC_UB_COEF)), round);
+
+    rgb = vshll_n_u8(vqmovun_s16(vshrq_n_s16(r, CSC_YUV_RGB_SHIFT)), 8);
+    rgb = vsriq_n_u16(rgb, vshll_n_u8(vqmovun_s16(vshrq_n_s16(g, CSC_YUV_RGB_SHIFT)), 8), 5);
+    rgb = vsriq_n_u16(rgb, vshll_n_u8(vqmovun_s16(vshrq_n_s16(b, CSC_YUV_RGB_SHIFT)), 8), 11);
+    return rgb;
+}
+
+/* 16 pixels per iteration */
+static void csc_rgb565_row_neon(const uint8_t *y, const uint8_t *u,
+                                const uint8_t *v, int uv_step, uint16_t *dst,
+                                int width)
+{
+    int i = 0;
+
+    for (; i + 16 <= width; i += 16) {
+        uint8x16_t yy = vld1q_u8(y + i);
+        uint8x8_t cu, cv;
+        uint8x8x2_t uu, vv;
+
+        if (uv_step == 1) {
+            cu = vld1_u8(u);
+            cv = vld1_u8(v);
+        } else {
+            uint8x8x2_t p = vld2_u8(u < v ? u : v);
+            cu = u < v ? p.val[0] : p.val[1];
+            cv = u < v ? p.val[1] : p.val[0];
+        }
+
+        /* every chroma sample covers two pixels */
+        uu = vzip_u8(cu, cu);
+        vv = vzip_u8(cv, cv);
+
+        vst1q_u16(dst + i, csc_rgb565_8_neon(vget_low_u8(yy), uu.val[0], vv.val[0]));
+        vst1q_u16(dst + i + 8, csc_rgb565_8_neon(vget_high_u8(yy), uu.val[1], vv.val[1]));
+
+        u += uv_step << 3;
+        v += uv_step << 3;
+    }
+
+    if (i < width)
+        csc_rgb565_row_c(y + i, u, v, uv_step, dst + i, width - i);
+}
+
+const struct csc_row_ops csc_row_ops_neon = {
+    "neon",
+    csc_yuyv_row_neon,
+    csc_uv_row_neon,
+    csc_rgb565_row_neon,
+};
+
+#endif
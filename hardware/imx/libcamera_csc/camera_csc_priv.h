@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Copyright 2009-2012 Freescale Semiconductor, Inc.
+ */
+#ifndef CAMERA_CSC_PRIV_H
+#define CAMERA_CSC_PRIV_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Every conversion is built from three row kernels. Chroma pointers carry
+ * a step: 1 for planar chroma, 2 for interleaved NV12/NV21 chroma where u
+ * and v point into the same row. The SIMD kernels do the bulk of a row and
+ * hand the tail to the C kernels, so their output is bit exact with C.
+ */
+struct csc_row_ops {
+    const char *name;
+
+    /* Split a YUYV row into Y and, if u is not NULL, one u/v per pair */
+    void (*yuyv)(const uint8_t *src, uint8_t *y, uint8_t *u, uint8_t *v,
+                 int uv_step, int width);
+
+    /* Copy n chroma pairs between planar and interleaved layouts */
+    void (*uv)(const uint8_t *su, const uint8_t *sv, int src_step,
+               uint8_t *du, uint8_t *dv, int dst_step, int n);
+
+    /* Convert a row to RGB565, each u/v is shared by a pixel pair */
+    void (*rgb565)(const uint8_t *y, const uint8_t *u, const uint8_t *v,
+                   int uv_step, uint16_t *dst, int width);
+};
+
+extern const struct csc_row_ops csc_row_ops_c;
+#if defined(__ARM_NEON__)
+extern const struct csc_row_ops csc_row_ops_neon;
+#endif
+#if defined(__SSE2__)
+extern const struct csc_row_ops csc_row_ops_sse2;
+#endif
+
+void csc_yuyv_row_c(const uint8_t *src, uint8_t *y, uint8_t *u, uint8_t *v,
+                    int uv_step, int width);
+void csc_uv_row_c(const uint8_t *su, const uint8_t *sv, int src_step,
+                  uint8_t *du, uint8_t *dv, int dst_step, int n);
+void csc_rgb565_row_c(const uint8_t *y, const uint8_t *u, const uint8_t *v,
+                      int uv_step, uint16_t *dst, int width);
+
+/*
+ * BT.601 video range to RGB in 6 bit fixed point. The coefficients keep
+ * every intermediate inside int16 except the blue sum, which can only
+ * overflow when the result clamps to 255 anyway, so 16 bit saturating SIMD
+ * lanes give the same result as this code.
+ */
+#define CSC_YUV_RGB_SHIFT   6
+#define CSC_Y_COEF          74
+#define CSC_VR_COEF         102
+#define CSC_UG_COEF         25
+#define CSC_VG_COEF         52
+#define CSC_UB_COEF         129
+#define CSC_ROUND           (1 << (CSC_YUV_RGB_SHIFT - 1))
+
+static inline uint8_t csc_clamp(int v)
+{
+    return v < 0 ? 0 : (v > 255 ? 255 : v);
+}
+
+static inline uint16_t csc_yuv_to_rgb565(int y, int u, int v)
+{
+    int c = (y - 16) * CSC_Y_COEF;
+    int d = u - 128;
+    int e = v - 128;
+    uint8_t r = csc_clamp((c + CSC_VR_COEF * e + CSC_ROUND) >> CSC_YUV_RGB_SHIFT);
+    uint8_t g = csc_clamp((c - CSC_UG_COEF * d - CSC_VG_COEF * e + CSC_ROUND) >> CSC_YUV_RGB_SHIFT);
+    uint8_t b = csc_clamp((c + CSC_UB_COEF * d + CSC_ROUND) >> CSC_YUV_RGB_SHIFT);
+
+    return ((r & 0xf8) << 8) | ((g & 0xfc) << 3) | (b >> 3);
+}
+
+#endif
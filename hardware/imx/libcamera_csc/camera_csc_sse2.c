@@ -0,0 +1,208 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Copyright 2009-2012 Freescale Semiconductor, Inc.
+ */
+
+/*
+ * SSE2 kernels so the host build, benchmark and bit exactness test run
+ * the same SIMD structure as the NEON kernels on target.
+ */
+
+#include <string.h>
+
+#include "camera_csc_priv.h"
+
+#if defined(__SSE2__)
+
+#include <emmintrin.h>
+
+/* Swap the two bytes of every 16 bit lane: UVUV <-> VUVU */
+static inline __m128i csc_swap_pairs(__m128i x)
+{
+    return _mm_or_si128(_mm_slli_epi16(x, 8), _mm_srli_epi16(x, 8));
+}
+
+/* Store eight interleaved pairs, in u/v order as given by the pointers */
+static inline void csc_store_pairs(uint8_t *u, uint8_t *v, __m128i uv)
+{
+    if (u < v)
+        _mm_storeu_si128((__m128i *)u, uv);
+    else
+        _mm_storeu_si128((__m128i *)v, csc_swap_pairs(uv));
+}
+
+/* Store eight interleaved u/v pairs as planar */
+static inline void csc_store_planar(uint8_t *u, uint8_t *v, __m128i uv)
+{
+    __m128i mask = _mm_set1_epi16(0xff);
+    __m128i zero = _mm_setzero_si128();
+
+    _mm_storel_epi64((__m128i *)u, _mm_packus_epi16(_mm_and_si128(uv, mask), zero));
+    _mm_storel_epi64((__m128i *)v, _mm_packus_epi16(_mm_srli_epi16(uv, 8), zero));
+}
+
+/* 16 pixels per iteration */
+static void csc_yuyv_row_sse2(const uint8_t *src, uint8_t *y, uint8_t *u,
+                              uint8_t *v, int uv_step, int width)
+{
+    __m128i mask = _mm_set1_epi16(0xff);
+    int i = 0;
+
+    for (; i + 16 <= width; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *)src);
+        __m128i b = _mm_loadu_si128((const __m128i *)(src + 16));
+
+        _mm_storeu_si128((__m128i *)(y + i),
+                         _mm_packus_epi16(_mm_and_si128(a, mask),
+                                          _mm_and_si128(b, mask)));
+        if (u != NULL) {
+            __m128i uv = _mm_packus_epi16(_mm_srli_epi16(a, 8),
+                                          _mm_srli_epi16(b, 8));
+            if (uv_step == 1) {
+                csc_store_planar(u, v, uv);
+                u += 8;
+                v += 8;
+            } else {
+                csc_store_pairs(u, v, uv);
+                u += 16;
+                v += 16;
+            }
+        }
+        src += 32;
+    }
+
+    if (i < width)
+        csc_yuyv_row_c(src, y + i, u, v, uv_step, width - i);
+}
+
+/* 8 pairs per iteration */
+static void csc_uv_row_sse2(const uint8_t *su, const uint8_t *sv, int src_step,
+                            uint8_t *du, uint8_t *dv, int dst_step, int n)
+{
+    int i = 0;
+
+    if (src_step == 1 && dst_step == 1) {
+        memcpy(du, su, n);
+        memcpy(dv, sv, n);
+        return;
+    }
+
+    for (; i + 8 <= n; i += 8) {
+        __m128i uv;
+
+        if (src_step == 1) {
+            __m128i cu = _mm_loadl_epi64((const __m128i *)su);
+            __m128i cv = _mm_loadl_epi64((const __m128i *)sv);
+            uv = _mm_unpacklo_epi8(cu, cv);
+        } else if (su < sv) {
+            uv = _mm_loadu_si128((const __m128i *)su);
+        } else {
+            uv = csc_swap_pairs(_mm_loadu_si128((const __m128i *)sv));
+        }
+
+        if (dst_step == 1)
+            csc_store_planar(du, dv, uv);
+        else
+            csc_store_pairs(du, dv, uv);
+
+        su += src_step << 3;
+        sv += src_step << 3;
+        du += dst_step << 3;
+        dv += dst_step << 3;
+    }
+
+    if (i < n)
+        csc_uv_row_c(su, sv, src_step, du, dv, dst_step, n - i);
+}
+
+/* Eight pixels of RGB565 with the saturating order described in camera_csc_priv.h */
+static inline __m128i csc_rgb565_8_sse2(__m128i y, __m128i u, __m128i v)
+{
+    __m128i zero = _mm_setzero_si128();
+    __m128i round = _mm_set1_epi16(CSC_ROUND);
+    __m128i c = _mm_mullo_epi16(_mm_sub_epi16(y, _mm_set1_epi16(16)),
+                                _mm_set1_epi16(CSC_Y_COEF));
+    __m128i d = _mm_sub_epi16(u, _mm_set1_epi16(128));
+    __m128i e = _mm_sub_epi16(v, _mm_set1_epi16(128));
+    __m128i r, g, b;
+
+    r = _mm_adds_epi16(_mm_adds_epi16(c, _mm_mullo_epi16(e, _mm_set1_epi16(CSC_VR_COEF))), round);
+    g = _mm_subs_epi16(_mm_subs_epi16(c, _mm_mullo_epi16(d, _mm_set1_epi16(CSC_UG_COEF))),
+                       _mm_mullo_epi16(e, _mm_set1_epi16(CSC_VG_COEF)));
+    g = _mm_adds_epi16(g, round);
+    b = _mm_adds_epi16(_mm_adds_epi16(c, _mm_mullo_epi16(d, _mm_set1_epi16(CSC_UB_COEF))), round);
+
+    /* clamp to 0..255 by packing to bytes and back */
+    r = _mm_unpacklo_epi8(_mm_packus_epi16(_mm_srai_epi16(r, CSC_YUV_RGB_SHIFT), zero), zero);
+    g = _mm_unpacklo_epi8(_mm_packus_epi16(_mm_srai_epi16(g, CSC_YUV_RGB_SHIFT), zero), zero);
+    b = _mm_unpacklo_epi8(_mm_packus_epi16(_mm_srai_epi16(b, CSC_YUV_RGB_SHIFT), zero), zero);
+
+    r = _mm_slli_epi16(_mm_and_si128(r, _mm_set1_epi16(0xf8)), 8);
+    g = _mm_slli_epi16(_mm_and_si128(g, _mm_set1_epi16(0xfc)), 3);
+    b = _mm_srli_epi16(b, 3);
+    return _mm_or_si128(_mm_or_si128(r, g), b);
+}
+
+/* 8 pixels per iteration */
+static void csc_rgb565_row_sse2(const uint8_t *y, const uint8_t *u,
+                                const uint8_t *v, int uv_step, uint16_t *dst,
+                                int width)
+{
+    __m128i zero = _mm_setzero_si128();
+    int i = 0;
+
+    for (; i + 8 <= width; i += 8) {
+        __m128i yy = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(y + i)), zero);
+        __m128i cu, cv;
+
+        if (uv_step == 1) {
+            int32_t pu, pv;
+            memcpy(&pu, u, 4);
+            memcpy(&pv, v, 4);
+            cu = _mm_unpacklo_epi8(_mm_cvtsi32_si128(pu), zero);
+            cv = _mm_unpacklo_epi8(_mm_cvtsi32_si128(pv), zero);
+        } else {
+            __m128i p = _mm_loadl_epi64((const __m128i *)(u < v ? u : v));
+            __m128i lo = _mm_and_si128(p, _mm_set1_epi16(0xff));
+            __m128i hi = _mm_srli_epi16(p, 8);
+            cu = u < v ? lo : hi;
+            cv = u < v ? hi : lo;
+        }
+
+        /* every chroma sample covers two pixels */
+        cu = _mm_unpacklo_epi16(cu, cu);
+        cv = _mm_unpacklo_epi16(cv, cv);
+
+        _mm_storeu_si128((__m128i *)(dst + i), csc_rgb565_8_sse2(yy, cu, cv));
+
+        u += uv_step << 2;
+        v += uv_step << 2;
+    }
+
+    if (i < width)
+        csc_rgb565_row_c(y + i, u, v, uv_step, dst + i, width - i);
+}
+
+const struct csc_row_ops csc_row_ops_sse2 = {
+    "sse2",
+    csc_yuyv_row_sse2,
+    csc_uv_row_sse2,
+    csc_rgb565_row_sse2,
+};
+
+#endif
@@ -0,0 +1,397 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Copyright 2009-2012 Freescale Semiconductor, Inc.
+ */
+
+/*
+ * Bit exactness test and benchmark for libcamera_csc.
+ *
+ *   camera_csc_test [-n iterations] [-w width] [-h height]
+ *
+ * Every conversion is checked SIMD against C on several frame sizes,
+ * including widths that leave a tail for the C kernels. The conversions
+ * that replace HAL loops are also checked against copies of those loops.
+ * The benchmark then times the HAL loops, the C kernels and the SIMD
+ * kernels on a width x height frame (720p by default).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "camera_csc.h"
+
+/* V4l2UVCDevice::convertYUYUToNV12 */
+static void legacy_yuyv_to_nv12(const unsigned char *src, unsigned char *dst,
+                                int width, int height)
+{
+    const unsigned char *pSrcBufs = src;
+    unsigned char *pDstBufs = dst;
+    unsigned int bufWidth = width;
+    unsigned int bufHeight = height;
+
+    const unsigned char *pSrcY1Offset = pSrcBufs;
+    const unsigned char *pSrcY2Offset = pSrcBufs + (bufWidth << 1);
+    const unsigned char *pSrcY3Offset = pSrcBufs + (bufWidth << 1) * 2;
+    const unsigned char *pSrcY4Offset = pSrcBufs + (bufWidth << 1) * 3;
+    const unsigned char *pSrcU1Offset = pSrcY1Offset + 1;
+    const unsigned char *pSrcU3Offset = pSrcY3Offset + 1;
+    const unsigned char *pSrcV1Offset = pSrcY1Offset + 3;
+    const unsigned char *pSrcV3Offset = pSrcY3Offset + 3;
+    unsigned int srcYStride = (bufWidth << 1) * 3;
+    unsigned int srcUVStride = srcYStride;
+
+    unsigned char *pDstY1Offset = pDstBufs;
+    unsigned char *pDstY2Offset = pDstBufs + bufWidth;
+    unsigned char *pDstY3Offset = pDstBufs + bufWidth * 2;
+    unsigned char *pDstY4Offset = pDstBufs + bufWidth * 3;
+    unsigned char *pDstU1Offset = pDstBufs + bufWidth * bufHeight;
+    unsigned char *pDstU2Offset = pDstBufs + bufWidth * (bufHeight + 1);
+    unsigned char *pDstV1Offset = pDstU1Offset + 1;
+    unsigned char *pDstV2Offset = pDstU2Offset + 1;
+    unsigned int dstYStride = bufWidth * 3;
+    unsigned int dstUVStride = bufWidth;
+
+    unsigned int nw, nh;
+    for(nh = 0; nh < (bufHeight >> 2); nh++) {
+        for(nw=0; nw < (bufWidth >> 1); nw++) {
+            *pDstY1Offset++ = *pSrcY1Offset;
+            *pDstY2Offset++ = *pSrcY2Offset;
+            *pDstY3Offset++ = *pSrcY3Offset;
+            *pDstY4Offset++ = *pSrcY4Offset;
+
+            pSrcY1Offset += 2;
+            pSrcY2Offset += 2;
+            pSrcY3Offset += 2;
+            pSrcY4Offset += 2;
+
+            *pDstY1Offset++ = *pSrcY1Offset;
+            *pDstY2Offset++ = *pSrcY2Offset;
+            *pDstY3Offset++ = *pSrcY3Offset;
+            *pDstY4Offset++ = *pSrcY4Offset;
+
+            pSrcY1Offset += 2;
+            pSrcY2Offset += 2;
+            pSrcY3Offset += 2;
+            pSrcY4Offset += 2;
+
+            *pDstU1Offset = *pSrcU1Offset;
+            *pDstU2Offset = *pSrcU3Offset;
+            pDstU1Offset += 2;
+            pDstU2Offset += 2;
+            pSrcU1Offset += 4;
+            pSrcU3Offset += 4;
+
+            *pDstV1Offset = *pSrcV1Offset;
+            *pDstV2Offset = *pSrcV3Offset;
+            pDstV1Offset += 2;
+            pDstV2Offset += 2;
+            pSrcV1Offset += 4;
+            pSrcV3Offset += 4;
+        }
+
+        pSrcY1Offset += srcYStride;
+        pSrcY2Offset += srcYStride;
+        pSrcY3Offset += srcYStride;
+        pSrcY4Offset += srcYStride;
+
+        pSrcU1Offset += srcUVStride;
+        pSrcU3Offset += srcUVStride;
+        pSrcV1Offset += srcUVStride;
+        pSrcV3Offset += srcUVStride;
+
+        pDstY1Offset += dstYStride;
+        pDstY2Offset += dstYStride;
+        pDstY3Offset += dstYStride;
+        pDstY4Offset += dstYStride;
+
+        pDstU1Offset += dstUVStride;
+        pDstU2Offset += dstUVStride;
+        pDstV1Offset += dstUVStride;
+        pDstV2Offset += dstUVStride;
+    }
+}
+
+/* CameraHal::convertNV12toYUV420SP */
+static void legacy_nv12_to_nv21(const unsigned char *src, unsigned char *dst,
+                                int width, int height)
+{
+    int Ysize = width * height;
+    int UVsize = width * height >> 2;
+    const unsigned char *Uin = src + Ysize;
+    const unsigned char *Vin = Uin + 1;
+    unsigned char *Vout = dst + Ysize;
+    unsigned char *Uout = Vout + 1;
+    int k;
+
+    memcpy(dst, src, Ysize);
+    for (k = 0; k < UVsize; k++) {
+        *Uout = *Uin;
+        *Vout = *Vin;
+        Uout += 2;
+        Vout += 2;
+        Uin += 2;
+        Vin += 2;
+    }
+}
+
+/* JpegEncoderSoftware::yuv_resize */
+static int legacy_resize(unsigned char *dst_ptr, int dst_width, int dst_height,
+                         const unsigned char *src_ptr, int src_width, int src_height)
+{
+    int i, j, s = 0;
+    int h_offset, v_offset, h_scale_ratio, v_scale_ratio;
+
+    for (;;) {
+        if (!dst_width || !dst_height) return -1;
+        h_scale_ratio = src_width / dst_width;
+        if (!h_scale_ratio) return -1;
+        v_scale_ratio = src_height / dst_height;
+        if (!v_scale_ratio) return -1;
+
+        h_offset = (src_width - dst_width * h_scale_ratio) / 2;
+        v_offset = (src_height - dst_height * v_scale_ratio) / 2;
+
+        for (i = 0; i < dst_height * v_scale_ratio; i += v_scale_ratio)
+            for (j = 0; j < dst_width * h_scale_ratio; j += h_scale_ratio)
+                dst_ptr[(i / v_scale_ratio) * dst_width + (j / h_scale_ratio)] =
+                    src_ptr[i * src_width + j + v_offset * src_width + h_offset];
+
+        src_ptr += src_width * src_height;
+        dst_ptr += dst_width * dst_height;
+        if (s >= 2)
+            return 0;
+        if (!s++) {
+            src_width >>= 1;
+            src_height >>= 1;
+            dst_width >>= 1;
+            dst_height >>= 1;
+        }
+    }
+}
+
+static const unsigned int s_formats[] = {
+    CSC_FMT_YUYV, CSC_FMT_NV12, CSC_FMT_NV21, CSC_FMT_I420, CSC_FMT_RGB565,
+};
+#define NUM_FORMATS (sizeof(s_formats) / sizeof(s_formats[0]))
+
+static const int s_sizes[][2] = {
+    { 2, 2 }, { 14, 6 }, { 46, 18 }, { 176, 144 }, { 322, 242 }, { 640, 480 },
+};
+#define NUM_SIZES (sizeof(s_sizes) / sizeof(s_sizes[0]))
+
+static void fill_random(unsigned char *p, size_t len)
+{
+    size_t i;
+    for (i = 0; i < len; i++)
+        p[i] = rand() & 0xff;
+}
+
+static int check_simd_vs_c(void)
+{
+    int failures = 0;
+    unsigned int s, d, z;
+
+    for (s = 0; s < NUM_FORMATS; s++) {
+        for (d = 0; d < NUM_FORMATS; d++) {
+            const struct camera_csc *csc = camera_csc_find(s_formats[s], s_formats[d]);
+            if (csc == NULL)
+                continue;
+            for (z = 0; z < NUM_SIZES; z++) {
+                int w = s_sizes[z][0], h = s_sizes[z][1];
+                size_t in_len = camera_csc_frame_size(csc->src_format, w, h);
+                size_t out_len = camera_csc_frame_size(csc->dst_format, w, h);
+                unsigned char *in = malloc(in_len);
+                unsigned char *ref = malloc(out_len);
+                unsigned char *out = malloc(out_len);
+
+                fill_random(in, in_len);
+                memset(ref, 0x5a, out_len);
+                memset(out, 0xa5, out_len);
+
+                camera_csc_set_impl(CSC_IMPL_C);
+                csc->convert(in, ref, w, h);
+                camera_csc_set_impl(CSC_IMPL_SIMD);
+                csc->convert(in, out, w, h);
+
+                if (memcmp(ref, out, out_len)) {
+                    printf("FAIL %s %dx%d: %s differs from c\n",
+                           csc->name, w, h, camera_csc_impl_name());
+                    failures++;
+                }
+                free(in);
+                free(ref);
+                free(out);
+            }
+        }
+    }
+    return failures;
+}
+
+static int check_legacy(void)
+{
+    int failures = 0;
+    unsigned int z, impl;
+
+    for (impl = CSC_IMPL_C; impl <= CSC_IMPL_SIMD; impl++) {
+        camera_csc_set_impl((CSC_IMPL)impl);
+        for (z = 0; z < NUM_SIZES; z++) {
+            /* the HAL loop only handled heights that are a multiple of 4 */
+            int w = s_sizes[z][0], h = s_sizes[z][1] & ~3;
+            size_t len = w * h * 2;
+            unsigned char *in, *ref, *out;
+
+            if (h == 0)
+                continue;
+            in = malloc(len);
+            ref = malloc(len);
+            out = malloc(len);
+            fill_random(in, len);
+
+            legacy_yuyv_to_nv12(in, ref, w, h);
+            camera_csc_convert(CSC_FMT_YUYV, CSC_FMT_NV12, in, out, w, h);
+            if (memcmp(ref, out, w * h * 3 / 2)) {
+                printf("FAIL yuyv->nv12 %dx%d: %s differs from HAL loop\n",
+                       w, h, camera_csc_impl_name());
+                failures++;
+            }
+
+            legacy_nv12_to_nv21(in, ref, w, h);
+            camera_csc_convert(CSC_FMT_NV12, CSC_FMT_NV21, in, out, w, h);
+            if (memcmp(ref, out, w * h * 3 / 2)) {
+                printf("FAIL nv12->nv21 %dx%d: %s differs from HAL loop\n",
+                       w, h, camera_csc_impl_name());
+                failures++;
+            }
+
+            if (w >= 8 && h >= 8) {
+                int tw = w / 3 & ~1, th = h / 3 & ~1;
+                memset(ref, 0, len);
+                memset(out, 0, len);
+                legacy_resize(ref, tw, th, in, w, h);
+                camera_csc_resize_i420(out, tw, th, in, w, h);
+                if (memcmp(ref, out, tw * th * 3 / 2)) {
+                    printf("FAIL resize %dx%d -> %dx%d differs from HAL loop\n",
+                           w, h, tw, th);
+                    failures++;
+                }
+            }
+            free(in);
+            free(ref);
+            free(out);
+        }
+    }
+    return failures;
+}
+
+static double now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static void bench(int width, int height, int iterations)
+{
+    size_t len = width * height * 2;
+    unsigned char *in = malloc(len);
+    unsigned char *out = malloc(len);
+    unsigned int s, d;
+    double start;
+    int i;
+
+    fill_random(in, len);
+    printf("%-14s %10s %10s %10s   (ms/frame, %dx%d)\n", "conversion",
+           "hal", "c", "simd", width, height);
+
+    for (s = 0; s < NUM_FORMATS; s++) {
+        for (d = 0; d < NUM_FORMATS; d++) {
+            const struct camera_csc *csc = camera_csc_find(s_formats[s], s_formats[d]);
+            double hal = -1, c, simd;
+            void (*legacy)(const unsigned char *, unsigned char *, int, int) = NULL;
+
+            if (csc == NULL)
+                continue;
+            if (csc->src_format == CSC_FMT_YUYV && csc->dst_format == CSC_FMT_NV12)
+                legacy = legacy_yuyv_to_nv12;
+            else if (csc->src_format == CSC_FMT_NV12 && csc->dst_format == CSC_FMT_NV21)
+                legacy = legacy_nv12_to_nv21;
+
+            if (legacy) {
+                start = now_ms();
+                for (i = 0; i < iterations; i++)
+                    legacy(in, out, width, height);
+                hal = (now_ms() - start) / iterations;
+            }
+
+            camera_csc_set_impl(CSC_IMPL_C);
+            start = now_ms();
+            for (i = 0; i < iterations; i++)
+                csc->convert(in, out, width, height);
+            c = (now_ms() - start) / iterations;
+
+            camera_csc_set_impl(CSC_IMPL_SIMD);
+            start = now_ms();
+            for (i = 0; i < iterations; i++)
+                csc->convert(in, out, width, height);
+            simd = (now_ms() - start) / iterations;
+
+            if (hal < 0)
+                printf("%-14s %10s %10.3f %10.3f\n", csc->name, "-", c, simd);
+            else
+                printf("%-14s %10.3f %10.3f %10.3f\n", csc->name, hal, c, simd);
+        }
+    }
+
+    free(in);
+    free(out);
+}
+
+int main(int argc, char **argv)
+{
+    int iterations = 100;
+    int width = 1280;
+    int height = 720;
+    int failures;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:w:h:")) != -1) {
+        switch (opt) {
+            case 'n': iterations = atoi(optarg); break;
+            case 'w': width = atoi(optarg) & ~1; break;
+            case 'h': height = atoi(optarg) & ~1; break;
+            default:
+                fprintf(stderr, "usage: %s [-n iterations] [-w width] [-h height]\n", argv[0]);
+                return 2;
+        }
+    }
+
+    camera_csc_set_impl(CSC_IMPL_SIMD);
+    printf("simd kernels: %s\n", camera_csc_impl_name());
+
+    srand(1);
+    failures = check_simd_vs_c() + check_legacy();
+    printf("bit exactness: %s (%d failures)\n", failures ? "FAIL" : "PASS", failures);
+
+    if (iterations > 0 && width > 0 && height > 0)
+        bench(width, height, iterations);
+
+    return failures ? 1 : 0;
+}
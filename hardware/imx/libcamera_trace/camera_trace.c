@@ -0,0 +1,257 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Copyright 2009-2012 Freescale Semiconductor, Inc.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <cutils/atomic.h>
+
+#include "camera_trace.h"
+
+#define TRACE_MASK (CAMERA_TRACE_EVENTS - 1)
+
+static const char *s_stage_names[CAMERA_TRACE_STAGES] = {
+    "capture",
+    "postprocess",
+    "window_enqueue",
+    "window_dequeue",
+    "preview_callback",
+    "video_callback",
+    "video_release",
+    "preview_drop",
+    "video_drop",
+};
+
+static int64_t trace_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+void camera_trace_reset(struct camera_trace *t)
+{
+    memset(t, 0, sizeof(*t));
+    t->start = trace_now();
+}
+
+static void trace_log(struct camera_trace *t, CAMERA_TRACE_STAGE stage,
+                      unsigned int buffer, uint32_t frame)
+{
+    int32_t pos = android_atomic_inc(&t->next);
+    struct camera_trace_event *e = &t->events[pos & TRACE_MASK];
+
+    /* readers skip the slot until seq matches again */
+    android_atomic_release_store(0, &e->seq);
+    e->time = trace_now();
+    e->frame = frame;
+    e->stage = stage;
+    e->buffer = buffer;
+    android_atomic_release_store(pos + 1, &e->seq);
+    android_atomic_inc(&t->counts[stage]);
+}
+
+uint32_t camera_trace_capture(struct camera_trace *t, unsigned int buffer)
+{
+    uint32_t frame = android_atomic_inc(&t->frames) + 1;
+
+    if (buffer < CAMERA_TRACE_BUFFERS)
+        t->buffer_frame[buffer] = frame;
+    trace_log(t, CAMERA_TRACE_CAPTURE, buffer, frame);
+    return frame;
+}
+
+uint32_t camera_trace_frame(const struct camera_trace *t, unsigned int buffer)
+{
+    return buffer < CAMERA_TRACE_BUFFERS ? t->buffer_frame[buffer] : 0;
+}
+
+void camera_trace_event(struct camera_trace *t, CAMERA_TRACE_STAGE stage,
+                        unsigned int buffer)
+{
+    trace_log(t, stage, buffer, camera_trace_frame(t, buffer));
+}
+
+void camera_trace_frame_event(struct camera_trace *t, CAMERA_TRACE_STAGE stage,
+                              unsigned int buffer, uint32_t frame)
+{
+    trace_log(t, stage, buffer, frame);
+}
+
+void camera_trace_move(struct camera_trace *t, CAMERA_TRACE_STAGE stage,
+                       unsigned int from, unsigned int to)
+{
+    uint32_t frame = camera_trace_frame(t, from);
+
+    if (to < CAMERA_TRACE_BUFFERS)
+        t->buffer_frame[to] = frame;
+    trace_log(t, stage, to, frame);
+}
+
+/* Copy the complete events of the ring, oldest first */
+static int trace_snapshot(const struct camera_trace *t,
+                          struct camera_trace_event *out)
+{
+    int32_t end = android_atomic_acquire_load(&t->next);
+    int32_t pos = end > CAMERA_TRACE_EVENTS ? end - CAMERA_TRACE_EVENTS : 0;
+    int n = 0;
+
+    for (; pos < end; pos++) {
+        const struct camera_trace_event *e = &t->events[pos & TRACE_MASK];
+
+        if (android_atomic_acquire_load(&e->seq) != pos + 1)
+            continue;
+        out[n] = *e;
+        android_memory_barrier();
+        if (android_atomic_acquire_load(&e->seq) == pos + 1)
+            n++;
+    }
+    return n;
+}
+
+static int compare_time(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+#define TRACE_PRINT(...) do { \
+        int r = snprintf(n < (int)len ? buf + n : NULL, \
+                         n < (int)len ? len - n : 0, __VA_ARGS__); \
+        if (r > 0) \
+            n += r; \
+    } while (0)
+
+int camera_trace_report(const struct camera_trace *t, char *buf, size_t len)
+{
+    struct camera_trace_event *ev;
+    int64_t *capture, *lat;
+    int64_t first = 0, last = 0, interval, total = 0, dev = 0, max = 0;
+    uint32_t base = 0;
+    int num, i, s, frames = 0, cnt, n = 0;
+
+    ev = malloc(sizeof(*ev) * CAMERA_TRACE_EVENTS);
+    capture = calloc(CAMERA_TRACE_EVENTS, sizeof(*capture));
+    lat = malloc(sizeof(*lat) * CAMERA_TRACE_EVENTS);
+    if (ev == NULL || capture == NULL || lat == NULL) {
+        free(ev);
+        free(capture);
+        free(lat);
+        return snprintf(buf, len, "frame trace: out of memory\n");
+    }
+
+    num = trace_snapshot(t, ev);
+    TRACE_PRINT("frame trace: %d events, %d frames over %lld ms\n", num,
+                (int)t->frames, (long long)((trace_now() - t->start) / 1000000));
+
+    /* capture rate and jitter, the mean deviation of the frame interval */
+    for (i = 0; i < num; i++) {
+        if (ev[i].stage != CAMERA_TRACE_CAPTURE)
+            continue;
+        if (frames == 0) {
+            first = ev[i].time;
+            base = ev[i].frame;
+        }
+        else if (ev[i].time - last > max)
+            max = ev[i].time - last;
+        if (ev[i].frame - base < CAMERA_TRACE_EVENTS)
+            capture[ev[i].frame - base] = ev[i].time;
+        last = ev[i].time;
+        frames++;
+    }
+    if (frames > 1 && last > first) {
+        interval = (last - first) / (frames - 1);
+        for (i = 0, last = 0; i < num; i++) {
+            if (ev[i].stage != CAMERA_TRACE_CAPTURE)
+                continue;
+            if (last != 0)
+                dev += llabs(ev[i].time - last - interval);
+            last = ev[i].time;
+        }
+        TRACE_PRINT("  capture: %d.%02d fps, interval avg %lld us, jitter %lld us, max %lld us\n",
+                    (int)(100000000000LL / interval / 100),
+                    (int)(100000000000LL / interval % 100),
+                    (long long)(interval / 1000),
+                    (long long)(dev / (frames - 1) / 1000),
+                    (long long)(max / 1000));
+    }
+
+    /* latency of every later stage against the capture of its frame */
+    for (s = CAMERA_TRACE_CAPTURE + 1; s < CAMERA_TRACE_STAGES; s++) {
+        for (i = 0, cnt = 0, total = 0; i < num; i++) {
+            uint32_t k = ev[i].frame - base;
+
+            if (ev[i].stage != s || frames == 0 || k >= CAMERA_TRACE_EVENTS ||
+                    capture[k] == 0)
+                continue;
+            lat[cnt] = ev[i].time - capture[k];
+            total += lat[cnt++];
+        }
+        if (cnt == 0)
+            continue;
+        qsort(lat, cnt, sizeof(*lat), compare_time);
+        TRACE_PRINT("  %s: %d frames, latency avg %lld us, p50 %lld us, p90 %lld us, "
+                    "p99 %lld us, max %lld us\n", s_stage_names[s], cnt,
+                    (long long)(total / cnt / 1000),
+                    (long long)(lat[cnt / 2] / 1000),
+                    (long long)(lat[cnt * 9 / 10] / 1000),
+                    (long long)(lat[cnt * 99 / 100] / 1000),
+                    (long long)(lat[cnt - 1] / 1000));
+    }
+
+    TRACE_PRINT("  totals:");
+    for (s = 0; s < CAMERA_TRACE_STAGES; s++)
+        TRACE_PRINT(" %s %d%s", s_stage_names[s], (int)t->counts[s],
+                    s + 1 < CAMERA_TRACE_STAGES ? "," : "\n");
+
+    free(ev);
+    free(capture);
+    free(lat);
+    return n;
+}
+
+int camera_trace_export(const struct camera_trace *t, int fd)
+{
+    struct camera_trace_event *ev;
+    char line[2048];
+    int num, i, n, ret = 0;
+
+    n = camera_trace_report(t, line, sizeof(line));
+    if (write(fd, line, n < (int)sizeof(line) ? n : (int)sizeof(line) - 1) < 0)
+        return -1;
+
+    ev = malloc(sizeof(*ev) * CAMERA_TRACE_EVENTS);
+    if (ev == NULL)
+        return -1;
+    num = trace_snapshot(t, ev);
+    for (i = 0; i < num && ret == 0; i++) {
+        n = snprintf(line, sizeof(line), "%lld %s %u %u\n",
+                     (long long)(ev[i].time / 1000), s_stage_names[ev[i].stage],
+                     ev[i].frame, ev[i].buffer);
+        if (write(fd, line, n) < 0)
+            ret = -1;
+    }
+    free(ev);
+    return ret;
+}
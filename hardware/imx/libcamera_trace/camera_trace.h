@@ -0,0 +1,113 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Copyright 2009-2012 Freescale Semiconductor, Inc.
+ */
+
+/*
+ * Per frame timing trace shared by the mx5x and mx6 camera HALs. Every
+ * pipeline stage logs (time, stage, buffer) into a fixed ring; a frame is
+ * numbered when it is captured and keeps that number while it moves
+ * between buffers, so the report can tell how long each stage took after
+ * capture. Logging takes no lock and allocates nothing and any thread
+ * may log. Reading is only meant for dump() and may skip events that are
+ * being written.
+ */
+#ifndef CAMERA_TRACE_H
+#define CAMERA_TRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Events kept, a power of two */
+#define CAMERA_TRACE_EVENTS     1024
+/* Buffer ids a frame can be logged against */
+#define CAMERA_TRACE_BUFFERS    32
+
+typedef enum {
+    CAMERA_TRACE_CAPTURE = 0,       /* dequeued from the driver, numbers the frame */
+    CAMERA_TRACE_POSTPROCESS,       /* copied to a post process buffer */
+    CAMERA_TRACE_WINDOW_ENQUEUE,    /* queued to the preview window */
+    CAMERA_TRACE_WINDOW_DEQUEUE,    /* back from the preview window */
+    CAMERA_TRACE_PREVIEW_CALLBACK,  /* CAMERA_MSG_PREVIEW_FRAME delivered */
+    CAMERA_TRACE_VIDEO_CALLBACK,    /* CAMERA_MSG_VIDEO_FRAME delivered */
+    CAMERA_TRACE_VIDEO_RELEASE,     /* releaseRecordingFrame */
+    CAMERA_TRACE_DROP_PREVIEW,      /* not shown */
+    CAMERA_TRACE_DROP_VIDEO,        /* not recorded */
+    CAMERA_TRACE_STAGES
+} CAMERA_TRACE_STAGE;
+
+struct camera_trace_event {
+    int64_t time;               /* CLOCK_MONOTONIC ns */
+    uint32_t frame;
+    uint16_t stage;
+    uint16_t buffer;
+    volatile int32_t seq;       /* ring position + 1 once written */
+};
+
+struct camera_trace {
+    struct camera_trace_event events[CAMERA_TRACE_EVENTS];
+    volatile int32_t next;
+    volatile int32_t frames;
+    volatile int32_t counts[CAMERA_TRACE_STAGES];
+    uint32_t buffer_frame[CAMERA_TRACE_BUFFERS];
+    int64_t start;
+};
+
+/* Forget every event, not safe against concurrent logging */
+void camera_trace_reset(struct camera_trace *t);
+
+/* A new frame was captured in buffer, returns its number */
+uint32_t camera_trace_capture(struct camera_trace *t, unsigned int buffer);
+
+/* The frame last captured into or moved to buffer reached stage */
+void camera_trace_event(struct camera_trace *t, CAMERA_TRACE_STAGE stage,
+                        unsigned int buffer);
+
+/* Frame number now in buffer */
+uint32_t camera_trace_frame(const struct camera_trace *t, unsigned int buffer);
+
+/* Frame, no longer the one in buffer, reached stage */
+void camera_trace_frame_event(struct camera_trace *t, CAMERA_TRACE_STAGE stage,
+                              unsigned int buffer, uint32_t frame);
+
+/* The frame in buffer from was copied to buffer to by stage */
+void camera_trace_move(struct camera_trace *t, CAMERA_TRACE_STAGE stage,
+                       unsigned int from, unsigned int to);
+
+/*
+ * Summary of the events in the ring: capture rate and jitter, frame
+ * latency percentiles from capture to each stage, and the stage totals
+ * since the last reset. Returns the length written, as snprintf.
+ */
+int camera_trace_report(const struct camera_trace *t, char *buf, size_t len);
+
+/*
+ * Write the summary, then one "time_us stage frame buffer" line per event
+ * in the ring, oldest first. Returns 0 or -1 on a write error.
+ */
+int camera_trace_export(const struct camera_trace *t, int fd);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
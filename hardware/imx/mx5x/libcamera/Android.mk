@@ -34,6 +34,8 @@ LOCAL_SRC_FILES:=    \
 
 LOCAL_CPPFLAGS +=
 
+LOCAL_STATIC_LIBRARIES := libcamera_csc libcamera_trace
+
 LOCAL_SHARED_LIBRARIES:= \
     libcamera_client \
     libui \
@@ -50,6 +52,8 @@ LOCAL_C_INCLUDES += \
 	frameworks/base/include/binder \
 	frameworks/base/include/ui \
 	frameworks/base/camera/libcameraservice \
+	hardware/imx/libcamera_csc \
+	hardware/imx/libcamera_trace \
 	external/linux-lib/ipu \
 	hardware/imx/mx5x/libgralloc
 
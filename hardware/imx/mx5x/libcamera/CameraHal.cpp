@@ -24,11 +24,13 @@
 #include <time.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 #include <dlfcn.h>
 #include <hardware_legacy/power.h>
 #include <ui/GraphicBufferMapper.h>
 #include <ui/Rect.h>
 #include "gralloc_priv.h"
+#include "camera_csc.h"
 
 namespace android {
 
@@ -83,6 +85,8 @@ namespace android {
         mExitPostProcessThread(false), mExitEncodeThread(false), mTakePictureInProcess(false)
     {
         CAMERA_HAL_LOG_FUNC;
+        memset(mVideoTraceFrame, 0, sizeof(mVideoTraceFrame));
+        camera_trace_reset(&mFrameTrace);
         preInit();
     }
 
@@ -528,6 +532,23 @@ namespace android {
 
     status_t CameraHal::dump(int fd) const
     {
+        char buffer[2048];
+        char path[PROPERTY_VALUE_MAX];
+        int len, efd;
+
+        len = camera_trace_report(&mFrameTrace, buffer, sizeof(buffer));
+        write(fd, buffer, len < (int)sizeof(buffer) ? len : sizeof(buffer) - 1);
+
+        if (property_get("camera.trace.export", path, "") <= 0)
+            return NO_ERROR;
+        efd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (efd < 0) {
+            CAMERA_HAL_ERR("%s: open %s failed: %s", __FUNCTION__, path, strerror(errno));
+            return NO_ERROR;
+        }
+        if (camera_trace_export(&mFrameTrace, efd) < 0)
+            CAMERA_HAL_ERR("%s: write %s failed", __FUNCTION__, path);
+        close(efd);
         return NO_ERROR;
     }
 
@@ -1006,6 +1027,8 @@ namespace android {
 
         index = ((size_t)mem - (size_t)mVideoMemory->data) / mPreviewFrameSize;
         mVideoBufferUsing[index] = 0;
+        camera_trace_frame_event(&mFrameTrace, CAMERA_TRACE_VIDEO_RELEASE,
+                traceBuffer(index), mVideoTraceFrame[index]);
 
         if (bDirectInput == true) {
             if(mCaptureBuffers[index].refCount == 0) {
@@ -1628,6 +1651,7 @@ Pic_out:
                 mPreviewFrameSize = mCaptureDeviceCfg.width*mCaptureDeviceCfg.height*3/2;
             else
                 mPreviewFrameSize = mCaptureDeviceCfg.width*mCaptureDeviceCfg.height *2;
+        camera_trace_reset(&mFrameTrace);
 
         if ((ret = PrepareCaptureDevices()) < 0){
             CAMERA_HAL_ERR("PrepareCaptureDevices error ");
@@ -2015,6 +2039,7 @@ Pic_out:
                     sem_post(&mCaptureStoppedCondition);
                     return NO_ERROR;
                 }
+                camera_trace_capture(&mFrameTrace, bufIndex);
                 //handle the normal return.
                 if(!mPPDeviceNeed) {
                     getBufferCount(&mCaptureBuffers[bufIndex]);
@@ -2102,6 +2127,8 @@ Pic_out:
                 mPPDevice->DoPorcess(PPInBuf, PPoutBuf);
                 mPPDevice->PPDeviceDeInit();
                 pthread_mutex_unlock(&mPPIOParamMutex);
+                camera_trace_move(&mFrameTrace, CAMERA_TRACE_POSTPROCESS,
+                        PPInIdx, traceBuffer(PPoutIdx));
 
                 getBufferCount(&mPPbuf[PPoutIdx]);
                 mPreviewThreadQueue.postMessage(new CMessage(CMESSAGE_TYPE_NORMAL, PPoutIdx));
@@ -2147,6 +2174,12 @@ Pic_out:
         *pIndex = -1;
         return;
     }
+
+    /* Trace id of a preview/encode index, post process buffers follow the capture ones */
+    unsigned int CameraHal::traceBuffer(int index) const
+    {
+        return mPPDeviceNeed ? mCaptureBufNum + index : index;
+    }
     
     int CameraHal ::previewshowFrameThreadWrapper()
     {
@@ -2229,6 +2262,8 @@ Pic_out:
                     //CAMERA_HAL_ERR("*******CAMERA_MSG_PREVIEW_FRAME*******");
                     convertNV12toYUV420SP((uint8_t*)(pInBuf->virt_start),
                             (uint8_t*)((unsigned char*)mPreviewMemory->data + preview_heap_buf_head*mPreviewFrameSize),mCaptureDeviceCfg.width, mCaptureDeviceCfg.height);
+                    camera_trace_event(&mFrameTrace, CAMERA_TRACE_PREVIEW_CALLBACK,
+                            traceBuffer(display_index));
                     mDataCb(CAMERA_MSG_PREVIEW_FRAME, mPreviewMemory, preview_heap_buf_head, NULL, mCallbackCookie);
                     preview_heap_buf_head ++;
                     preview_heap_buf_head %= mPreviewHeapBufNum;
@@ -2243,6 +2278,8 @@ Pic_out:
                         return BAD_VALUE;
                     }
                     pInBuf->buf_state = WINDOW_BUFS_QUEUED;
+                    camera_trace_event(&mFrameTrace, CAMERA_TRACE_WINDOW_ENQUEUE,
+                            traceBuffer(display_index));
                     mEnqueuedBufs ++;
                     bufferDump(pInBuf);
                     if (mEnqueuedBufs <= 2) {
@@ -2278,6 +2315,7 @@ Pic_out:
                 }
 
                 mCaptureBuffers[buf_index].buf_state = WINDOW_BUFS_DEQUEUED;
+                camera_trace_event(&mFrameTrace, CAMERA_TRACE_WINDOW_DEQUEUE, buf_index);
                 ret = putBufferCount(&mCaptureBuffers[buf_index]);
                 break;
             case CMESSAGE_TYPE_STOP:
@@ -2360,6 +2398,10 @@ Pic_out:
 
                     getBufferCount(&mCaptureBuffers[enc_index]);
                     mVideoBufferUsing[enc_index] = 1;
+                    mVideoTraceFrame[enc_index] = camera_trace_frame(&mFrameTrace,
+                            traceBuffer(enc_index));
+                    camera_trace_event(&mFrameTrace, CAMERA_TRACE_VIDEO_CALLBACK,
+                            traceBuffer(enc_index));
                     mDataCbTimestamp(timeStamp, CAMERA_MSG_VIDEO_FRAME, mVideoMemory, enc_index, mCallbackCookie);
                     break;
                 }
@@ -2433,31 +2475,8 @@ Pic_out:
 
     void CameraHal::convertNV12toYUV420SP(uint8_t *inputBuffer, uint8_t *outputBuffer, int width, int height)
     {
-        /* Color space conversion from I420 to YUV420SP */
-        int Ysize = 0, UVsize = 0;
-        uint8_t *Yin, *Uin, *Vin, *Yout, *Uout, *Vout;
-
-        Ysize = width * height;
-        UVsize = width *  height >> 2;
-
-        Yin = inputBuffer;
-        Uin = Yin + Ysize;
-        Vin = Uin + 1;
-
-        Yout = outputBuffer;
-        Vout = Yout + Ysize;
-        Uout = Vout + 1;
-
-        memcpy(Yout, Yin, Ysize);
-
-        for(int k = 0; k < UVsize; k++) {
-            *Uout = *Uin;
-            *Vout = *Vin;
-            Uout += 2;
-            Vout += 2;
-            Uin  += 2;
-            Vin += 2;
-        }
+        /* Color space conversion from NV12 to YUV420SP (NV21) */
+        camera_csc_convert(CSC_FMT_NV12, CSC_FMT_NV21, inputBuffer, outputBuffer, width, height);
     }
 
 
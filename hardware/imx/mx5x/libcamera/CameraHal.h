@@ -41,6 +41,7 @@
 #include "PostProcessDeviceInterface.h"
 #include "JpegEncoderInterface.h"
 #include "messageQueue.h"
+#include "camera_trace.h"
 
 
 #define EXIF_MAKENOTE "fsl_makernote"
@@ -293,6 +294,7 @@ namespace android {
 
         status_t allocateBuffersFromNativeWindow();
         void SearchBuffer(void *pNativeBuf, unsigned int *pIndex);
+        unsigned int traceBuffer(int index) const;
         status_t freeBuffersToNativeWindow();
         status_t PrepareCaptureBufs();
         status_t updateDirectInput(bool bDirect);
@@ -381,6 +383,7 @@ namespace android {
         //sp<MemoryBase>      mVideoBuffers[VIDEO_OUTPUT_BUFFER_NUM];
         volatile  int       mVideoBufferUsing[VIDEO_OUTPUT_BUFFER_NUM];
 		VIDEOFRAME_BUFFER_PHY mVideoBufferPhy[VIDEO_OUTPUT_BUFFER_NUM];
+        uint32_t            mVideoTraceFrame[VIDEO_OUTPUT_BUFFER_NUM];
 
         sp<PmemAllocator>   mPmemAllocator;
         DMA_BUFFER          mPPbuf[POST_PROCESS_BUFFER_NUM];
@@ -404,6 +407,8 @@ namespace android {
         unsigned int        mCaptureBufNum;
         //unsigned int        mCaptureBufsActual;
         unsigned int        mEnqueuedBufs;
+        /* per frame timing, reset on every preview start */
+        struct camera_trace mFrameTrace;
 
         bool                mRecordRunning;
         int                 mCurrentRecordFrame;
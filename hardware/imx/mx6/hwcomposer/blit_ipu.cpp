@@ -124,8 +124,6 @@ static void dump_ipu_task(struct ipu_task *t)
 int blit_ipu::blit(hwc_layer_t *layer, hwc_buffer *out_buf)
 {
 	  int status = -EINVAL;
-          char value[10];
-          int hdmi_full_screen = 0;
 	  if(mIpuFd < 0 || layer == NULL || out_buf == NULL){
 	  	  HWCOMPOSER_LOG_ERR("Error!invalid parameters!");
 	  	  return status;
@@ -174,15 +172,7 @@ int blit_ipu::blit(hwc_layer_t *layer, hwc_buffer *out_buf)
     //out_buf should has width and height to be checked with the display_frame.
     mTask.output.format = out_buf->format;//v4l2_fourcc('U', 'Y', 'V', 'Y');
 
-    property_get("sys.HDMI_FULL_SCREEN", value, "");
-    if(strcmp(value, "1") == 0) {
-        hdmi_full_screen = 1;
-    }
-    else {
-        hdmi_full_screen = 0;
-    }
-
-    if(out_buf->usage & GRALLOC_USAGE_DISPLAY_MASK || (hdmi_full_screen && 
+    if(out_buf->usage & GRALLOC_USAGE_DISPLAY_MASK || (m_hdmi_full_screen && 
                         (out_buf->usage & GRALLOC_USAGE_HWC_OVERLAY_DISP2))) { 
 	    mTask.output.width = out_buf->width;
 	    mTask.output.height = out_buf->height;
@@ -0,0 +1,219 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*Copyright 2009-2012 Freescale Semiconductor, Inc. All Rights Reserved.*/
+
+#include <sys/resource.h>
+#include <string.h>
+
+#include "hwc_common.h"
+#include "blit_queue.h"
+
+/*****************************************************************************/
+using namespace android;
+
+blit_queue::blit_queue(blit_device *blit)
+    : mBlit(blit),
+      mThreadRunning(false),
+      mExit(false),
+      mQueued(0),
+      mBlitted(0),
+      mDone(0),
+      mWaitTime(0),
+      mBusyTime(0)
+{
+    memset(mFrames, 0, sizeof(mFrames));
+    if(pthread_create(&mThread, NULL, threadEntry, this) != 0) {
+        //without the worker the frames are blitted by queueFrame itself.
+        HWCOMPOSER_LOG_ERR("Error! blit_queue thread create failed, blit synchronously");
+        return;
+    }
+    mThreadRunning = true;
+}
+
+blit_queue::~blit_queue()
+{
+    if(mThreadRunning) {
+        mLock.lock();
+        mExit = true;
+        mQueueCond.signal();
+        mLock.unlock();
+        pthread_join(mThread, NULL);
+    }
+}
+
+void *blit_queue::threadEntry(void *arg)
+{
+    setpriority(PRIO_PROCESS, 0, ANDROID_PRIORITY_URGENT_DISPLAY);
+    ((blit_queue *)arg)->threadLoop();
+    return NULL;
+}
+
+void blit_queue::threadLoop()
+{
+    Mutex::Autolock _l(mLock);
+    for(;;) {
+        while(mDone == mQueued && !mExit)
+            mQueueCond.wait(mLock);
+        //finish what was queued before leaving
+        if(mDone == mQueued)
+            break;
+
+        blit_frame *frame = &mFrames[mDone % BLIT_QUEUE_FRAMES];
+        mLock.unlock();
+        runBlits(frame);
+        mLock.lock();
+        mBlitted ++;
+        mDoneCond.broadcast();
+
+        mLock.unlock();
+        runPosts(frame);
+        mLock.lock();
+        mDone ++;
+        mDoneCond.broadcast();
+    }
+}
+
+void blit_queue::runBlits(blit_frame *frame)
+{
+    nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+    int status;
+
+    for(int i = 0; i < frame->job_count; i++) {
+        blit_job *job = &frame->jobs[i];
+        status = mBlit->blit(&job->layer, &frame->bufs[job->out]);
+        if(status < 0){
+            HWCOMPOSER_LOG_ERR("Error! bltdev->blit() failed!");
+        }
+    }
+
+    nsecs_t busy = systemTime(SYSTEM_TIME_MONOTONIC) - start;
+    Mutex::Autolock _l(mLock);
+    mBusyTime += busy;
+}
+
+void blit_queue::runPosts(blit_frame *frame)
+{
+    nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+    int status;
+
+    for(int i = 0; i < frame->out_count; i++) {
+        status = frame->outs[i]->post(&frame->bufs[i]);
+        if(status < 0){
+            HWCOMPOSER_LOG_ERR("Error! output device post buffer failed!");
+        }
+    }
+
+    nsecs_t busy = systemTime(SYSTEM_TIME_MONOTONIC) - start;
+    Mutex::Autolock _l(mLock);
+    mBusyTime += busy;
+}
+
+blit_frame *blit_queue::dequeueFrame()
+{
+    Mutex::Autolock _l(mLock);
+    //the slot is free once the frame that used it last is posted
+    if(mQueued - mDone >= BLIT_QUEUE_FRAMES) {
+        nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+        while(mQueued - mDone >= BLIT_QUEUE_FRAMES)
+            mDoneCond.wait(mLock);
+        mWaitTime += systemTime(SYSTEM_TIME_MONOTONIC) - start;
+    }
+
+    blit_frame *frame = &mFrames[mQueued % BLIT_QUEUE_FRAMES];
+    frame->job_count = 0;
+    frame->out_count = 0;
+    return frame;
+}
+
+int blit_queue::addBlit(blit_frame *frame, hwc_layer_t *layer, output_device *out)
+{
+    int n;
+
+    if(frame->job_count >= MAX_BLIT_JOBS) {
+        HWCOMPOSER_LOG_ERR("Error! too many blits in one frame");
+        return -EINVAL;
+    }
+    for(n = 0; n < frame->out_count; n++) {
+        if(frame->outs[n] == out)
+            break;
+    }
+    if(n == frame->out_count) {
+        if(out->fetch(&frame->bufs[n]) < 0)
+            return -EINVAL;
+        frame->outs[n] = out;
+        frame->out_count ++;
+    }
+
+    blit_job *job = &frame->jobs[frame->job_count++];
+    job->layer = *layer;
+    job->out = n;
+    return 0;
+}
+
+unsigned int blit_queue::queueFrame(blit_frame *frame)
+{
+    if(!mThreadRunning) {
+        runBlits(frame);
+        runPosts(frame);
+        Mutex::Autolock _l(mLock);
+        frame->fence = ++mQueued;
+        mBlitted = mQueued;
+        mDone = mQueued;
+        return frame->fence;
+    }
+
+    Mutex::Autolock _l(mLock);
+    frame->fence = ++mQueued;
+    mQueueCond.signal();
+    return frame->fence;
+}
+
+void blit_queue::waitBlits(unsigned int fence)
+{
+    Mutex::Autolock _l(mLock);
+    if((int)(fence - mBlitted) > 0) {
+        nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+        while((int)(fence - mBlitted) > 0)
+            mDoneCond.wait(mLock);
+        mWaitTime += systemTime(SYSTEM_TIME_MONOTONIC) - start;
+    }
+}
+
+void blit_queue::wait(unsigned int fence)
+{
+    Mutex::Autolock _l(mLock);
+    //fences wrap, compare the distance
+    while((int)(fence - mDone) > 0)
+        mDoneCond.wait(mLock);
+}
+
+void blit_queue::flush()
+{
+    unsigned int fence;
+
+    mLock.lock();
+    fence = mQueued;
+    mLock.unlock();
+    wait(fence);
+}
+
+void blit_queue::getStats(nsecs_t *wait, nsecs_t *busy)
+{
+    Mutex::Autolock _l(mLock);
+    *wait = mWaitTime;
+    *busy = mBusyTime;
+    mWaitTime = 0;
+    mBusyTime = 0;
+}
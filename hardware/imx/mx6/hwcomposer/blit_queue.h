@@ -0,0 +1,102 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*Copyright 2009-2012 Freescale Semiconductor, Inc. All Rights Reserved.*/
+
+#ifndef _BLIT_QUEUE_H_
+#define _BLIT_QUEUE_H_
+
+#include <pthread.h>
+#include <utils/threads.h>
+#include <utils/Timers.h>
+#include "hwc_common.h"
+
+/*****************************************************************************/
+
+//frames of blit tasks: hwc_set fills one while the worker posts the other.
+#define BLIT_QUEUE_FRAMES   2
+#define MAX_BLIT_JOBS       (LAYER_PLAN_NUM * 2)
+
+typedef struct {
+    hwc_layer_t layer;      //a copy, the list is reused once hwc_set returns
+    int out;                //index in the frame's outputs
+}blit_job;
+
+typedef struct {
+    int job_count;
+    blit_job jobs[MAX_BLIT_JOBS];
+    int out_count;
+    output_device *outs[MAX_OUTPUT_DISPLAY];
+    hwc_buffer bufs[MAX_OUTPUT_DISPLAY];
+    unsigned int fence;
+}blit_frame;
+
+/*
+ * Runs the blits of a frame and then posts its output buffers on a worker
+ * thread. A frame's fence passes waitBlits once its blits are done and
+ * wait once its outputs are posted.
+ * The source buffers are not refcounted: SurfaceFlinger gives a layer's
+ * buffer back to its producer when it latches the next one, which is
+ * before the next hwc_set. So hwc_set queues the blits before the GPU
+ * swap, to overlap the two, and waits for them before it returns; only
+ * the posts are left running.
+ */
+class blit_queue
+{
+public:
+    blit_queue(blit_device *blit);
+    ~blit_queue();
+
+    //an empty frame to fill, waits while every slot is still posting.
+    blit_frame *dequeueFrame();
+    //adds a blit of layer to the output, fetching its buffer the first time.
+    int addBlit(blit_frame *frame, hwc_layer_t *layer, output_device *out);
+    //hands the frame to the worker and returns its fence.
+    unsigned int queueFrame(blit_frame *frame);
+    //waits until the frame no longer reads its sources.
+    void waitBlits(unsigned int fence);
+    void wait(unsigned int fence);
+    //waits for every queued frame, needed before an output device is closed.
+    void flush();
+
+    //time hwc_set spent waiting for the blits or a slot, and the worker
+    //spent blitting and posting.
+    void getStats(nsecs_t *wait, nsecs_t *busy);
+
+private:
+    static void *threadEntry(void *arg);
+    void threadLoop();
+    void runBlits(blit_frame *frame);
+    void runPosts(blit_frame *frame);
+
+    blit_device *mBlit;
+    pthread_t mThread;
+    bool mThreadRunning;
+    bool mExit;
+
+    mutable Mutex mLock;
+    Condition mQueueCond;
+    Condition mDoneCond;
+    blit_frame mFrames[BLIT_QUEUE_FRAMES];
+    unsigned int mQueued;       //last fence handed out
+    unsigned int mBlitted;      //last fence whose blits are done
+    unsigned int mDone;         //last fence posted
+    nsecs_t mWaitTime;
+    nsecs_t mBusyTime;
+
+    blit_queue& operator = (blit_queue& out);
+    blit_queue(const blit_queue& out);
+};
+
+#endif // _BLIT_QUEUE_H_
@@ -237,6 +237,7 @@ blit_device::blit_device()
 
         m_def_disp_w = 0;
         m_def_disp_h = 0;
+        m_hdmi_full_screen = 0;
 
         fd_def = open(DEFAULT_FB_DEV_NAME, O_RDWR | O_NONBLOCK, 0);
 
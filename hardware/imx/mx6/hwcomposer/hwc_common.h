@@ -113,12 +113,28 @@ typedef enum {
 #define GRALLOC_USAGE_DISPLAY_MASK    0x07000000
 #define GRALLOC_USAGE_OVERLAY_DISPLAY_MASK 0x07F00000
 
-#define LAYER_RECORD_NUM      8
+//the composition plan built by hwc_prepare. It is reused as long as the
+//overlay layers keep their position in the list, crops, display frames and
+//transforms and no watched system property changed; hwc_set blits from it.
+#define LAYER_PLAN_NUM      8
 typedef struct {
-    void* handle;
-    hwc_rect_t outRect;
-    int outDev;
-}layer_record;
+    int index;              //position in the layer list
+    hwc_rect_t sourceCrop;
+    hwc_rect_t displayFrame;
+    uint32_t transform;
+    int usage;              //overlay and display usage given to the buffer
+    int composition;
+    int outputs;            //bit n set for ctx->m_out[n]
+    void* handle;           //buffer blitted by the last hwc_set
+}layer_plan;
+
+typedef struct {
+    int valid;
+    unsigned int generation;    //of the watched properties
+    size_t numHwLayers;
+    int count;
+    layer_plan layers[LAYER_PLAN_NUM];
+}hwc_plan;
 
 typedef struct{
     void *virt_addr;
@@ -227,6 +243,8 @@ public:
 
                 int m_def_disp_w;
                 int m_def_disp_h;
+                //sys.HDMI_FULL_SCREEN, kept up to date by hwc_prepare
+                int m_hdmi_full_screen;
 };
 
 //int FG_init(struct output_device *dev);
@@ -23,20 +23,54 @@
 #include <cutils/log.h>
 #include <cutils/atomic.h>
 #include <cutils/properties.h>
+#include <sys/_system_properties.h>
+#include <utils/Timers.h>
 
 #include <hardware/hwcomposer.h>
 
 #include <EGL/egl.h>
 #include "gralloc_priv.h"
 #include "hwc_common.h"
+#include "blit_queue.h"
 /*****************************************************************************/
 using namespace android;
 
+//properties that change the composition, looked up once and then only
+//their serials are read per frame. A missing one is looked up again at
+//most every HWC_PROPERTY_FIND_INTERVAL.
+#define HWC_STATS_PROP "debug.hwc.stats"    //seconds between cost reports, 0 off
+#define HWC_SYNC_BLIT_PROP "debug.hwc.blit.sync"  //1 waits for the blits in hwc_set
+static const char *hwc_watch_props[] = {
+    "rw.VIDEO_TVOUT_DISPLAY",
+    "sys.SECOND_DISPLAY_ENABLED",
+    "sys.VIDEO_OVERLAY_DISPLAY",
+    "sys.VIDEO_DISPLAY",
+    "sys.HDMI_FULL_SCREEN",
+    HWC_STATS_PROP,
+    HWC_SYNC_BLIT_PROP,
+};
+#define HWC_WATCH_PROP_NUM (sizeof(hwc_watch_props) / sizeof(hwc_watch_props[0]))
+#define HWC_PROPERTY_FIND_INTERVAL s2ns(1)
+
+typedef struct {
+    nsecs_t start;
+    nsecs_t interval;
+    unsigned int prepares;
+    unsigned int sets;
+    unsigned int rebuilds;
+    nsecs_t prepare_total;
+    nsecs_t prepare_max;
+    nsecs_t set_total;
+    nsecs_t set_max;
+}hwc_stats;
+
 struct hwc_context_t {
     hwc_composer_device_t device;
     /* our private state goes below here */
     //now the blit device may only changed in hwc_composer_device open or close.
     blit_device *blit;
+    blit_queue *queue;
+    int sync_blit;
 
     output_device *m_out[MAX_OUTPUT_DISPLAY];
     char m_using[MAX_OUTPUT_DISPLAY]; //0 indicates no output_device, 1 indicates related index;
@@ -48,7 +82,13 @@ struct hwc_context_t {
     int second_display;
 
     hwc_composer_device_t* viv_hwc;
-    layer_record records[LAYER_RECORD_NUM];
+    hwc_plan plan;
+
+    const prop_info *props[HWC_WATCH_PROP_NUM];
+    nsecs_t prop_find_time;
+    unsigned int prop_generation;
+
+    hwc_stats stats;
 };
 
 static int hwc_device_open(const struct hw_module_t* module, const char* name,
@@ -86,91 +126,49 @@ static void dump_layer(hwc_layer_t const* l) {
 }
 
 /***********************************************************************/
-static void addRecord(hwc_context_t *dev, hwc_layer_list_t* list)
-{
-    int rec_index = 0;
-    if (list && dev) {
-        for(int n=0; n<LAYER_RECORD_NUM; n++) {
-            dev->records[n].handle = NULL;
-            memset(&(dev->records[n].outRect), 0, sizeof(dev->records[n].outRect));
-            dev->records[n].outDev = 0;
-        }
-
-        for (size_t i=0 ; i<list->numHwLayers ; i++) {
-            //dump_layer(&list->hwLayers[i]);
-            //list->hwLayers[i].compositionType = HWC_FRAMEBUFFER;
-            hwc_layer_t *layer = &list->hwLayers[i];
-            /*
-             *the private_handle_t should expand to have usage and format member.
-            */
-            if(!layer->handle || ((private_handle_t *)layer->handle)->magic != private_handle_t::sMagic) {
-                continue;//skip NULL pointer and other magic handler
-            }
-            if (private_handle_t::validate(layer->handle) < 0) {
-                //HWCOMPOSER_LOG_ERR("it is not a valide buffer handle\n");
-                continue;
-            }
-            //HWCOMPOSER_LOG_RUNTIME("<<<<<<<<<<<<<<<hwc_prepare---2>>>>>>>>>>>>>>>>>\n");
-            //HWCOMPOSER_LOG_ERR("-------hwc_prepare----layer[%d]-----displayID = %d", i, layer->displayId);
-            private_handle_t *handle = (private_handle_t *)(layer->handle);
-            if(!(handle->usage & GRALLOC_USAGE_HWC_OVERLAY)) {
-                //HWCOMPOSER_LOG_ERR("<<<<<<<<<<<<<<<hwc_prepare---usage=%x>>phy=%x>>>>>>>>>>>>>>>\n", handle->usage, handle->phys);
-                continue;
-            }
-
-            if(rec_index >= LAYER_RECORD_NUM) {
-                HWCOMPOSER_LOG_ERR("******************Error: too many video layers");
-                return;
-            }
-            dev->records[rec_index].handle = (void*)(layer->handle);
-            dev->records[rec_index].outRect = layer->displayFrame;
-            dev->records[rec_index].outDev = handle->usage & GRALLOC_USAGE_OVERLAY_DISPLAY_MASK;
-            rec_index ++;
-        }// end for
-    }//end if
-}
-
 static int isRectEqual(hwc_rect_t* hs, hwc_rect_t* hd)
 {
     return ((hs->left == hd->left) && (hs->top == hd->top)
             && (hs->right == hd->right) && (hs->bottom == hd->bottom));
 }
 
-static int isInRecord(hwc_context_t *dev, hwc_layer_t *layer)
+//property_set goes through init and bumps the serial even for the same
+//value, which would make the plan look stale again, so only real changes
+//are written.
+static void hwc_update_property(const char *name, const char *value)
 {
-    if(dev && layer) {
-        private_handle_t *handle = (private_handle_t *)(layer->handle);
-        for(int i=0; i<LAYER_RECORD_NUM; i++) {
-            if(((int)(dev->records[i].handle) == (int)(layer->handle))
-                      && isRectEqual(&(dev->records[i].outRect), &(layer->displayFrame))
-                      && (dev->records[i].outDev == (handle->usage & GRALLOC_USAGE_OVERLAY_DISPLAY_MASK))) {
-                return 1;
-            }
-        }
-    }
-    return 0;
+    char cur[PROPERTY_VALUE_MAX];
+
+    property_get(name, cur, "");
+    if (strcmp(cur, value))
+        property_set(name, value);
 }
 
 static int hwc_check_property(hwc_context_t *dev)
 {
     //bool bValue = false;
-    char value[10];
+    char value[PROPERTY_VALUE_MAX];
+    char overlay_display[PROPERTY_VALUE_MAX];
+    char video_display[PROPERTY_VALUE_MAX];
+
+    property_get("sys.VIDEO_OVERLAY_DISPLAY", overlay_display, "");
+    property_get("sys.VIDEO_DISPLAY", video_display, "");
 
     property_get("rw.VIDEO_TVOUT_DISPLAY", value, "");
     if (strcmp(value, "1") == 0) {
-        property_set("sys.VIDEO_OVERLAY_DISPLAY", "0");
-        property_set("sys.VIDEO_DISPLAY", "1");
+        strcpy(overlay_display, "0");
+        strcpy(video_display, "1");
     }
     else if (strcmp(value, "0") == 0)
     {
-       property_set("sys.VIDEO_OVERLAY_DISPLAY", "1");
-       property_set("sys.VIDEO_DISPLAY", "0");
+        strcpy(overlay_display, "1");
+        strcpy(video_display, "0");
     }
 
     property_get("sys.SECOND_DISPLAY_ENABLED", value, "");
     if (strcmp(value, "1") == 0) {
-       property_set("sys.VIDEO_OVERLAY_DISPLAY", "2");
-       property_set("sys.VIDEO_DISPLAY", "0");
+       hwc_update_property("sys.VIDEO_OVERLAY_DISPLAY", "2");
+       hwc_update_property("sys.VIDEO_DISPLAY", "0");
        dev->display_mode &= ~(DISPLAY_MODE_OVERLAY_DISP0 | DISPLAY_MODE_OVERLAY_DISP1 |
                               DISPLAY_MODE_OVERLAY_DISP2 | DISPLAY_MODE_OVERLAY_DISP3);
        dev->display_mode |= DISPLAY_MODE_OVERLAY_DISP0;
@@ -181,29 +179,30 @@ static int hwc_check_property(hwc_context_t *dev)
     else if (strcmp(value, "0") == 0)
     {
        dev->second_display = 0;
-       property_set("sys.VIDEO_OVERLAY_DISPLAY", "1");
-       property_set("sys.VIDEO_DISPLAY", "0");
+       strcpy(overlay_display, "1");
+       strcpy(video_display, "0");
     }
+    hwc_update_property("sys.VIDEO_OVERLAY_DISPLAY", overlay_display);
+    hwc_update_property("sys.VIDEO_DISPLAY", video_display);
 
     /*note:sys.VIDEO_OVERLAY_DISPLAY means the overlay will be combined to which display.
      *the default value is 0 and it indicates nothing.
      *if the value is 1 and it indicates combined to display0.
      *if the value is 2 and it indicates combined to display1.
     */
-    property_get("sys.VIDEO_OVERLAY_DISPLAY", value, "");
     dev->display_mode &= ~(DISPLAY_MODE_OVERLAY_DISP0 | DISPLAY_MODE_OVERLAY_DISP1 |
         				DISPLAY_MODE_OVERLAY_DISP2 | DISPLAY_MODE_OVERLAY_DISP3);
-    if (strcmp(value, "1") == 0){
+    if (strcmp(overlay_display, "1") == 0){
         dev->display_mode |= DISPLAY_MODE_OVERLAY_DISP0;
     }
-    else if (strcmp(value, "2") == 0){
+    else if (strcmp(overlay_display, "2") == 0){
         dev->display_mode |= DISPLAY_MODE_OVERLAY_DISP1;
     }
 
-    if (strcmp(value, "3") == 0){
+    if (strcmp(overlay_display, "3") == 0){
         dev->display_mode |= DISPLAY_MODE_OVERLAY_DISP2;
     }
-    else if (strcmp(value, "4") == 0){
+    else if (strcmp(overlay_display, "4") == 0){
         dev->display_mode |= DISPLAY_MODE_OVERLAY_DISP3;
     }
     /*note:rw.VIDEO_DISPLAY means the display device.
@@ -211,18 +210,58 @@ static int hwc_check_property(hwc_context_t *dev)
      *if the value is 1 and it indicates display1.
      *if the value is 2 and it indicates display2.
     */
-    property_get("sys.VIDEO_DISPLAY", value, "");
     dev->display_mode &= ~(DISPLAY_MODE_DISP1 | DISPLAY_MODE_DISP2);
-    if (strcmp(value, "1") == 0){
+    if (strcmp(video_display, "1") == 0){
         dev->display_mode |= DISPLAY_MODE_DISP1;
     }
-    if (strcmp(value, "2") == 0){
+    if (strcmp(video_display, "2") == 0){
         dev->display_mode |= DISPLAY_MODE_DISP2;
     }
     //HWCOMPOSER_LOG_ERR("************dev->display_mode=%x", dev->display_mode);
 	return 0;
 }
 
+/*
+ *a hash of the serials of the watched properties, it changes whenever one
+ *of them is set or shows up.
+*/
+static unsigned int hwc_property_generation(hwc_context_t *ctx)
+{
+    unsigned int generation = 0;
+    nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+    int retry = (now - ctx->prop_find_time) >= HWC_PROPERTY_FIND_INTERVAL;
+
+    for (size_t i = 0; i < HWC_WATCH_PROP_NUM; i++) {
+        if (ctx->props[i] == NULL && retry)
+            ctx->props[i] = __system_property_find(hwc_watch_props[i]);
+        generation = generation * 31 + (ctx->props[i] ? ctx->props[i]->serial + 1 : 0);
+    }
+    if (retry)
+        ctx->prop_find_time = now;
+
+    return generation;
+}
+
+//the settings read outside of hwc_check_property, refreshed on a property change.
+static void hwc_read_settings(hwc_context_t *ctx)
+{
+    char value[PROPERTY_VALUE_MAX];
+
+    property_get("sys.HDMI_FULL_SCREEN", value, "");
+    int hdmi_full_screen = (strcmp(value, "1") == 0);
+    if (ctx->blit && ctx->blit->m_hdmi_full_screen != hdmi_full_screen) {
+        //the queue's worker reads it while blitting
+        ctx->queue->flush();
+        ctx->blit->m_hdmi_full_screen = hdmi_full_screen;
+    }
+
+    property_get(HWC_STATS_PROP, value, "0");
+    ctx->stats.interval = s2ns(atoi(value));
+
+    property_get(HWC_SYNC_BLIT_PROP, value, "0");
+    ctx->sync_blit = (strcmp(value, "1") == 0);
+}
+
 static int hwc_modify_property(hwc_context_t *dev, private_handle_t *handle)
 {
 	handle->usage &= ~GRALLOC_USAGE_OVERLAY_DISPLAY_MASK;
@@ -427,16 +466,96 @@ static int open_outputDevice(struct hwc_context_t *ctx, const char *dev_name, ou
     return output_dev_open(dev_name, device, flag);
 }
 
-static int hwc_prepare(hwc_composer_device_t *dev, hwc_layer_list_t* list) {
-    char out_using[MAX_OUTPUT_DISPLAY] = {0};
+//the output devices hwc_set blits a layer with the given usage to.
+static int planOutputs(struct hwc_context_t *ctx, int usage)
+{
+    int outputs = 0;
+    int retv = 0;
+    int m_usage = 0;
+    int index = 0;
 
-    struct hwc_context_t *ctx = (struct hwc_context_t *)dev;
-    if(ctx) {
-        if(ctx->viv_hwc)
-            ctx->viv_hwc->prepare(ctx->viv_hwc, list);
-	//hwc_check_property(ctx);
+    if(!usage)
+        return 0;
+    do {
+        retv = findOutputDevice(ctx, &index, usage, &m_usage);
+        usage &= ~m_usage;
+        if((index < 0) || (index >= MAX_OUTPUT_DISPLAY))
+            break;
+        if(ctx->m_out[index] != NULL)
+            outputs |= 1 << index;
+    }while(retv);
+
+    return outputs;
+}
+
+static private_handle_t *overlayHandle(hwc_layer_t *layer)
+{
+    if(!layer->handle || ((private_handle_t *)layer->handle)->magic != private_handle_t::sMagic)
+        return NULL;
+    if (private_handle_t::validate(layer->handle) < 0)
+        return NULL;
+    private_handle_t *handle = (private_handle_t *)(layer->handle);
+    if(!(handle->usage & GRALLOC_USAGE_HWC_OVERLAY))
+        return NULL;
+    return handle;
+}
+
+static int hwc_plan_match(struct hwc_context_t *ctx, hwc_layer_list_t* list)
+{
+    hwc_plan *plan = &ctx->plan;
+    int n = 0;
+
+    if(!plan->valid || (list->flags & HWC_GEOMETRY_CHANGED) ||
+            plan->generation != ctx->prop_generation ||
+            plan->numHwLayers != list->numHwLayers)
+        return 0;
+
+    for (size_t i=0 ; i<list->numHwLayers ; i++) {
+        hwc_layer_t *layer = &list->hwLayers[i];
+        if(overlayHandle(layer) == NULL)
+            continue;
+        if(n >= plan->count)
+            return 0;
+        layer_plan *lp = &plan->layers[n++];
+        if((lp->index != (int)i) || (lp->transform != layer->transform) ||
+                !isRectEqual(&lp->sourceCrop, &layer->sourceCrop) ||
+                !isRectEqual(&lp->displayFrame, &layer->displayFrame))
+            return 0;
     }
-    if (list && dev) {
+
+    return n == plan->count;
+}
+
+//replay the plan on the new buffers of the same layers.
+static void hwc_plan_apply(struct hwc_context_t *ctx, hwc_layer_list_t* list)
+{
+    hwc_plan *plan = &ctx->plan;
+
+    for (int n = 0; n < plan->count; n++) {
+        layer_plan *lp = &plan->layers[n];
+        hwc_layer_t *layer = &list->hwLayers[lp->index];
+        private_handle_t *handle = (private_handle_t *)(layer->handle);
+
+        handle->usage = (handle->usage & ~GRALLOC_USAGE_OVERLAY_DISPLAY_MASK) | lp->usage;
+        layer->compositionType = lp->composition;
+        if(validate_displayFrame(layer))
+            checkDisplayFrame(ctx, layer, lp->usage);
+    }
+}
+
+//map the overlay layers to output devices, opening and closing them as
+//needed, and record the result as the new plan.
+static int hwc_plan_build(struct hwc_context_t *ctx, hwc_layer_list_t* list)
+{
+    char out_using[MAX_OUTPUT_DISPLAY] = {0};
+    hwc_plan *plan = &ctx->plan;
+
+    plan->valid = 0;
+    plan->count = 0;
+    ctx->stats.rebuilds ++;
+    //the worker may still post to a device the new mapping closes
+    ctx->queue->flush();
+    {
         for (size_t i=0 ; i<list->numHwLayers ; i++) {
             //dump_layer(&list->hwLayers[i]);
             //list->hwLayers[i].compositionType = HWC_FRAMEBUFFER;
@@ -464,6 +583,19 @@ static int hwc_prepare(hwc_composer_device_t *dev, hwc_layer_list_t* list) {
 	    //handle the display frame position for tv out.
 	    hwc_modify_property(ctx, handle);
 
+            if(plan->count >= LAYER_PLAN_NUM) {
+                HWCOMPOSER_LOG_ERR("******************Error: too many video layers");
+                layer->compositionType = HWC_FRAMEBUFFER;
+                continue;
+            }
+            layer_plan *lp = &plan->layers[plan->count++];
+            lp->index = i;
+            lp->sourceCrop = layer->sourceCrop;
+            lp->displayFrame = layer->displayFrame;
+            lp->transform = layer->transform;
+            lp->usage = handle->usage & GRALLOC_USAGE_OVERLAY_DISPLAY_MASK;
+            lp->handle = NULL;
+
             if(!validate_displayFrame(layer)) {
                 HWCOMPOSER_LOG_INFO("<<<<<<<<<<<<<<<hwc_prepare---3-2>>>>>>>>>>>>>>>>\n");
                 continue;
@@ -516,9 +648,82 @@ static int hwc_prepare(hwc_composer_device_t *dev, hwc_layer_list_t* list) {
 		//ctx->m_using[i] = out_using[i];
 	}
     }//end if
+
+    //the outputs are settled only once every layer has been through the loop
+    for (int n = 0; n < plan->count; n++) {
+        layer_plan *lp = &plan->layers[n];
+        hwc_layer_t *layer = &list->hwLayers[lp->index];
+        lp->composition = layer->compositionType;
+        lp->outputs = validate_displayFrame(layer) ? planOutputs(ctx, lp->usage) : 0;
+    }
+    plan->numHwLayers = list->numHwLayers;
+    plan->generation = ctx->prop_generation;
+    plan->valid = 1;
     return 0;
 }
 
+static void hwc_stats_update(struct hwc_context_t *ctx, nsecs_t *total, nsecs_t *max, nsecs_t start)
+{
+    nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+    nsecs_t cost = now - start;
+    hwc_stats *stats = &ctx->stats;
+
+    *total += cost;
+    if(cost > *max)
+        *max = cost;
+
+    if(!stats->interval)
+        return;
+    if(!stats->start) {
+        stats->start = now;
+        return;
+    }
+    if(now - stats->start < stats->interval)
+        return;
+
+    nsecs_t blit_wait, blit_busy;
+    ctx->queue->getStats(&blit_wait, &blit_busy);
+    HWCOMPOSER_LOG_INFO("hwc: %u prepare avg %lld us max %lld us, %u set avg %lld us max %lld us, %u plan rebuilds",
+            stats->prepares, stats->prepares ? ns2us(stats->prepare_total) / stats->prepares : 0LL,
+            ns2us(stats->prepare_max),
+            stats->sets, stats->sets ? ns2us(stats->set_total) / stats->sets : 0LL,
+            ns2us(stats->set_max), stats->rebuilds);
+    HWCOMPOSER_LOG_INFO("hwc: blit queue busy %lld us, hwc_set waited %lld us for it",
+            ns2us(blit_busy), ns2us(blit_wait));
+    nsecs_t interval = stats->interval;
+    memset(stats, 0, sizeof(*stats));
+    stats->interval = interval;
+    stats->start = now;
+}
+
+static int hwc_prepare(hwc_composer_device_t *dev, hwc_layer_list_t* list) {
+    int ret = 0;
+
+    struct hwc_context_t *ctx = (struct hwc_context_t *)dev;
+    if(ctx) {
+        if(ctx->viv_hwc)
+            ctx->viv_hwc->prepare(ctx->viv_hwc, list);
+	//hwc_check_property(ctx);
+    }
+    if (list && dev) {
+        nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+        unsigned int generation = hwc_property_generation(ctx);
+        if(generation != ctx->prop_generation || !ctx->plan.valid) {
+            ctx->prop_generation = generation;
+            hwc_read_settings(ctx);
+        }
+
+        if(hwc_plan_match(ctx, list))
+            hwc_plan_apply(ctx, list);
+        else
+            ret = hwc_plan_build(ctx, list);
+
+        ctx->stats.prepares ++;
+        hwc_stats_update(ctx, &ctx->stats.prepare_total, &ctx->stats.prepare_max, start);
+    }
+    return ret;
+}
+
 static int releaseAllOutput(struct hwc_context_t *ctx)
 {
 		for(int i = 0; i < MAX_OUTPUT_DISPLAY; i++) {
@@ -553,6 +758,54 @@ static int hwc_setUpdateMode(hwc_composer_device_t *dev, char refresh, char vRef
     return 0;
 }
 
+//Queues the blits of the overlay layers, returns the frame's fence or 0
+//when there is nothing to blit.
+static unsigned int hwc_queue_overlays(struct hwc_context_t *ctx, hwc_layer_list_t* list)
+{
+    if(getActiveOuputDevice(ctx) == 0) {return 0;}
+    HWCOMPOSER_LOG_RUNTIME("%s,%d", __FUNCTION__, __LINE__);
+
+    int status = -EINVAL;
+    hwc_plan *plan = &ctx->plan;
+    //prepare has mapped the layers, a list it did not see is left alone
+    if(!plan->valid || plan->numHwLayers != list->numHwLayers) {
+        HWCOMPOSER_LOG_RUNTIME("%s,%d, no plan for this list", __FUNCTION__, __LINE__);
+        return 0;
+    }
+    blit_frame *frame = ctx->queue->dequeueFrame();
+    for (int n = 0; n < plan->count; n++){
+        layer_plan *lp = &plan->layers[n];
+	hwc_layer_t *layer = &list->hwLayers[lp->index];
+        if(!lp->outputs || overlayHandle(layer) == NULL) {
+    	    HWCOMPOSER_LOG_RUNTIME("%s,%d", __FUNCTION__, __LINE__);
+            continue;
+        }
+        HWCOMPOSER_LOG_RUNTIME("%s,%d", __FUNCTION__, __LINE__);
+
+        //when GM do seek, it always queue the same buffer.
+        //so, we can not judge the reduplicated buffer by buffer handle now.
+        if(lp->handle == (void*)(layer->handle)) {
+            HWCOMPOSER_LOG_RUNTIME("%s,%d, lost frames", __FUNCTION__, __LINE__);
+            //continue;
+        }
+        lp->handle = (void*)(layer->handle);
+
+        for(int index = 0; index < MAX_OUTPUT_DISPLAY; index++) {
+    		output_device *outdev = ctx->m_out[index];
+    		if(!(lp->outputs & (1 << index)) || !ctx->m_using[index] || outdev == NULL)
+    			continue;
+		status = ctx->queue->addBlit(frame, layer, outdev);
+		if(status < 0){
+			HWCOMPOSER_LOG_ERR("Error! queue blit failed!");
+			continue;
+		}
+        }
+    }//end for
+    if(frame->out_count == 0)
+        return 0;
+    return ctx->queue->queueFrame(frame);
+}
+
 static int hwc_set(hwc_composer_device_t *dev,
         hwc_display_t dpy,
         hwc_surface_t sur,
@@ -568,13 +821,25 @@ static int hwc_set(hwc_composer_device_t *dev,
 	//close the output device.
         if(ctx->viv_hwc)
             ctx->viv_hwc->set(ctx->viv_hwc, dpy, sur, list);
+	ctx->queue->flush();
 	releaseAllOutput(ctx);
+	ctx->plan.valid = 0;
 	//ctx->display_mode_changed = 1;
 
 	return 0;
     }
     ctx->ui_refresh = 1;
     ctx->vd_refresh = 1;
+
+    //the overlay blits are queued before the swap so the IPU converts
+    //them while the GPU frame goes out. Their sources are given back to
+    //the producers once surfaceflinger latches the next buffers, so
+    //hwc_set returns only after the blits; the posts stay on the worker.
+    unsigned int fence = 0;
+    nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+    if(list != NULL && dev != NULL && ctx->vd_refresh)
+        fence = hwc_queue_overlays(ctx, list);
+
     if((ctx == NULL) || (ctx && ctx->ui_refresh)) {
         EGLBoolean sucess;
         if(ctx->viv_hwc)
@@ -582,89 +847,21 @@ static int hwc_set(hwc_composer_device_t *dev,
         else
             sucess = eglSwapBuffers((EGLDisplay)dpy, (EGLSurface)sur);
         if (!sucess) {
+            if(fence)
+                ctx->queue->waitBlits(fence);
             return HWC_EGL_ERROR;
         }
     }
-    if(list == NULL || dev == NULL || !ctx->vd_refresh) {
+    if(fence == 0) {
     	return 0;
     }
-    if(getActiveOuputDevice(ctx) == 0) {return 0;}//eglSwapBuffers((EGLDisplay)dpy, (EGLSurface)sur); return 0;}
-    HWCOMPOSER_LOG_RUNTIME("%s,%d", __FUNCTION__, __LINE__);
-
-    int status = -EINVAL;
-    hwc_buffer out_buffer[MAX_OUTPUT_DISPLAY];
-    char bufs_state[MAX_OUTPUT_DISPLAY];
-    memset(bufs_state, 0, sizeof(bufs_state));
-    memset(out_buffer, 0, sizeof(out_buffer));
-    blit_device *bltdev = ctx->blit;
-    for (size_t i=0 ; i<list->numHwLayers ; i++){
-	hwc_layer_t *layer = &list->hwLayers[i];
-        if(!layer->handle || ((private_handle_t *)layer->handle)->magic != private_handle_t::sMagic) {
-    	    HWCOMPOSER_LOG_RUNTIME("%s,%d", __FUNCTION__, __LINE__);
-            continue;
-        }
-	if (private_handle_t::validate(layer->handle) < 0) {
-    	    HWCOMPOSER_LOG_RUNTIME("%s,%d, not a valide buffer handle", __FUNCTION__, __LINE__);
-    	    continue;
-	}
-
-        if(!validate_displayFrame(layer)) {
-    	    HWCOMPOSER_LOG_RUNTIME("%s,%d", __FUNCTION__, __LINE__);
-            continue;
-        }
-        HWCOMPOSER_LOG_RUNTIME("%s,%d", __FUNCTION__, __LINE__);
 
-        //when GM do seek, it always queue the same buffer.
-        //so, we can not judge the reduplicated buffer by buffer handle now.
-        if(isInRecord(ctx, layer)) {
-            HWCOMPOSER_LOG_RUNTIME("%s,%d, lost frames", __FUNCTION__, __LINE__);
-            //continue;
-        }
-
-	private_handle_t *handle = (private_handle_t *)(layer->handle);
-	if(handle->usage & GRALLOC_USAGE_HWC_OVERLAY){
-            int retv = 0;
-            int m_usage = 0;
-            int i_usage = handle->usage & GRALLOC_USAGE_OVERLAY_DISPLAY_MASK;
-            if(!i_usage) continue;
-            do {
-    		output_device *outdev = NULL;
-    		int index = 0;
-        	retv = findOutputDevice(ctx, &index, i_usage, &m_usage);
-                i_usage &= ~m_usage;
-                if((index >= 0) && (index < MAX_OUTPUT_DISPLAY)) {
-                    outdev = ctx->m_out[index];
-                }else {
-                    break;
-                }
-
-    		if(outdev != NULL) {
-			if(!bufs_state[index] && ctx->m_using[index]) {
-				outdev->fetch(&out_buffer[index]);
-				bufs_state[index] = 1;
-			}
-			if(!bufs_state[index])
-				continue;
-			status = bltdev->blit(layer, &(out_buffer[index]));
-			if(status < 0){
-				HWCOMPOSER_LOG_ERR("Error! bltdev->blit() failed!");
-				continue;
-			}
-    		}//end if(outdev != NULL)
-            }while(retv);
-
-		}//end if
-    }//end for
-    for(int i = 0; i < MAX_OUTPUT_DISPLAY; i++) {
-	if(ctx->m_using[i] && bufs_state[i]) {
-		status = ctx->m_out[i]->post(&out_buffer[i]);
-		if(status < 0){
-			HWCOMPOSER_LOG_ERR("Error! output device post buffer failed!");
-			continue;
-		}
-	}
-    }
-    addRecord(ctx, list);
+    if(ctx->sync_blit)
+        ctx->queue->wait(fence);
+    else
+        ctx->queue->waitBlits(fence);
+    ctx->stats.sets ++;
+    hwc_stats_update(ctx, &ctx->stats.set_total, &ctx->stats.set_max, start);
 
     return 0;
 }
@@ -673,6 +870,8 @@ static int hwc_device_close(struct hw_device_t *dev)
 {
     struct hwc_context_t* ctx = (struct hwc_context_t*)dev;
     if (ctx) {
+        //finishes the queued frames first
+        delete ctx->queue;
     		if(ctx->blit)
     				blit_dev_close(ctx->blit);
         releaseAllOutput(ctx);
@@ -715,6 +914,7 @@ static int hwc_device_open(const struct hw_module_t* module, const char* name,
         	  HWCOMPOSER_LOG_ERR("Error! blit_dev_open failed!");
         	  goto err_exit;
         }
+        dev->queue = new blit_queue(dev->blit);
 
         const hw_module_t *hwc_module;
         if(hw_get_module(HWC_VIV_HARDWARE_MODULE_ID,
@@ -149,6 +149,8 @@ int output_device::fetch(hwc_buffer *buf)
       }
       //orignRegion = currenRegion;
       currenRegion.clear();
+      //the buffer is posted later, possibly after the next one is fetched.
+      mbuffer_cur = (mbuffer_cur + 1) % DEFAULT_BUFFERS;
 
 	  return 0;
 }
@@ -177,7 +179,6 @@ HWCOMPOSER_LOG_RUNTIME("#######output_device::post()############");
 
     info.yoffset = ((unsigned long)buf->virt_addr - (unsigned long)(mbuffers[0]).virt_addr) / finfo.line_length;
     //info.yoffset = ((info.yres_virtual * finfo.line_length)/ DEFAULT_BUFFERS) * mbuffer_cur;
-    mbuffer_cur = (mbuffer_cur + 1) % DEFAULT_BUFFERS;
     info.activate = FB_ACTIVATE_VBL;
 //HWCOMPOSER_LOG_RUNTIME("#######yoffset=%d, mbuffer_cur=%d######", info.yoffset, mbuffer_cur);
     ioctl(m_dev, FBIOPAN_DISPLAY, &info);
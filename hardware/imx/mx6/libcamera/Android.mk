@@ -28,10 +28,13 @@ LOCAL_SRC_FILES:=    \
 	JpegEncoderInterface.cpp \
     JpegEncoderSoftware.cpp \
     messageQueue.cpp \
-    V4l2UVCDevice.cpp
+    V4l2UVCDevice.cpp \
+    V4l2FileDevice.cpp
 
 LOCAL_CPPFLAGS +=
 
+LOCAL_STATIC_LIBRARIES := libcamera_csc libcamera_trace
+
 LOCAL_SHARED_LIBRARIES:= \
     libcamera_client \
     libui \
@@ -47,6 +50,8 @@ LOCAL_C_INCLUDES += \
 	frameworks/base/include/binder \
 	frameworks/base/include/ui \
 	frameworks/base/camera/libcameraservice \
+	hardware/imx/libcamera_csc \
+	hardware/imx/libcamera_trace \
 	hardware/imx/mx6/libgralloc_wrapper
 
 ifeq ($(HAVE_FSL_IMX_CODEC),true)
@@ -73,6 +78,14 @@ LOCAL_PRELINK_MODULE := false
 LOCAL_MODULE_TAGS := eng
 
 include $(BUILD_SHARED_LIBRARY)
+
+# Preview, recording and picture benchmark, runs on the file capture device
+include $(CLEAR_VARS)
+LOCAL_SRC_FILES := camera_bench.c
+LOCAL_SHARED_LIBRARIES := libhardware libcutils
+LOCAL_MODULE := camera_bench
+LOCAL_MODULE_TAGS := optional tests
+include $(BUILD_EXECUTABLE)
 endif
 
 endif
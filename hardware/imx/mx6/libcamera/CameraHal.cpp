@@ -29,6 +29,7 @@
 #include <ui/GraphicBufferMapper.h>
 #include <ui/Rect.h>
 #include "gralloc_priv.h"
+#include "camera_csc.h"
 
 namespace android {
 
@@ -40,6 +41,16 @@ namespace android {
         mExitPreviewThread(false),
         mExitEncodeThread(false),
         mTakePictureInProcess(false),
+        mBurstCount(1),
+        mBurstStop(false),
+        mShutterTime(0),
+        mZslEnabled(false),
+        mZslFrameNum(0),
+        mZslCopying(false),
+        mZslBuf(NULL),
+        mZslBufSize(0),
+        mZslPictures(0),
+        mZslShutterLag(0),
         mParameters(),
         mCallbackCookie(NULL),
         mNotifyCb(NULL),
@@ -59,8 +70,26 @@ namespace android {
         mNativeWindow(NULL),
         mMsgEnabled(0),
         mPreviewMemory(NULL),
+        mPreviewZeroCopy(false),
+        mPreviewCallbackFormat(0),
+        mPreviewHeldNum(0),
+        mPreviewFrameNum(0),
+        mStatsStartTime(0),
+        mPreviewCopyBytes(0),
+        mVideoCopyBytes(0),
+        mPreviewCopyFrames(0),
+        mPreviewZeroCopyFrames(0),
         mVideoBufNume(VIDEO_OUTPUT_BUFFER_NUM),
         mVideoMemory(NULL),
+        mVideoMemoryInUse(NULL),
+        mVideoMemoryRetired(NULL),
+        mVideoBufSize(0),
+        mVideoMetaData(false),
+        mVideoFrames(0),
+        mVideoStarved(0),
+        mVideoLatencyFrames(0),
+        mVideoLatencyTotal(0),
+        mVideoLatencyMax(0),
         mDefaultPreviewFormat(V4L2_PIX_FMT_NV12), //the optimized selected format, hard code
         mPreviewFrameSize(0),
         mTakePicFlag(false),
@@ -79,9 +108,16 @@ namespace android {
         mPowerLock(false),
         mDirectInput(false),
         mCameraid(cameraid),
-        mPreviewRotate(CAMERA_PREVIEW_BACK_REF)
+        mPreviewRotate(CAMERA_PREVIEW_BACK_REF),
+        mOpenTime(0),
+        mCapsCached(false),
+        mFirstFrameLogged(false)
    {
         CAMERA_LOG_FUNC;
+        memset(mPreviewBufMemory, 0, sizeof(mPreviewBufMemory));
+        memset(mVideoBufferUsing, 0, sizeof(mVideoBufferUsing));
+        memset(mVideoTraceFrame, 0, sizeof(mVideoTraceFrame));
+        camera_trace_reset(&mFrameTrace);
         preInit();
     }
 
@@ -95,9 +131,15 @@ namespace android {
         if(mVideoMemory != NULL) {
             mVideoMemory->release(mVideoMemory);
         }
+        if(mVideoMemoryRetired != NULL) {
+            mVideoMemoryRetired->release(mVideoMemoryRetired);
+        }
         if(mPreviewMemory != NULL) {
             mPreviewMemory->release(mPreviewMemory);
         }
+        if(mZslBuf != NULL) {
+            free(mZslBuf);
+        }
     }
 
     void CameraHal :: release()
@@ -149,6 +191,7 @@ namespace android {
         CAMERA_LOG_FUNC;
         CAMERA_HAL_RET ret = CAMERA_HAL_ERR_NONE;
         mCameraReady == true;
+        mOpenTime = systemTime(SYSTEM_TIME_MONOTONIC);
         mCaptureDevice->GetDevType(&mSensorType);
 
         if ((ret = AllocInterBuf())<0)
@@ -158,6 +201,9 @@ namespace android {
         if ((ret = CameraMiscInit()) < 0)
             return ret;
 
+        CAMERA_LOG_INFO("camera %d init took %lld ms, capabilities %s", mCameraid,
+                ns2ms(systemTime(SYSTEM_TIME_MONOTONIC) - mOpenTime),
+                mCapsCached ? "cached" : "enumerated");
         return ret;
     }
     void  CameraHal::setPreviewRotate(CAMERA_PREVIEW_ROTATE previewRotate)
@@ -226,6 +272,8 @@ namespace android {
         sem_init(&mPreviewStoppedCondition, 0, 0);
         //sem_init(&mEncodeStoppedCondition, 0, 0);
         sem_init(&mTakingPicture, 0, 0);
+        mPreviewThreadQueue.setFrameQueue(&mPreviewFrameQueue);
+        mEncodeThreadQueue.setFrameQueue(&mEncodeFrameQueue);
         //mPostProcessRunning = false;
         //mEncodeRunning = false;
         mCaptureFrameThread = new CaptureFrameThread(this);
@@ -304,6 +352,85 @@ namespace android {
         return CAMERA_HAL_ERR_NONE;
     }
 
+    struct CameraCapsCache {
+        char name[CAMERA_SENSOR_LENGTH];
+        char version[CAMERA_DEV_VERSION_LENGTH];
+        unsigned int fmt[MAX_QUERY_FMT_TIMES];
+        int fmtCnt;
+        char pictureSizes[CAMER_PARAM_BUFFER_SIZE];
+        char previewSizes[CAMER_PARAM_BUFFER_SIZE];
+    };
+
+    static CameraCapsCache gCapsCache[MAX_CAPS_CACHE_ENTRY];
+    static Mutex gCapsCacheLock;
+
+    static CameraCapsCache *findCapsCache(const char *name)
+    {
+        for (int i = 0; i < MAX_CAPS_CACHE_ENTRY; i++) {
+            if (gCapsCache[i].fmtCnt > 0 && !strcmp(gCapsCache[i].name, name))
+                return &gCapsCache[i];
+        }
+        return NULL;
+    }
+
+    static void dropCapsCache(const char *name)
+    {
+        Mutex::Autolock lock(gCapsCacheLock);
+        CameraCapsCache *entry = findCapsCache(name);
+        if (entry != NULL) {
+            CAMERA_LOG_INFO("drop the cached capabilities of %s", name);
+            entry->fmtCnt = 0;
+        }
+    }
+
+    bool CameraHal :: LoadCachedCaps(const char *version, int *pFmtCnt)
+    {
+        CAMERA_LOG_FUNC;
+        Mutex::Autolock lock(gCapsCacheLock);
+        CameraCapsCache *entry = findCapsCache(mCameraSensorName);
+
+        if (entry == NULL)
+            return false;
+        if (strcmp(entry->version, version)) {
+            //replugged or updated, enumerate again
+            CAMERA_LOG_INFO("%s changed from %s to %s", mCameraSensorName, entry->version, version);
+            entry->fmtCnt = 0;
+            return false;
+        }
+
+        memcpy(mSensorSupportFmt, entry->fmt, sizeof(entry->fmt));
+        strcpy(mSupportedPictureSizes, entry->pictureSizes);
+        strcpy(mSupportedPreviewSizes, entry->previewSizes);
+        *pFmtCnt = entry->fmtCnt;
+        return true;
+    }
+
+    void CameraHal :: StoreCachedCaps(const char *version, int fmtCnt)
+    {
+        CAMERA_LOG_FUNC;
+        Mutex::Autolock lock(gCapsCacheLock);
+        CameraCapsCache *entry = findCapsCache(mCameraSensorName);
+        int i;
+
+        for (i = 0; entry == NULL && i < MAX_CAPS_CACHE_ENTRY; i++) {
+            if (gCapsCache[i].fmtCnt == 0)
+                entry = &gCapsCache[i];
+        }
+        if (entry == NULL) {
+            CAMERA_LOG_INFO("no room to cache the capabilities of %s", mCameraSensorName);
+            return;
+        }
+
+        strncpy(entry->name, mCameraSensorName, CAMERA_SENSOR_LENGTH - 1);
+        entry->name[CAMERA_SENSOR_LENGTH - 1] = '\0';
+        strncpy(entry->version, version, CAMERA_DEV_VERSION_LENGTH - 1);
+        entry->version[CAMERA_DEV_VERSION_LENGTH - 1] = '\0';
+        memcpy(entry->fmt, mSensorSupportFmt, sizeof(entry->fmt));
+        strcpy(entry->pictureSizes, mSupportedPictureSizes);
+        strcpy(entry->previewSizes, mSupportedPreviewSizes);
+        entry->fmtCnt = fmtCnt;
+    }
+
     CAMERA_HAL_RET CameraHal :: InitCameraBaseParam(CameraParameters *pParam)
     {
         CAMERA_LOG_FUNC;
@@ -312,19 +439,36 @@ namespace android {
         struct capture_config_t CaptureSizeFps;
         int  previewCnt= 0, pictureCnt = 0, i;
         char previewFmt[20] = {0};
+        char version[CAMERA_DEV_VERSION_LENGTH];
+        char value[PROPERTY_VALUE_MAX];
+
+        memset(mCameraSensorName, 0, CAMERA_SENSOR_LENGTH);
+        mCaptureDevice->GetDevName(mCameraSensorName);
 
         //the Camera Open here will not be close immediately, for later preview.
-        if (OpenCaptureDevice() < 0)
+        if (OpenCaptureDevice() < 0) {
+            //unplugged, what was cached may not come back the same
+            dropCapsCache(mCameraSensorName);
             return CAMERA_HAL_ERR_OPEN_CAPTURE_DEVICE;
+        }
 
-        memset(mSensorSupportFmt, 0, sizeof(unsigned int)*MAX_QUERY_FMT_TIMES);
+        property_get(CAMERA_CAPS_CACHE_PROP, value, "1");
+        memset(version, 0, sizeof(version));
+        if (strcmp(value, "0") == 0 ||
+                mCaptureDevice->GetDevVersion(version, sizeof(version)) < 0)
+            version[0] = '\0';
+        mCapsCached = version[0] != '\0' && LoadCachedCaps(version, &i);
 
-        for(i =0; i< MAX_QUERY_FMT_TIMES; i ++){
-            if (mCaptureDevice->EnumDevParam(OUTPU_FMT,&(mSensorSupportFmt[i])) < 0)
-                break;
+        if (!mCapsCached) {
+            memset(mSensorSupportFmt, 0, sizeof(unsigned int)*MAX_QUERY_FMT_TIMES);
+
+            for(i =0; i< MAX_QUERY_FMT_TIMES; i ++){
+                if (mCaptureDevice->EnumDevParam(OUTPU_FMT,&(mSensorSupportFmt[i])) < 0)
+                    break;
+            }
+            if (i == 0)
+                return CAMERA_HAL_ERR_GET_PARAM;
         }
-        if (i == 0)
-            return CAMERA_HAL_ERR_GET_PARAM;
 
         //InitCameraPreviewFormatToParam(i);
 
@@ -344,7 +488,7 @@ namespace android {
 
         CAMERA_LOG_INFO("mCaptureDeviceCfg.fmt is %x", mCaptureDeviceCfg.fmt);
 
-        for(;;){
+        while (!mCapsCached) {
             if (mCaptureDevice->EnumDevParam(FRAME_SIZE_FPS,&CaptureSizeFps) <0){
                 CAMERA_LOG_RUNTIME("get the frame size and time interval error");
                 break;
@@ -387,6 +531,9 @@ namespace android {
             }
         }
 
+        if (!mCapsCached && version[0] != '\0' && pictureCnt > 0 && previewCnt > 0)
+            StoreCachedCaps(version, i);
+
         /*hard code here*/
         strcpy(mSupportedFPS, "15,30");
         CAMERA_LOG_INFO("SupportedPictureSizes is %s", mSupportedPictureSizes);
@@ -528,6 +675,11 @@ namespace android {
         //ratio of the maximum zoom value.
         pParam->set(CameraParameters::KEY_ZOOM_RATIOS, "100,200");
 
+        pParam->set(CAMERA_PARAM_ZSL_VALUES, "off,on");
+        pParam->set(CAMERA_PARAM_ZSL, "off");
+        pParam->set(CAMERA_PARAM_MAX_BURST_COUNT, MAX_BURST_COUNT);
+        pParam->set(CAMERA_PARAM_BURST_COUNT, 1);
+
         return CAMERA_HAL_ERR_NONE;
     }
 
@@ -538,12 +690,116 @@ namespace android {
 
     status_t CameraHal::dump(int fd) const
     {
+        char buffer[512];
+        uint64_t msecs = 0;
+
+        Mutex::Autolock lock(mPreviewCbLock);
+        if (mStatsStartTime != 0)
+            msecs = ns2ms(systemTime(SYSTEM_TIME_MONOTONIC) - mStatsStartTime);
+        if (msecs == 0)
+            msecs = 1;
+
+        snprintf(buffer, sizeof(buffer),
+                "CameraHal %d frame copies over %llu ms:\n"
+                "  preview callback: zero-copy %s, %u zero-copy frames, %u copied frames, %u held\n"
+                "  preview copy: %llu bytes, %llu bytes/s\n"
+                "  video copy: %llu bytes, %llu bytes/s\n",
+                mCameraid, (unsigned long long)msecs,
+                mPreviewZeroCopy ? "on" : "off", mPreviewZeroCopyFrames,
+                mPreviewCopyFrames, mPreviewHeldNum,
+                (unsigned long long)mPreviewCopyBytes,
+                (unsigned long long)(mPreviewCopyBytes * 1000 / msecs),
+                (unsigned long long)mVideoCopyBytes,
+                (unsigned long long)(mVideoCopyBytes * 1000 / msecs));
+        write(fd, buffer, strlen(buffer));
+
+        mEncodeLock.lock();
+        unsigned int held = 0;
+        for (unsigned int i = 0; i < mVideoBufNume; i++)
+            held += mVideoBufferUsing[i] ? 1 : 0;
+        snprintf(buffer, sizeof(buffer),
+                "  recording: %s, %u buffers, %u held, %u frames, %u starved, "
+                "encoder latency avg %lld us max %lld us\n",
+                mVideoMetaData ? "metadata" : "copy", mVideoMemory != NULL ? mVideoBufNume : 0,
+                held, mVideoFrames, mVideoStarved,
+                mVideoLatencyFrames ? ns2us(mVideoLatencyTotal) / mVideoLatencyFrames : 0LL,
+                ns2us(mVideoLatencyMax));
+        mEncodeLock.unlock();
+        write(fd, buffer, strlen(buffer));
+
+        mZslLock.lock();
+        snprintf(buffer, sizeof(buffer),
+                "  zsl: %s, %u frames held, %u pictures, last shutter lag %lld us\n",
+                mZslEnabled ? "on" : "off", mZslFrameNum, mZslPictures,
+                ns2us(mZslShutterLag));
+        mZslLock.unlock();
+        write(fd, buffer, strlen(buffer));
+
+        dumpFrameQueue(fd, "preview", mPreviewFrameQueue);
+        dumpFrameQueue(fd, "encode", mEncodeFrameQueue);
+
+        dumpFrameTrace(fd);
         return NO_ERROR;
     }
 
+    //The summary goes to dump, the whole trace to the file named by
+    //camera.trace.export when it is set
+    void CameraHal::dumpFrameTrace(int fd) const
+    {
+        char buffer[2048];
+        char path[PROPERTY_VALUE_MAX];
+        int len, efd;
+
+        len = camera_trace_report(&mFrameTrace, buffer, sizeof(buffer));
+        write(fd, buffer, len < (int)sizeof(buffer) ? len : sizeof(buffer) - 1);
+
+        if (property_get("camera.trace.export", path, "") <= 0)
+            return;
+        efd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (efd < 0) {
+            CAMERA_LOG_ERR("%s: open %s failed: %s", __FUNCTION__, path, strerror(errno));
+            return;
+        }
+        if (camera_trace_export(&mFrameTrace, efd) < 0)
+            CAMERA_LOG_ERR("%s: write %s failed", __FUNCTION__, path);
+        close(efd);
+    }
+
+    void CameraHal::dumpFrameQueue(int fd, const char *name, const CFrameQueue &frames) const
+    {
+        char buffer[256];
+        CFrameQueueStats stats;
+
+        frames.getStats(&stats);
+        snprintf(buffer, sizeof(buffer),
+                "  %s queue: depth %u, max depth %u, %u pushed, %u dropped, "
+                "wait avg %lld us max %lld us, stage avg %lld us max %lld us\n",
+                name, frames.depth(), stats.maxDepth, stats.pushed, stats.dropped,
+                stats.popped ? ns2us(stats.waitTotal) / stats.popped : 0LL,
+                ns2us(stats.waitMax),
+                stats.done ? ns2us(stats.stageTotal) / stats.done : 0LL,
+                ns2us(stats.stageMax));
+        write(fd, buffer, strlen(buffer));
+    }
+
     status_t CameraHal::sendCommand(int32_t command, int32_t arg1,
             int32_t arg2)
     {
+        if (command == CAMERA_CMD_RELEASE_PREVIEW_FRAME)
+            return releasePreviewFrame((unsigned int)arg1);
+        if (command == CAMERA_CMD_START_BURST_CAPTURE) {
+            if (arg1 < 1 || arg1 > MAX_BURST_COUNT)
+                return BAD_VALUE;
+            Mutex::Autolock lock(mLock);
+            return startTakePicture(arg1);
+        }
+        if (command == CAMERA_CMD_STOP_BURST_CAPTURE) {
+            mZslLock.lock();
+            mBurstStop = true;
+            mZslCond.broadcast();
+            mZslLock.unlock();
+            return NO_ERROR;
+        }
         return BAD_VALUE;
     }
 
@@ -684,6 +940,20 @@ namespace android {
             CAMERA_LOG_ERR("The focus mode is not corrected");
             return BAD_VALUE;
         }
+
+        const char *pZslStr = params.get(CAMERA_PARAM_ZSL);
+        if (pZslStr != NULL && strcmp(pZslStr, "on") != 0 && strcmp(pZslStr, "off") != 0) {
+            CAMERA_LOG_ERR("The zsl mode %s is not corrected", pZslStr);
+            return BAD_VALUE;
+        }
+
+        if (params.get(CAMERA_PARAM_BURST_COUNT) != NULL) {
+            int burst = params.getInt(CAMERA_PARAM_BURST_COUNT);
+            if (burst < 1 || burst > MAX_BURST_COUNT) {
+                CAMERA_LOG_ERR("The burst count %d is not corrected", burst);
+                return BAD_VALUE;
+            }
+        }
         mParameters = params;
 
         return NO_ERROR;
@@ -723,9 +993,15 @@ namespace android {
             return BAD_VALUE;
         }
 
+        releaseAllPreviewFrames();
+
         GraphicBufferMapper &mapper = GraphicBufferMapper::get();
         buffer_handle_t *handle;
         for(unsigned int i = 0; i < mCaptureBufNum; i++) {
+            if(mPreviewBufMemory[i] != NULL) {
+                mPreviewBufMemory[i]->release(mPreviewBufMemory[i]);
+                mPreviewBufMemory[i] = NULL;
+            }
             if(mCaptureBuffers[i].buf_state == WINDOW_BUFS_DEQUEUED) {
                 handle = (buffer_handle_t *)mCaptureBuffers[i].native_buf;
                 if(handle != NULL) {
@@ -849,6 +1125,13 @@ namespace android {
             mCaptureBuffers[i].native_buf = (void *)buf_h;
             mCaptureBuffers[i].refCount = 0;
             mCaptureBuffers[i].buf_state = WINDOW_BUFS_DEQUEUED;
+
+            //The client maps the whole fd, so only buffers starting at offset 0 can be shared
+            if(mPreviewZeroCopy && !mTakePicFlag && (handle->offset == 0)) {
+                mPreviewBufMemory[i] = mRequestMemory(handle->fd, mPreviewFrameSize, 1, NULL);
+                if(mPreviewBufMemory[i] == NULL)
+                    CAMERA_LOG_ERR("%s: wrap buffer %d failed, preview callback will copy it", __FUNCTION__, i);
+            }
             CAMERA_LOG_RUNTIME("mCaptureBuffers[%d]-phys=%x, base=%p, size=%d", i, mCaptureBuffers[i].phy_offset, mCaptureBuffers[i].virt_start, mCaptureBuffers[i].length);
         }
 
@@ -914,19 +1197,17 @@ namespace android {
         return mPreviewRunning;
     }
 
-    //update buffer for direct input in video recorder
+    //update buffer for direct input in video recorder, the descriptors
+    //never change while the capture buffers stay allocated
     status_t CameraHal::updateDirectInput(bool bDirect)
     {
         unsigned int i;
-        if (bDirect == true) {
-            if(mCaptureBufNum <= 0)
-                CAMERA_LOG_INFO("mCaptureBuf not allocated yet, will register it later");
-
-            for(i = 0 ; i < mCaptureBufNum; i ++) {
+        if (bDirect == true && mVideoMemory != NULL) {
+            for(i = 0 ; i < mVideoBufNume; i ++) {
                 mVideoBufferPhy[i].phy_offset = mCaptureBuffers[i].phy_offset;
                 CAMERA_LOG_INFO("Camera HAL physic address: %x", mCaptureBuffers[i].phy_offset);
                 mVideoBufferPhy[i].length = mCaptureBuffers[i].length;
-                memcpy((unsigned char*)mVideoMemory->data + i*mPreviewFrameSize,
+                memcpy((unsigned char*)mVideoMemory->data + i*mVideoBufSize,
                         (void*)&mVideoBufferPhy[i], sizeof(VIDEOFRAME_BUFFER_PHY));
             }
         }
@@ -934,11 +1215,11 @@ namespace android {
         return NO_ERROR;
     }
 
+    //Takes effect at the next startRecording
     status_t CameraHal::storeMetaDataInBuffers(bool enable)
     {
         CAMERA_LOG_FUNC;
         mDirectInput = enable;
-        updateDirectInput(enable);
         return NO_ERROR;
     }
 
@@ -946,7 +1227,6 @@ namespace android {
     {
         CAMERA_LOG_FUNC;
         status_t ret = NO_ERROR;
-        unsigned int i;
 
         mEncodeLock.lock();
         if (mRecordRunning == true ) {
@@ -955,11 +1235,10 @@ namespace android {
             return ret;
         }
 
-
-        if (mDirectInput == true) {
-            for(i = 0; i < mVideoBufNume; i++) {
-                mVideoBufferUsing[i] = 0;
-            }
+        if ((ret = AllocateRecordVideoBuf()) < 0) {
+            CAMERA_LOG_ERR("%s: AllocateRecordVideoBuf error", __FUNCTION__);
+            mEncodeLock.unlock();
+            return ret;
         }
 
         mRecordRunning = true;
@@ -975,7 +1254,7 @@ namespace android {
         mEncodeLock.lock();
         if(mRecordRunning) {
             mRecordRunning = false;
-            mEncodeThreadQueue.postMessage(new CMessage(CMESSAGE_TYPE_STOP, 0));
+            mEncodeThreadQueue.postStopMessage();
             //stopRecording() will holde mLock in camera service,
             //when encodeframeThread() is in the call back mDataCbTimestamp.
             //That call back will make a call of releaseRecordingFrame, which
@@ -990,11 +1269,32 @@ namespace android {
     {
         //CAMERA_LOG_FUNC;
         int index;
+        nsecs_t latency;
+        bool metaData;
 
-        index = ((size_t)mem - (size_t)mVideoMemory->data) / mPreviewFrameSize;
+        mEncodeLock.lock();
+        if (mVideoMemory == NULL || mem < mVideoMemory->data) {
+            mEncodeLock.unlock();
+            return;
+        }
+        index = ((size_t)mem - (size_t)mVideoMemory->data) / mVideoBufSize;
+        if ((unsigned int)index >= mVideoBufNume || mVideoBufferUsing[index] == 0) {
+            //a frame of an earlier pool, or one reclaimed after stopRecording
+            mEncodeLock.unlock();
+            return;
+        }
         mVideoBufferUsing[index] = 0;
+        latency = systemTime(SYSTEM_TIME_MONOTONIC) - mVideoSendTime[index];
+        mVideoLatencyTotal += latency;
+        mVideoLatencyFrames ++;
+        if (latency > mVideoLatencyMax)
+            mVideoLatencyMax = latency;
+        metaData = mVideoMetaData;
+        camera_trace_frame_event(&mFrameTrace, CAMERA_TRACE_VIDEO_RELEASE, index,
+                mVideoTraceFrame[index]);
+        mEncodeLock.unlock();
 
-        if (mDirectInput == true) {
+        if (metaData == true) {
             if(mCaptureBuffers[index].refCount == 0) {
                 CAMERA_LOG_ERR("warning:%s about to release mCaptureBuffers[%d].refcount=%d-", __FUNCTION__, index, mCaptureBuffers[index].refCount);
                 return;
@@ -1035,12 +1335,24 @@ namespace android {
     {
         CAMERA_LOG_FUNC;
         Mutex::Autolock lock(mLock);
+        int count = 1;
+
+        if (mParameters.get(CAMERA_PARAM_BURST_COUNT) != NULL)
+            count = mParameters.getInt(CAMERA_PARAM_BURST_COUNT);
+        return startTakePicture(count);
+    }
 
+    //Called with mLock held
+    status_t CameraHal::startTakePicture(int count)
+    {
         if(mTakePictureInProcess) {
             CAMERA_LOG_ERR("%s: takePicture already in process", __FUNCTION__);
             return INVALID_OPERATION;
         }
 
+        mShutterTime = systemTime(SYSTEM_TIME_MONOTONIC);
+        mBurstCount = count;
+        mBurstStop = false;
         if(mTakePicThread->run("takepicThread", PRIORITY_URGENT_DISPLAY) != NO_ERROR) {
             CAMERA_LOG_ERR("%s: could't run take picture thread", __FUNCTION__);
             return INVALID_OPERATION;
@@ -1053,6 +1365,10 @@ namespace android {
     status_t CameraHal::cancelPicture()
     {
         CAMERA_LOG_FUNC;
+        mZslLock.lock();
+        mBurstStop = true;
+        mZslCond.broadcast();
+        mZslLock.unlock();
         mTakePicThread->requestExitAndWait();
 
         return NO_ERROR;
@@ -1075,9 +1391,13 @@ namespace android {
         CAMERA_LOG_FUNC;
         CAMERA_LOG_INFO("Start taking picture!");
 
-        /* Stop preview, start picture capture, and then restart preview again for CSI camera*/
-        CameraHALStopPreview();
-        cameraHALTakePicture();
+        //A ZSL picture comes from the running preview stream when it
+        //matches the picture size; otherwise stop preview, start picture
+        //capture, and then restart preview again for CSI camera
+        if (!mZslEnabled || !mPreviewRunning || cameraHALTakeZslPicture() == NO_INIT) {
+            CameraHALStopPreview();
+            cameraHALTakePicture();
+        }
         mTakePictureInProcess = false;
 
         return UNKNOWN_ERROR;
@@ -1091,7 +1411,6 @@ namespace android {
         struct jpeg_encoding_conf JpegEncConf;
         DMA_BUFFER *Buf_input, Buf_output;
         camera_memory_t* JpegMemBase = NULL;
-        camera_memory_t *RawMemBase = NULL;
 
         int  max_fps, min_fps;
         int actual_fps = 15;
@@ -1143,12 +1462,6 @@ namespace android {
         if ((ret = PrepareJpegEncoder()) < 0)
             return ret;
 
-        JpegMemBase = mRequestMemory(-1, mCaptureFrameSize, 1, NULL);
-        if (JpegMemBase == NULL || JpegMemBase->data == NULL){
-            ret = NO_MEMORY;
-            goto Pic_out;
-        }
-
         if (mCaptureDevice->DevStart()<0){
             CAMERA_LOG_ERR("the capture start up failed !!!!");
             return INVALID_OPERATION;
@@ -1169,10 +1482,66 @@ namespace android {
             }
         }
 
-        Buf_input = &mCaptureBuffers[DeQueBufIdx];
+        CAMERA_LOG_INFO("Generated %d picture(s) with mMsgEnabled 0x%x", mBurstCount, mMsgEnabled);
+        for (int shot = 0; shot < mBurstCount && !mBurstStop; shot++) {
+            //the rest of a burst are the frames that follow the first one
+            if (shot > 0) {
+                if (mCaptureDevice->DevQueue(DeQueBufIdx) < 0 ||
+                        mCaptureDevice->DevDequeue(&DeQueBufIdx) < 0) {
+                    LOGE("VIDIOC_DQBUF Failed!!!");
+                    ret = UNKNOWN_ERROR;
+                    goto Pic_out;
+                }
+            }
+
+            Buf_input = &mCaptureBuffers[DeQueBufIdx];
+            sendPictureNotify(Buf_input);
+
+            //a fresh buffer per picture, the client may still hold the last one
+            JpegMemBase = mRequestMemory(-1, mCaptureFrameSize, 1, NULL);
+            if (JpegMemBase == NULL || JpegMemBase->data == NULL){
+                ret = NO_MEMORY;
+                goto Pic_out;
+            }
+            Buf_output.virt_start = (unsigned char *)(JpegMemBase->data);
 
-        Buf_output.virt_start = (unsigned char *)(JpegMemBase->data);
-        CAMERA_LOG_INFO("Generated a picture with mMsgEnabled 0x%x", mMsgEnabled);
+            if (mJpegEncoder->DoEncode(Buf_input,&Buf_output,&JpegEncConf) < 0){
+                ret = UNKNOWN_ERROR;
+                goto Pic_out;
+            }
+
+            if (mMsgEnabled & CAMERA_MSG_COMPRESSED_IMAGE) {
+                CAMERA_LOG_INFO("==========CAMERA_MSG_COMPRESSED_IMAGE==================");
+                mDataCb(CAMERA_MSG_COMPRESSED_IMAGE, JpegMemBase, 0, NULL, mCallbackCookie);
+            }
+            JpegMemBase->release(JpegMemBase);
+            JpegMemBase = NULL;
+        }
+
+Pic_out:
+        freeBuffersToNativeWindow();
+
+        mCaptureDevice->DevStop();
+        mCaptureDevice->DevDeAllocate();
+        if(mSensorType == CAMERA_TYPE_UVC) {
+            CloseCaptureDevice();
+        }
+
+        if(JpegMemBase) {
+            JpegMemBase->release(JpegMemBase);
+        }
+        if(mWaitForTakingPicture) {
+            sem_post(&mTakingPicture);
+        }
+        return ret;
+
+    }
+
+    //Shutter and raw image messages that go ahead of every picture
+    void CameraHal::sendPictureNotify(DMA_BUFFER *pBuf)
+    {
+        camera_memory_t *RawMemBase = NULL;
+        size_t rawSize = pBuf->length < mCaptureFrameSize ? pBuf->length : mCaptureFrameSize;
 
         if (mMsgEnabled & CAMERA_MSG_SHUTTER) {
             CAMERA_LOG_INFO("CAMERA_MSG_SHUTTER");
@@ -1181,23 +1550,16 @@ namespace android {
 
         if (mMsgEnabled & CAMERA_MSG_RAW_IMAGE) {
             CAMERA_LOG_INFO("CAMERA_MSG_RAW_IMAGE");
-            RawMemBase = mRequestMemory(-1, mCaptureFrameSize, 1, NULL);
-
-            if ( NULL == RawMemBase ) {
-                CAMERA_LOG_INFO("Raw buffer allocation failed!");
-                ret = UNKNOWN_ERROR;
-                goto Pic_out;
+            RawMemBase = mRequestMemory(-1, rawSize, 1, NULL);
+            if (RawMemBase == NULL || RawMemBase->data == NULL) {
+                CAMERA_LOG_ERR("Raw buffer allocation failed!");
             }
-            void *dest = RawMemBase->data;
-
-            if (NULL != dest) {
-                void *src = &mCaptureBuffers[DeQueBufIdx];
-                memcpy(dest, src, mCaptureFrameSize);
+            else {
+                memcpy(RawMemBase->data, pBuf->virt_start, rawSize);
+                mDataCb(CAMERA_MSG_RAW_IMAGE, RawMemBase, 0, NULL, mCallbackCookie);
             }
-
-            mDataCb(CAMERA_MSG_RAW_IMAGE, RawMemBase, 0, NULL, mCallbackCookie);
-
-            RawMemBase->release(RawMemBase);
+            if (RawMemBase != NULL)
+                RawMemBase->release(RawMemBase);
         }
 
         if ( mMsgEnabled & CAMERA_MSG_RAW_IMAGE_NOTIFY ) {
@@ -1205,33 +1567,205 @@ namespace android {
             if(mNotifyCb)
                 mNotifyCb(CAMERA_MSG_RAW_IMAGE_NOTIFY, 0, 0, mCallbackCookie);
         }
+    }
 
-        if (mJpegEncoder->DoEncode(Buf_input,&Buf_output,&JpegEncConf) < 0){
-            ret = UNKNOWN_ERROR;
-            goto Pic_out;
-        }
+    //Encode the picture(s) from the frames the preview stream already
+    //captured. Returns NO_INIT when the stream can't be used, so the
+    //caller falls back to a stop preview capture.
+    int CameraHal::cameraHALTakeZslPicture()
+    {
+        CAMERA_LOG_FUNC;
+        int ret = NO_ERROR, i;
+        struct jpeg_encoding_conf JpegEncConf;
+        DMA_BUFFER Buf_input, Buf_output;
+        camera_memory_t* JpegMemBase = NULL;
+        unsigned int yu12 = v4l2_fourcc('Y','U','1','2');
+        unsigned int encodeFmt = 0;
+        nsecs_t last = 0;
+        int width, height;
+        size_t size;
+
+        if (mJpegEncoder == NULL)
+            return NO_INIT;
+        mParameters.getPictureSize(&width, &height);
+        if (width != (int)mCaptureDeviceCfg.width || height != (int)mCaptureDeviceCfg.height) {
+            CAMERA_LOG_INFO("ZSL stream is %dx%d, picture is %dx%d", mCaptureDeviceCfg.width,
+                    mCaptureDeviceCfg.height, width, height);
+            return NO_INIT;
+        }
+
+        //encode the stream format as is, or convert it to planar on the way
+        if (GetJpegEncoderParam() < 0)
+            return NO_INIT;
+        for (i = 0; i < MAX_QUERY_FMT_TIMES && mJpegEncoderSupportFmt[i] != 0; i++) {
+            if (mJpegEncoderSupportFmt[i] == mPreviewCapturedFormat)
+                encodeFmt = mPreviewCapturedFormat;
+            else if (mJpegEncoderSupportFmt[i] == yu12 && encodeFmt == 0 &&
+                    camera_csc_find(mPreviewCapturedFormat, yu12) != NULL)
+                encodeFmt = yu12;
+        }
+        if (encodeFmt == 0) {
+            CAMERA_LOG_ERR("%s: no encoder format for the preview stream", __FUNCTION__);
+            return NO_INIT;
+        }
+
+        size = camera_csc_frame_size(encodeFmt, width, height);
+        if (mZslBufSize < size) {
+            free(mZslBuf);
+            mZslBuf = (unsigned char *)malloc(size);
+            mZslBufSize = mZslBuf != NULL ? size : 0;
+            if (mZslBuf == NULL)
+                return NO_INIT;
+        }
+
+        mPictureEncodeFormat = encodeFmt;
+        if ((ret = PrepareJpegEncoder()) < 0)
+            goto Zsl_out;
+
+        CAMERA_LOG_INFO("Generated %d ZSL picture(s) with mMsgEnabled 0x%x", mBurstCount, mMsgEnabled);
+        for (int shot = 0; shot < mBurstCount; shot++) {
+            //the first picture is the frame closest to the shutter, the
+            //rest of a burst are the frames that follow it
+            if (grabZslFrame(shot == 0 ? mShutterTime : 0, &last, size) < 0) {
+                //nothing delivered yet, let the caller capture the picture
+                if (shot == 0 && !mBurstStop)
+                    ret = NO_INIT;
+                break;
+            }
 
-Pic_out:
-        freeBuffersToNativeWindow();
-        if ((JpegMemBase != NULL) &&(JpegMemBase->data != NULL) && (mMsgEnabled & CAMERA_MSG_COMPRESSED_IMAGE)) {
-            CAMERA_LOG_INFO("==========CAMERA_MSG_COMPRESSED_IMAGE==================");
-            mDataCb(CAMERA_MSG_COMPRESSED_IMAGE, JpegMemBase, 0, NULL, mCallbackCookie);
-        }
+            Buf_input.virt_start = mZslBuf;
+            Buf_input.length = size;
+            sendPictureNotify(&Buf_input);
 
-        mCaptureDevice->DevStop();
-        mCaptureDevice->DevDeAllocate();
-        if(mSensorType == CAMERA_TYPE_UVC) {
-            CloseCaptureDevice();
+            JpegMemBase = mRequestMemory(-1, mCaptureFrameSize, 1, NULL);
+            if (JpegMemBase == NULL || JpegMemBase->data == NULL){
+                ret = NO_MEMORY;
+                goto Zsl_out;
+            }
+            Buf_output.virt_start = (unsigned char *)(JpegMemBase->data);
+
+            if (mJpegEncoder->DoEncode(&Buf_input,&Buf_output,&JpegEncConf) < 0){
+                ret = UNKNOWN_ERROR;
+                goto Zsl_out;
+            }
+
+            if (mMsgEnabled & CAMERA_MSG_COMPRESSED_IMAGE) {
+                CAMERA_LOG_INFO("==========CAMERA_MSG_COMPRESSED_IMAGE==================");
+                mDataCb(CAMERA_MSG_COMPRESSED_IMAGE, JpegMemBase, 0, NULL, mCallbackCookie);
+            }
+            JpegMemBase->release(JpegMemBase);
+            JpegMemBase = NULL;
+
+            mZslLock.lock();
+            mZslPictures ++;
+            mZslLock.unlock();
         }
 
+Zsl_out:
         if(JpegMemBase) {
             JpegMemBase->release(JpegMemBase);
         }
-        if(mWaitForTakingPicture) {
+        if(ret != NO_INIT && mWaitForTakingPicture) {
             sem_post(&mTakingPicture);
         }
         return ret;
+    }
+
+    //Called by the capture thread for every frame, before it goes to the
+    //preview thread. The ring holds a reference on the newest frames, the
+    //oldest one is handed back so capture never runs out of buffers.
+    void CameraHal::pushZslFrame(unsigned int index, nsecs_t timestamp)
+    {
+        int oldest = -1;
+
+        getBufferCount(&mCaptureBuffers[index]);
+        mZslLock.lock();
+        if (mZslFrameNum == ZSL_RING_FRAMES) {
+            oldest = mZslFrames[0].index;
+            memmove(&mZslFrames[0], &mZslFrames[1], sizeof(CFrame) * (ZSL_RING_FRAMES - 1));
+            mZslFrameNum --;
+        }
+        mZslFrames[mZslFrameNum].index = index;
+        mZslFrames[mZslFrameNum].timestamp = timestamp;
+        mZslFrameNum ++;
+        mZslCond.broadcast();
+        mZslLock.unlock();
+
+        if (oldest >= 0)
+            putBufferCount(&mCaptureBuffers[oldest]);
+    }
+
+    //Copy a frame of the ring to mZslBuf in mPictureEncodeFormat, size
+    //bytes of it at most. With a shutter time, take the frame closest to
+    //it, otherwise the first frame newer than *last, waiting for it if
+    //needed.
+    int CameraHal::grabZslFrame(nsecs_t shutter, nsecs_t *last, size_t size)
+    {
+        DMA_BUFFER *pBuf;
+        int pick = -1;
+        unsigned int i;
+
+        mZslLock.lock();
+        while (pick < 0) {
+            if (!mZslEnabled || mBurstStop)
+                break;
+            for (i = 0; i < mZslFrameNum; i++) {
+                if (shutter != 0) {
+                    if (pick < 0 || llabs(mZslFrames[i].timestamp - shutter) <
+                            llabs(mZslFrames[pick].timestamp - shutter))
+                        pick = i;
+                }
+                else if (mZslFrames[i].timestamp > *last) {
+                    pick = i;
+                    break;
+                }
+            }
+            if (pick < 0 && mZslCond.waitRelative(mZslLock, ZSL_FRAME_TIMEOUT) != NO_ERROR) {
+                CAMERA_LOG_ERR("%s: no frame from the preview stream", __FUNCTION__);
+                break;
+            }
+        }
+        if (pick < 0) {
+            mZslLock.unlock();
+            return -1;
+        }
+
+        //the reference keeps the buffer out of capture while it is copied,
+        //mZslCopying keeps stop preview from freeing it
+        pBuf = &mCaptureBuffers[mZslFrames[pick].index];
+        getBufferCount(pBuf);
+        mZslCopying = true;
+        if (shutter != 0)
+            mZslShutterLag = mZslFrames[pick].timestamp - shutter;
+        *last = mZslFrames[pick].timestamp;
+        mZslLock.unlock();
+
+        if (mPictureEncodeFormat == mPreviewCapturedFormat)
+            memcpy(mZslBuf, pBuf->virt_start, size < mCaptureFrameSize ? size : mCaptureFrameSize);
+        else
+            camera_csc_convert(mPreviewCapturedFormat, mPictureEncodeFormat, pBuf->virt_start,
+                    mZslBuf, mCaptureDeviceCfg.width, mCaptureDeviceCfg.height);
+        putBufferCount(pBuf);
+
+        mZslLock.lock();
+        mZslCopying = false;
+        mZslCond.broadcast();
+        mZslLock.unlock();
+
+        return 0;
+    }
 
+    //Drop the ring once the capture thread is stopped. The buffer counts
+    //are reset when the buffers go back to the window.
+    void CameraHal::releaseZslFrames()
+    {
+        mZslLock.lock();
+        mZslEnabled = false;
+        mZslCond.broadcast();
+        while (mZslCopying)
+            mZslCond.wait(mZslLock);
+        mZslFrameNum = 0;
+        mZslLock.unlock();
     }
 
     int CameraHal :: GetJpegEncoderParam()
@@ -1556,8 +2090,21 @@ Pic_out:
         int  max_fps, min_fps;
         int actual_fps = 15;
 
+        bool zsl = mParameters.get(CAMERA_PARAM_ZSL) != NULL &&
+                strcmp(mParameters.get(CAMERA_PARAM_ZSL), "on") == 0;
+        int pic_w, pic_h;
+
         mParameters.getPreviewSize((int *)&(mCaptureDeviceCfg.width),(int *)&(mCaptureDeviceCfg.height));
 
+        //the ring is only kept when its frames can be encoded as the
+        //picture, otherwise takePicture stops preview to capture
+        mParameters.getPictureSize(&pic_w, &pic_h);
+        if (zsl && (pic_w != (int)mCaptureDeviceCfg.width || pic_h != (int)mCaptureDeviceCfg.height)) {
+            CAMERA_LOG_INFO("zsl off, preview is %dx%d, picture is %dx%d", mCaptureDeviceCfg.width,
+                    mCaptureDeviceCfg.height, pic_w, pic_h);
+            zsl = false;
+        }
+
         if ((ret = convertStringToPreviewFormat(&mPreviewCapturedFormat)) != 0) {
             CAMERA_LOG_ERR("%s: convertStringToPreviewFormat error", __FUNCTION__);
             return ret;
@@ -1565,6 +2112,26 @@ Pic_out:
 
         mCaptureDeviceCfg.fmt = mPreviewCapturedFormat;
 
+        //yuv420sp callbacks are NV21 while the device captures NV12
+        if(mPreviewCapturedFormat == v4l2_fourcc('N','V','1','2'))
+            mPreviewCallbackFormat = v4l2_fourcc('N','V','2','1');
+        else
+            mPreviewCallbackFormat = mPreviewCapturedFormat;
+        mPreviewZeroCopy = mParameters.get(CAMERA_PARAM_PREVIEW_ZERO_COPY) != NULL &&
+                strcmp(mParameters.get(CAMERA_PARAM_PREVIEW_ZERO_COPY), "true") == 0;
+
+        mPreviewCbLock.lock();
+        mStatsStartTime = systemTime(SYSTEM_TIME_MONOTONIC);
+        mPreviewCopyBytes = 0;
+        mVideoCopyBytes = 0;
+        mPreviewCopyFrames = 0;
+        mPreviewZeroCopyFrames = 0;
+        mPreviewFrameNum = 0;
+        mPreviewCbLock.unlock();
+        mPreviewFrameQueue.resetStats();
+        mEncodeFrameQueue.resetStats();
+        camera_trace_reset(&mFrameTrace);
+
         CAMERA_LOG_RUNTIME("*********%s,mCaptureDeviceCfg.fmt=%x************", __FUNCTION__, mCaptureDeviceCfg.fmt);
         mCaptureDeviceCfg.rotate = (SENSOR_PREVIEW_ROTATE)mPreviewRotate;
         //Default setting is 15FPS
@@ -1611,6 +2178,11 @@ Pic_out:
             return ret;
         }
 
+        mZslLock.lock();
+        mZslEnabled = zsl;
+        mZslFrameNum = 0;
+        mZslLock.unlock();
+
         if(mNativeWindow != NULL) {
             if ((ret = CameraHALPreviewStart()) < 0){
                 CAMERA_LOG_ERR("CameraHALPreviewStart error");
@@ -1625,6 +2197,7 @@ Pic_out:
         CAMERA_LOG_FUNC;
         if (mPreviewRunning != 0)	{
             CameraHALStopThreads();
+            releaseZslFrames();
             CameraHALStopMisc();
             mCaptureBufNum = 0;
             CAMERA_LOG_INFO("camera hal stop preview done");
@@ -1710,11 +2283,6 @@ Pic_out:
         nCameraBuffersQueued = mCaptureBufNum;
         mIsCaptureBufsAllocated = 1;
 
-        if((AllocateRecordVideoBuf())<0) {
-            CAMERA_LOG_INFO("%s: AllocateRecordVideoBuf error\n", __FUNCTION__);
-            return BAD_VALUE;
-        }
-
         return NO_ERROR;
     }
 
@@ -1805,7 +2373,11 @@ Pic_out:
         unsigned int buf_index = pBuf - &mCaptureBuffers[0];
 
         Mutex::Autolock _l(pBuf->mBufferLock);
-        if(!mRecordRunning &&  (mVideoBufferUsing[buf_index] == 1)
+        if(pBuf->refCount == 0) {
+            CAMERA_LOG_ERR("%s: buffer %d is not held", __FUNCTION__, buf_index);
+            return INVALID_OPERATION;
+        }
+        if(mVideoMetaData && !mRecordRunning && (mVideoBufferUsing[buf_index] == 1)
                 && (pBuf->refCount == 2)) {
             pBuf->refCount --;
             mVideoBufferUsing[buf_index] = 0;
@@ -1864,6 +2436,7 @@ Pic_out:
 
         unsigned int bufIndex = -1;
         status_t ret = NO_ERROR;
+        nsecs_t timestamp;
         sp<CMessage> msg = mCaptureThreadQueue.waitMessage();
         if(msg == 0) {
             CAMERA_LOG_ERR("%s: get invalide message", __FUNCTION__);
@@ -1883,11 +2456,36 @@ Pic_out:
                 }
                 //CAMERA_LOG_RUNTIME("Get buffer %d from Capture Device", bufIndex);
                 //handle the normal return.
+                timestamp = systemTime(SYSTEM_TIME_MONOTONIC);
+                camera_trace_capture(&mFrameTrace, bufIndex);
+                if (!mFirstFrameLogged) {
+                    mFirstFrameLogged = true;
+                    CAMERA_LOG_INFO("camera %d first frame %lld ms after open, capabilities %s",
+                            mCameraid, ns2ms(timestamp - mOpenTime),
+                            mCapsCached ? "cached" : "enumerated");
+                }
+                //the ring takes its reference first, once the frame is
+                //posted the preview thread may hand it back to the driver
+                if(mZslEnabled)
+                    pushZslFrame(bufIndex, timestamp);
+
                 getBufferCount(&mCaptureBuffers[bufIndex]);
-                mPreviewThreadQueue.postMessage(new CMessage(CMESSAGE_TYPE_NORMAL, bufIndex));
+                if(mPreviewThreadQueue.postFrame(bufIndex) != NO_ERROR) {
+                    CAMERA_LOG_ERR("%s: preview queue full, drop buffer %d", __FUNCTION__, bufIndex);
+                    camera_trace_event(&mFrameTrace, CAMERA_TRACE_DROP_PREVIEW, bufIndex);
+                    putBufferCount(&mCaptureBuffers[bufIndex]);
+                    break;
+                }
 
+                //the encode thread owns a reference until the frame is
+                //copied, or in metadata mode until the encoder releases it
                 if(mRecordRunning) {
-                    mEncodeThreadQueue.postMessage(new CMessage(CMESSAGE_TYPE_NORMAL, bufIndex));
+                    getBufferCount(&mCaptureBuffers[bufIndex]);
+                    if(mEncodeThreadQueue.postFrame(bufIndex) != NO_ERROR) {
+                        CAMERA_LOG_ERR("%s: encode queue full, drop buffer %d", __FUNCTION__, bufIndex);
+                        camera_trace_event(&mFrameTrace, CAMERA_TRACE_DROP_VIDEO, bufIndex);
+                        putBufferCount(&mCaptureBuffers[bufIndex]);
+                    }
                 }
                 break;
             case CMESSAGE_TYPE_STOP:
@@ -1979,17 +2577,13 @@ Pic_out:
         buffer_handle_t *buf_h = NULL;
         int buf_index = -1;
         int stride = 0, err = 0;
+        CFrame frame;
+        CMESSAGE_TYPE what;
 
-        sp<CMessage> msg = mPreviewThreadQueue.waitMessage();
-        if(msg == 0) {
-            CAMERA_LOG_ERR("%s: get invalide message", __FUNCTION__);
-            mPreviewRunning = false;
-            return BAD_VALUE;
-        }
-
-        switch(msg->what) {
+        what = mPreviewThreadQueue.waitFrame(&frame);
+        switch(what) {
             case CMESSAGE_TYPE_NORMAL:
-                display_index = msg->arg0;
+                display_index = frame.index;
                 if(display_index < 0 || (unsigned int)display_index >= mCaptureBufNum) {
                     CAMERA_LOG_ERR("%s: get invalide buffer index", __FUNCTION__);
                     mPreviewRunning = false;
@@ -2000,12 +2594,7 @@ Pic_out:
                 pInBuf = &mCaptureBuffers[display_index];
 
                 if (mMsgEnabled & CAMERA_MSG_PREVIEW_FRAME) {
-                    //CAMERA_LOG_ERR("*******CAMERA_MSG_PREVIEW_FRAME*******");
-                    convertNV12toYUV420SP((uint8_t*)(pInBuf->virt_start),
-                            (uint8_t*)((unsigned char*)mPreviewMemory->data + preview_heap_buf_head*mPreviewFrameSize),mCaptureDeviceCfg.width, mCaptureDeviceCfg.height);
-                    mDataCb(CAMERA_MSG_PREVIEW_FRAME, mPreviewMemory, preview_heap_buf_head, NULL, mCallbackCookie);
-                    preview_heap_buf_head ++;
-                    preview_heap_buf_head %= mPreviewHeapBufNum;
+                    sendPreviewFrame(display_index);
                 }
 
                 if (mNativeWindow != 0) {
@@ -2017,7 +2606,9 @@ Pic_out:
                         return BAD_VALUE;
                     }
                     pInBuf->buf_state = WINDOW_BUFS_QUEUED;
+                    camera_trace_event(&mFrameTrace, CAMERA_TRACE_WINDOW_ENQUEUE, display_index);
                     mEnqueuedBufs ++;
+                    mPreviewFrameQueue.frameDone(frame);
                     bufferDump(pInBuf);
                     if (mEnqueuedBufs <= 2) {
                         return NO_ERROR;
@@ -2051,6 +2642,7 @@ Pic_out:
                 }
 
                 mCaptureBuffers[buf_index].buf_state = WINDOW_BUFS_DEQUEUED;
+                camera_trace_event(&mFrameTrace, CAMERA_TRACE_WINDOW_DEQUEUE, buf_index);
                 ret = putBufferCount(&mCaptureBuffers[buf_index]);
                 break;
             case CMESSAGE_TYPE_STOP:
@@ -2064,7 +2656,7 @@ Pic_out:
                 CAMERA_LOG_INFO("%s: receive QUIT message", __FUNCTION__);
                 break;
             default:
-                CAMERA_LOG_ERR("%s: wrong msg type %d", __FUNCTION__, msg->what);
+                CAMERA_LOG_ERR("%s: wrong msg type %d", __FUNCTION__, what);
                 ret = INVALID_OPERATION;
                 break;
         }
@@ -2095,15 +2687,13 @@ Pic_out:
         //CAMERA_LOG_FUNC;
         status_t ret = NO_ERROR;
         int enc_index;
-        sp<CMessage> msg = mEncodeThreadQueue.waitMessage();
-        if(msg == 0) {
-            CAMERA_LOG_ERR("%s: get invalide message", __FUNCTION__);
-            return BAD_VALUE;
-        }
+        CFrame frame;
+        CMESSAGE_TYPE what;
 
-        switch(msg->what) {
+        what = mEncodeThreadQueue.waitFrame(&frame);
+        switch(what) {
             case CMESSAGE_TYPE_NORMAL:
-                enc_index = msg->arg0;
+                enc_index = frame.index;
                 unsigned int i;
                 if(enc_index < 0 || (unsigned int)enc_index >= mCaptureBufNum) {
                     CAMERA_LOG_ERR("%s: get invalide buffer index", __FUNCTION__);
@@ -2113,31 +2703,48 @@ Pic_out:
                     return BAD_VALUE;
                 }
 
-                struct timespec ts;
                 DMA_BUFFER *EncBuf;
+                camera_memory_t *VideoMem;
+                unsigned char *VideoBuf;
+                int slot;
                 EncBuf = &mCaptureBuffers[enc_index];
 
-                if ((mMsgEnabled & CAMERA_MSG_VIDEO_FRAME) && mRecordRunning) {
+                if (!(mMsgEnabled & CAMERA_MSG_VIDEO_FRAME) || !mRecordRunning) {
+                    putBufferCount(EncBuf);
+                    break;
+                }
+                if ((slot = getVideoSlot(enc_index, &VideoMem, &VideoBuf)) < 0) {
+                    camera_trace_event(&mFrameTrace, CAMERA_TRACE_DROP_VIDEO, enc_index);
+                    putBufferCount(EncBuf);
+                    break;
+                }
+
+                {
                     nsecs_t timeStamp = systemTime(SYSTEM_TIME_MONOTONIC);
-                    if (mDirectInput == true) {
-	                    memcpy((unsigned char*)mVideoMemory->data + enc_index*mPreviewFrameSize,
-                            (void*)&mVideoBufferPhy[enc_index], sizeof(VIDEOFRAME_BUFFER_PHY));
-                    } else {
-                        memcpy((unsigned char*)mVideoMemory->data + enc_index*mPreviewFrameSize,
-                                (void*)EncBuf->virt_start, mPreviewFrameSize);
+                    //the metadata descriptor is already in place and the
+                    //encoder keeps the reference on the capture buffer
+                    if (!mVideoMetaData) {
+                        memcpy(VideoBuf, (void*)EncBuf->virt_start, mPreviewFrameSize);
+                        mPreviewCbLock.lock();
+                        mVideoCopyBytes += mPreviewFrameSize;
+                        mPreviewCbLock.unlock();
                         ret = putBufferCount(EncBuf);
                     }
 
-                    getBufferCount(&mCaptureBuffers[enc_index]);
-                    mVideoBufferUsing[enc_index] = 1;
-                    mDataCbTimestamp(timeStamp, CAMERA_MSG_VIDEO_FRAME, mVideoMemory, enc_index, mCallbackCookie);
-                    break;
+                    camera_trace_event(&mFrameTrace, CAMERA_TRACE_VIDEO_CALLBACK, enc_index);
+                    mDataCbTimestamp(timeStamp, CAMERA_MSG_VIDEO_FRAME, VideoMem, slot, mCallbackCookie);
+                    putVideoMemory(VideoMem);
+                    mEncodeFrameQueue.frameDone(frame);
                 }
                 break;
 
             case CMESSAGE_TYPE_STOP:
                 CAMERA_LOG_INFO("%s: encode thread stop", __FUNCTION__);
-                mEncodeThreadQueue.clearMessage();
+                //give back the references the capture thread took for the
+                //queued frames, frames queued after this come in as normal
+                mEncodeThreadQueue.clearStopMessage();
+                while (mEncodeThreadQueue.pollFrame(&frame))
+                    putBufferCount(&mCaptureBuffers[frame.index]);
                 //sem_post(&mEncodeStoppedCondition);
                 break;
             case CMESSAGE_TYPE_QUITE:
@@ -2145,7 +2752,7 @@ Pic_out:
                 break;
 
             default:
-                CAMERA_LOG_ERR("%s: wrong msg type %d", __FUNCTION__, msg->what);
+                CAMERA_LOG_ERR("%s: wrong msg type %d", __FUNCTION__, what);
                 ret = INVALID_OPERATION;
                 break;
         }
@@ -2153,26 +2760,132 @@ Pic_out:
         return ret;
     }
 
+    //Called with mEncodeLock held, no frame of the old pool is in use
+    //once the encoder has been stopped. The encode thread may still be
+    //sending its last frame from the old pool though, that pool is then
+    //released by putVideoMemory.
     status_t CameraHal :: AllocateRecordVideoBuf()
     {
         status_t ret = NO_ERROR;
-        unsigned int i = 0;
-        if(mVideoMemory != NULL) {
-            mVideoMemory->release(mVideoMemory);
+        unsigned int num, size, fps;
+
+        if(mPreviewFrameSize == 0 || mCaptureBufNum == 0) {
+            CAMERA_LOG_ERR("%s: preview is not running", __FUNCTION__);
+            return INVALID_OPERATION;
+        }
+
+        if(mDirectInput) {
+            num = mCaptureBufNum < VIDEO_OUTPUT_BUFFER_NUM ? mCaptureBufNum : VIDEO_OUTPUT_BUFFER_NUM;
+            size = sizeof(VIDEOFRAME_BUFFER_PHY);
+        }
+        else {
+            //enough buffers to cover the slowest frame of the last recording
+            num = VIDEO_OUTPUT_BUFFER_NUM;
+            if(mVideoLatencyFrames > 0) {
+                fps = mCaptureDeviceCfg.tv.numerator ?
+                    mCaptureDeviceCfg.tv.denominator / mCaptureDeviceCfg.tv.numerator : DEFAULT_PREVIEW_FPS;
+                num = (unsigned int)((mVideoLatencyMax * fps + s2ns(1) - 1) / s2ns(1)) + 1;
+                if(mVideoStarved > 0)
+                    num ++;
+                if(num < VIDEO_MIN_BUFFER_NUM)
+                    num = VIDEO_MIN_BUFFER_NUM;
+                if(num > VIDEO_OUTPUT_BUFFER_NUM)
+                    num = VIDEO_OUTPUT_BUFFER_NUM;
+            }
+            size = mPreviewFrameSize;
         }
 
-        CAMERA_LOG_RUNTIME("Init the video Memory size %d", mPreviewFrameSize);
-        mVideoMemory = mRequestMemory(-1, mPreviewFrameSize, mVideoBufNume, NULL);
-        if(mVideoMemory == NULL) {
-            CAMERA_LOG_ERR("%s, request video buffer failed", __FUNCTION__);
-            return NO_MEMORY;
+        if(mVideoMemory == NULL || mVideoBufNume != num || mVideoBufSize != size) {
+            if(mVideoMemory != NULL && mVideoMemory == mVideoMemoryInUse)
+                mVideoMemoryRetired = mVideoMemory;
+            else if(mVideoMemory != NULL)
+                mVideoMemory->release(mVideoMemory);
+            mVideoMemory = NULL;
+
+            CAMERA_LOG_RUNTIME("Init the video Memory %d x %d", num, size);
+            mVideoMemory = mRequestMemory(-1, size, num, NULL);
+            if(mVideoMemory == NULL) {
+                CAMERA_LOG_ERR("%s, request video buffer failed", __FUNCTION__);
+                return NO_MEMORY;
+            }
+            mVideoBufNume = num;
+            mVideoBufSize = size;
         }
+        CAMERA_LOG_INFO("Recording with %d %s buffers", num, mDirectInput ? "metadata" : "copy");
+
+        mVideoMetaData = mDirectInput;
+        memset(mVideoBufferUsing, 0, sizeof(mVideoBufferUsing));
+        mVideoFrames = 0;
+        mVideoStarved = 0;
+        mVideoLatencyFrames = 0;
+        mVideoLatencyTotal = 0;
+        mVideoLatencyMax = 0;
 
         //Make sure the buffer been updated for direct input
-        updateDirectInput(mDirectInput);
+        updateDirectInput(mVideoMetaData);
         return ret;
     }
 
+    //Pick the recording buffer for capture buffer index, -1 if the frame
+    //has to be dropped. The pool and the slot's buffer are returned in
+    //memory and data, the pool stays allocated until putVideoMemory.
+    int CameraHal :: getVideoSlot(unsigned int index, camera_memory_t **memory, unsigned char **data)
+    {
+        Mutex::Autolock lock(mEncodeLock);
+        unsigned int i, held = 0;
+        int slot = -1;
+
+        if(mVideoMemory == NULL)
+            return -1;
+
+        if(mVideoMetaData) {
+            for(i = 0; i < mVideoBufNume; i++)
+                held += mVideoBufferUsing[i] ? 1 : 0;
+            if(index < mVideoBufNume && !mVideoBufferUsing[index] &&
+                    held + VIDEO_CAPTURE_RESERVED < mCaptureBufNum)
+                slot = index;
+        }
+        else {
+            for(i = 0; i < mVideoBufNume; i++) {
+                if(!mVideoBufferUsing[i]) {
+                    slot = i;
+                    break;
+                }
+            }
+        }
+
+        if(slot < 0) {
+            mVideoStarved ++;
+            return -1;
+        }
+        mVideoBufferUsing[slot] = 1;
+        mVideoSendTime[slot] = systemTime(SYSTEM_TIME_MONOTONIC);
+        mVideoTraceFrame[slot] = camera_trace_frame(&mFrameTrace, index);
+        mVideoFrames ++;
+        mVideoMemoryInUse = mVideoMemory;
+        *memory = mVideoMemory;
+        *data = (unsigned char *)mVideoMemory->data + slot * mVideoBufSize;
+        return slot;
+    }
+
+    //The encode thread is done with the pool getVideoSlot returned, free
+    //it if startRecording replaced it meanwhile
+    void CameraHal :: putVideoMemory(camera_memory_t *memory)
+    {
+        camera_memory_t *retired = NULL;
+
+        mEncodeLock.lock();
+        mVideoMemoryInUse = NULL;
+        if(mVideoMemoryRetired == memory) {
+            retired = mVideoMemoryRetired;
+            mVideoMemoryRetired = NULL;
+        }
+        mEncodeLock.unlock();
+
+        if(retired != NULL)
+            retired->release(retired);
+    }
+
 
     void CameraHal :: LockWakeLock()
     {
@@ -2189,33 +2902,96 @@ Pic_out:
         }
     }
 
-    void CameraHal::convertNV12toYUV420SP(uint8_t *inputBuffer, uint8_t *outputBuffer, int width, int height)
+    void CameraHal::sendPreviewFrame(unsigned int index)
     {
-        /* Color space conversion from I420 to YUV420SP */
-        int Ysize = 0, UVsize = 0;
-        uint8_t *Yin, *Uin, *Vin, *Yout, *Uout, *Vout;
+        DMA_BUFFER *pInBuf = &mCaptureBuffers[index];
+        unsigned char *pOutBuf;
+        unsigned int frame;
 
-        Ysize = width * height;
-        UVsize = width *  height >> 2;
+        mPreviewCbLock.lock();
+        frame = mPreviewFrameNum ++;
+        mPreviewCbLock.unlock();
 
-        Yin = inputBuffer;
-        Uin = Yin + Ysize;
-        Vin = Uin + 1;
+        if (holdPreviewFrame(index, frame)) {
+            camera_trace_event(&mFrameTrace, CAMERA_TRACE_PREVIEW_CALLBACK, index);
+            mDataCb(CAMERA_MSG_PREVIEW_FRAME, mPreviewBufMemory[index], 0, NULL, mCallbackCookie);
+            return;
+        }
+
+        pOutBuf = (unsigned char*)mPreviewMemory->data + preview_heap_buf_head*mPreviewFrameSize;
+        if (mPreviewCallbackFormat == mPreviewCapturedFormat)
+            memcpy(pOutBuf, pInBuf->virt_start, mPreviewFrameSize);
+        else
+            camera_csc_convert(mPreviewCapturedFormat, mPreviewCallbackFormat,
+                    pInBuf->virt_start, pOutBuf, mCaptureDeviceCfg.width, mCaptureDeviceCfg.height);
 
-        Yout = outputBuffer;
-        Vout = Yout + Ysize;
-        Uout = Vout + 1;
+        mPreviewCbLock.lock();
+        mPreviewCopyBytes += mPreviewFrameSize;
+        mPreviewCopyFrames ++;
+        mPreviewCbLock.unlock();
 
-        memcpy(Yout, Yin, Ysize);
+        camera_trace_event(&mFrameTrace, CAMERA_TRACE_PREVIEW_CALLBACK, index);
+        mDataCb(CAMERA_MSG_PREVIEW_FRAME, mPreviewMemory, preview_heap_buf_head, NULL, mCallbackCookie);
+        preview_heap_buf_head ++;
+        preview_heap_buf_head %= mPreviewHeapBufNum;
+    }
 
-        for(int k = 0; k < UVsize; k++) {
-            *Uout = *Uin;
-            *Vout = *Vin;
-            Uout += 2;
-            Vout += 2;
-            Uin  += 2;
-            Vin += 2;
+    //Take a reference on the capture buffer for the client, which keeps it
+    //from V4L2 until the client releases the frame. When the client already
+    //holds PREVIEW_CALLBACK_MAX_HELD frames the frame is copied instead, so
+    //a client that never releases cannot starve capture.
+    bool CameraHal::holdPreviewFrame(unsigned int index, unsigned int frame)
+    {
+        if (!mPreviewZeroCopy || (mPreviewBufMemory[index] == NULL) ||
+                (mPreviewCallbackFormat != mPreviewCapturedFormat))
+            return false;
+
+        mPreviewCbLock.lock();
+        if (mPreviewHeldNum == PREVIEW_CALLBACK_MAX_HELD) {
+            mPreviewCbLock.unlock();
+            return false;
         }
+        mPreviewHeld[mPreviewHeldNum].frame = frame;
+        mPreviewHeld[mPreviewHeldNum].index = index;
+        mPreviewHeldNum ++;
+        mPreviewZeroCopyFrames ++;
+        getBufferCount(&mCaptureBuffers[index]);
+        mPreviewCbLock.unlock();
+
+        return true;
+    }
+
+    status_t CameraHal::releasePreviewFrame(unsigned int frame)
+    {
+        unsigned int index;
+        unsigned int i;
+
+        mPreviewCbLock.lock();
+        for (i = 0; i < mPreviewHeldNum; i++) {
+            if (mPreviewHeld[i].frame == frame)
+                break;
+        }
+        if (i == mPreviewHeldNum) {
+            mPreviewCbLock.unlock();
+            //a copied frame has nothing to give back
+            CAMERA_LOG_RUNTIME("%s: preview frame %u not held", __FUNCTION__, frame);
+            return NO_ERROR;
+        }
+        index = mPreviewHeld[i].index;
+        memmove(&mPreviewHeld[i], &mPreviewHeld[i + 1], (mPreviewHeldNum - i - 1) * sizeof(mPreviewHeld[0]));
+        mPreviewHeldNum --;
+        mPreviewCbLock.unlock();
+
+        putBufferCount(&mCaptureBuffers[index]);
+        return NO_ERROR;
+    }
+
+    //The capture buffers are about to go back to the window, their
+    //reference counts are reset there.
+    void CameraHal::releaseAllPreviewFrames()
+    {
+        Mutex::Autolock lock(mPreviewCbLock);
+        mPreviewHeldNum = 0;
     }
 
 
@@ -43,6 +43,7 @@
 #include "CaptureDeviceInterface.h"
 #include "JpegEncoderInterface.h"
 #include "messageQueue.h"
+#include "camera_trace.h"
 
 
 #define EXIF_MAKENOTE "fsl_makernote"
@@ -73,6 +74,55 @@
 
 #define MAX_VPU_SUPPORT_FORMAT 2
 
+//Zero-copy preview callbacks, enabled by "preview-callback-zero-copy=true".
+//The client gets the capture buffer itself and gives it back with
+//sendCommand(CAMERA_CMD_RELEASE_PREVIEW_FRAME, frame, 0), where frame
+//numbers the preview callbacks from 0 at startPreview, copied ones
+//included. The buffer only goes back to V4L2 once released; while the
+//client holds PREVIEW_CALLBACK_MAX_HELD frames the callbacks are copies.
+#define CAMERA_PARAM_PREVIEW_ZERO_COPY "preview-callback-zero-copy"
+#define CAMERA_CMD_RELEASE_PREVIEW_FRAME 0x1000
+#define PREVIEW_CALLBACK_MAX_HELD 2
+
+//Zero shutter lag capture, enabled by "zsl=on" when picture-size is also
+//the preview-size; otherwise takePicture stops preview as usual. The
+//newest ZSL_RING_FRAMES preview frames are kept, so
+//takePicture encodes the frame nearest the shutter without stopping
+//preview. The ring holds references on the capture buffers only; the
+//frames it keeps are the ones the preview window still shows, so it
+//does not take buffers from the driver.
+//"burst-capture-count=N" makes takePicture deliver N pictures: the
+//following frames of the ring in ZSL mode, consecutive frames of one
+//capture stream otherwise. sendCommand(CAMERA_CMD_START_BURST_CAPTURE,
+//N, 0) starts a burst and CAMERA_CMD_STOP_BURST_CAPTURE ends it early.
+#define CAMERA_PARAM_ZSL "zsl"
+#define CAMERA_PARAM_ZSL_VALUES "zsl-values"
+#define CAMERA_PARAM_BURST_COUNT "burst-capture-count"
+#define CAMERA_PARAM_MAX_BURST_COUNT "max-burst-capture-count"
+#define CAMERA_CMD_START_BURST_CAPTURE 0x1001
+#define CAMERA_CMD_STOP_BURST_CAPTURE 0x1002
+#define ZSL_RING_FRAMES 2
+#define MAX_BURST_COUNT 16
+#define ZSL_FRAME_TIMEOUT ms2ns(1000)
+
+//Recording buffers. With storeMetaDataInBuffers(true) every video frame
+//is a VIDEOFRAME_BUFFER_PHY naming the capture buffer, which stays with
+//the encoder until releaseRecordingFrame; no more than the capture
+//buffers less VIDEO_CAPTURE_RESERVED are handed out so capture and
+//preview keep running. Otherwise frames are copied into a pool sized at
+//startRecording from the encoder latency seen by the last recording,
+//between VIDEO_MIN_BUFFER_NUM and VIDEO_OUTPUT_BUFFER_NUM buffers.
+//A frame that finds no buffer is dropped and counted as starved.
+#define VIDEO_MIN_BUFFER_NUM 3
+#define VIDEO_CAPTURE_RESERVED 2
+
+//The formats and sizes enumerated from a sensor are kept for the life of
+//the process, keyed by sensor name, and reused by the next open as long
+//as the device reports the same version string (see GetDevVersion).
+//"camera.caps.cache=0" turns the cache off.
+#define CAMERA_CAPS_CACHE_PROP "camera.caps.cache"
+#define MAX_CAPS_CACHE_ENTRY 4
+
 namespace android {
 
     typedef enum{
@@ -244,6 +294,8 @@ namespace android {
         void  FreeInterBuf();
         CAMERA_HAL_RET InitCameraHalParam();
         CAMERA_HAL_RET InitCameraBaseParam(CameraParameters *pParam);
+        bool LoadCachedCaps(const char *version, int *pFmtCnt);
+        void StoreCachedCaps(const char *version, int fmtCnt);
         CAMERA_HAL_RET InitPictureExifParam(CameraParameters *pParam);
         CAMERA_HAL_RET CameraMiscInit();
         CAMERA_HAL_RET CameraMiscDeInit();
@@ -255,6 +307,8 @@ namespace android {
         int previewshowFrameThreadWrapper();
         int encodeframeThreadWrapper();
         status_t AllocateRecordVideoBuf();
+        int getVideoSlot(unsigned int index, camera_memory_t **memory, unsigned char **data);
+        void putVideoMemory(camera_memory_t *memory);
 
         status_t CameraHALStartPreview();
         void     CameraHALStopPreview();
@@ -273,9 +327,20 @@ namespace android {
         int GetJpegEncoderParam();
         int NegotiateCaptureFmt(bool TakePicFlag);
         int cameraHALTakePicture();
+        int cameraHALTakeZslPicture();
+        status_t startTakePicture(int count);
+        void pushZslFrame(unsigned int index, nsecs_t timestamp);
+        int grabZslFrame(nsecs_t shutter, nsecs_t *last, size_t size);
+        void releaseZslFrames();
+        void sendPictureNotify(DMA_BUFFER *pBuf);
         void CameraHALStopMisc();
         int PrepareJpegEncoder();
-        void convertNV12toYUV420SP(uint8_t *inputBuffer, uint8_t *outputBuffer, int width, int height);
+        void sendPreviewFrame(unsigned int index);
+        void dumpFrameQueue(int fd, const char *name, const CFrameQueue &frames) const;
+        void dumpFrameTrace(int fd) const;
+        bool holdPreviewFrame(unsigned int index, unsigned int frame);
+        status_t releasePreviewFrame(unsigned int frame);
+        void releaseAllPreviewFrames();
 
         int stringTodegree(char* cAttribute, unsigned int &degree, unsigned int &minute, unsigned int &second);
 
@@ -295,6 +360,8 @@ namespace android {
         CMessageQueue mCaptureThreadQueue;
         CMessageQueue mPreviewThreadQueue;
         CMessageQueue mEncodeThreadQueue;
+        CFrameQueue mPreviewFrameQueue;
+        CFrameQueue mEncodeFrameQueue;
 
         //For capture thread(queue/dequeue with v4l2 driver)
         mutable Mutex mCaptureLock;
@@ -317,6 +384,21 @@ namespace android {
         mutable sem_t mTakingPicture;
         bool mWaitForTakingPicture;
         bool mTakePictureInProcess;
+        int mBurstCount;
+        bool mBurstStop;
+        nsecs_t mShutterTime;
+
+        /* zero shutter lag ring, oldest frame first, guarded by mZslLock */
+        bool                mZslEnabled;
+        mutable Mutex       mZslLock;
+        Condition           mZslCond;
+        CFrame              mZslFrames[ZSL_RING_FRAMES];
+        unsigned int        mZslFrameNum;
+        bool                mZslCopying;
+        unsigned char      *mZslBuf;
+        unsigned int        mZslBufSize;
+        unsigned int        mZslPictures;
+        nsecs_t             mZslShutterLag;
 
         CameraParameters    mParameters;
         void               *mCallbackCookie;
@@ -351,11 +433,47 @@ namespace android {
 
         camera_memory_t* mPreviewMemory;
 
-        /* the buffer for recorder */
+        /* zero-copy preview callbacks, one wrapper per capture buffer */
+        bool                mPreviewZeroCopy;
+        unsigned int        mPreviewCallbackFormat;
+        camera_memory_t*    mPreviewBufMemory[PREVIEW_CAPTURE_BUFFER_NUM];
+        struct {
+            unsigned int    frame;      //callback number the client releases
+            unsigned int    index;      //capture buffer
+        }                   mPreviewHeld[PREVIEW_CALLBACK_MAX_HELD];
+        unsigned int        mPreviewHeldNum;
+        unsigned int        mPreviewFrameNum;   //callbacks since startPreview
+
+        /* frame copy statistics for dump(), guarded by mPreviewCbLock */
+        mutable Mutex       mPreviewCbLock;
+        nsecs_t             mStatsStartTime;
+        uint64_t            mPreviewCopyBytes;
+        uint64_t            mVideoCopyBytes;
+        unsigned int        mPreviewCopyFrames;
+        unsigned int        mPreviewZeroCopyFrames;
+
+        /* per frame timing, reset with the statistics above */
+        struct camera_trace mFrameTrace;
+
+        /* the buffer for recorder, guarded by mEncodeLock. In metadata mode
+         * buffer i describes capture buffer i. The encode thread sends its
+         * frame from mVideoMemoryInUse outside the lock; a pool replaced
+         * meanwhile is kept in mVideoMemoryRetired until it is done */
         unsigned int        mVideoBufNume;
         camera_memory_t* mVideoMemory;
+        camera_memory_t* mVideoMemoryInUse;
+        camera_memory_t* mVideoMemoryRetired;
+        unsigned int        mVideoBufSize;
+        bool                mVideoMetaData;
         int       mVideoBufferUsing[VIDEO_OUTPUT_BUFFER_NUM];
 		VIDEOFRAME_BUFFER_PHY mVideoBufferPhy[VIDEO_OUTPUT_BUFFER_NUM];
+        nsecs_t             mVideoSendTime[VIDEO_OUTPUT_BUFFER_NUM];
+        uint32_t            mVideoTraceFrame[VIDEO_OUTPUT_BUFFER_NUM];
+        unsigned int        mVideoFrames;
+        unsigned int        mVideoStarved;
+        unsigned int        mVideoLatencyFrames;
+        nsecs_t             mVideoLatencyTotal;
+        nsecs_t             mVideoLatencyMax;
 
         unsigned int        mDefaultPreviewFormat;
         unsigned int 		mPreviewFrameSize;
@@ -395,6 +513,11 @@ namespace android {
 
         unsigned int mVpuSupportFmt[MAX_VPU_SUPPORT_FORMAT];
         CAMERA_TYPE mSensorType;
+
+        /* open to first frame timing, logged once per open */
+        nsecs_t mOpenTime;
+        bool mCapsCached;
+        bool mFirstFrameLogged;
     };
 
 }; // namespace android
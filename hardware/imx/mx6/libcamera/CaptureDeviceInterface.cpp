@@ -19,10 +19,15 @@
  */
 #include "V4l2UVCDevice.h"
 #include "V4l2CsiDevice.h"
+#include "V4l2FileDevice.h"
 namespace android{
     extern "C" sp<CaptureDeviceInterface> createCaptureDevice(const char *deviceName, const char *devPath)
     {
-        if(strstr(deviceName, UVC_NAME_STRING)){
+        if(!strncmp(deviceName, FILE_NAME_STRING, strlen(FILE_NAME_STRING))){
+            sp<CaptureDeviceInterface>  device(new V4l2FileDevice());
+            device->SetDevName(deviceName, devPath);
+            return device;
+        }else if(strstr(deviceName, UVC_NAME_STRING)){
             sp<CaptureDeviceInterface>  device(new V4l2UVCDevice());
             device->SetDevName(deviceName, devPath);
             return device;
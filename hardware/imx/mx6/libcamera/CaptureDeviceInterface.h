@@ -28,10 +28,12 @@
 #define CAMAERA_FILENAME_LENGTH     256
 #define MAX_CAPTURE_BUF_QUE_NUM     6
 #define CAMERA_SENSOR_LENGTH       32
+#define CAMERA_DEV_VERSION_LENGTH  192
 #define MAX_DEQUEUE_WAIT_TIME  (5000)  //5000ms for uvc camera
 
 namespace android {
 #define UVC_NAME_STRING "uvc"
+#define FILE_NAME_STRING "file"
 
     typedef enum{
         CAPTURE_DEVICE_ERR_ALRADY_OPENED  = 3,
@@ -56,6 +58,7 @@ namespace android {
     typedef enum{
         CAMERA_TYPE_CSI = 0,
         CAMERA_TYPE_UVC = 1,
+        CAMERA_TYPE_FILE = 2,
     }CAMERA_TYPE;
 
     typedef enum{
@@ -106,6 +109,9 @@ namespace android {
         virtual CAPTURE_DEVICE_RET DevDeAllocate()=0;
         virtual CAPTURE_DEVICE_RET DevClose()=0;
         virtual CAPTURE_DEVICE_RET GetDevType(CAMERA_TYPE *pType)=0;
+        //a string that changes whenever the enumerated capabilities may
+        //change, fails if they can not be cached for this device.
+        virtual CAPTURE_DEVICE_RET GetDevVersion(char *version, unsigned int len)=0;
 
         virtual ~ CaptureDeviceInterface(){}
     };
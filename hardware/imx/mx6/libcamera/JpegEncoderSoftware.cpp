@@ -32,27 +32,49 @@
 #include <sys/stat.h>
 #include <utils/threads.h>
 #include <dirent.h>
+#include <cutils/properties.h>
 
 #include "JpegEncoderSoftware.h"
+#include "camera_csc.h"
 
 namespace android{
 
-    JPEG_ENC_UINT32 JpegEncoderSoftware::g_JpegDataSize = 0;//Total size of g_JpegData
-    JPEG_ENC_UINT32 JpegEncoderSoftware::g_JpegDataLen = 0;//Valid data len of g_JpegData
-    JPEG_ENC_UINT8 *JpegEncoderSoftware::g_JpegData = NULL;//Buffer to hold jpeg data
-
     JpegEncoderSoftware :: JpegEncoderSoftware()
         :mSupportedTypeIdx(0),
         pEncCfgLocal(NULL),
-        pEncObj(NULL)
+        mEncThreads(1),
+        mThumbBuf(NULL),
+        mThumbBufSize(0),
+        mSliceSrc(NULL),
+        mSliceRows(0),
+        mSliceExif(0),
+        mSliceNum(0),
+        mSliceNext(0),
+        mSliceDone(0),
+        mSliceExit(false),
+        mSliceThreadNum(0)
     {
         mSupportedType[0] = v4l2_fourcc('Y','U','1','2');
         mSupportedType[1] = v4l2_fourcc('Y','U','Y','V');
+        memset(&mSerialCtx, 0, sizeof(mSerialCtx));
+        memset(mSliceCtx, 0, sizeof(mSliceCtx));
     }
 
     JpegEncoderSoftware :: ~JpegEncoderSoftware()
     {
-
+        stopSliceThreads();
+        JpegEncoderDeInit();
+
+        freeContext(&mSerialCtx);
+        for (int i = 0; i < JPEG_ENC_MAX_SLICES; i++) {
+            if (mSliceCtx[i] != NULL) {
+                freeContext(mSliceCtx[i]);
+                free(mSliceCtx[i]);
+                mSliceCtx[i] = NULL;
+            }
+        }
+        free(mThumbBuf);
+        mThumbBuf = NULL;
     }
 
     JPEG_ENC_ERR_RET  JpegEncoderSoftware :: EnumJpegEncParam(JPEEG_QUERY_TYPE QueryType, void * pQueryRet)
@@ -87,11 +109,27 @@ namespace android{
         struct jpeg_enc_model_info_t *pModelInfo = NULL;
         struct jpeg_enc_datetime_info_t *pDatetimeInfo = NULL;
         struct jpeg_enc_gps_param *pGpsInfoLocal = NULL;
+        char value[PROPERTY_VALUE_MAX];
+        int threads;
 
         if(pEncCfg == NULL){
             return JPEG_ENC_ERROR_BAD_PARAM;
         }
 
+        //the config of the previous shot
+        if (pEncCfgLocal != NULL)
+            JpegEncoderDeInit();
+
+        property_get(JPEG_ENC_THREADS_PROPERTY, value, "0");
+        threads = atoi(value);
+        if (threads <= 0)
+            threads = sysconf(_SC_NPROCESSORS_ONLN);
+        if (threads < 1)
+            threads = 1;
+        if (threads > JPEG_ENC_MAX_THREADS)
+            threads = JPEG_ENC_MAX_THREADS;
+        mEncThreads = threads;
+
         pEncCfgLocal = (enc_cfg_param *)malloc(sizeof(enc_cfg_param));
 
         if (pEncCfgLocal == NULL){
@@ -191,6 +229,7 @@ namespace android{
 INT_ERR_RET:
         if(pEncCfgLocal)
             free(pEncCfgLocal);
+        pEncCfgLocal = NULL;
         if(pFoclLength)
             free(pFoclLength);
         if(pMakeInfo)
@@ -233,6 +272,7 @@ INT_ERR_RET:
             if (pEncCfgLocal->pGps_info != NULL)
                 free(pEncCfgLocal->pGps_info);
             free(pEncCfgLocal);
+            pEncCfgLocal = NULL;
         }
 
         return ret;
@@ -274,290 +314,545 @@ INT_ERR_RET:
         CAMERA_LOG_FUNC;
 
         JPEG_ENC_ERR_RET ret = JPEG_ENC_ERROR_NONE;
-        int width, height, size,index;
-        JPEG_ENC_UINT8 * i_buff = NULL;
-        JPEG_ENC_UINT8 * y_buff = NULL;
-        JPEG_ENC_UINT8 * u_buff = NULL;
-        JPEG_ENC_UINT8 * v_buff = NULL;
-        JPEG_ENC_RET_TYPE return_val;
-        jpeg_enc_parameters * params = NULL;
-        jpeg_enc_object * obj_ptr = NULL;
-        JPEG_ENC_UINT8 number_mem_info;
-        jpeg_enc_memory_info * mem_info = NULL;
-        unsigned char *thumbnail_buffer,*temp_buffer=NULL;
-        int thumbnail_width, thumbnail_height;
         unsigned char *buffer = inBuf->virt_start;
+        JPEG_ENC_UINT8 *out = outBuf->virt_start;
+        JPEG_ENC_UINT32 size = pEncCfgLocal->PicWidth * pEncCfgLocal->PicHeight * 3 / 2;
 
-        bool mEncodeThumbnailFlag = true;
-
-        width = pEncCfgLocal->PicWidth;
-        height = pEncCfgLocal->PicHeight;
+        if(!out)
+        {
+            return JPEG_ENC_ERROR_BAD_PARAM;
+        }
 
-        thumbnail_width = pEncCfgLocal->ThumbWidth;
-        thumbnail_height = pEncCfgLocal->ThumbHeight;
+        if (mEncThreads > 1) {
+            ret = encodeSlices(buffer, out, size, pEncSize);
+            if (ret == JPEG_ENC_ERROR_NONE)
+                return ret;
+            CAMERA_LOG_INFO("slice encoding failed, encode on one thread");
+        }
 
+        return encodeSerial(buffer, out, size, pEncSize);
+    }
 
-        if (thumbnail_width <= 0 || thumbnail_height<= 0)
-            mEncodeThumbnailFlag = false;
+    JPEG_ENC_ERR_RET JpegEncoderSoftware::encodeSerial(unsigned char *buffer, JPEG_ENC_UINT8 *out,
+            JPEG_ENC_UINT32 outSize, unsigned int *pEncSize)
+    {
+        JPEG_ENC_ERR_RET ret = JPEG_ENC_ERROR_NONE;
+        JpegEncContext *ctx = &mSerialCtx;
+        JPEG_ENC_MODE mode = JPEG_ENC_MAIN_ONLY;
 
-        g_JpegDataSize = 0;//Total size of g_JpegData
-        g_JpegDataLen = 0;//Valid data len of g_JpegData
-        g_JpegData = NULL;//Buffer to hold jpeg data
-        size = width * height * 3 / 2;
+        ctx->outBuf = out;
+        ctx->outSize = outSize;
+        ctx->outLen = 0;
 
-        g_JpegData = outBuf->virt_start;
-        g_JpegDataSize = size;
-        if(!g_JpegData)
-        {
-            return JPEG_ENC_ERROR_BAD_PARAM;
-        }
-
-        /* --------------------------------------------
-         * Allocate memory for Encoder Object
-         * -------------------------------------------*/
-        obj_ptr = (jpeg_enc_object *) malloc(sizeof(jpeg_enc_object));
-        if(!obj_ptr)
-        {
-            return JPEG_ENC_ERROR_ALOC_BUF;
+        if (pEncCfgLocal->ThumbWidth > 0 && pEncCfgLocal->ThumbHeight > 0) {
+            if ((ret = encodeThumbnail(ctx, buffer)) != JPEG_ENC_ERROR_NONE)
+                return ret;
+            //the main picture follows the thumbnail in the same output
+            mode = JPEG_ENC_MAIN;
         }
-        memset(obj_ptr, 0, sizeof(jpeg_enc_object));
 
-        /* Assign the function for streaming output */
-        obj_ptr->jpeg_enc_push_output = pushJpegOutput;
-        obj_ptr->context=NULL;   //user can put private variables into it
-        /* --------------------------------------------
-         * Fill up the parameter structure of JPEG Encoder
-         * -------------------------------------------*/
-        params = &(obj_ptr->parameters);
+        ret = encodePicture(ctx, mode, 1, buffer, pEncCfgLocal->PicWidth, pEncCfgLocal->PicHeight,
+                0, pEncCfgLocal->PicHeight);
+        if (ret != JPEG_ENC_ERROR_NONE)
+            return ret;
 
-        if(mEncodeThumbnailFlag==true)
-        {
+        CAMERA_LOG_RUNTIME("jpeg_enc_encodeframe success");
+        *pEncSize = ctx->outLen;
+        return ret;
+    }
 
-            //need resizing code here!!!
-            thumbnail_buffer = (unsigned char *)malloc(thumbnail_width * thumbnail_height * 3 / 2);
-            if(!thumbnail_buffer)
-            {
+    JPEG_ENC_ERR_RET JpegEncoderSoftware::encodeThumbnail(JpegEncContext *ctx, unsigned char *buffer)
+    {
+        unsigned int width = pEncCfgLocal->ThumbWidth;
+        unsigned int height = pEncCfgLocal->ThumbHeight;
+        unsigned int size = width * height * 3 / 2;
+
+        if (size > mThumbBufSize) {
+            free(mThumbBuf);
+            mThumbBufSize = 0;
+            mThumbBuf = (unsigned char *)malloc(size);
+            if (!mThumbBuf)
                 return JPEG_ENC_ERROR_ALOC_BUF;
-            }
+            mThumbBufSize = size;
+        }
 
-            yuv_resize((unsigned char *)thumbnail_buffer, thumbnail_width, thumbnail_height, buffer, width, height);
+        yuv_resize(mThumbBuf, width, height, buffer, pEncCfgLocal->PicWidth, pEncCfgLocal->PicHeight);
 
-            width = thumbnail_width;
-            height = thumbnail_height;
+        return encodePicture(ctx, JPEG_ENC_THUMB, 1, mThumbBuf, width, height, 0, height);
+    }
 
-            temp_buffer = buffer;
-            buffer = thumbnail_buffer;
+    /*
+     * Encode rows [top, top + rows) of a width x height frame, appending to
+     * ctx->outBuf. The slices are encoded as pictures of their own, so every
+     * plane pointer is moved to the first row of the slice.
+     */
+    JPEG_ENC_ERR_RET JpegEncoderSoftware::encodePicture(JpegEncContext *ctx, JPEG_ENC_MODE mode, int exif,
+            unsigned char *buffer, int width, int height, int top, int rows)
+    {
+        jpeg_enc_object *obj_ptr = &ctx->obj;
+        jpeg_enc_parameters *params = &obj_ptr->parameters;
+        jpeg_enc_memory_info *mem_info = NULL;
+        JPEG_ENC_UINT8 * i_buff = NULL;
+        JPEG_ENC_UINT8 * y_buff = NULL;
+        JPEG_ENC_UINT8 * u_buff = NULL;
+        JPEG_ENC_UINT8 * v_buff = NULL;
+        JPEG_ENC_RET_TYPE return_val;
+        JPEG_ENC_UINT8 number_mem_info;
+        int index;
 
-            params->mode = JPEG_ENC_THUMB;
-        }
-        else
-        {
-            params->mode = JPEG_ENC_MAIN_ONLY;
-        }
+        memset(obj_ptr, 0, sizeof(jpeg_enc_object));
 
-encodeframe:
+        /* Assign the function for streaming output */
+        obj_ptr->jpeg_enc_push_output = pushJpegOutput;
+        obj_ptr->context = ctx;
 
+        params->mode = mode;
         params->compression_method = JPEG_ENC_SEQUENTIAL;
         params->quality = 75;
         params->restart_markers = 0;
-        if (pEncCfgLocal->BufFmt == v4l2_fourcc('Y','U','1','2')){
-            params->y_width = width;
-            params->y_height = height;
-            params->u_width = params->y_width/2;
+        params->y_width = width;
+        params->y_height = rows;
+        params->u_width = params->y_width/2;
+        params->v_width = params->y_width/2;
+        //yuv_resize() always leaves the thumbnail planar
+        if (pEncCfgLocal->BufFmt == v4l2_fourcc('Y','U','1','2') || mode == JPEG_ENC_THUMB){
             params->u_height = params->y_height/2;
-            params->v_width = params->y_width/2;
             params->v_height = params->y_height/2;
-            params->primary_image_height = height;
-            params->primary_image_width = width;
             params->yuv_format = JPEG_ENC_YUV_420_NONINTERLEAVED;
-        }else if (pEncCfgLocal->BufFmt == v4l2_fourcc('Y','U','Y','V')){
-            params->y_width = width;
-            params->y_height = height;
-            params->u_width = params->y_width/2;
+            y_buff = (JPEG_ENC_UINT8 *)buffer + top*width;
+            u_buff = (JPEG_ENC_UINT8 *)buffer + width*height + top/2*width/2;
+            v_buff = (JPEG_ENC_UINT8 *)buffer + width*height*5/4 + top/2*width/2;
+        }else {
             params->u_height = params->y_height;
-            params->v_width = params->y_width/2;
             params->v_height = params->y_height;
-            params->primary_image_height = height;
-            params->primary_image_width = width;
             params->yuv_format = JPEG_ENC_YU_YV_422_INTERLEAVED;
+            i_buff = (JPEG_ENC_UINT8 *)buffer + top*width*2;
         }
-        params->exif_flag = 1;
-
-        params->y_left = 0;
-        params->y_top = 0;
-        params->y_total_width = 0;
-        params->y_total_height = 0;
-        params->raw_dat_flag= 0;
-
-        if(params->y_total_width==0)
-        {
-            params->y_left=0;
-            params->u_left=0;
-            params->v_left=0;
-            params->y_total_width=params->y_width;  // no cropping
-            params->u_total_width=params->u_width;  // no cropping
-            params->v_total_width=params->v_width;  // no cropping
+        //Only the thumbnail is smaller than the primary image
+        if (mode == JPEG_ENC_THUMB) {
+            params->primary_image_width = width;
+            params->primary_image_height = height;
+        }else {
+            params->primary_image_width = pEncCfgLocal->PicWidth;
+            params->primary_image_height = pEncCfgLocal->PicHeight;
         }
+        params->exif_flag = exif;
+        params->raw_dat_flag= 0;
 
-        if(params->y_total_height==0)
-        {
-            params->y_top=0;
-            params->u_top=0;
-            params->v_top=0;
-            params->y_total_height=params->y_height; // no cropping
-            params->u_total_height=params->u_height; // no cropping
-            params->v_total_height=params->v_height; // no cropping
-        }
+        /* no cropping */
+        params->y_left=0;
+        params->u_left=0;
+        params->v_left=0;
+        params->y_top=0;
+        params->u_top=0;
+        params->v_top=0;
+        params->y_total_width=params->y_width;
+        params->u_total_width=params->u_width;
+        params->v_total_width=params->v_width;
+        params->y_total_height=params->y_height;
+        params->u_total_height=params->u_height;
+        params->v_total_height=params->v_height;
 
         /* Pixel size is unknown by default */
         params->jfif_params.density_unit = 0;
         /* Pixel aspect ratio is square by default */
         params->jfif_params.X_density = 1;
         params->jfif_params.Y_density = 1;
-        if (params->yuv_format == JPEG_ENC_YUV_420_NONINTERLEAVED){
-            y_buff = (JPEG_ENC_UINT8 *)buffer;
-            u_buff = y_buff+width*height;
-            v_buff = u_buff+width*height/4;
-            i_buff = NULL;
-        }else if (params->yuv_format == JPEG_ENC_YU_YV_422_INTERLEAVED){
-            y_buff = NULL;
-            u_buff = NULL;
-            v_buff = NULL;
-            i_buff = (JPEG_ENC_UINT8 *)buffer;
-        }
         CAMERA_LOG_RUNTIME("version: %s\n", jpege_CodecVersionInfo());
 
         /* --------------------------------------------
          * QUERY MEMORY REQUIREMENTS
          * -------------------------------------------*/
         return_val = jpeg_enc_query_mem_req(obj_ptr);
-
         if(return_val != JPEG_ENC_ERR_NO_ERROR)
         {
-            CAMERA_LOG_RUNTIME("JPEG encoder returned an error when jpeg_enc_query_mem_req was called \n");
-            CAMERA_LOG_RUNTIME("Return Val %d\n",return_val);
-            goto done;
+            CAMERA_LOG_ERR("jpeg_enc_query_mem_req failed: %d", return_val);
+            return JPEG_ENC_ERROR_BAD_PARAM;
         }
-        CAMERA_LOG_RUNTIME("jpeg_enc_query_mem_req success");
+
         /* --------------------------------------------
-         * ALLOCATE MEMORY REQUESTED BY CODEC
+         * MEMORY REQUESTED BY CODEC, kept from earlier shots if it is big enough
          * -------------------------------------------*/
         number_mem_info = obj_ptr->mem_infos.no_entries;
         for(index = 0; index < number_mem_info; index++)
         {
-            /* This example code ignores the 'alignment' and
-             * 'memory_type', but some other applications might want
-             * to allocate memory based on them */
             mem_info = &(obj_ptr->mem_infos.mem_info[index]);
-            mem_info->memptr = (void *) malloc(mem_info->size);
-            if(mem_info->memptr==NULL) {
-                CAMERA_LOG_RUNTIME("Malloc error after query\n");
-                goto done;
+            if (mem_info->size > ctx->memSize[index]) {
+                free(ctx->mem[index]);
+                ctx->memSize[index] = 0;
+                ctx->mem[index] = malloc(mem_info->size);
+                if (ctx->mem[index] == NULL) {
+                    CAMERA_LOG_ERR("Malloc error after query");
+                    return JPEG_ENC_ERROR_ALOC_BUF;
+                }
+                ctx->memSize[index] = mem_info->size;
             }
+            mem_info->memptr = ctx->mem[index];
         }
 
         return_val = jpeg_enc_init(obj_ptr);
         if(return_val != JPEG_ENC_ERR_NO_ERROR)
         {
-            CAMERA_LOG_RUNTIME("JPEG encoder returned an error when jpeg_enc_init was called \n");
-            CAMERA_LOG_RUNTIME("Return Val %d\n",return_val);
-            goto done;
+            CAMERA_LOG_ERR("jpeg_enc_init failed: %d", return_val);
+            return JPEG_ENC_ERROR_BAD_PARAM;
         }
 
-        CAMERA_LOG_RUNTIME("jpeg_enc_init success");
-        if(params->mode == JPEG_ENC_THUMB)
+        if(mode == JPEG_ENC_THUMB)
             createJpegExifTags(obj_ptr);
 
-        return_val = jpeg_enc_encodeframe(obj_ptr, i_buff,
-                y_buff, u_buff, v_buff);
-
+        return_val = jpeg_enc_encodeframe(obj_ptr, i_buff, y_buff, u_buff, v_buff);
         if(return_val != JPEG_ENC_ERR_ENCODINGCOMPLETE)
         {
-            CAMERA_LOG_RUNTIME("JPEG encoder returned an error in jpeg_enc_encodeframe \n");
-            CAMERA_LOG_RUNTIME("Return Val %d\n",return_val);
-            goto done;
+            CAMERA_LOG_ERR("jpeg_enc_encodeframe failed: %d", return_val);
+            return JPEG_ENC_ERROR_BAD_PARAM;
         }
 
-        if(params->mode == JPEG_ENC_THUMB)
+        if(mode == JPEG_ENC_THUMB)
         {
-            JPEG_ENC_UINT8 num_entries;
-            JPEG_ENC_UINT32 *offset_tbl_ptr = (JPEG_ENC_UINT32 *)malloc(sizeof(JPEG_ENC_UINT32)*JPEG_ENC_NUM_OF_OFFSETS);
-            JPEG_ENC_UINT8 *value_tbl_ptr = (JPEG_ENC_UINT8 *)malloc(sizeof(JPEG_ENC_UINT8)*JPEG_ENC_NUM_OF_OFFSETS);
-
-            jpeg_enc_find_length_position(obj_ptr, offset_tbl_ptr,value_tbl_ptr,&num_entries);
+            JPEG_ENC_UINT8 num_entries = 0;
+            JPEG_ENC_UINT32 offset_tbl[JPEG_ENC_NUM_OF_OFFSETS];
+            JPEG_ENC_UINT8 value_tbl[JPEG_ENC_NUM_OF_OFFSETS];
 
+            jpeg_enc_find_length_position(obj_ptr, offset_tbl, value_tbl, &num_entries);
             for(int i = 0; i < num_entries; i++)
             {
-                *((JPEG_ENC_UINT8 *)g_JpegData+offset_tbl_ptr[i]) = value_tbl_ptr[i];
+                ctx->outBuf[offset_tbl[i]] = value_tbl[i];
             }
+        }
 
-            free(offset_tbl_ptr);
-            free(value_tbl_ptr);
+        return JPEG_ENC_ERROR_NONE;
+    }
 
-            free(buffer);
+    /* ------------------------------------------------------------------------
+     * Slice parallel encoding
+     *
+     * The picture is cut into bands of whole MCU rows that are encoded as
+     * separate pictures on the slice threads, while the calling thread
+     * encodes the thumbnail. Every band starts its DC prediction from zero,
+     * which is exactly what a restart marker does, so the entropy coded
+     * data of the bands joined by RSTn markers under one header, with a DRI
+     * of one band, is the full picture. The codec always uses the same
+     * tables for the same quality; that is checked and any difference falls
+     * back to the single threaded encoder.
+     * ----------------------------------------------------------------------*/
+
+    //Marker layout of a baseline picture as written by the codec
+    struct JpegLayout {
+        JPEG_ENC_UINT32 appEnd;     //end of SOI and the APPn/COM segments
+        JPEG_ENC_UINT32 sofOffset;  //SOFn, one of the tables
+        JPEG_ENC_UINT32 sosStart;   //end of the tables
+        JPEG_ENC_UINT32 sosEnd;     //start of the entropy coded data
+        JPEG_ENC_UINT32 dataEnd;    //EOI
+    };
+
+    static bool parseJpegLayout(const JPEG_ENC_UINT8 *buf, JPEG_ENC_UINT32 len, JpegLayout *layout)
+    {
+        JPEG_ENC_UINT32 pos = 2;
+        bool tables = false;
+
+        memset(layout, 0, sizeof(JpegLayout));
+        if (len < 4 || buf[0] != 0xff || buf[1] != 0xd8)
+            return false;
+        layout->appEnd = 2;
+
+        while (pos + 4 <= len && buf[pos] == 0xff) {
+            JPEG_ENC_UINT8 marker = buf[pos + 1];
+            JPEG_ENC_UINT32 seglen = (buf[pos + 2] << 8) | buf[pos + 3];
+
+            if (pos + 2 + seglen > len)
+                return false;
+
+            if (marker == 0xda) {
+                layout->sosStart = pos;
+                layout->sosEnd = pos + 2 + seglen;
+                layout->dataEnd = len - 2;
+                return tables && layout->sofOffset != 0 && layout->sosEnd <= layout->dataEnd &&
+                    buf[len - 2] == 0xff && buf[len - 1] == 0xd9;
+            }
 
-            number_mem_info = obj_ptr->mem_infos.no_entries;
-            for(index = 0; index < number_mem_info; index++)
-            {
-                mem_info = &(obj_ptr->mem_infos.mem_info[index]);
-                if(mem_info)
-                    free(mem_info->memptr);
+            if ((marker >= 0xe0 && marker <= 0xef) || marker == 0xfe) {
+                if (tables)
+                    return false;
+                layout->appEnd = pos + 2 + seglen;
+            }else if (marker == 0xdd) {
+                //restart markers are ours to place
+                return false;
+            }else {
+                tables = true;
+                if (marker == 0xc0 || marker == 0xc1)
+                    layout->sofOffset = pos;
             }
+            pos += 2 + seglen;
+        }
 
-            g_JpegData += g_JpegDataLen;
-            g_JpegDataSize -= g_JpegDataLen;
+        return false;
+    }
 
+    //End of SOI and the APPn segments, which is all the thumbnail pass writes
+    //ahead of the main picture.
+    static JPEG_ENC_UINT32 jpegAppEnd(const JPEG_ENC_UINT8 *buf, JPEG_ENC_UINT32 len)
+    {
+        JPEG_ENC_UINT32 pos = 2;
 
-            //recover to build the main jpeg
-            params->mode = JPEG_ENC_MAIN;
+        if (len < 2 || buf[0] != 0xff || buf[1] != 0xd8)
+            return 0;
 
-            buffer = temp_buffer;
-            width = pEncCfgLocal->PicWidth;
-            height = pEncCfgLocal->PicHeight;
+        while (pos + 4 <= len && buf[pos] == 0xff &&
+                ((buf[pos + 1] >= 0xe0 && buf[pos + 1] <= 0xef) || buf[pos + 1] == 0xfe)) {
+            JPEG_ENC_UINT32 seglen = (buf[pos + 2] << 8) | buf[pos + 3];
+            if (pos + 2 + seglen > len)
+                break;
+            pos += 2 + seglen;
+        }
+        return pos;
+    }
+
+    //Same tables and scan header, apart from the height in SOF
+    static bool sameJpegTables(const JPEG_ENC_UINT8 *a, const JpegLayout *la,
+            const JPEG_ENC_UINT8 *b, const JpegLayout *lb)
+    {
+        JPEG_ENC_UINT32 sof = la->sofOffset - la->appEnd;
 
-            goto encodeframe;
+        if (la->sosEnd - la->appEnd != lb->sosEnd - lb->appEnd ||
+                lb->sofOffset - lb->appEnd != sof)
+            return false;
+
+        a += la->appEnd;
+        b += lb->appEnd;
+        return memcmp(a, b, sof + 5) == 0 &&
+            memcmp(a + sof + 7, b + sof + 7, la->sosEnd - la->sofOffset - 7) == 0;
+    }
+
+    JPEG_ENC_ERR_RET JpegEncoderSoftware::encodeSlices(unsigned char *buffer, JPEG_ENC_UINT8 *out,
+            JPEG_ENC_UINT32 outSize, unsigned int *pEncSize)
+    {
+        JPEG_ENC_ERR_RET ret = JPEG_ENC_ERROR_NONE;
+        JpegLayout layout[JPEG_ENC_MAX_SLICES];
+        int width = pEncCfgLocal->PicWidth;
+        int height = pEncCfgLocal->PicHeight;
+        int mcuHeight = (pEncCfgLocal->BufFmt == v4l2_fourcc('Y','U','1','2')) ? 16 : 8;
+        int mcuCols = (width + 15) / 16;
+        int mcuRows = (height + mcuHeight - 1) / mcuHeight;
+        int sliceMcuRows = (mcuRows + mEncThreads - 1) / mEncThreads;
+        bool thumb = pEncCfgLocal->ThumbWidth > 0 && pEncCfgLocal->ThumbHeight > 0;
+        JPEG_ENC_UINT32 sliceBufSize, pos, interval;
+        int num, i;
+
+        //DRI holds the MCUs of one slice in 16 bits
+        if (sliceMcuRows * mcuCols > 0xffff)
+            sliceMcuRows = 0xffff / mcuCols;
+        if (sliceMcuRows == 0)
+            return JPEG_ENC_ERROR_BAD_PARAM;
+        num = (mcuRows + sliceMcuRows - 1) / sliceMcuRows;
+        if (num < 2 || num > JPEG_ENC_MAX_SLICES)
+            return JPEG_ENC_ERROR_BAD_PARAM;
+        interval = sliceMcuRows * mcuCols;
+
+        //raw size of a slice is more than the codec writes for it at this quality,
+        //plus room for the headers
+        sliceBufSize = width * sliceMcuRows * mcuHeight * 2 + 65536;
+        for (i = 0; i < num; i++) {
+            if (mSliceCtx[i] == NULL) {
+                mSliceCtx[i] = (JpegEncContext *)calloc(1, sizeof(JpegEncContext));
+                if (mSliceCtx[i] == NULL)
+                    return JPEG_ENC_ERROR_ALOC_BUF;
+            }
+            if (mSliceCtx[i]->sliceBufSize < sliceBufSize) {
+                free(mSliceCtx[i]->sliceBuf);
+                mSliceCtx[i]->sliceBufSize = 0;
+                mSliceCtx[i]->sliceBuf = (JPEG_ENC_UINT8 *)malloc(sliceBufSize);
+                if (mSliceCtx[i]->sliceBuf == NULL)
+                    return JPEG_ENC_ERROR_ALOC_BUF;
+                mSliceCtx[i]->sliceBufSize = sliceBufSize;
+            }
         }
-        CAMERA_LOG_RUNTIME("jpeg_enc_encodeframe success");
-        // Make an IMemory for each frame
-        //jpegPtr = new MemoryBase(mJpegImageHeap, 0, g_JpegDataLen);
-        *pEncSize = g_JpegDataLen;
 
-done:
-        /* --------------------------------------------
-         * FREE MEMORY REQUESTED BY CODEC
-         * -------------------------------------------*/
-        if(obj_ptr)
-        {
-            number_mem_info = obj_ptr->mem_infos.no_entries;
-            for(index = 0; index < number_mem_info; index++)
-            {
-                mem_info = &(obj_ptr->mem_infos.mem_info[index]);
-                if(mem_info)
-                    free(mem_info->memptr);
+        startSliceThreads();
+
+        mSliceLock.lock();
+        mSliceSrc = buffer;
+        mSliceRows = sliceMcuRows * mcuHeight;
+        mSliceExif = !thumb;
+        mSliceNum = num;
+        mSliceNext = 0;
+        mSliceDone = 0;
+        mSliceCond.broadcast();
+        mSliceLock.unlock();
+
+        //the thumbnail and its EXIF header go straight to the output
+        mSerialCtx.outBuf = out;
+        mSerialCtx.outSize = outSize;
+        mSerialCtx.outLen = 0;
+        if (thumb)
+            ret = encodeThumbnail(&mSerialCtx, buffer);
+
+        runSlices();
+        mSliceLock.lock();
+        while (mSliceDone < mSliceNum)
+            mSliceDoneCond.wait(mSliceLock);
+        mSliceNum = 0;
+        mSliceLock.unlock();
+
+        if (ret != JPEG_ENC_ERROR_NONE)
+            return ret;
+
+        for (i = 0; i < num; i++) {
+            JpegEncContext *ctx = mSliceCtx[i];
+            if (mSliceRet[i] != JPEG_ENC_ERROR_NONE)
+                return mSliceRet[i];
+            if (!parseJpegLayout(ctx->outBuf, ctx->outLen, &layout[i]) ||
+                    !sameJpegTables(mSliceCtx[0]->outBuf, &layout[0], ctx->outBuf, &layout[i])) {
+                CAMERA_LOG_ERR("%s: slice %d can not be joined", __FUNCTION__, i);
+                return JPEG_ENC_ERROR_BAD_PARAM;
             }
-            free(obj_ptr);
         }
 
-        return ret;
+        //header: SOI and EXIF from the thumbnail pass or from the first slice
+        if (thumb) {
+            pos = jpegAppEnd(out, mSerialCtx.outLen);
+            if (pos == 0)
+                return JPEG_ENC_ERROR_BAD_PARAM;
+        }else {
+            pos = layout[0].appEnd;
+            if (pos > outSize)
+                return JPEG_ENC_ERROR_BAD_PARAM;
+            memcpy(out, mSliceCtx[0]->outBuf, pos);
+        }
+
+        //tables with the full height, DRI and the scan header of the first slice
+        JPEG_ENC_UINT32 tables = layout[0].sosStart - layout[0].appEnd;
+        JPEG_ENC_UINT32 sof = pos + layout[0].sofOffset - layout[0].appEnd;
+        JPEG_ENC_UINT32 sos = layout[0].sosEnd - layout[0].sosStart;
+        if (pos + tables + 6 + sos > outSize)
+            return JPEG_ENC_ERROR_BAD_PARAM;
+        memcpy(out + pos, mSliceCtx[0]->outBuf + layout[0].appEnd, tables);
+        out[sof + 5] = height >> 8;
+        out[sof + 6] = height & 0xff;
+        pos += tables;
+        out[pos++] = 0xff;
+        out[pos++] = 0xdd;
+        out[pos++] = 0;
+        out[pos++] = 4;
+        out[pos++] = interval >> 8;
+        out[pos++] = interval & 0xff;
+        memcpy(out + pos, mSliceCtx[0]->outBuf + layout[0].sosStart, sos);
+        pos += sos;
+
+        for (i = 0; i < num; i++) {
+            JPEG_ENC_UINT32 len = layout[i].dataEnd - layout[i].sosEnd;
+            if (pos + len + 2 > outSize)
+                return JPEG_ENC_ERROR_BAD_PARAM;
+            memcpy(out + pos, mSliceCtx[i]->outBuf + layout[i].sosEnd, len);
+            pos += len;
+            out[pos++] = 0xff;
+            out[pos++] = (i == num - 1) ? 0xd9 : 0xd0 + (i & 7);
+        }
+
+        CAMERA_LOG_RUNTIME("jpeg encoded in %d slices of %d rows, %d bytes", num, mSliceRows, pos);
+        *pEncSize = pos;
+        return JPEG_ENC_ERROR_NONE;
+    }
+
+    void JpegEncoderSoftware::encodeSlice(int slice)
+    {
+        JpegEncContext *ctx = mSliceCtx[slice];
+        int height = pEncCfgLocal->PicHeight;
+        int top = slice * mSliceRows;
+        int rows = height - top < mSliceRows ? height - top : mSliceRows;
+
+        ctx->outBuf = ctx->sliceBuf;
+        ctx->outSize = ctx->sliceBufSize;
+        ctx->outLen = 0;
+        mSliceRet[slice] = encodePicture(ctx, JPEG_ENC_MAIN_ONLY, (slice == 0 && mSliceExif) ? 1 : 0,
+                mSliceSrc, pEncCfgLocal->PicWidth, height, top, rows);
+    }
+
+    //Encode slices until none is left, on the calling thread
+    void JpegEncoderSoftware::runSlices()
+    {
+        mSliceLock.lock();
+        while (mSliceNext < mSliceNum) {
+            int slice = mSliceNext++;
+            mSliceLock.unlock();
+            encodeSlice(slice);
+            mSliceLock.lock();
+            if (++mSliceDone == mSliceNum)
+                mSliceDoneCond.broadcast();
+        }
+        mSliceLock.unlock();
+    }
+
+    bool JpegEncoderSoftware::sliceThreadLoop()
+    {
+        mSliceLock.lock();
+        while (!mSliceExit && mSliceNext >= mSliceNum)
+            mSliceCond.wait(mSliceLock);
+        bool exit = mSliceExit;
+        mSliceLock.unlock();
+
+        if (exit)
+            return false;
+        runSlices();
+        return true;
+    }
+
+    int JpegEncoderSoftware::startSliceThreads()
+    {
+        while (mSliceThreadNum < mEncThreads - 1) {
+            sp<SliceThread> thread = new SliceThread(this);
+            if (thread->run("JpegSliceThread", PRIORITY_DISPLAY) != NO_ERROR) {
+                CAMERA_LOG_ERR("%s: can not start slice thread %d", __FUNCTION__, mSliceThreadNum);
+                break;
+            }
+            mSliceThreads[mSliceThreadNum++] = thread;
+        }
+        return mSliceThreadNum;
+    }
+
+    void JpegEncoderSoftware::stopSliceThreads()
+    {
+        mSliceLock.lock();
+        mSliceExit = true;
+        mSliceCond.broadcast();
+        mSliceLock.unlock();
+
+        for (int i = 0; i < mSliceThreadNum; i++) {
+            mSliceThreads[i]->requestExitAndWait();
+            mSliceThreads[i].clear();
+        }
+        mSliceThreadNum = 0;
+    }
+
+    void JpegEncoderSoftware::freeContext(JpegEncContext *ctx)
+    {
+        for (int i = 0; i < JPEG_ENC_MAX_MEMORY_INFO_ENTRIES; i++) {
+            free(ctx->mem[i]);
+            ctx->mem[i] = NULL;
+            ctx->memSize[i] = 0;
+        }
+        free(ctx->sliceBuf);
+        ctx->sliceBuf = NULL;
+        ctx->sliceBufSize = 0;
     }
 
     JPEG_ENC_UINT8 JpegEncoderSoftware::pushJpegOutput(JPEG_ENC_UINT8 ** out_buf_ptrptr,JPEG_ENC_UINT32 *out_buf_len_ptr,
             JPEG_ENC_UINT8 flush, void * context, JPEG_ENC_MODE enc_mode)
     {
-        JPEG_ENC_UINT32 i;
+        JpegEncContext *ctx = (JpegEncContext *)context;
+
         if(*out_buf_ptrptr == NULL)
         {
             /* This function is called for the 1'st time from the
              * codec */
-            *out_buf_ptrptr = g_JpegData;
-            *out_buf_len_ptr = g_JpegDataSize;
+            *out_buf_ptrptr = ctx->outBuf + ctx->outLen;
+            *out_buf_len_ptr = ctx->outSize - ctx->outLen;
         }
 
         else if(flush == 1)
         {
             /* Flush the buffer*/
-            g_JpegDataLen += *out_buf_len_ptr;
-            CAMERA_LOG_RUNTIME("jpeg output data len %d",(int)g_JpegDataLen);
+            ctx->outLen += *out_buf_len_ptr;
+            CAMERA_LOG_RUNTIME("jpeg output data len %d",(int)ctx->outLen);
 
             *out_buf_ptrptr = NULL;
             *out_buf_len_ptr = NULL;
@@ -598,59 +893,7 @@ done:
 
     int JpegEncoderSoftware::yuv_resize(unsigned char *dst_ptr, int dst_width, int dst_height, unsigned char *src_ptr, int src_width, int src_height)
     {
-        int i,j,s;
-        int h_offset;
-        int v_offset;
-        unsigned char *ptr,cc;
-        int h_scale_ratio;
-        int v_scale_ratio;
-
-        s = 0;
-
-_resize_begin:
-
-        if(!dst_width) return -1;
-        if(!dst_height) return -1;
-
-        h_scale_ratio = src_width / dst_width;
-        if(!h_scale_ratio) return -1;
-
-        v_scale_ratio = src_height / dst_height;
-        if(!v_scale_ratio) return -1;
-
-        h_offset = (src_width - dst_width * h_scale_ratio) / 2;
-        v_offset = (src_height - dst_height * v_scale_ratio) / 2;
-
-        for(i = 0; i < dst_height * v_scale_ratio; i += v_scale_ratio)
-        {
-            for(j = 0; j < dst_width * h_scale_ratio; j += h_scale_ratio)
-            {
-                ptr = src_ptr + i * src_width + j + v_offset * src_width + h_offset;
-                cc = ptr[0];
-
-                ptr = dst_ptr + (i / v_scale_ratio) * dst_width + (j / h_scale_ratio);
-                ptr[0] = cc;
-            }
-        }
-
-        src_ptr += src_width*src_height;
-        dst_ptr += dst_width*dst_height;
-
-        if(s < 2)
-        {
-            if(!s++)
-            {
-                src_width >>= 1;
-                src_height >>= 1;
-
-                dst_width >>= 1;
-                dst_height >>= 1;
-            }
-
-            goto _resize_begin;
-        }
-
-        return 0;
+        return camera_csc_resize_i420(dst_ptr, dst_width, dst_height, src_ptr, src_width, src_height);
     }
 
     sp<JpegEncoderInterface> JpegEncoderSoftware::createInstance(){
@@ -34,6 +34,7 @@
 #include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <utils/threads.h>
 
 #include "JpegEncoderInterface.h"
 #include "jpeg_enc_interface.h"
@@ -42,6 +43,30 @@
 namespace android{
 #define MAX_ENC_SUPPORTED_YUV_TYPE  2
 
+//Slice parallel encoding, see encodeSlices(). The thread count comes from
+//the camera.jpeg.threads property and defaults to the online cores; 1
+//keeps the single threaded encoder.
+#define JPEG_ENC_THREADS_PROPERTY   "camera.jpeg.threads"
+#define JPEG_ENC_MAX_THREADS        4
+#define JPEG_ENC_MAX_SLICES         16
+
+    //One codec instance. It is kept across shots and the memory the codec
+    //asks for is only reallocated when a request grows.
+    struct JpegEncContext {
+        jpeg_enc_object obj;
+        void *mem[JPEG_ENC_MAX_MEMORY_INFO_ENTRIES];
+        JPEG_ENC_UINT32 memSize[JPEG_ENC_MAX_MEMORY_INFO_ENTRIES];
+
+        //Where pushJpegOutput writes, and how much it wrote
+        JPEG_ENC_UINT8 *outBuf;
+        JPEG_ENC_UINT32 outSize;
+        JPEG_ENC_UINT32 outLen;
+
+        //Private output of a slice
+        JPEG_ENC_UINT8 *sliceBuf;
+        JPEG_ENC_UINT32 sliceBufSize;
+    };
+
     class JpegEncoderSoftware : public JpegEncoderInterface{
     public:
         virtual  JPEG_ENC_ERR_RET  EnumJpegEncParam(JPEEG_QUERY_TYPE QueryType, void * pQueryRet);
@@ -52,12 +77,33 @@ namespace android{
         static sp<JpegEncoderInterface>createInstance();
     private:
 
+        class SliceThread : public Thread {
+            JpegEncoderSoftware* mEncoder;
+        public:
+            SliceThread(JpegEncoderSoftware* encoder)
+                : Thread(false), mEncoder(encoder) { }
+            virtual bool threadLoop() {
+                return mEncoder->sliceThreadLoop();
+            }
+        };
+
         JpegEncoderSoftware();
         virtual ~JpegEncoderSoftware();
 
         virtual JPEG_ENC_ERR_RET CheckEncParm();
         virtual JPEG_ENC_ERR_RET encodeImge(DMA_BUFFER *inBuf, DMA_BUFFER *outBuf, unsigned int *pEncSize);
 
+        JPEG_ENC_ERR_RET encodeSerial(unsigned char *buffer, JPEG_ENC_UINT8 *out, JPEG_ENC_UINT32 outSize, unsigned int *pEncSize);
+        JPEG_ENC_ERR_RET encodeSlices(unsigned char *buffer, JPEG_ENC_UINT8 *out, JPEG_ENC_UINT32 outSize, unsigned int *pEncSize);
+        JPEG_ENC_ERR_RET encodeThumbnail(JpegEncContext *ctx, unsigned char *buffer);
+        JPEG_ENC_ERR_RET encodePicture(JpegEncContext *ctx, JPEG_ENC_MODE mode, int exif,
+                unsigned char *buffer, int width, int height, int top, int rows);
+        void encodeSlice(int slice);
+        bool sliceThreadLoop();
+        void runSlices();
+        int startSliceThreads();
+        void stopSliceThreads();
+        void freeContext(JpegEncContext *ctx);
 
         static JPEG_ENC_UINT8 pushJpegOutput(JPEG_ENC_UINT8 ** out_buf_ptrptr,
                 JPEG_ENC_UINT32 *out_buf_len_ptr,
@@ -71,13 +117,27 @@ namespace android{
         unsigned int mSupportedType[MAX_ENC_SUPPORTED_YUV_TYPE];
         unsigned int mSupportedTypeIdx;
         enc_cfg_param *pEncCfgLocal;
-        jpeg_enc_object *pEncObj;
-
-
-        static JPEG_ENC_UINT32 g_JpegDataSize ;//Total size of g_JpegData
-        static JPEG_ENC_UINT32 g_JpegDataLen ;//Valid data len of g_JpegData
-        static JPEG_ENC_UINT8 *g_JpegData ;//Buffer to hold jpeg data
-
+        int mEncThreads;
+
+        JpegEncContext mSerialCtx;
+        unsigned char *mThumbBuf;
+        unsigned int mThumbBufSize;
+
+        //Slice job, set up by encodeSlices() and read by the slice threads
+        JpegEncContext *mSliceCtx[JPEG_ENC_MAX_SLICES];
+        JPEG_ENC_ERR_RET mSliceRet[JPEG_ENC_MAX_SLICES];
+        unsigned char *mSliceSrc;
+        int mSliceRows;
+        int mSliceExif;
+        int mSliceNum;
+        int mSliceNext;
+        int mSliceDone;
+        bool mSliceExit;
+        Mutex mSliceLock;
+        Condition mSliceCond;
+        Condition mSliceDoneCond;
+        sp<SliceThread> mSliceThreads[JPEG_ENC_MAX_THREADS - 1];
+        int mSliceThreadNum;
     };
 };
 
@@ -92,6 +92,16 @@ namespace android{
         return CAPTURE_DEVICE_ERR_NONE;
     }
 
+    CAPTURE_DEVICE_RET V4l2CapDeviceBase::GetDevVersion(char *version, unsigned int len)
+    {
+        CAMERA_LOG_FUNC;
+        if(mCameraDevice <= 0)
+            return CAPTURE_DEVICE_ERR_OPEN;
+        if(version == NULL || len == 0)
+            return CAPTURE_DEVICE_ERR_BAD_PARAM;
+        return V4l2QueryVersion(version, len);
+    }
+
     CAPTURE_DEVICE_RET V4l2CapDeviceBase::EnumDevParam(DevParamType devParamType, void *retParam){
         CAPTURE_DEVICE_RET ret = CAPTURE_DEVICE_ERR_NONE;
         CAMERA_LOG_FUNC;
@@ -712,4 +722,25 @@ namespace android{
         return CAPTURE_DEVICE_ERR_NONE;
     }
 
+    CAPTURE_DEVICE_RET V4l2CapDeviceBase :: V4l2QueryVersion(char *version, unsigned int len){
+
+        CAMERA_LOG_FUNC;
+        struct v4l2_capability v4l2_cap;
+        struct stat st;
+
+        memset(&v4l2_cap, 0, sizeof(v4l2_cap));
+        if (ioctl(mCameraDevice, VIDIOC_QUERYCAP, &v4l2_cap) < 0 ||
+                fstat(mCameraDevice, &st) < 0){
+            CAMERA_LOG_ERR("%s: query the device failed", __FUNCTION__);
+            return CAPTURE_DEVICE_ERR_SYS_CALL;
+        }
+        //the node is created again when the device is plugged again, so
+        //its change time tells a replug apart from a plain reopen.
+        snprintf(version, len, "%s:%s:%s:%x:%llx:%lx",
+                (char *)v4l2_cap.driver, (char *)v4l2_cap.card,
+                (char *)v4l2_cap.bus_info, v4l2_cap.version,
+                (unsigned long long)st.st_rdev, (long)st.st_ctime);
+        return CAPTURE_DEVICE_ERR_NONE;
+    }
+
 };
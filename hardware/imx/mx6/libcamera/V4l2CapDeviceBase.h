@@ -31,6 +31,7 @@ namespace android{
         virtual CAPTURE_DEVICE_RET SetDevName(const char * deviceName, const char *devPath = NULL);
         virtual CAPTURE_DEVICE_RET GetDevName(char * deviceName);
         virtual CAPTURE_DEVICE_RET GetDevType(CAMERA_TYPE *pType);
+        virtual CAPTURE_DEVICE_RET GetDevVersion(char *version, unsigned int len);
         virtual CAPTURE_DEVICE_RET DevOpen(int cameraId);
         virtual CAPTURE_DEVICE_RET EnumDevParam(DevParamType devParamType, void *retParam);
         virtual CAPTURE_DEVICE_RET DevSetConfig(struct capture_config_t *pCapcfg);
@@ -62,6 +63,7 @@ namespace android{
         virtual CAPTURE_DEVICE_RET V4l2Stop();
         virtual CAPTURE_DEVICE_RET V4l2DeAlloc();
         virtual CAPTURE_DEVICE_RET V4l2Close();
+        virtual CAPTURE_DEVICE_RET V4l2QueryVersion(char *version, unsigned int len);
         virtual CAPTURE_DEVICE_RET V4l2ConfigInput(struct capture_config_t *pCapcfg);
         virtual CAPTURE_DEVICE_RET V4l2GetCaptureMode(struct capture_config_t *pCapcfg, unsigned int *pMode);
         virtual CAPTURE_DEVICE_RET V4l2SetRot(struct capture_config_t *pCapcfg);
@@ -0,0 +1,397 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Copyright 2009-2012 Freescale Semiconductor, Inc.
+ */
+
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <utils/Timers.h>
+#include <cutils/properties.h>
+
+#include "V4l2FileDevice.h"
+#include "camera_csc.h"
+
+namespace android {
+
+V4l2FileDevice::V4l2FileDevice()
+    : mClip(NULL),
+    mClipLength(0),
+    mClipFormat(0),
+    mClipWidth(0),
+    mClipHeight(0),
+    mClipFps(FILE_CAMERA_DEFAULT_FPS),
+    mClipFrameSize(0),
+    mClipFrames(0),
+    mClipPos(0),
+    mOutputFmtCnt(0),
+    mOutputFrameSize(0),
+    mFramePeriod(0),
+    mNextFrameTime(0),
+    mQueueHead(0),
+    mStreaming(false)
+{
+    mCameraType = CAMERA_TYPE_FILE;
+    memset(mOutputFmt, 0, sizeof(mOutputFmt));
+    memset(mQueue, 0, sizeof(mQueue));
+}
+
+V4l2FileDevice::~V4l2FileDevice()
+{
+    if (mClip != NULL)
+        munmap(mClip, mClipLength);
+    if (mCameraDevice > 0)
+        close(mCameraDevice);
+}
+
+bool V4l2FileDevice::canOutput(unsigned int format)
+{
+    return format == mClipFormat || camera_csc_find(mClipFormat, format) != NULL;
+}
+
+CAPTURE_DEVICE_RET V4l2FileDevice::V4l2Open(int cameraId)
+{
+    CAMERA_LOG_FUNC;
+    char value[PROPERTY_VALUE_MAX];
+    const unsigned int candidates[] = {
+        v4l2_fourcc('N','V','1','2'),
+        v4l2_fourcc('Y','U','1','2'),
+        v4l2_fourcc('Y','U','Y','V'),
+    };
+    struct stat st;
+    int fd;
+
+    if (mCameraDevice > 0)
+        return CAPTURE_DEVICE_ERR_ALRADY_OPENED;
+
+    //a device path from the camera list wins over the property
+    if (mCaptureDeviceName[0] == '#')
+        property_get(FILE_CAMERA_PATH, mCaptureDeviceName, FILE_CAMERA_DEFAULT_PATH);
+
+    property_get(FILE_CAMERA_FORMAT, value, "nv12");
+    if (!strcmp(value, "yuyv"))
+        mClipFormat = v4l2_fourcc('Y','U','Y','V');
+    else if (!strcmp(value, "i420"))
+        mClipFormat = v4l2_fourcc('Y','U','1','2');
+    else if (!strcmp(value, "nv12"))
+        mClipFormat = v4l2_fourcc('N','V','1','2');
+    else {
+        CAMERA_LOG_ERR("%s: unknown clip format %s", __FUNCTION__, value);
+        return CAPTURE_DEVICE_ERR_OPEN;
+    }
+
+    property_get(FILE_CAMERA_SIZE, value, "640x480");
+    if (sscanf(value, "%ux%u", &mClipWidth, &mClipHeight) != 2 ||
+            mClipWidth == 0 || mClipHeight == 0 || (mClipWidth | mClipHeight) & 1) {
+        CAMERA_LOG_ERR("%s: bad clip size %s", __FUNCTION__, value);
+        return CAPTURE_DEVICE_ERR_OPEN;
+    }
+
+    property_get(FILE_CAMERA_FPS, value, "");
+    mClipFps = atoi(value);
+    if (mClipFps == 0 || mClipFps > 120)
+        mClipFps = FILE_CAMERA_DEFAULT_FPS;
+
+    mClipFrameSize = camera_csc_frame_size(mClipFormat, mClipWidth, mClipHeight);
+
+    fd = open(mCaptureDeviceName, O_RDONLY);
+    if (fd < 0) {
+        CAMERA_LOG_ERR("%s: open %s failed: %s", __FUNCTION__, mCaptureDeviceName, strerror(errno));
+        return CAPTURE_DEVICE_ERR_OPEN;
+    }
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < mClipFrameSize) {
+        CAMERA_LOG_ERR("%s: %s holds no %ux%u frame", __FUNCTION__, mCaptureDeviceName,
+                mClipWidth, mClipHeight);
+        close(fd);
+        return CAPTURE_DEVICE_ERR_OPEN;
+    }
+    mClipFrames = st.st_size / mClipFrameSize;
+    mClipLength = mClipFrames * mClipFrameSize;
+    mClip = (unsigned char *)mmap(NULL, mClipLength, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mClip == MAP_FAILED) {
+        CAMERA_LOG_ERR("%s: mmap %s failed: %s", __FUNCTION__, mCaptureDeviceName, strerror(errno));
+        mClip = NULL;
+        close(fd);
+        return CAPTURE_DEVICE_ERR_OPEN;
+    }
+    madvise(mClip, mClipLength, MADV_SEQUENTIAL);
+    mClipPos = 0;
+
+    //the clip's own format first, then what the csc library converts it to
+    mOutputFmtCnt = 0;
+    mOutputFmt[mOutputFmtCnt++] = mClipFormat;
+    for (unsigned int i = 0; i < sizeof(candidates) / sizeof(candidates[0]); i++) {
+        if (candidates[i] != mClipFormat && canOutput(candidates[i]) &&
+                mOutputFmtCnt < MAX_FILE_OUTPUT_FMT)
+            mOutputFmt[mOutputFmtCnt++] = candidates[i];
+    }
+
+    mCameraDevice = fd;
+    CAMERA_LOG_INFO("clip %s: %ux%u %c%c%c%c, %u frames at %u fps", mCaptureDeviceName,
+            mClipWidth, mClipHeight, mClipFormat & 0xFF, (mClipFormat >> 8) & 0xFF,
+            (mClipFormat >> 16) & 0xFF, (mClipFormat >> 24) & 0xFF, mClipFrames, mClipFps);
+    return CAPTURE_DEVICE_ERR_NONE;
+}
+
+CAPTURE_DEVICE_RET V4l2FileDevice::V4l2EnumFmt(void *retParam)
+{
+    CAMERA_LOG_FUNC;
+    unsigned int *pParamVal = (unsigned int *)retParam;
+
+    if (mFmtParamIdx >= mOutputFmtCnt) {
+        mFmtParamIdx = 0;
+        return CAPTURE_DEVICE_ERR_GET_PARAM;
+    }
+    *pParamVal = mOutputFmt[mFmtParamIdx++];
+    return CAPTURE_DEVICE_ERR_ENUM_CONTINUE;
+}
+
+CAPTURE_DEVICE_RET V4l2FileDevice::V4l2EnumSizeFps(void *retParam)
+{
+    CAMERA_LOG_FUNC;
+    struct capture_config_t *pCapCfg = (struct capture_config_t *)retParam;
+
+    //one size, the clip's
+    if (mSizeFPSParamIdx > 0) {
+        mSizeFPSParamIdx = 0;
+        return CAPTURE_DEVICE_ERR_SET_PARAM;
+    }
+    pCapCfg->width = mClipWidth;
+    pCapCfg->height = mClipHeight;
+    pCapCfg->tv.numerator = 1;
+    pCapCfg->tv.denominator = mClipFps;
+    mSizeFPSParamIdx ++;
+    return CAPTURE_DEVICE_ERR_ENUM_CONTINUE;
+}
+
+CAPTURE_DEVICE_RET V4l2FileDevice::V4l2SetConfig(struct capture_config_t *pCapcfg)
+{
+    CAMERA_LOG_FUNC;
+    unsigned int fps;
+
+    if (mCameraDevice <= 0 || pCapcfg == NULL)
+        return CAPTURE_DEVICE_ERR_BAD_PARAM;
+
+    if (pCapcfg->width != mClipWidth || pCapcfg->height != mClipHeight) {
+        CAMERA_LOG_ERR("%s: %ux%u requested, the clip is %ux%u", __FUNCTION__,
+                pCapcfg->width, pCapcfg->height, mClipWidth, mClipHeight);
+        return CAPTURE_DEVICE_ERR_SET_PARAM;
+    }
+    if (!canOutput(pCapcfg->fmt)) {
+        CAMERA_LOG_ERR(" Set the Format :%c%c%c%c\n",
+                pCapcfg->fmt & 0xFF, (pCapcfg->fmt >> 8) & 0xFF,
+                (pCapcfg->fmt >> 16) & 0xFF, (pCapcfg->fmt >> 24) & 0xFF);
+        return CAPTURE_DEVICE_ERR_SET_PARAM;
+    }
+
+    //never faster than the clip was made for, like a sensor mode
+    fps = pCapcfg->tv.numerator ? pCapcfg->tv.denominator / pCapcfg->tv.numerator : 0;
+    if (fps == 0 || fps > mClipFps)
+        fps = mClipFps;
+    mFramePeriod = 1000000000LL / fps;
+
+    mOutputFrameSize = camera_csc_frame_size(pCapcfg->fmt, mClipWidth, mClipHeight);
+    pCapcfg->framesize = mOutputFrameSize;
+    pCapcfg->picture_waite_number = 1;
+    CAMERA_LOG_RUNTIME("file device: %ux%u at %u fps, frame size %u", mClipWidth, mClipHeight,
+            fps, (unsigned int)mOutputFrameSize);
+
+    return CAPTURE_DEVICE_ERR_NONE;
+}
+
+CAPTURE_DEVICE_RET V4l2FileDevice::V4l2AllocateBuf(DMA_BUFFER *DevBufQue, unsigned int *pBufQueNum)
+{
+    CAMERA_LOG_ERR("%s: the file device only fills registered buffers", __FUNCTION__);
+    return CAPTURE_DEVICE_ERR_ALLOCATE_BUF;
+}
+
+CAPTURE_DEVICE_RET V4l2FileDevice::V4l2RegisterBufs(DMA_BUFFER *DevBufQue, unsigned int *pBufQueNum)
+{
+    CAMERA_LOG_FUNC;
+    if (mCameraDevice <= 0 || DevBufQue == NULL || pBufQueNum == NULL || *pBufQueNum == 0)
+        return CAPTURE_DEVICE_ERR_BAD_PARAM;
+
+    mBufQueNum = *pBufQueNum;
+    if (mBufQueNum > MAX_CAPTURE_BUF_QUE_NUM)
+        *pBufQueNum = mBufQueNum = MAX_CAPTURE_BUF_QUE_NUM;
+
+    for (unsigned int i = 0; i < mBufQueNum; i++) {
+        mCaptureBuffers[i].virt_start = DevBufQue[i].virt_start;
+        mCaptureBuffers[i].phy_offset = DevBufQue[i].phy_offset;
+        mCaptureBuffers[i].length = DevBufQue[i].length;
+        if (mCaptureBuffers[i].length < mOutputFrameSize) {
+            CAMERA_LOG_ERR("%s: buffer %u holds %u bytes, a frame is %u", __FUNCTION__,
+                    i, mCaptureBuffers[i].length, (unsigned int)mOutputFrameSize);
+            return CAPTURE_DEVICE_ERR_BAD_PARAM;
+        }
+    }
+    return CAPTURE_DEVICE_ERR_NONE;
+}
+
+CAPTURE_DEVICE_RET V4l2FileDevice::V4l2Prepare()
+{
+    CAMERA_LOG_FUNC;
+    Mutex::Autolock lock(mQueueLock);
+
+    mQueueHead = 0;
+    for (unsigned int i = 0; i < mBufQueNum; i++)
+        mQueue[i] = i;
+    mQueuedBufNum = mBufQueNum;
+    return CAPTURE_DEVICE_ERR_NONE;
+}
+
+CAPTURE_DEVICE_RET V4l2FileDevice::V4l2Start()
+{
+    CAMERA_LOG_FUNC;
+    Mutex::Autolock lock(mQueueLock);
+
+    mStreaming = true;
+    mNextFrameTime = systemTime(SYSTEM_TIME_MONOTONIC);
+    return CAPTURE_DEVICE_ERR_NONE;
+}
+
+//Sleep until the next frame is due; a late caller restarts the cadence
+//from now, the way a sensor drops the frames nobody dequeued
+void V4l2FileDevice::waitFrameTime()
+{
+    nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+    struct timespec ts;
+
+    if (mNextFrameTime > now) {
+        ts.tv_sec = mNextFrameTime / 1000000000LL;
+        ts.tv_nsec = mNextFrameTime % 1000000000LL;
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+            ;
+        mNextFrameTime += mFramePeriod;
+    }
+    else if (now - mNextFrameTime > mFramePeriod)
+        mNextFrameTime = now + mFramePeriod;
+    else
+        mNextFrameTime += mFramePeriod;
+}
+
+CAPTURE_DEVICE_RET V4l2FileDevice::V4l2Dequeue(unsigned int *pBufQueIdx)
+{
+    unsigned int index;
+    DMA_BUFFER *pBuf;
+    const unsigned char *pFrame;
+
+    mQueueLock.lock();
+    while (mStreaming && mQueuedBufNum == 0) {
+        if (mQueueCond.waitRelative(mQueueLock, ms2ns(MAX_DEQUEUE_WAIT_TIME)) == TIMED_OUT) {
+            mQueueLock.unlock();
+            CAMERA_LOG_INFO("Warning!Time out wait for the file device to get a buffer!");
+            return CAPTURE_DEVICE_ERR_OPT_TIMEOUT;
+        }
+    }
+    if (!mStreaming) {
+        mQueueLock.unlock();
+        return CAPTURE_DEVICE_ERR_SYS_CALL;
+    }
+    index = mQueue[mQueueHead];
+    mQueueHead = (mQueueHead + 1) % MAX_CAPTURE_BUF_QUE_NUM;
+    mQueuedBufNum --;
+    mQueueLock.unlock();
+
+    //only this thread dequeues, the pacing and clip position need no lock
+    waitFrameTime();
+    pBuf = &mCaptureBuffers[index];
+    pFrame = mClip + (size_t)mClipPos * mClipFrameSize;
+    if (mCapCfg.fmt == mClipFormat)
+        memcpy(pBuf->virt_start, pFrame, mClipFrameSize);
+    else
+        camera_csc_convert(mClipFormat, mCapCfg.fmt, pFrame, pBuf->virt_start,
+                mClipWidth, mClipHeight);
+    mClipPos = (mClipPos + 1) % mClipFrames;
+
+    *pBufQueIdx = index;
+    return CAPTURE_DEVICE_ERR_NONE;
+}
+
+CAPTURE_DEVICE_RET V4l2FileDevice::V4l2Queue(unsigned int BufQueIdx)
+{
+    Mutex::Autolock lock(mQueueLock);
+
+    if (BufQueIdx >= mBufQueNum || mQueuedBufNum >= (int)mBufQueNum)
+        return CAPTURE_DEVICE_ERR_BAD_PARAM;
+    mQueue[(mQueueHead + mQueuedBufNum) % MAX_CAPTURE_BUF_QUE_NUM] = BufQueIdx;
+    mQueuedBufNum ++;
+    mQueueCond.signal();
+    return CAPTURE_DEVICE_ERR_NONE;
+}
+
+CAPTURE_DEVICE_RET V4l2FileDevice::V4l2Stop()
+{
+    CAMERA_LOG_FUNC;
+    Mutex::Autolock lock(mQueueLock);
+
+    mStreaming = false;
+    mQueuedBufNum = 0;
+    mQueueHead = 0;
+    mQueueCond.broadcast();
+    return CAPTURE_DEVICE_ERR_NONE;
+}
+
+CAPTURE_DEVICE_RET V4l2FileDevice::V4l2DeAlloc()
+{
+    CAMERA_LOG_FUNC;
+    //the buffers belong to the HAL, just forget them
+    for (unsigned int i = 0; i < mBufQueNum; i++) {
+        mCaptureBuffers[i].virt_start = NULL;
+        mCaptureBuffers[i].length = 0;
+    }
+    mBufQueNum = 0;
+    return CAPTURE_DEVICE_ERR_NONE;
+}
+
+CAPTURE_DEVICE_RET V4l2FileDevice::V4l2Close()
+{
+    CAMERA_LOG_FUNC;
+    if (mCameraDevice <= 0)
+        return CAPTURE_DEVICE_ERR_BAD_PARAM;
+
+    if (mClip != NULL) {
+        munmap(mClip, mClipLength);
+        mClip = NULL;
+    }
+    close(mCameraDevice);
+    mCameraDevice = -1;
+    return CAPTURE_DEVICE_ERR_NONE;
+}
+
+CAPTURE_DEVICE_RET V4l2FileDevice::V4l2QueryVersion(char *version, unsigned int len)
+{
+    CAMERA_LOG_FUNC;
+    struct stat st;
+
+    if (fstat(mCameraDevice, &st) < 0)
+        return CAPTURE_DEVICE_ERR_SYS_CALL;
+    //a new clip or new clip properties change what is enumerated
+    snprintf(version, len, "file:%s:%llx:%lx:%x:%ux%u@%u", mCaptureDeviceName,
+            (unsigned long long)st.st_size, (long)st.st_mtime,
+            mClipFormat, mClipWidth, mClipHeight, mClipFps);
+    return CAPTURE_DEVICE_ERR_NONE;
+}
+
+};
@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Copyright 2009-2012 Freescale Semiconductor, Inc.
+ */
+#ifndef V4L2_FILE_DEVICE_H
+#define V4L2_FILE_DEVICE_H
+
+#include <linux/videodev2.h>
+#include <utils/threads.h>
+#include "V4l2CapDeviceBase.h"
+
+//the clip, raw frames back to back, is described by these properties
+#define FILE_CAMERA_PATH    "camera.file.path"
+#define FILE_CAMERA_FORMAT  "camera.file.format"    //nv12, i420 or yuyv
+#define FILE_CAMERA_SIZE    "camera.file.size"      //WIDTHxHEIGHT
+#define FILE_CAMERA_FPS     "camera.file.fps"
+#define FILE_CAMERA_DEFAULT_PATH    "/data/camera/clip.yuv"
+#define FILE_CAMERA_DEFAULT_FPS     30
+#define MAX_FILE_OUTPUT_FMT 3
+
+namespace android{
+
+/*
+ * Stand-in for a sensor that plays a raw clip mapped from a file. Frames
+ * are handed out in the buffers registered by the HAL at the configured
+ * frame rate and the clip loops, so the HAL runs its real pipeline with
+ * no capture hardware. Selected with a camera name starting with "file".
+ */
+class V4l2FileDevice : public V4l2CapDeviceBase{
+public:
+    V4l2FileDevice();
+    virtual ~V4l2FileDevice();
+
+protected:
+    CAPTURE_DEVICE_RET V4l2Open(int cameraId);
+    CAPTURE_DEVICE_RET V4l2EnumFmt(void *retParam);
+    CAPTURE_DEVICE_RET V4l2EnumSizeFps(void *retParam);
+    CAPTURE_DEVICE_RET V4l2SetConfig(struct capture_config_t *pCapcfg);
+    CAPTURE_DEVICE_RET V4l2AllocateBuf(DMA_BUFFER *DevBufQue, unsigned int *pBufQueNum);
+    CAPTURE_DEVICE_RET V4l2RegisterBufs(DMA_BUFFER *DevBufQue, unsigned int *pBufQueNum);
+    CAPTURE_DEVICE_RET V4l2Prepare();
+    CAPTURE_DEVICE_RET V4l2Start();
+    CAPTURE_DEVICE_RET V4l2Dequeue(unsigned int *pBufQueIdx);
+    CAPTURE_DEVICE_RET V4l2Queue(unsigned int BufQueIdx);
+    CAPTURE_DEVICE_RET V4l2Stop();
+    CAPTURE_DEVICE_RET V4l2DeAlloc();
+    CAPTURE_DEVICE_RET V4l2Close();
+    CAPTURE_DEVICE_RET V4l2QueryVersion(char *version, unsigned int len);
+
+private:
+    bool canOutput(unsigned int format);
+    void waitFrameTime();
+
+    //the mapped clip
+    unsigned char *mClip;
+    size_t mClipLength;
+    unsigned int mClipFormat;
+    unsigned int mClipWidth;
+    unsigned int mClipHeight;
+    unsigned int mClipFps;
+    size_t mClipFrameSize;
+    unsigned int mClipFrames;
+    unsigned int mClipPos;
+
+    unsigned int mOutputFmt[MAX_FILE_OUTPUT_FMT];
+    unsigned int mOutputFmtCnt;
+    size_t mOutputFrameSize;
+    nsecs_t mFramePeriod;
+    nsecs_t mNextFrameTime;
+
+    //indices queued by the HAL, oldest first, like the driver's incoming queue
+    Mutex mQueueLock;
+    Condition mQueueCond;
+    unsigned int mQueue[MAX_CAPTURE_BUF_QUE_NUM];
+    unsigned int mQueueHead;
+    bool mStreaming;
+};
+
+};
+#endif
@@ -38,6 +38,7 @@
 
 
 #include "V4l2UVCDevice.h"
+#include "camera_csc.h"
 
 #define MAX_DEV_NAME_LENGTH 10
 
@@ -506,6 +507,14 @@ CAPTURE_DEVICE_RET V4l2UVCDevice::V4l2EnumSizeFps(void *retParam)
     return ret;
 }
 
+CAPTURE_DEVICE_RET V4l2UVCDevice::V4l2QueryVersion(char *version, unsigned int len)
+{
+    CAMERA_LOG_FUNC;
+    //V4l2SetConfig and the csc setup rely on the tables filled while the
+    //formats and sizes are enumerated, so the enumeration can not be skipped.
+    return CAPTURE_DEVICE_ERR_GET_PARAM;
+}
+
 CAPTURE_DEVICE_RET V4l2UVCDevice::V4l2SetConfig(struct capture_config_t *pCapcfg)
 {
     CAMERA_LOG_FUNC;
@@ -621,94 +630,10 @@ CAPTURE_DEVICE_RET V4l2UVCDevice::V4l2SetConfig(struct capture_config_t *pCapcfg
 
 void V4l2UVCDevice::convertYUYUToNV12(struct CscConversion* param)
 {
-    unsigned char *pSrcBufs = param->srcVirt;
-    unsigned char *pDstBufs = param->dstVirt;
-    unsigned int bufWidth = param->width;
-    unsigned int bufHeight = param->height;
-
-    unsigned char *pSrcY1Offset = pSrcBufs;
-    unsigned char *pSrcY2Offset = pSrcBufs + (bufWidth << 1);
-    unsigned char *pSrcY3Offset = pSrcBufs + (bufWidth << 1) * 2;
-    unsigned char *pSrcY4Offset = pSrcBufs + (bufWidth << 1) * 3;
-    unsigned char *pSrcU1Offset = pSrcY1Offset + 1;
-    unsigned char *pSrcU2Offset = pSrcY2Offset + 1;
-    unsigned char *pSrcU3Offset = pSrcY3Offset + 1;
-    unsigned char *pSrcU4Offset = pSrcY4Offset + 1;
-    unsigned char *pSrcV1Offset = pSrcY1Offset + 3;
-    unsigned char *pSrcV2Offset = pSrcY2Offset + 3;
-    unsigned char *pSrcV3Offset = pSrcY3Offset + 3;
-    unsigned char *pSrcV4Offset = pSrcY4Offset + 3;
-    unsigned int srcYStride = (bufWidth << 1) * 3;
-    unsigned int srcUVStride = srcYStride;
-
-    unsigned char *pDstY1Offset = pDstBufs;
-    unsigned char *pDstY2Offset = pDstBufs + bufWidth;
-    unsigned char *pDstY3Offset = pDstBufs + bufWidth * 2;
-    unsigned char *pDstY4Offset = pDstBufs + bufWidth * 3;
-    unsigned char *pDstU1Offset = pDstBufs + bufWidth * bufHeight;
-    unsigned char *pDstU2Offset = pDstBufs + bufWidth * (bufHeight + 1);
-    unsigned char *pDstV1Offset = pDstU1Offset + 1;
-    unsigned char *pDstV2Offset = pDstU2Offset + 1;
-    unsigned int dstYStride = bufWidth * 3;
-    unsigned int dstUVStride = bufWidth;
-
-    unsigned int nw, nh;
-    for(nh = 0; nh < (bufHeight >> 2); nh++) {
-        for(nw=0; nw < (bufWidth >> 1); nw++) {
-            *pDstY1Offset++ = *pSrcY1Offset;
-            *pDstY2Offset++ = *pSrcY2Offset;
-            *pDstY3Offset++ = *pSrcY3Offset;
-            *pDstY4Offset++ = *pSrcY4Offset;
-
-            pSrcY1Offset += 2;
-            pSrcY2Offset += 2;
-            pSrcY3Offset += 2;
-            pSrcY4Offset += 2;
-
-            *pDstY1Offset++ = *pSrcY1Offset;
-            *pDstY2Offset++ = *pSrcY2Offset;
-            *pDstY3Offset++ = *pSrcY3Offset;
-            *pDstY4Offset++ = *pSrcY4Offset;
-
-            pSrcY1Offset += 2;
-            pSrcY2Offset += 2;
-            pSrcY3Offset += 2;
-            pSrcY4Offset += 2;
-
-            *pDstU1Offset = *pSrcU1Offset;
-            *pDstU2Offset = *pSrcU3Offset;
-            pDstU1Offset += 2;
-            pDstU2Offset += 2;
-            pSrcU1Offset += 4;
-            pSrcU3Offset += 4;
-
-            *pDstV1Offset = *pSrcV1Offset;
-            *pDstV2Offset = *pSrcV3Offset;
-            pDstV1Offset += 2;
-            pDstV2Offset += 2;
-            pSrcV1Offset += 4;
-            pSrcV3Offset += 4;
-        }
-
-        pSrcY1Offset += srcYStride;
-        pSrcY2Offset += srcYStride;
-        pSrcY3Offset += srcYStride;
-        pSrcY4Offset += srcYStride;
-
-        pSrcU1Offset += srcUVStride;
-        pSrcU3Offset += srcUVStride;
-        pSrcV1Offset += srcUVStride;
-        pSrcV3Offset += srcUVStride;
-
-        pDstY1Offset += dstYStride;
-        pDstY2Offset += dstYStride;
-        pDstY3Offset += dstYStride;
-        pDstY4Offset += dstYStride;
-
-        pDstU1Offset += dstUVStride;
-        pDstU2Offset += dstUVStride;
-        pDstV1Offset += dstUVStride;
-        pDstV2Offset += dstUVStride;
+    if (camera_csc_convert(param->srcFormat, param->dstFormat, param->srcVirt,
+                           param->dstVirt, param->width, param->height) < 0) {
+        CAMERA_LOG_ERR("csc from 0x%x to 0x%x %dx%d not supported",
+                       param->srcFormat, param->dstFormat, param->width, param->height);
     }
 }
 
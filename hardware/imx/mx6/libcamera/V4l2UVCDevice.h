@@ -64,6 +64,7 @@ protected:
     CAPTURE_DEVICE_RET V4l2EnumFmt(void *retParam);
     CAPTURE_DEVICE_RET V4l2EnumSizeFps(void *retParam);
     CAPTURE_DEVICE_RET V4l2SetConfig(struct capture_config_t *pCapcfg);
+    CAPTURE_DEVICE_RET V4l2QueryVersion(char *version, unsigned int len);
 
 private:
     static void convertYUYUToNV12(struct CscConversion* param);
@@ -0,0 +1,550 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Copyright 2009-2012 Freescale Semiconductor, Inc.
+ */
+
+/*
+ * Throughput benchmark for the camera HAL.
+ *
+ *   camera_bench [-c camera] [-n frames] [-p pictures]
+ *
+ * Loads the camera module like the camera service does and runs preview,
+ * preview with recording, and takePicture against an offscreen preview
+ * window that gives every buffer straight back. For each phase it prints
+ * the frame rate, the CPU time of the whole process per frame and the
+ * HAL's own dump, whose frame trace has the capture to callback latency.
+ * Picture latency is takePicture to the JPEG callback.
+ *
+ * With the file capture device no sensor is needed:
+ *
+ *   setprop back_camera_name file
+ *   setprop camera.file.path /data/camera/clip.yuv
+ *   setprop camera.file.format nv12
+ *   setprop camera.file.size 640x480
+ *   setprop camera.file.fps 30
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+
+#include <hardware/camera.h>
+#include <hardware/gralloc.h>
+#include <hardware/hardware.h>
+
+#define BENCH_WINDOW_BUFFERS    8
+#define BENCH_TIMEOUT_MS        5000
+#define BENCH_PICTURE_PREVIEW   5
+
+/* Offscreen preview window, the display takes a buffer and returns it at once */
+struct bench_window {
+    preview_stream_ops_t ops;   /* first, the HAL hands &ops back */
+    alloc_device_t *alloc;
+    pthread_mutex_t lock;
+    buffer_handle_t buffers[BENCH_WINDOW_BUFFERS];
+    int fifo[BENCH_WINDOW_BUFFERS];
+    int head, num, count;
+    int width, height, format, usage;
+};
+
+struct bench_memory {
+    camera_memory_t mem;        /* first, the HAL only sees this */
+    size_t buf_size;
+    size_t length;
+    int mapped;
+};
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    unsigned int preview_frames;
+    unsigned int video_frames;
+    unsigned int pictures;
+    camera_device_t *dev;
+} s_bench = {
+    PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0, 0, 0, NULL
+};
+
+static int64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* User and system time of every thread in the process, the HAL's included */
+static int64_t cpu_ns(void)
+{
+    struct rusage ru;
+
+    getrusage(RUSAGE_SELF, &ru);
+    return ((int64_t)ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000000LL +
+           ((int64_t)ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) * 1000LL;
+}
+
+/* window */
+
+static struct bench_window *to_window(const struct preview_stream_ops *w)
+{
+    return (struct bench_window *)w;
+}
+
+static int window_index(struct bench_window *win, buffer_handle_t *buffer)
+{
+    int i = buffer - win->buffers;
+
+    return (i >= 0 && i < win->count) ? i : -1;
+}
+
+static int window_dequeue(struct preview_stream_ops *w, buffer_handle_t **buffer,
+                          int *stride)
+{
+    struct bench_window *win = to_window(w);
+    int i;
+
+    pthread_mutex_lock(&win->lock);
+    if (win->num == 0) {
+        pthread_mutex_unlock(&win->lock);
+        return -EBUSY;
+    }
+    i = win->fifo[win->head];
+    win->head = (win->head + 1) % BENCH_WINDOW_BUFFERS;
+    win->num--;
+    pthread_mutex_unlock(&win->lock);
+
+    *buffer = &win->buffers[i];
+    *stride = win->width;
+    return 0;
+}
+
+static int window_give_back(struct preview_stream_ops *w, buffer_handle_t *buffer)
+{
+    struct bench_window *win = to_window(w);
+    int i = window_index(win, buffer);
+
+    if (i < 0)
+        return -EINVAL;
+    pthread_mutex_lock(&win->lock);
+    win->fifo[(win->head + win->num) % BENCH_WINDOW_BUFFERS] = i;
+    win->num++;
+    pthread_mutex_unlock(&win->lock);
+    return 0;
+}
+
+static void window_free(struct bench_window *win)
+{
+    int i;
+
+    for (i = 0; i < win->count; i++)
+        win->alloc->free(win->alloc, win->buffers[i]);
+    win->count = win->num = win->head = 0;
+}
+
+static int window_set_buffer_count(struct preview_stream_ops *w, int count)
+{
+    struct bench_window *win = to_window(w);
+    int i, stride, err;
+
+    if (count <= 0 || count > BENCH_WINDOW_BUFFERS)
+        return -EINVAL;
+    window_free(win);
+    for (i = 0; i < count; i++) {
+        err = win->alloc->alloc(win->alloc, win->width, win->height, win->format,
+                                win->usage, &win->buffers[i], &stride);
+        if (err != 0) {
+            fprintf(stderr, "gralloc alloc %dx%d failed: %d\n", win->width, win->height, err);
+            window_free(win);
+            return err;
+        }
+        win->count++;
+        win->fifo[i] = i;
+        win->num++;
+    }
+    return 0;
+}
+
+static int window_set_geometry(struct preview_stream_ops *w, int width, int height,
+                               int format)
+{
+    struct bench_window *win = to_window(w);
+
+    win->width = width;
+    win->height = height;
+    win->format = format;
+    return 0;
+}
+
+static int window_set_usage(struct preview_stream_ops *w, int usage)
+{
+    to_window(w)->usage = usage;
+    return 0;
+}
+
+static int window_set_crop(struct preview_stream_ops *w, int left, int top,
+                           int right, int bottom)
+{
+    return 0;
+}
+
+static int window_set_swap_interval(struct preview_stream_ops *w, int interval)
+{
+    return 0;
+}
+
+static int window_get_min_undequeued(const struct preview_stream_ops *w, int *count)
+{
+    *count = 0;
+    return 0;
+}
+
+static int window_lock(struct preview_stream_ops *w, buffer_handle_t *buffer)
+{
+    return 0;
+}
+
+static int window_init(struct bench_window *win)
+{
+    const hw_module_t *module;
+    int err;
+
+    memset(win, 0, sizeof(*win));
+    err = hw_get_module(GRALLOC_HARDWARE_MODULE_ID, &module);
+    if (err == 0)
+        err = gralloc_open(module, &win->alloc);
+    if (err != 0) {
+        fprintf(stderr, "cannot open gralloc: %d\n", err);
+        return err;
+    }
+    pthread_mutex_init(&win->lock, NULL);
+    win->ops.dequeue_buffer = window_dequeue;
+    win->ops.enqueue_buffer = window_give_back;
+    win->ops.cancel_buffer = window_give_back;
+    win->ops.set_buffer_count = window_set_buffer_count;
+    win->ops.set_buffers_geometry = window_set_geometry;
+    win->ops.set_crop = window_set_crop;
+    win->ops.set_usage = window_set_usage;
+    win->ops.set_swap_interval = window_set_swap_interval;
+    win->ops.get_min_undequeued_buffer_count = window_get_min_undequeued;
+    win->ops.lock_buffer = window_lock;
+    return 0;
+}
+
+/* callbacks */
+
+static void memory_release(camera_memory_t *mem)
+{
+    struct bench_memory *m = (struct bench_memory *)mem;
+
+    if (m->mapped)
+        munmap(mem->data, m->length);
+    else
+        free(mem->data);
+    free(m);
+}
+
+static camera_memory_t *get_memory(int fd, size_t buf_size, unsigned int num_bufs,
+                                   void *user)
+{
+    struct bench_memory *m = calloc(1, sizeof(*m));
+
+    if (m == NULL)
+        return NULL;
+    m->buf_size = buf_size;
+    m->length = buf_size * num_bufs;
+    if (fd >= 0) {
+        m->mem.data = mmap(NULL, m->length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (m->mem.data == MAP_FAILED)
+            m->mem.data = NULL;
+        m->mapped = 1;
+    }
+    else
+        m->mem.data = malloc(m->length);
+    if (m->mem.data == NULL) {
+        free(m);
+        return NULL;
+    }
+    m->mem.size = m->length;
+    m->mem.release = memory_release;
+    return &m->mem;
+}
+
+static void notify_cb(int32_t msg_type, int32_t ext1, int32_t ext2, void *user)
+{
+}
+
+static void bump(unsigned int *counter)
+{
+    pthread_mutex_lock(&s_bench.lock);
+    (*counter)++;
+    pthread_cond_broadcast(&s_bench.cond);
+    pthread_mutex_unlock(&s_bench.lock);
+}
+
+static void data_cb(int32_t msg_type, const camera_memory_t *data, unsigned int index,
+                    camera_frame_metadata_t *metadata, void *user)
+{
+    if (msg_type & CAMERA_MSG_PREVIEW_FRAME)
+        bump(&s_bench.preview_frames);
+    if (msg_type & CAMERA_MSG_COMPRESSED_IMAGE)
+        bump(&s_bench.pictures);
+}
+
+static void data_cb_timestamp(nsecs_t timestamp, int32_t msg_type,
+                              const camera_memory_t *data, unsigned int index, void *user)
+{
+    const struct bench_memory *m = (const struct bench_memory *)data;
+
+    /* an encoder that keeps up, the frame goes back at once */
+    s_bench.dev->ops->release_recording_frame(s_bench.dev,
+            (unsigned char *)data->data + index * m->buf_size);
+    bump(&s_bench.video_frames);
+}
+
+/* Wait until *counter reaches target, 0 or -1 on timeout */
+static int wait_for(unsigned int *counter, unsigned int target)
+{
+    struct timespec ts;
+    int err = 0;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += BENCH_TIMEOUT_MS / 1000;
+    pthread_mutex_lock(&s_bench.lock);
+    while (*counter < target && err != ETIMEDOUT)
+        err = pthread_cond_timedwait(&s_bench.cond, &s_bench.lock, &ts);
+    err = *counter < target ? -1 : 0;
+    pthread_mutex_unlock(&s_bench.lock);
+    return err;
+}
+
+static unsigned int read_counter(unsigned int *counter)
+{
+    unsigned int n;
+
+    pthread_mutex_lock(&s_bench.lock);
+    n = *counter;
+    pthread_mutex_unlock(&s_bench.lock);
+    return n;
+}
+
+static void report(const char *phase, unsigned int frames, int64_t wall, int64_t cpu)
+{
+    if (frames == 0 || wall <= 0) {
+        printf("%s: no frames\n", phase);
+        return;
+    }
+    printf("%s: %u frames in %lld ms, %.2f fps, cpu %lld us per frame (%.1f%% of one core)\n",
+           phase, frames, (long long)(wall / 1000000), frames * 1e9 / wall,
+           (long long)(cpu / frames / 1000), cpu * 100.0 / wall);
+}
+
+/* Copy "key=value" out of flattened parameters */
+static int param_get(const char *params, const char *key, char *value, size_t len)
+{
+    size_t klen = strlen(key);
+    const char *p = params, *end;
+
+    while (p != NULL && *p) {
+        if (!strncmp(p, key, klen) && p[klen] == '=') {
+            p += klen + 1;
+            end = strchr(p, ';');
+            if (end == NULL)
+                end = p + strlen(p);
+            if ((size_t)(end - p) >= len)
+                return -1;
+            memcpy(value, p, end - p);
+            value[end - p] = '\0';
+            return 0;
+        }
+        p = strchr(p, ';');
+        if (p != NULL)
+            p++;
+    }
+    return -1;
+}
+
+/* Preview and picture at the first listed size, which is the clip's */
+static int configure(camera_device_t *dev)
+{
+    char *params = dev->ops->get_parameters(dev);
+    char size[32], *comma, *flat;
+    int ret;
+
+    if (params == NULL)
+        return -1;
+    if (param_get(params, "preview-size-values", size, sizeof(size)) < 0 &&
+            param_get(params, "preview-size", size, sizeof(size)) < 0) {
+        dev->ops->put_parameters(dev, params);
+        return -1;
+    }
+    comma = strchr(size, ',');
+    if (comma != NULL)
+        *comma = '\0';
+
+    flat = malloc(strlen(params) + 2 * sizeof(size) + 32);
+    if (flat == NULL) {
+        dev->ops->put_parameters(dev, params);
+        return -1;
+    }
+    /* later keys replace earlier ones when the string is parsed */
+    sprintf(flat, "%s;preview-size=%s;picture-size=%s", params, size, size);
+    dev->ops->put_parameters(dev, params);
+    ret = dev->ops->set_parameters(dev, flat);
+    free(flat);
+    printf("preview and picture size %s\n", size);
+    return ret;
+}
+
+static int run_stream(camera_device_t *dev, const char *phase, unsigned int *counter,
+                      unsigned int frames)
+{
+    unsigned int start = read_counter(counter);
+    int64_t wall, cpu;
+    int ret;
+
+    wall = now_ns();
+    cpu = cpu_ns();
+    ret = wait_for(counter, start + frames);
+    wall = now_ns() - wall;
+    cpu = cpu_ns() - cpu;
+    report(phase, read_counter(counter) - start, wall, cpu);
+    fflush(stdout);
+    dev->ops->dump(dev, STDOUT_FILENO);
+    if (ret < 0)
+        printf("%s: timed out\n", phase);
+    return ret;
+}
+
+static int run_pictures(camera_device_t *dev, int pictures)
+{
+    int64_t t, total = 0, max = 0, cpu;
+    int i, tries, done = 0;
+
+    cpu = cpu_ns();
+    for (i = 0; i < pictures; i++) {
+        if (dev->ops->start_preview(dev) != 0 ||
+                wait_for(&s_bench.preview_frames,
+                         read_counter(&s_bench.preview_frames) + BENCH_PICTURE_PREVIEW) < 0) {
+            printf("picture %d: preview did not start\n", i);
+            break;
+        }
+        t = now_ns();
+        /* the last picture thread may still be finishing */
+        for (tries = 0; dev->ops->take_picture(dev) != 0 && tries < 100; tries++)
+            usleep(10000);
+        if (tries == 100 || wait_for(&s_bench.pictures, done + 1) < 0) {
+            printf("picture %d: no jpeg\n", i);
+            break;
+        }
+        t = now_ns() - t;
+        total += t;
+        if (t > max)
+            max = t;
+        done++;
+        dev->ops->stop_preview(dev);
+    }
+    cpu = cpu_ns() - cpu;
+    if (done > 0)
+        printf("picture: %d taken, latency avg %lld ms, max %lld ms, cpu %lld ms per picture "
+               "with its preview restart\n", done, (long long)(total / done / 1000000),
+               (long long)(max / 1000000), (long long)(cpu / done / 1000000));
+    return done == pictures ? 0 : -1;
+}
+
+int main(int argc, char **argv)
+{
+    const hw_module_t *module;
+    hw_device_t *hwdev = NULL;
+    camera_device_t *dev;
+    struct bench_window win;
+    char id[8] = "0";
+    int frames = 300, pictures = 3, failures = 0;
+    int64_t t;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "c:n:p:")) != -1) {
+        switch (opt) {
+            case 'c': snprintf(id, sizeof(id), "%d", atoi(optarg)); break;
+            case 'n': frames = atoi(optarg); break;
+            case 'p': pictures = atoi(optarg); break;
+            default:
+                fprintf(stderr, "usage: %s [-c camera] [-n frames] [-p pictures]\n", argv[0]);
+                return 2;
+        }
+    }
+
+    if (window_init(&win) != 0)
+        return 1;
+    if (hw_get_module(CAMERA_HARDWARE_MODULE_ID, &module) != 0) {
+        fprintf(stderr, "no camera module\n");
+        return 1;
+    }
+    t = now_ns();
+    if (module->methods->open(module, id, &hwdev) != 0 || hwdev == NULL) {
+        fprintf(stderr, "cannot open camera %s\n", id);
+        return 1;
+    }
+    printf("open: %lld ms\n", (long long)((now_ns() - t) / 1000000));
+    dev = s_bench.dev = (camera_device_t *)hwdev;
+
+    if (configure(dev) != 0)
+        fprintf(stderr, "setParameters failed, running at the default size\n");
+    dev->ops->set_callbacks(dev, notify_cb, data_cb, data_cb_timestamp, get_memory, NULL);
+    dev->ops->set_preview_window(dev, &win.ops);
+    dev->ops->enable_msg_type(dev, CAMERA_MSG_PREVIEW_FRAME | CAMERA_MSG_VIDEO_FRAME |
+                              CAMERA_MSG_COMPRESSED_IMAGE);
+
+    t = now_ns();
+    if (dev->ops->start_preview(dev) != 0 || wait_for(&s_bench.preview_frames, 1) < 0) {
+        fprintf(stderr, "preview did not start\n");
+        failures++;
+    }
+    else {
+        printf("first preview frame: %lld ms\n", (long long)((now_ns() - t) / 1000000));
+        if (run_stream(dev, "preview", &s_bench.preview_frames, frames) < 0)
+            failures++;
+
+        if (dev->ops->start_recording(dev) != 0) {
+            fprintf(stderr, "recording did not start\n");
+            failures++;
+        }
+        else {
+            if (run_stream(dev, "recording", &s_bench.video_frames, frames) < 0)
+                failures++;
+            dev->ops->stop_recording(dev);
+        }
+        dev->ops->stop_preview(dev);
+    }
+
+    if (pictures > 0 && run_pictures(dev, pictures) < 0)
+        failures++;
+
+    dev->ops->set_preview_window(dev, NULL);
+    dev->ops->release(dev);
+    hwdev->close(hwdev);
+    window_free(&win);
+    gralloc_close(win.alloc);
+
+    return failures ? 1 : 0;
+}
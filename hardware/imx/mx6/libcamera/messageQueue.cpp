@@ -22,7 +22,12 @@
 #include <stdint.h>
 #include <errno.h>
 #include <sys/types.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <string.h>
 
+#include <cutils/atomic.h>
+#include <cutils/atomic-inline.h>
 #include <utils/threads.h>
 #include <utils/Timers.h>
 #include <utils/Log.h>
@@ -48,8 +53,134 @@ void CMessageList::clear()
     mList.clear();
 }
 
+CFrameQueue::CFrameQueue()
+    :mHead(0), mTail(0), mWaiting(0), mWakePending(0)
+{
+    memset(mFrames, 0, sizeof(mFrames));
+    memset(&mStats, 0, sizeof(mStats));
+    mEventFd = eventfd(0, 0);
+    if(mEventFd < 0) {
+        CAMERA_LOG_ERR("%s: eventfd failed: %s", __FUNCTION__, strerror(errno));
+    }
+}
+
+CFrameQueue::~CFrameQueue()
+{
+    if(mEventFd >= 0)
+        close(mEventFd);
+}
+
+bool CFrameQueue::push(int32_t index)
+{
+    int32_t tail = mTail;
+    int32_t head = android_atomic_acquire_load(&mHead);
+    uint32_t depth = (uint32_t)(tail - head);
+
+    if(depth >= CFRAME_QUEUE_SIZE) {
+        mStats.dropped ++;
+        return false;
+    }
+
+    CFrame *frame = &mFrames[tail & (CFRAME_QUEUE_SIZE - 1)];
+    frame->index = index;
+    frame->timestamp = systemTime(SYSTEM_TIME_MONOTONIC);
+    android_atomic_release_store(tail + 1, &mTail);
+
+    mStats.pushed ++;
+    if(depth + 1 > mStats.maxDepth)
+        mStats.maxDepth = depth + 1;
+
+    //Pairs with the barrier in wait(): either the consumer sees the new
+    //tail, or we see it waiting and kick the eventfd.
+    android_memory_barrier();
+    if(android_atomic_acquire_load(&mWaiting)) {
+        uint64_t one = 1;
+        write(mEventFd, &one, sizeof(one));
+    }
+    return true;
+}
+
+bool CFrameQueue::pop(CFrame *frame)
+{
+    int32_t head = mHead;
+
+    if(android_atomic_acquire_load(&mTail) == head)
+        return false;
+
+    *frame = mFrames[head & (CFRAME_QUEUE_SIZE - 1)];
+    android_atomic_release_store(head + 1, &mHead);
+
+    nsecs_t waited = systemTime(SYSTEM_TIME_MONOTONIC) - frame->timestamp;
+    mStats.popped ++;
+    mStats.waitTotal += waited;
+    if(waited > mStats.waitMax)
+        mStats.waitMax = waited;
+    return true;
+}
+
+int CFrameQueue::wait(CFrame *frame)
+{
+    while(true) {
+        if(android_atomic_acquire_load(&mWakePending)) {
+            android_atomic_release_store(0, &mWakePending);
+            return WAKE;
+        }
+        if(pop(frame))
+            return FRAME;
+
+        android_atomic_release_store(1, &mWaiting);
+        android_memory_barrier();
+        if(!android_atomic_acquire_load(&mWakePending) &&
+                android_atomic_acquire_load(&mTail) == mHead) {
+            //A count left over from an earlier kick only costs one more pass.
+            uint64_t count;
+            while(read(mEventFd, &count, sizeof(count)) < 0 && errno == EINTR)
+                ;
+        }
+        android_atomic_release_store(0, &mWaiting);
+    }
+}
+
+void CFrameQueue::frameDone(const CFrame &frame)
+{
+    nsecs_t stage = systemTime(SYSTEM_TIME_MONOTONIC) - frame.timestamp;
+    mStats.done ++;
+    mStats.stageTotal += stage;
+    if(stage > mStats.stageMax)
+        mStats.stageMax = stage;
+}
+
+void CFrameQueue::clear()
+{
+    android_atomic_release_store(android_atomic_acquire_load(&mTail), &mHead);
+}
+
+void CFrameQueue::wake()
+{
+    uint64_t one = 1;
+
+    android_atomic_release_store(1, &mWakePending);
+    write(mEventFd, &one, sizeof(one));
+}
+
+uint32_t CFrameQueue::depth() const
+{
+    return (uint32_t)(android_atomic_acquire_load(&mTail) -
+            android_atomic_acquire_load(&mHead));
+}
+
+void CFrameQueue::getStats(CFrameQueueStats *stats) const
+{
+    *stats = mStats;
+}
+
+void CFrameQueue::resetStats()
+{
+    memset(&mStats, 0, sizeof(mStats));
+}
+
 CMessageQueue::CMessageQueue()
-    :mQuit(false), mStop(false)
+    :mQuit(false), mStop(false), mFrames(NULL)
 {
     mQuitMessage = new CMessage(CMESSAGE_TYPE_QUITE);
     mStopMessage = new CMessage(CMESSAGE_TYPE_STOP);
@@ -67,6 +198,47 @@ void CMessageQueue::clearMessage()
     Mutex::Autolock _l(mLock);
     mMessages.clear();
     mStop = false;
+    if(mFrames != NULL)
+        mFrames->clear();
+}
+
+//Unlike clearMessage(), the queued frames are left to the consumer
+void CMessageQueue::clearStopMessage()
+{
+    Mutex::Autolock _l(mLock);
+    mStop = false;
+}
+
+void CMessageQueue::setFrameQueue(CFrameQueue *frames)
+{
+    Mutex::Autolock _l(mLock);
+    mFrames = frames;
+}
+
+status_t CMessageQueue::postFrame(int32_t index)
+{
+    if(mFrames == NULL)
+        return queueMessage(new CMessage(CMESSAGE_TYPE_NORMAL, index), 0);
+    return mFrames->push(index) ? NO_ERROR : NO_MEMORY;
+}
+
+CMESSAGE_TYPE CMessageQueue::waitFrame(CFrame *frame)
+{
+    while(true) {
+        if(mFrames->wait(frame) == CFrameQueue::FRAME)
+            return CMESSAGE_TYPE_NORMAL;
+
+        Mutex::Autolock _l(mLock);
+        if(mQuit)
+            return CMESSAGE_TYPE_QUITE;
+        if(mStop)
+            return CMESSAGE_TYPE_STOP;
+    }
+}
+
+bool CMessageQueue::pollFrame(CFrame *frame)
+{
+    return mFrames != NULL && mFrames->pop(frame);
 }
 
 sp<CMessage> CMessageQueue::waitMessage(nsecs_t timeout)
@@ -120,6 +292,8 @@ status_t CMessageQueue::postQuitMessage()
     Mutex::Autolock _l(mLock);
     mQuit = true;
     mCondition.signal();
+    if(mFrames != NULL)
+        mFrames->wake();
     return NO_ERROR;
 }
 
@@ -129,6 +303,8 @@ status_t CMessageQueue::postStopMessage()
     mStop = true;
     //mMessages.insert(new CMessage(CMESSAGE_TYPE_STOP, 0));
     mCondition.signal();
+    if(mFrames != NULL)
+        mFrames->wake();
     return NO_ERROR;
 }
 
@@ -41,6 +41,71 @@ typedef enum{
 
 class CMessage;
 
+//Capacity of a CFrameQueue, a power of two no smaller than the number of
+//capture buffers, so a push can only fail if a buffer index is lost.
+#define CFRAME_QUEUE_SIZE 8
+
+typedef struct {
+    int32_t index;
+    nsecs_t timestamp;  //when the producer pushed the frame
+} CFrame;
+
+typedef struct {
+    uint32_t pushed;
+    uint32_t dropped;    //pushes that found the ring full
+    uint32_t popped;
+    uint32_t done;
+    uint32_t maxDepth;
+    nsecs_t  waitTotal;  //push to pop
+    nsecs_t  waitMax;
+    nsecs_t  stageTotal; //push to frameDone()
+    nsecs_t  stageMax;
+} CFrameQueueStats;
+
+/*
+ * Fixed capacity single producer, single consumer ring of frame indices.
+ * Nothing is allocated or locked per frame; the consumer sleeps on an
+ * eventfd that the producer only writes when the consumer says it is
+ * about to sleep. wake() breaks the wait so the consumer can look at the
+ * control messages of the CMessageQueue the ring is attached to.
+ * The producer and the consumer each update their own statistics, which
+ * are read without locking and are only meant for dump().
+ */
+class CFrameQueue
+{
+public:
+    enum {
+        FRAME = 0,
+        WAKE = 1,
+    };
+
+    CFrameQueue();
+    ~CFrameQueue();
+
+    //producer side
+    bool push(int32_t index);
+
+    //consumer side
+    int wait(CFrame *frame);
+    bool pop(CFrame *frame);
+    void frameDone(const CFrame &frame);
+    void clear();
+
+    void wake();
+    uint32_t depth() const;
+    void getStats(CFrameQueueStats *stats) const;
+    void resetStats();
+
+private:
+    CFrame mFrames[CFRAME_QUEUE_SIZE];
+    volatile int32_t mHead;
+    volatile int32_t mTail;
+    volatile int32_t mWaiting;
+    volatile int32_t mWakePending;
+    int mEventFd;
+    CFrameQueueStats mStats;
+};
+
 class CMessageList
 {
     List< sp<CMessage> > mList;
@@ -85,6 +150,13 @@ public:
     status_t postQuitMessage();
     status_t postStopMessage();
     void clearMessage();
+    void clearStopMessage();
+
+    //Per frame path, see CFrameQueue. The frame queue must outlive this one.
+    void setFrameQueue(CFrameQueue *frames);
+    status_t postFrame(int32_t index);
+    CMESSAGE_TYPE waitFrame(CFrame *frame);
+    bool pollFrame(CFrame *frame);
 
 private:
     status_t queueMessage(const sp<CMessage>& message, int32_t flags);
@@ -96,6 +168,7 @@ private:
     bool mStop;
     sp<CMessage> mQuitMessage;
     sp<CMessage> mStopMessage;
+    CFrameQueue *mFrames;
 };
 
 
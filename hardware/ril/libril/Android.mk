@@ -4,8 +4,15 @@ LOCAL_PATH:= $(call my-dir)
 include $(CLEAR_VARS)
 
 LOCAL_SRC_FILES:= \
-    ril.cpp \
-    ril_event.cpp
+    ril.cpp
+
+# Set RIL_EVENT_USE_EPOLL := true in BoardConfig.mk to use the
+# epoll/timerfd event loop instead of select()
+ifeq ($(RIL_EVENT_USE_EPOLL),true)
+LOCAL_SRC_FILES += ril_event_epoll.cpp
+else
+LOCAL_SRC_FILES += ril_event.cpp
+endif
 
 LOCAL_SHARED_LIBRARIES := \
     libutils \
@@ -42,3 +49,87 @@ LOCAL_LDLIBS += -lpthread
 
 include $(BUILD_STATIC_LIBRARY)
 endif # ANDROID_BIONIC_TRANSITION
+
+
+# Host microbenchmark for the two ril_event backends
+# =================================================
+ifeq ($(HOST_OS),linux)
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES:= \
+    ril_event_bench.cpp \
+    ril_event.cpp
+
+LOCAL_STATIC_LIBRARIES := \
+    libcutils \
+    liblog
+
+# the select() backend needs a watch table big enough for the benchmark
+LOCAL_CFLAGS := -DMAX_FD_EVENTS=1000
+
+LOCAL_MODULE:= ril_event_bench_select
+
+LOCAL_MODULE_TAGS := optional
+
+LOCAL_LDLIBS += -lpthread -lrt
+
+include $(BUILD_HOST_EXECUTABLE)
+
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES:= \
+    ril_event_bench.cpp \
+    ril_event_epoll.cpp
+
+LOCAL_STATIC_LIBRARIES := \
+    libcutils \
+    liblog
+
+LOCAL_CFLAGS := -DMAX_FD_EVENTS=1000
+
+LOCAL_MODULE:= ril_event_bench_epoll
+
+LOCAL_MODULE_TAGS := optional
+
+LOCAL_LDLIBS += -lpthread -lrt
+
+include $(BUILD_HOST_EXECUTABLE)
+endif # HOST_OS == linux
+
+# Response marshalling benchmark
+# ==============================
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES:= \
+    ril_parcel_bench.cpp
+
+LOCAL_SHARED_LIBRARIES := \
+    libutils \
+    libbinder \
+    libcutils
+
+LOCAL_MODULE:= ril_parcel_bench
+
+LOCAL_MODULE_TAGS := optional
+
+include $(BUILD_EXECUTABLE)
+
+# Record/replay harness: ril.cpp against a stub RIL
+# =================================================
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES:= \
+    ril_replay.cpp \
+    ril_event.cpp
+
+LOCAL_SHARED_LIBRARIES := \
+    libutils \
+    libbinder \
+    libcutils \
+    libhardware_legacy
+
+LOCAL_MODULE:= ril_replay
+
+LOCAL_MODULE_TAGS := optional
+
+include $(BUILD_EXECUTABLE)
@@ -26,6 +26,7 @@
 #include <cutils/record_stream.h>
 #include <utils/Log.h>
 #include <utils/SystemClock.h>
+#include <utils/Timers.h>
 #include <pthread.h>
 #include <binder/Parcel.h>
 #include <cutils/jstring.h>
@@ -45,6 +46,7 @@
 #include <ctype.h>
 #include <alloca.h>
 #include <sys/un.h>
+#include <sys/uio.h>
 #include <assert.h>
 #include <netinet/in.h>
 #include <cutils/properties.h>
@@ -63,9 +65,47 @@ namespace android {
 
 #define PROPERTY_RIL_IMPL "gsm.version.ril-impl"
 
+// Unsolicited response coalescing window in ms; 0 (the default) sends
+// every indication as soon as it is reported
+#define PROPERTY_UNSOL_COALESCE_MS "ro.ril.unsol_coalesce_ms"
+
 // match with constant in RIL.java
 #define MAX_COMMAND_BYTES (8 * 1024)
 
+// Every response frame on the command socket starts with a big-endian
+// length word. Response parcels reserve room for it up front so the
+// whole frame can go out in a single write.
+#define RESPONSE_HEADER_SIZE sizeof(uint32_t)
+
+// Number of response parcels kept around for reuse
+#define NUM_RESPONSE_PARCELS 4
+
+// Max unsolicited responses held in one coalescing batch
+#define MAX_COALESCED_UNSOL 32
+
+// Max simultaneous connections to the command socket. The first is
+// normally the framework; the others are e.g. monitoring agents.
+#define MAX_COMMAND_CLIENTS 4
+
+// Output queued for a client whose socket is full. Writes never block;
+// a client that falls this far behind is disconnected.
+#define MAX_CLIENT_OUTPUT_BYTES (128 * 1024)
+
+// Number of threads calling onRequest(); 0 (the default) dispatches on
+// the event loop thread
+#define PROPERTY_DISPATCH_THREADS "ro.ril.dispatch_threads"
+#define MAX_DISPATCH_THREADS 8
+
+// Name of a file in RECORD_COMMANDS_DIR to append every command read
+// from a client to, framed as on the socket, for replay with ril_replay.
+// Read once in RIL_register(), and ignored unless ro.debuggable is 1:
+// the capture holds dialled numbers and SMS PDUs.
+#define PROPERTY_RECORD_COMMANDS "ril.record_commands"
+#define RECORD_COMMANDS_DIR "/data/radio"
+
+// Commands waiting for the recorder thread; more are dropped
+#define MAX_RECORD_QUEUE_BYTES (256 * 1024)
+
 // Basically: memset buffers that the client library
 // shouldn't be using anymore in an attempt to find
 // memory usage issues sooner.
@@ -82,6 +122,13 @@ namespace android {
 /* Negative values for private RIL errno's */
 #define RIL_ERRNO_INVALID_RESPONSE -1
 
+// Number of preallocated RequestInfo slots. Requests beyond this many in
+// flight still work, they just fall back to calloc().
+#define MAX_PENDING_REQUESTS 128
+
+// Latency histogram buckets: <1ms, <2ms, <4ms, ... <1024ms, >=1024ms
+#define NUM_LATENCY_BUCKETS 12
+
 // request, response, and unsolicited msg print macro
 #define PRINTBUF_SIZE 8096
 
@@ -115,6 +162,15 @@ namespace android {
 
 enum WakeType {DONT_WAKE, WAKE_PARTIAL};
 
+/*
+ * How an unsolicited response is treated when coalescing is enabled:
+ * SEND_NOW    never held back (flushes anything already batched)
+ * BATCH       held for the coalescing window, then sent with the batch
+ * SUPERSEDE   as BATCH, but replaces an earlier batched one of the
+ *             same type, since only the latest value matters
+ */
+enum CoalesceType {SEND_NOW, BATCH, SUPERSEDE};
+
 typedef struct {
     int requestNumber;
     void (*dispatchFunction) (Parcel &p, struct RequestInfo *pRI);
@@ -125,16 +181,58 @@ typedef struct {
     int requestNumber;
     int (*responseFunction) (Parcel &p, void *response, size_t responselen);
     WakeType wakeType;
+    CoalesceType coalesceType;
 } UnsolResponseInfo;
 
+typedef struct {
+    int unsolResponse;
+    Parcel *p;
+} BatchedUnsolResponse;
+
+/** A command received from a client, waiting for a dispatch thread */
+typedef struct QueuedCommand {
+    struct QueuedCommand *p_next;
+    size_t len;
+    // command bytes follow
+} QueuedCommand;
+
+typedef struct RilClient {
+    int fd;             // -1 when the slot is free; guarded by s_writeMutex
+    int generation;     // bumped on every connect that uses this slot
+    // guarded by s_writeMutex
+    uint8_t *outBuf;    // bytes the socket didn't take yet
+    size_t outLen;
+    size_t outSize;
+    int writeFailed;    // shut down, skipped until the reader closes it
+    int writeWatched;   // event also fires on POLLOUT until outBuf drains
+    int primary;        // the framework's connection, never dropped for lag
+    RecordStream *p_rs;
+    struct ril_event event;
+    // guarded by s_dispatchMutex
+    QueuedCommand *queueHead;
+    QueuedCommand *queueTail;
+    int dispatching;    // a dispatch thread is running one of our commands
+} RilClient;
+
 typedef struct RequestInfo {
     int32_t token;      //this is not RIL_Token
     CommandInfo *pCI;
-    struct RequestInfo *p_next;
+    struct RequestInfo *p_next;     // free list linkage for pooled slots
     char cancelled;
     char local;         // responses to local commands do not go back to command process
+    nsecs_t dispatchTime;
+    RilClient *client;  // where the response goes
+    int clientGeneration;
 } RequestInfo;
 
+typedef struct {
+    int inFlight;
+    int maxInFlight;
+    unsigned int completed;
+    nsecs_t totalLatency;
+    unsigned int latency[NUM_LATENCY_BUCKETS];
+} RequestStats;
+
 typedef struct UserCallbackInfo {
     RIL_TimedCallback p_callback;
     void *userParam;
@@ -153,13 +251,25 @@ static pthread_t s_tid_reader;
 static int s_started = 0;
 
 static int s_fdListen = -1;
-static int s_fdCommand = -1;
 static int s_fdDebug = -1;
 
+static RilClient s_clients[MAX_COMMAND_CLIENTS];
+static int s_numClients = 0;
+static int s_listening = 0;     // s_listen_event is armed
+
+static int s_numDispatchThreads = 0;
+
+// command capture, see PROPERTY_RECORD_COMMANDS; guarded by s_recordMutex
+static int s_recording = 0;
+static QueuedCommand *s_recordHead = NULL;
+static QueuedCommand *s_recordTail = NULL;
+static size_t s_recordQueuedBytes = 0;
+static unsigned int s_recordDropped = 0;
+static int s_nextDispatchClient = 0;
+
 static int s_fdWakeupRead;
 static int s_fdWakeupWrite;
 
-static struct ril_event s_commands_event;
 static struct ril_event s_wakeupfd_event;
 static struct ril_event s_listen_event;
 static struct ril_event s_wake_timeout_event;
@@ -170,19 +280,59 @@ static const struct timeval TIMEVAL_WAKE_TIMEOUT = {1,0};
 
 static pthread_mutex_t s_pendingRequestsMutex = PTHREAD_MUTEX_INITIALIZER;
 static pthread_mutex_t s_writeMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t s_responseParcelsMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t s_unsolBatchMutex = PTHREAD_MUTEX_INITIALIZER;
 static pthread_mutex_t s_startupMutex = PTHREAD_MUTEX_INITIALIZER;
 static pthread_cond_t s_startupCond = PTHREAD_COND_INITIALIZER;
 
 static pthread_mutex_t s_dispatchMutex = PTHREAD_MUTEX_INITIALIZER;
 static pthread_cond_t s_dispatchCond = PTHREAD_COND_INITIALIZER;
 
-static RequestInfo *s_pendingRequests = NULL;
+static pthread_mutex_t s_recordMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t s_recordCond = PTHREAD_COND_INITIALIZER;
+
+/*
+ * Pending requests are kept in an open-addressed hash table keyed by
+ * the RequestInfo pointer (which is what the vendor RIL hands back as
+ * its RIL_Token), so RIL_onRequestComplete can validate and dequeue a
+ * token in O(1). The RequestInfo structs themselves come from a fixed
+ * pool so the dispatch path normally does no allocation.
+ * All of this is protected by s_pendingRequestsMutex.
+ */
+static RequestInfo **s_pendingRequests = NULL;
+static size_t s_pendingRequestsSize = 0;    // always a power of 2
+static size_t s_pendingRequestsCount = 0;
 
-static RequestInfo *s_toDispatchHead = NULL;
-static RequestInfo *s_toDispatchTail = NULL;
+static RequestInfo s_requestInfoPool[MAX_PENDING_REQUESTS];
+static RequestInfo *s_requestInfoFreeList = NULL;
+static int s_requestInfoPoolInit = 0;
 
 static UserCallbackInfo *s_last_wake_timeout_info = NULL;
 
+/*
+ * Response parcels are recycled rather than built from scratch for every
+ * response, so their buffers only grow to the working-set size once.
+ * Protected by s_responseParcelsMutex.
+ */
+static Parcel *s_responseParcels[NUM_RESPONSE_PARCELS];
+static int s_numResponseParcels = 0;
+
+/*
+ * Unsolicited response coalescing, see PROPERTY_UNSOL_COALESCE_MS.
+ * The batch and counters are protected by s_unsolBatchMutex.
+ */
+static struct timeval s_unsolCoalesceWindow = {0, 0};
+static int s_unsolCoalesceEnabled = 0;
+
+static BatchedUnsolResponse s_unsolBatch[MAX_COALESCED_UNSOL];
+static int s_unsolBatchCount = 0;
+static int s_unsolBatchWakeLock = 0;    // batch holds a partial wake lock
+static int s_unsolFlushScheduled = 0;
+
+static unsigned int s_unsolReceived = 0;    // indications reported
+static unsigned int s_unsolSuperseded = 0;  // dropped for a newer one
+static unsigned int s_unsolWrites = 0;      // batch writes to the socket
+
 static void *s_lastNITZTimeData = NULL;
 static size_t s_lastNITZTimeDataSize;
 
@@ -245,6 +395,11 @@ static UserCallbackInfo * internalRequestTimedCallback
     (RIL_TimedCallback callback, void *param,
         const struct timeval *relativeTime);
 
+static void triggerEvLoop();
+static void dumpUnsolStats(int fd);
+static void sendUnsolicitedResponse(int unsolResponse, void *data,
+        size_t datalen, RilClient *pClient);
+
 /** Index == requestNumber */
 static CommandInfo s_commands[] = {
 #include "ril_commands.h"
@@ -254,6 +409,9 @@ static UnsolResponseInfo s_unsolResponses[] = {
 #include "ril_unsol_commands.h"
 };
 
+/** Index == requestNumber, protected by s_pendingRequestsMutex */
+static RequestStats s_requestStats[NUM_ELEMS(s_commands)];
+
 
 static char *
 strdupReadString(Parcel &p) {
@@ -265,12 +423,28 @@ strdupReadString(Parcel &p) {
     return strndup16to8(s16, stringlen);
 }
 
+/**
+ * Equivalent to p.writeString16(strdup8to16(s)), but converts straight
+ * into the parcel instead of going through a temporary UTF-16 copy
+ */
 static void writeStringToParcel(Parcel &p, const char *s) {
     char16_t *s16;
     size_t s16_len;
-    s16 = strdup8to16(s, &s16_len);
-    p.writeString16(s16, s16_len);
-    free(s16);
+
+    if (s == NULL) {
+        p.writeInt32(-1);
+        return;
+    }
+
+    s16_len = strlen8to16(s);
+    p.writeInt32(s16_len);
+
+    // writeInplace() zeroes the padding, we supply the terminator
+    s16 = (char16_t *)p.writeInplace((s16_len + 1) * sizeof(char16_t));
+    if (s16 != NULL) {
+        strcpy8to16(s16, s, &s16_len);
+        s16[s16_len] = 0;
+    }
 }
 
 
@@ -287,31 +461,260 @@ void   nullParcelReleaseFunction (const uint8_t* data, size_t dataSize,
     // do nothing -- the data reference lives longer than the Parcel object
 }
 
+static inline size_t
+hashRequestInfo(const RequestInfo *pRI) {
+    // the low bits of a pointer are mostly alignment; mix them away
+    return (size_t)(((uintptr_t)pRI >> 3) * 2654435761u);
+}
+
+/** Called with s_pendingRequestsMutex held */
+static void
+insertPendingRequest(RequestInfo *pRI);
+
+/** Called with s_pendingRequestsMutex held */
+static void
+growPendingRequests() {
+    RequestInfo **oldTable = s_pendingRequests;
+    size_t oldSize = s_pendingRequestsSize;
+    size_t newSize = oldSize == 0 ? 2 * MAX_PENDING_REQUESTS : 2 * oldSize;
+
+    s_pendingRequests = (RequestInfo **)calloc(newSize, sizeof(RequestInfo *));
+    s_pendingRequestsSize = newSize;
+    s_pendingRequestsCount = 0;
+
+    for (size_t i = 0; i < oldSize; i++) {
+        if (oldTable[i] != NULL) {
+            insertPendingRequest(oldTable[i]);
+        }
+    }
+
+    free(oldTable);
+}
+
+static void
+insertPendingRequest(RequestInfo *pRI) {
+    size_t mask;
+    size_t i;
+
+    // keep the load factor at or below 1/2
+    if (2 * (s_pendingRequestsCount + 1) > s_pendingRequestsSize) {
+        growPendingRequests();
+    }
+
+    mask = s_pendingRequestsSize - 1;
+    for (i = hashRequestInfo(pRI) & mask
+            ; s_pendingRequests[i] != NULL
+            ; i = (i + 1) & mask) {
+    }
+
+    s_pendingRequests[i] = pRI;
+    s_pendingRequestsCount++;
+}
+
 /**
- * To be called from dispatch thread
- * Issue a single local request, ensuring that the response
- * is not sent back up to the command process
+ * Called with s_pendingRequestsMutex held
+ * Returns 1 if pRI was pending (and now is not), 0 otherwise
  */
-static void
-issueLocalRequest(int request, void *data, int len) {
+static int
+removePendingRequest(RequestInfo *pRI) {
+    size_t mask;
+    size_t i, j;
+
+    if (s_pendingRequestsCount == 0) {
+        return 0;
+    }
+
+    mask = s_pendingRequestsSize - 1;
+    for (i = hashRequestInfo(pRI) & mask
+            ; s_pendingRequests[i] != pRI
+            ; i = (i + 1) & mask) {
+        if (s_pendingRequests[i] == NULL) {
+            return 0;
+        }
+    }
+
+    // backward-shift deletion keeps probe chains intact without tombstones
+    for (j = (i + 1) & mask; s_pendingRequests[j] != NULL; j = (j + 1) & mask) {
+        size_t home = hashRequestInfo(s_pendingRequests[j]) & mask;
+
+        // move entry j into the hole at i unless its home slot lies
+        // cyclically in (i, j]
+        if ((j > i && (home <= i || home > j))
+                || (j < i && (home <= i && home > j))) {
+            s_pendingRequests[i] = s_pendingRequests[j];
+            i = j;
+        }
+    }
+    s_pendingRequests[i] = NULL;
+    s_pendingRequestsCount--;
+
+    return 1;
+}
+
+static int
+isPooledRequestInfo(RequestInfo *pRI) {
+    return pRI >= &s_requestInfoPool[0]
+            && pRI < &s_requestInfoPool[MAX_PENDING_REQUESTS];
+}
+
+/**
+ * Allocate a RequestInfo for request from pClient (NULL for local
+ * requests) and make it pending
+ * Never returns NULL
+ */
+static RequestInfo *
+allocRequestInfo(int request, RilClient *pClient) {
     RequestInfo *pRI;
+    RequestStats *pStats;
     int ret;
 
-    pRI = (RequestInfo *)calloc(1, sizeof(RequestInfo));
+    ret = pthread_mutex_lock(&s_pendingRequestsMutex);
+    assert (ret == 0);
+
+    if (!s_requestInfoPoolInit) {
+        for (int i = MAX_PENDING_REQUESTS - 1; i >= 0; i--) {
+            s_requestInfoPool[i].p_next = s_requestInfoFreeList;
+            s_requestInfoFreeList = &s_requestInfoPool[i];
+        }
+        s_requestInfoPoolInit = 1;
+    }
+
+    pRI = s_requestInfoFreeList;
+    if (pRI != NULL) {
+        s_requestInfoFreeList = pRI->p_next;
+        memset(pRI, 0, sizeof(RequestInfo));
+    } else {
+        pRI = (RequestInfo *)calloc(1, sizeof(RequestInfo));
+    }
 
-    pRI->local = 1;
-    pRI->token = 0xffffffff;        // token is not used in this context
     pRI->pCI = &(s_commands[request]);
+    pRI->dispatchTime = systemTime(SYSTEM_TIME_MONOTONIC);
+    if (pClient != NULL) {
+        pRI->client = pClient;
+        pRI->clientGeneration = pClient->generation;
+    }
+
+    insertPendingRequest(pRI);
+
+    pStats = &s_requestStats[request];
+    pStats->inFlight++;
+    if (pStats->inFlight > pStats->maxInFlight) {
+        pStats->maxInFlight = pStats->inFlight;
+    }
+
+    ret = pthread_mutex_unlock(&s_pendingRequestsMutex);
+    assert (ret == 0);
+
+    return pRI;
+}
+
+/** Return a RequestInfo that is no longer pending to the pool */
+static void
+freeRequestInfo(RequestInfo *pRI) {
+    int ret;
+
+    if (!isPooledRequestInfo(pRI)) {
+        free(pRI);
+        return;
+    }
+
+    ret = pthread_mutex_lock(&s_pendingRequestsMutex);
+    assert (ret == 0);
+
+    pRI->p_next = s_requestInfoFreeList;
+    s_requestInfoFreeList = pRI;
+
+    ret = pthread_mutex_unlock(&s_pendingRequestsMutex);
+    assert (ret == 0);
+}
+
+/** Called with s_pendingRequestsMutex held */
+static void
+recordRequestLatency(RequestInfo *pRI) {
+    RequestStats *pStats = &s_requestStats[pRI->pCI->requestNumber];
+    nsecs_t latency = systemTime(SYSTEM_TIME_MONOTONIC) - pRI->dispatchTime;
+    int64_t ms = ns2ms(latency);
+    int bucket = 0;
+
+    while (bucket < NUM_LATENCY_BUCKETS - 1 && ms >= (1LL << bucket)) {
+        bucket++;
+    }
+
+    pStats->inFlight--;
+    pStats->completed++;
+    pStats->totalLatency += latency;
+    pStats->latency[bucket]++;
+}
+
+/**
+ * Write the in-flight count and latency histogram for every request
+ * type seen so far to fd, as text
+ */
+static void
+dumpRequestStats(int fd) {
+    // copied under the lock so a slow reader on fd doesn't hold up
+    // dispatch and RIL_onRequestComplete
+    RequestStats stats[NUM_ELEMS(s_requestStats)];
+    int pendingCount;
+    char line[256];
+    int len;
+    int ret;
 
     ret = pthread_mutex_lock(&s_pendingRequestsMutex);
     assert (ret == 0);
 
-    pRI->p_next = s_pendingRequests;
-    s_pendingRequests = pRI;
+    memcpy(stats, s_requestStats, sizeof(stats));
+    pendingCount = (int)s_pendingRequestsCount;
 
     ret = pthread_mutex_unlock(&s_pendingRequestsMutex);
     assert (ret == 0);
 
+    len = snprintf(line, sizeof(line),
+            "request stats: %d pending, latency buckets <1 <2 <4 ... <1024 >=1024 ms\n",
+            pendingCount);
+    write(fd, line, len);
+
+    for (int i = 1; i < (int)NUM_ELEMS(stats); i++) {
+        RequestStats *pStats = &stats[i];
+
+        if (pStats->completed == 0 && pStats->inFlight == 0) {
+            continue;
+        }
+
+        len = snprintf(line, sizeof(line),
+                "%s: inflight=%d max=%d done=%u avg=%lldus [",
+                requestToString(i), pStats->inFlight, pStats->maxInFlight,
+                pStats->completed,
+                pStats->completed == 0 ? 0LL
+                    : (long long)ns2us(pStats->totalLatency / pStats->completed));
+        for (int b = 0; b < NUM_LATENCY_BUCKETS && len < (int)sizeof(line); b++) {
+            len += snprintf(line + len, sizeof(line) - len, "%s%u",
+                    b == 0 ? "" : " ", pStats->latency[b]);
+        }
+        if (len < (int)sizeof(line)) {
+            len += snprintf(line + len, sizeof(line) - len, "]\n");
+        }
+        if (len >= (int)sizeof(line)) {
+            len = sizeof(line) - 1;
+        }
+        write(fd, line, len);
+    }
+}
+
+/**
+ * To be called from dispatch thread
+ * Issue a single local request, ensuring that the response
+ * is not sent back up to the command process
+ */
+static void
+issueLocalRequest(int request, void *data, int len) {
+    RequestInfo *pRI;
+
+    pRI = allocRequestInfo(request, NULL);
+
+    pRI->local = 1;
+    pRI->token = 0xffffffff;        // token is not used in this context
+
     LOGD("C[locl]> %s", requestToString(request));
 
     s_callbacks.onRequest(request, data, len, pRI);
@@ -320,13 +723,12 @@ issueLocalRequest(int request, void *data, int len) {
 
 
 static int
-processCommandBuffer(void *buffer, size_t buflen) {
+processCommandBuffer(void *buffer, size_t buflen, RilClient *pClient) {
     Parcel p;
     status_t status;
     int32_t request;
     int32_t token;
     RequestInfo *pRI;
-    int ret;
 
     p.setData((uint8_t *) buffer, buflen);
 
@@ -346,19 +748,9 @@ processCommandBuffer(void *buffer, size_t buflen) {
     }
 
 
-    pRI = (RequestInfo *)calloc(1, sizeof(RequestInfo));
+    pRI = allocRequestInfo(request, pClient);
 
     pRI->token = token;
-    pRI->pCI = &(s_commands[request]);
-
-    ret = pthread_mutex_lock(&s_pendingRequestsMutex);
-    assert (ret == 0);
-
-    pRI->p_next = s_pendingRequests;
-    s_pendingRequests = pRI;
-
-    ret = pthread_mutex_unlock(&s_pendingRequestsMutex);
-    assert (ret == 0);
 
 /*    sLastDispatchedToken = token; */
 
@@ -1219,112 +1611,411 @@ static void dispatchDataCall(Parcel& p, RequestInfo *pRI) {
     }
 }
 
-static int
-blockingWrite(int fd, const void *buffer, size_t len) {
-    size_t writeOffset = 0;
-    const uint8_t *toWrite;
+/**
+ * Get an empty parcel for building a response frame, with the frame
+ * header already reserved. Return it with releaseResponseParcel().
+ */
+static Parcel *
+obtainResponseParcel() {
+    Parcel *p = NULL;
+
+    pthread_mutex_lock(&s_responseParcelsMutex);
+    if (s_numResponseParcels > 0) {
+        p = s_responseParcels[--s_numResponseParcels];
+    }
+    pthread_mutex_unlock(&s_responseParcelsMutex);
+
+    if (p == NULL) {
+        p = new Parcel();
+    }
+
+    // placeholder, filled in by sendResponse()
+    p->writeInt32(0);
+
+    return p;
+}
+
+static void
+releaseResponseParcel(Parcel *p) {
+    // keep the buffer, unless some oversized response blew it up
+    if (p->dataCapacity() > RESPONSE_HEADER_SIZE + MAX_COMMAND_BYTES) {
+        p->freeData();
+    } else {
+        p->setDataSize(0);
+        p->setDataPosition(0);
+    }
+
+    pthread_mutex_lock(&s_responseParcelsMutex);
+    if (s_numResponseParcels < NUM_RESPONSE_PARCELS) {
+        s_responseParcels[s_numResponseParcels++] = p;
+        p = NULL;
+    }
+    pthread_mutex_unlock(&s_responseParcelsMutex);
 
-    toWrite = (const uint8_t *)buffer;
+    delete p;
+}
 
-    while (writeOffset < len) {
+static int
+blockingWritev(int fd, struct iovec *iov, int iovcnt) {
+    while (iovcnt > 0) {
         ssize_t written;
         do {
-            written = write (fd, toWrite + writeOffset,
-                                len - writeOffset);
+            written = writev (fd, iov, iovcnt);
         } while (written < 0 && errno == EINTR);
 
-        if (written >= 0) {
-            writeOffset += written;
-        } else {   // written < 0
-            LOGE ("RIL Response: unexpected error on write errno:%d", errno);
-            close(fd);
+        if (written < 0) {
+            LOGE ("RIL: unexpected error on writev errno:%d", errno);
             return -1;
         }
+
+        // skip what went out, then retry the remainder
+        while (iovcnt > 0 && (size_t)written >= iov->iov_len) {
+            written -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (uint8_t *)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
     }
 
     return 0;
 }
 
-static int
-sendResponseRaw (const void *data, size_t dataSize) {
-    int fd = s_fdCommand;
-    int ret;
-    uint32_t header;
+/**
+ * Write as much of iov as the socket takes without blocking
+ * Returns the number of bytes written, or -1 on error
+ */
+static ssize_t
+nonBlockingWritev(int fd, const struct iovec *iov, int iovcnt) {
+    struct msghdr msg;
+    ssize_t written;
 
-    if (s_fdCommand < 0) {
-        return -1;
-    }
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = (struct iovec *)iov;
+    msg.msg_iovlen = iovcnt;
 
-    if (dataSize > MAX_COMMAND_BYTES) {
-        LOGE("RIL: packet larger than %u (%u)",
-                MAX_COMMAND_BYTES, (unsigned int )dataSize);
+    do {
+        written = sendmsg(fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+    } while (written < 0 && errno == EINTR);
 
-        return -1;
+    if (written < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        return 0;
     }
 
-    pthread_mutex_lock(&s_writeMutex);
+    return written;
+}
 
-    header = htonl(dataSize);
+/**
+ * Stop writing to a client; the reader sees EOF and tears it down
+ * Called with s_writeMutex held
+ */
+static void
+failClientWrites(RilClient *pClient) {
+    shutdown(pClient->fd, SHUT_RDWR);
+    pClient->writeFailed = 1;
+    pClient->outLen = 0;
+}
 
-    ret = blockingWrite(fd, (void *)&header, sizeof(header));
+/**
+ * Append to the output a client's socket didn't take
+ * Called with s_writeMutex held. Returns -1 if the client is too far
+ * behind or out of memory, in which case it has been shut down. The
+ * primary client is only warned about, losing it loses the radio.
+ */
+static int
+queueClientOutput(RilClient *pClient, const struct iovec *iov, int iovcnt,
+        size_t skip) {
+    size_t len = 0;
 
-    if (ret < 0) {
-        pthread_mutex_unlock(&s_writeMutex);
-        return ret;
+    for (int i = 0; i < iovcnt; i++) {
+        len += iov[i].iov_len;
+    }
+    len -= skip;
+
+    if (pClient->outLen + len > MAX_CLIENT_OUTPUT_BYTES) {
+        if (!pClient->primary) {
+            LOGE("RIL Response: client %d stopped reading, disconnecting",
+                    (int)(pClient - s_clients));
+            failClientWrites(pClient);
+            return -1;
+        }
+        if (pClient->outLen <= MAX_CLIENT_OUTPUT_BYTES) {
+            LOGW("RIL Response: client %d is more than %d bytes behind",
+                    (int)(pClient - s_clients), MAX_CLIENT_OUTPUT_BYTES);
+        }
     }
 
-    ret = blockingWrite(fd, data, dataSize);
+    if (pClient->outLen + len > pClient->outSize) {
+        size_t newSize = pClient->outSize == 0 ? MAX_COMMAND_BYTES
+                : pClient->outSize;
+        uint8_t *newBuf;
 
-    if (ret < 0) {
-        pthread_mutex_unlock(&s_writeMutex);
-        return ret;
+        while (newSize < pClient->outLen + len) {
+            newSize *= 2;
+        }
+        newBuf = (uint8_t *)realloc(pClient->outBuf, newSize);
+        if (newBuf == NULL) {
+            LOGE("RIL Response: no memory to queue %d bytes for client %d",
+                    (int)len, (int)(pClient - s_clients));
+            failClientWrites(pClient);
+            return -1;
+        }
+        pClient->outBuf = newBuf;
+        pClient->outSize = newSize;
     }
 
-    pthread_mutex_unlock(&s_writeMutex);
+    for (int i = 0; i < iovcnt; i++) {
+        const uint8_t *base = (const uint8_t *)iov[i].iov_base;
+        size_t n = iov[i].iov_len;
 
-    return 0;
-}
+        if (skip >= n) {
+            skip -= n;
+            continue;
+        }
+        memcpy(pClient->outBuf + pClient->outLen, base + skip, n - skip);
+        pClient->outLen += n - skip;
+        skip = 0;
+    }
 
-static int
-sendResponse (Parcel &p) {
-    printResponse;
-    return sendResponseRaw(p.data(), p.dataSize());
+    return 0;
 }
 
-/** response is an int* pointing to an array of ints*/
-
+/**
+ * Write out what is queued for a client
+ * Called with s_writeMutex held. Returns -1 on a write error.
+ */
 static int
-responseInts(Parcel &p, void *response, size_t responselen) {
-    int numInts;
+drainClientOutput(RilClient *pClient) {
+    struct iovec iov;
+    ssize_t written;
 
-    if (response == NULL && responselen != 0) {
-        LOGE("invalid response: NULL");
-        return RIL_ERRNO_INVALID_RESPONSE;
-    }
-    if (responselen % sizeof(int) != 0) {
-        LOGE("invalid response length %d expected multiple of %d\n",
-            (int)responselen, (int)sizeof(int));
-        return RIL_ERRNO_INVALID_RESPONSE;
+    if (pClient->outLen == 0) {
+        return 0;
     }
 
-    int *p_int = (int *) response;
-
-    numInts = responselen / sizeof(int *);
-    p.writeInt32 (numInts);
+    iov.iov_base = pClient->outBuf;
+    iov.iov_len = pClient->outLen;
+    written = nonBlockingWritev(pClient->fd, &iov, 1);
 
-    /* each int*/
-    startResponse;
-    for (int i = 0 ; i < numInts ; i++) {
-        appendPrintBuf("%s%d,", printBuf, p_int[i]);
-        p.writeInt32(p_int[i]);
+    if (written < 0) {
+        LOGE ("RIL Response: unexpected error on writev errno:%d", errno);
+        failClientWrites(pClient);
+        return -1;
     }
-    removeLastChar;
-    closeResponse;
+
+    pClient->outLen -= written;
+    memmove(pClient->outBuf, pClient->outBuf + written, pClient->outLen);
 
     return 0;
 }
 
-/** response is a char **, pointing to an array of char *'s
+/** Returns 1 if the framework's connection is up */
+static int
+primaryClientConnected() {
+    int connected = 0;
+
+    pthread_mutex_lock(&s_writeMutex);
+    for (int i = 0; i < MAX_COMMAND_CLIENTS; i++) {
+        if (s_clients[i].fd >= 0 && s_clients[i].primary) {
+            connected = 1;
+        }
+    }
+    pthread_mutex_unlock(&s_writeMutex);
+
+    return connected;
+}
+
+/**
+ * Have the event loop tell us when a client with queued output can
+ * take more. Only the loop turns the watch off again, once it has
+ * drained the client, see processCommandsCallback().
+ * Called with s_writeMutex held. Returns 1 if the loop needs a wakeup.
+ */
+static int
+watchClientOutput(RilClient *pClient) {
+    if (pClient->outLen == 0 || pClient->writeWatched) {
+        return 0;
+    }
+
+    pClient->writeWatched = 1;
+    ril_event_want_write(&pClient->event, true);
+    return 1;
+}
+
+/**
+ * writeToClients() for callers that already hold s_writeMutex. Sets
+ * *pWakeup if the event loop has to be woken once it is released.
+ */
+static int
+writeToClientsLocked(const struct iovec *iov, int iovcnt, RilClient *pClient,
+        int generation, int *pWakeup) {
+    int ret = -1;
+    int wakeup = 0;
+
+    assert(iovcnt <= MAX_COALESCED_UNSOL);
+
+    for (int i = 0; i < MAX_COMMAND_CLIENTS; i++) {
+        RilClient *pCur = &s_clients[i];
+        ssize_t written = 0;
+
+        if (pCur->fd < 0 || pCur->writeFailed
+                || (pClient != NULL && (pCur != pClient
+                || pCur->generation != generation))) {
+            continue;
+        }
+
+        // anything still queued has to go out first to keep the order
+        if (drainClientOutput(pCur) < 0) {
+            continue;
+        }
+
+        if (pCur->outLen == 0) {
+            written = nonBlockingWritev(pCur->fd, iov, iovcnt);
+            if (written < 0) {
+                LOGE ("RIL Response: unexpected error on writev errno:%d",
+                        errno);
+                failClientWrites(pCur);
+                continue;
+            }
+        }
+
+        if (queueClientOutput(pCur, iov, iovcnt, written) == 0) {
+            ret = 0;
+            wakeup |= watchClientOutput(pCur);
+        }
+    }
+
+    *pWakeup |= wakeup;
+
+    return ret;
+}
+
+/**
+ * Write a frame to pClient, or to every connected client if pClient is
+ * NULL. A client that has reconnected since generation was taken is
+ * skipped. Returns 0 if at least one client got the frame.
+ * Never blocks: what a client's socket doesn't take is queued behind
+ * its earlier output and retried from the event loop.
+ */
+static int
+writeToClients(const struct iovec *iov, int iovcnt, RilClient *pClient,
+        int generation) {
+    int ret;
+    int wakeup = 0;
+
+    pthread_mutex_lock(&s_writeMutex);
+    ret = writeToClientsLocked(iov, iovcnt, pClient, generation, &wakeup);
+    pthread_mutex_unlock(&s_writeMutex);
+
+    if (wakeup) {
+        triggerEvLoop();
+    }
+
+    return ret;
+}
+
+static int
+sendResponseRaw (const void *data, size_t dataSize, RilClient *pClient) {
+    uint32_t header;
+    struct iovec iov[2];
+
+    if (dataSize > MAX_COMMAND_BYTES) {
+        LOGE("RIL: packet larger than %u (%u)",
+                MAX_COMMAND_BYTES, (unsigned int )dataSize);
+
+        return -1;
+    }
+
+    header = htonl(dataSize);
+
+    iov[0].iov_base = &header;
+    iov[0].iov_len = sizeof(header);
+    iov[1].iov_base = (void *)data;
+    iov[1].iov_len = dataSize;
+
+    return writeToClients(iov, 2, pClient,
+            pClient == NULL ? 0 : pClient->generation);
+}
+
+/**
+ * Fill in the reserved header of a parcel from obtainResponseParcel()
+ * Returns -1 if the payload is too large to send
+ */
+static int
+finishResponseFrame (Parcel &p) {
+    size_t dataSize = p.dataSize() - RESPONSE_HEADER_SIZE;
+    uint32_t *header;
+
+    if (dataSize > MAX_COMMAND_BYTES) {
+        LOGE("RIL: packet larger than %u (%u)",
+                MAX_COMMAND_BYTES, (unsigned int )dataSize);
+
+        return -1;
+    }
+
+    header = (uint32_t *)p.data();
+    *header = htonl(dataSize);
+
+    return 0;
+}
+
+/**
+ * Send a parcel from obtainResponseParcel(): fill in the reserved
+ * header and write header and payload with one system call.
+ * A NULL pClient sends to every connected client.
+ */
+static int
+sendResponse (Parcel &p, RilClient *pClient, int generation) {
+    struct iovec iov;
+
+    printResponse;
+
+    if (finishResponseFrame(p) < 0) {
+        return -1;
+    }
+
+    iov.iov_base = (void *)p.data();
+    iov.iov_len = p.dataSize();
+
+    return writeToClients(&iov, 1, pClient, generation);
+}
+
+/** response is an int* pointing to an array of ints*/
+
+static int
+responseInts(Parcel &p, void *response, size_t responselen) {
+    int numInts;
+
+    if (response == NULL && responselen != 0) {
+        LOGE("invalid response: NULL");
+        return RIL_ERRNO_INVALID_RESPONSE;
+    }
+    if (responselen % sizeof(int) != 0) {
+        LOGE("invalid response length %d expected multiple of %d\n",
+            (int)responselen, (int)sizeof(int));
+        return RIL_ERRNO_INVALID_RESPONSE;
+    }
+
+    int *p_int = (int *) response;
+
+    numInts = responselen / sizeof(int *);
+    p.writeInt32 (numInts);
+
+    /* each int*/
+    startResponse;
+    for (int i = 0 ; i < numInts ; i++) {
+        appendPrintBuf("%s%d,", printBuf, p_int[i]);
+        p.writeInt32(p_int[i]);
+    }
+    removeLastChar;
+    closeResponse;
+
+    return 0;
+}
+
+/** response is a char **, pointing to an array of char *'s
     The parcel will begin with the version */
 static int responseStringsWithVersion(int version, Parcel &p, void *response, size_t responselen) {
     p.writeInt32(version);
@@ -2263,41 +2954,327 @@ static void processWakeupCallback(int fd, short flags, void *param) {
     } while (ret > 0 || (ret < 0 && errno == EINTR));
 }
 
-static void onCommandsSocketClosed() {
+static void onCommandsSocketClosed(RilClient *pClient) {
     int ret;
-    RequestInfo *p_cur;
 
     /* mark pending requests as "cancelled" so we dont report responses */
 
     ret = pthread_mutex_lock(&s_pendingRequestsMutex);
     assert (ret == 0);
 
-    p_cur = s_pendingRequests;
+    for (size_t i = 0; i < s_pendingRequestsSize; i++) {
+        RequestInfo *pRI = s_pendingRequests[i];
 
-    for (p_cur = s_pendingRequests
-            ; p_cur != NULL
-            ; p_cur  = p_cur->p_next
-    ) {
-        p_cur->cancelled = 1;
+        if (pRI != NULL && pRI->client == pClient) {
+            pRI->cancelled = 1;
+        }
     }
 
     ret = pthread_mutex_unlock(&s_pendingRequestsMutex);
     assert (ret == 0);
 }
 
+/** Called with s_dispatchMutex held */
+static RilClient *
+nextClientToDispatch() {
+    for (int i = 0; i < MAX_COMMAND_CLIENTS; i++) {
+        RilClient *pClient
+            = &s_clients[(s_nextDispatchClient + i) % MAX_COMMAND_CLIENTS];
+
+        // one command per client at a time keeps each client's
+        // requests in order
+        if (pClient->queueHead != NULL && !pClient->dispatching) {
+            s_nextDispatchClient
+                = (pClient - s_clients + 1) % MAX_COMMAND_CLIENTS;
+            return pClient;
+        }
+    }
+
+    return NULL;
+}
+
+static void *
+dispatchLoop(void *param) {
+    for (;;) {
+        RilClient *pClient;
+        QueuedCommand *pCmd;
+
+        pthread_mutex_lock(&s_dispatchMutex);
+
+        while ((pClient = nextClientToDispatch()) == NULL) {
+            pthread_cond_wait(&s_dispatchCond, &s_dispatchMutex);
+        }
+
+        pCmd = pClient->queueHead;
+        pClient->queueHead = pCmd->p_next;
+        if (pClient->queueHead == NULL) {
+            pClient->queueTail = NULL;
+        }
+        pClient->dispatching = 1;
+
+        pthread_mutex_unlock(&s_dispatchMutex);
+
+        processCommandBuffer(pCmd + 1, pCmd->len, pClient);
+        free(pCmd);
+
+        pthread_mutex_lock(&s_dispatchMutex);
+        pClient->dispatching = 0;
+        pthread_cond_broadcast(&s_dispatchCond);
+        pthread_mutex_unlock(&s_dispatchMutex);
+    }
+
+    return NULL;
+}
+
+/**
+ * Hand a command to the dispatch threads. The record stream reuses
+ * its buffer, so the command is copied.
+ */
+static void
+queueCommand(RilClient *pClient, void *buffer, size_t buflen) {
+    QueuedCommand *pCmd;
+
+    pCmd = (QueuedCommand *)malloc(sizeof(QueuedCommand) + buflen);
+    pCmd->p_next = NULL;
+    pCmd->len = buflen;
+    memcpy(pCmd + 1, buffer, buflen);
+
+    pthread_mutex_lock(&s_dispatchMutex);
+
+    if (pClient->queueTail == NULL) {
+        pClient->queueHead = pCmd;
+    } else {
+        pClient->queueTail->p_next = pCmd;
+    }
+    pClient->queueTail = pCmd;
+
+    pthread_cond_signal(&s_dispatchCond);
+    pthread_mutex_unlock(&s_dispatchMutex);
+}
+
+static void closeClient(RilClient *pClient) {
+    QueuedCommand *pCmd;
+    int fd;
+
+    pthread_mutex_lock(&s_writeMutex);
+    fd = pClient->fd;
+    pClient->fd = -1;
+    free(pClient->outBuf);
+    pClient->outBuf = NULL;
+    pClient->outLen = pClient->outSize = 0;
+    pClient->writeWatched = 0;
+    pClient->primary = 0;
+    pthread_mutex_unlock(&s_writeMutex);
+
+    ril_event_del(&pClient->event);
+    close(fd);
+
+    record_stream_free(pClient->p_rs);
+    pClient->p_rs = NULL;
+
+    /* drop commands that never made it to a dispatch thread */
+    pthread_mutex_lock(&s_dispatchMutex);
+    pCmd = pClient->queueHead;
+    pClient->queueHead = pClient->queueTail = NULL;
+    pthread_mutex_unlock(&s_dispatchMutex);
+
+    while (pCmd != NULL) {
+        QueuedCommand *pNext = pCmd->p_next;
+        free(pCmd);
+        pCmd = pNext;
+    }
+
+    onCommandsSocketClosed(pClient);
+
+    s_numClients--;
+
+    /* start listening for new connections again */
+    if (!s_listening) {
+        s_listening = 1;
+        rilEventAddWakeup(&s_listen_event);
+    }
+}
+
+/**
+ * Hand a command to the recorder thread. The event loop never writes
+ * the capture itself; if the recorder falls behind, commands are dropped.
+ */
+static void
+recordCommand(const void *buffer, size_t buflen) {
+    QueuedCommand *pCmd;
+
+    pthread_mutex_lock(&s_recordMutex);
+
+    if (!s_recording) {
+        pthread_mutex_unlock(&s_recordMutex);
+        return;
+    }
+
+    if (s_recordQueuedBytes + buflen > MAX_RECORD_QUEUE_BYTES) {
+        if (s_recordDropped++ == 0) {
+            LOGW("Recorder is behind, dropping commands");
+        }
+        pthread_mutex_unlock(&s_recordMutex);
+        return;
+    }
+
+    pCmd = (QueuedCommand *)malloc(sizeof(QueuedCommand) + buflen);
+    pCmd->p_next = NULL;
+    pCmd->len = buflen;
+    memcpy(pCmd + 1, buffer, buflen);
+
+    if (s_recordTail == NULL) {
+        s_recordHead = pCmd;
+    } else {
+        s_recordTail->p_next = pCmd;
+    }
+    s_recordTail = pCmd;
+    s_recordQueuedBytes += buflen;
+
+    pthread_cond_signal(&s_recordCond);
+    pthread_mutex_unlock(&s_recordMutex);
+}
+
+static void
+freeCommandList(QueuedCommand *pCmd) {
+    while (pCmd != NULL) {
+        QueuedCommand *pNext = pCmd->p_next;
+        free(pCmd);
+        pCmd = pNext;
+    }
+}
+
+/**
+ * Recorder thread: append queued commands to the capture file, each with
+ * the same big-endian length header it had on the socket
+ */
+static void *
+recordLoop(void *param) {
+    int fd = (int)(intptr_t)param;
+
+    for (;;) {
+        QueuedCommand *pCmd;
+
+        pthread_mutex_lock(&s_recordMutex);
+        while (s_recordHead == NULL) {
+            pthread_cond_wait(&s_recordCond, &s_recordMutex);
+        }
+        pCmd = s_recordHead;
+        s_recordHead = s_recordTail = NULL;
+        s_recordQueuedBytes = 0;
+        pthread_mutex_unlock(&s_recordMutex);
+
+        while (pCmd != NULL) {
+            QueuedCommand *pNext = pCmd->p_next;
+            uint32_t header = htonl(pCmd->len);
+            struct iovec iov[2];
+
+            iov[0].iov_base = &header;
+            iov[0].iov_len = sizeof(header);
+            iov[1].iov_base = pCmd + 1;
+            iov[1].iov_len = pCmd->len;
+
+            if (blockingWritev(fd, iov, 2) < 0) {
+                break;
+            }
+
+            free(pCmd);
+            pCmd = pNext;
+        }
+
+        if (pCmd != NULL) {
+            LOGE("Stopped recording commands");
+            freeCommandList(pCmd);
+            break;
+        }
+    }
+
+    close(fd);
+
+    pthread_mutex_lock(&s_recordMutex);
+    s_recording = 0;
+    freeCommandList(s_recordHead);
+    s_recordHead = s_recordTail = NULL;
+    s_recordQueuedBytes = 0;
+    pthread_mutex_unlock(&s_recordMutex);
+
+    return NULL;
+}
+
+/**
+ * Start recording commands to RECORD_COMMANDS_DIR/name, on debuggable
+ * builds only
+ */
+static void
+startRecording(const char *name) {
+    char debuggable[PROPERTY_VALUE_MAX];
+    char path[sizeof(RECORD_COMMANDS_DIR) + PROPERTY_VALUE_MAX];
+    pthread_t tid;
+    pthread_attr_t attr;
+    int fd;
+
+    property_get("ro.debuggable", debuggable, "0");
+    if (strcmp(debuggable, "1") != 0) {
+        LOGW("Ignoring " PROPERTY_RECORD_COMMANDS " on a user build");
+        return;
+    }
+
+    if (strchr(name, '/') != NULL || name[0] == '.') {
+        LOGE(PROPERTY_RECORD_COMMANDS " must name a file in "
+                RECORD_COMMANDS_DIR ", not %s", name);
+        return;
+    }
+
+    snprintf(path, sizeof(path), RECORD_COMMANDS_DIR "/%s", name);
+    fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_NOFOLLOW, 0600);
+    if (fd < 0) {
+        LOGE("Unable to open %s: %s", path, strerror(errno));
+        return;
+    }
+
+    s_recording = 1;
+
+    pthread_attr_init (&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if (pthread_create(&tid, &attr, recordLoop, (void *)(intptr_t)fd) != 0) {
+        LOGE("Failed to create recorder thread");
+        s_recording = 0;
+        close(fd);
+        return;
+    }
+
+    LOGW("RIL_register: recording commands to %s", path);
+}
+
 static void processCommandsCallback(int fd, short flags, void *param) {
-    RecordStream *p_rs;
+    RilClient *pClient;
     void *p_record;
     size_t recordlen;
     int ret;
 
-    assert(fd == s_fdCommand);
+    pClient = (RilClient *)param;
+
+    assert(fd == pClient->fd);
+
+    if (flags & RIL_EVENT_WRITE) {
+        pthread_mutex_lock(&s_writeMutex);
+        if (!pClient->writeFailed) {
+            drainClientOutput(pClient);
+        }
+        if (pClient->outLen == 0) {
+            pClient->writeWatched = 0;
+            ril_event_want_write(&pClient->event, false);
+        }
+        pthread_mutex_unlock(&s_writeMutex);
+    }
 
-    p_rs = (RecordStream *)param;
+    if (!(flags & RIL_EVENT_READ)) {
+        return;
+    }
 
     for (;;) {
         /* loop until EAGAIN/EINTR, end of stream, or other error */
-        ret = record_stream_get_next(p_rs, &p_record, &recordlen);
+        ret = record_stream_get_next(pClient->p_rs, &p_record, &recordlen);
 
         if (ret == 0 && p_record == NULL) {
             /* end-of-stream */
@@ -2305,7 +3282,12 @@ static void processCommandsCallback(int fd, short flags, void *param) {
         } else if (ret < 0) {
             break;
         } else if (ret == 0) { /* && p_record != NULL */
-            processCommandBuffer(p_record, recordlen);
+            recordCommand(p_record, recordlen);
+            if (s_numDispatchThreads > 0) {
+                queueCommand(pClient, p_record, recordlen);
+            } else {
+                processCommandBuffer(p_record, recordlen, pClient);
+            }
         }
     }
 
@@ -2317,34 +3299,25 @@ static void processCommandsCallback(int fd, short flags, void *param) {
             LOGW("EOS.  Closing command socket.");
         }
 
-        close(s_fdCommand);
-        s_fdCommand = -1;
-
-        ril_event_del(&s_commands_event);
-
-        record_stream_free(p_rs);
-
-        /* start listening for new connections again */
-        rilEventAddWakeup(&s_listen_event);
-
-        onCommandsSocketClosed();
+        closeClient(pClient);
     }
 }
 
 
-static void onNewCommandConnect() {
+static void onNewCommandConnect(RilClient *pClient) {
     // Inform we are connected and the ril version
     int rilVer = s_callbacks.version;
-    RIL_onUnsolicitedResponse(RIL_UNSOL_RIL_CONNECTED,
-                                    &rilVer, sizeof(rilVer));
+    sendUnsolicitedResponse(RIL_UNSOL_RIL_CONNECTED,
+                                    &rilVer, sizeof(rilVer), pClient);
 
     // implicit radio state changed
-    RIL_onUnsolicitedResponse(RIL_UNSOL_RESPONSE_RADIO_STATE_CHANGED,
-                                    NULL, 0);
+    sendUnsolicitedResponse(RIL_UNSOL_RESPONSE_RADIO_STATE_CHANGED,
+                                    NULL, 0, pClient);
 
-    // Send last NITZ time data, in case it was missed
-    if (s_lastNITZTimeData != NULL) {
-        sendResponseRaw(s_lastNITZTimeData, s_lastNITZTimeDataSize);
+    // Send last NITZ time data, in case it was missed. Other clients
+    // connecting first mustn't take it from the framework.
+    if (s_lastNITZTimeData != NULL && pClient->primary) {
+        sendResponseRaw(s_lastNITZTimeData, s_lastNITZTimeDataSize, pClient);
 
         free(s_lastNITZTimeData);
         s_lastNITZTimeData = NULL;
@@ -2368,7 +3341,8 @@ static void listenCallback (int fd, short flags, void *param) {
     int ret;
     int err;
     int is_phone_socket;
-    RecordStream *p_rs;
+    int fdCommand;
+    RilClient *pClient = NULL;
 
     struct sockaddr_un peeraddr;
     socklen_t socklen = sizeof (peeraddr);
@@ -2378,14 +3352,18 @@ static void listenCallback (int fd, short flags, void *param) {
 
     struct passwd *pwd = NULL;
 
-    assert (s_fdCommand < 0);
+    assert (s_numClients < MAX_COMMAND_CLIENTS);
     assert (fd == s_fdListen);
 
-    s_fdCommand = accept(s_fdListen, (sockaddr *) &peeraddr, &socklen);
+    /* s_listen_event is non-persistent; rearm it below if there's room */
+    s_listening = 0;
 
-    if (s_fdCommand < 0 ) {
+    fdCommand = accept(s_fdListen, (sockaddr *) &peeraddr, &socklen);
+
+    if (fdCommand < 0 ) {
         LOGE("Error on accept() errno:%d", errno);
         /* start listening for new connections again */
+        s_listening = 1;
         rilEventAddWakeup(&s_listen_event);
 	      return;
     }
@@ -2396,7 +3374,7 @@ static void listenCallback (int fd, short flags, void *param) {
     errno = 0;
     is_phone_socket = 0;
 
-    err = getsockopt(s_fdCommand, SOL_SOCKET, SO_PEERCRED, &creds, &szCreds);
+    err = getsockopt(fdCommand, SOL_SOCKET, SO_PEERCRED, &creds, &szCreds);
 
     if (err == 0 && szCreds > 0) {
         errno = 0;
@@ -2414,36 +3392,72 @@ static void listenCallback (int fd, short flags, void *param) {
         LOGD("Error on getsockopt() errno: %d", errno);
     }
 
-    if ( !is_phone_socket ) {
-      LOGE("RILD must accept socket from %s", PHONE_PROCESS);
+    /* a slot whose last commands are still being dispatched can't be
+     * reused yet */
+    if (is_phone_socket) {
+        pthread_mutex_lock(&s_dispatchMutex);
+        for (int i = 0; i < MAX_COMMAND_CLIENTS; i++) {
+            if (s_clients[i].fd < 0 && !s_clients[i].dispatching) {
+                pClient = &s_clients[i];
+                break;
+            }
+        }
+        pthread_mutex_unlock(&s_dispatchMutex);
+    }
 
-      close(s_fdCommand);
-      s_fdCommand = -1;
+    if ( !is_phone_socket || pClient == NULL) {
+      if (!is_phone_socket) {
+          LOGE("RILD must accept socket from %s", PHONE_PROCESS);
+      } else {
+          LOGE("RILD has no free client slot");
+      }
 
-      onCommandsSocketClosed();
+      close(fdCommand);
 
       /* start listening for new connections again */
+      s_listening = 1;
       rilEventAddWakeup(&s_listen_event);
 
       return;
     }
 
-    ret = fcntl(s_fdCommand, F_SETFL, O_NONBLOCK);
+    ret = fcntl(fdCommand, F_SETFL, O_NONBLOCK);
 
     if (ret < 0) {
         LOGE ("Error setting O_NONBLOCK errno:%d", errno);
     }
 
-    LOGI("libril: new connection");
+    s_numClients++;
+    LOGI("libril: new connection (%d of %d)", s_numClients, MAX_COMMAND_CLIENTS);
 
-    p_rs = record_stream_new(s_fdCommand, MAX_COMMAND_BYTES);
+    pClient->p_rs = record_stream_new(fdCommand, MAX_COMMAND_BYTES);
 
-    ril_event_set (&s_commands_event, s_fdCommand, 1,
-        processCommandsCallback, p_rs);
+    // set up before writers can see the fd and watch the event for output
+    ril_event_set (&pClient->event, fdCommand, 1,
+        processCommandsCallback, pClient);
 
-    rilEventAddWakeup (&s_commands_event);
+    pthread_mutex_lock(&s_writeMutex);
+    // the first client in, and the next one in after it leaves, is the
+    // framework; rild's other users come and go beside it
+    pClient->primary = 1;
+    for (int i = 0; i < MAX_COMMAND_CLIENTS; i++) {
+        if (s_clients[i].fd >= 0 && s_clients[i].primary) {
+            pClient->primary = 0;
+        }
+    }
+    pClient->fd = fdCommand;
+    pClient->generation++;
+    pClient->writeFailed = 0;
+    pthread_mutex_unlock(&s_writeMutex);
+
+    rilEventAddWakeup (&pClient->event);
 
-    onNewCommandConnect();
+    if (s_numClients < MAX_COMMAND_CLIENTS) {
+        s_listening = 1;
+        rilEventAddWakeup(&s_listen_event);
+    }
+
+    onNewCommandConnect(pClient);
 }
 
 static void freeDebugCallbackArgs(int number, char **args) {
@@ -2509,9 +3523,14 @@ static void debugCallback (int fd, short flags, void *param) {
             LOGI ("Connection on debug port: issuing radio power off.");
             data = 0;
             issueLocalRequest(RIL_REQUEST_RADIO_POWER, &data, sizeof(int));
-            // Close the socket
-            close(s_fdCommand);
-            s_fdCommand = -1;
+            // Close the sockets; the readers see EOF and clean up
+            pthread_mutex_lock(&s_writeMutex);
+            for (int i = 0; i < MAX_COMMAND_CLIENTS; i++) {
+                if (s_clients[i].fd >= 0) {
+                    shutdown(s_clients[i].fd, SHUT_RDWR);
+                }
+            }
+            pthread_mutex_unlock(&s_writeMutex);
             break;
         case 2:
             LOGI ("Debug port: issuing unsolicited voice network change.");
@@ -2574,6 +3593,11 @@ static void debugCallback (int fd, short flags, void *param) {
             issueLocalRequest(RIL_REQUEST_HANGUP, &hangupData,
                               sizeof(hangupData));
             break;
+        case 11:
+            LOGI("Debug port: Dump stats");
+            dumpRequestStats(acceptFD);
+            dumpUnsolStats(acceptFD);
+            break;
         default:
             LOGE ("Invalid request");
             break;
@@ -2674,6 +3698,10 @@ extern "C" void
 RIL_register (const RIL_RadioFunctions *callbacks) {
     int ret;
     int flags;
+    int coalesceMs;
+    char coalesceProp[PROPERTY_VALUE_MAX];
+    char dispatchProp[PROPERTY_VALUE_MAX];
+    char recordProp[PROPERTY_VALUE_MAX];
 
     if (callbacks == NULL) {
         LOGE("RIL_register: RIL_RadioFunctions * null");
@@ -2701,6 +3729,16 @@ RIL_register (const RIL_RadioFunctions *callbacks) {
 
     s_registerCalled = 1;
 
+    property_get(PROPERTY_UNSOL_COALESCE_MS, coalesceProp, "0");
+    coalesceMs = atoi(coalesceProp);
+    if (coalesceMs > 0) {
+        LOGI("RIL_register: coalescing unsolicited responses for %dms",
+                coalesceMs);
+        s_unsolCoalesceWindow.tv_sec = coalesceMs / 1000;
+        s_unsolCoalesceWindow.tv_usec = (coalesceMs % 1000) * 1000;
+        s_unsolCoalesceEnabled = 1;
+    }
+
     // Little self-check
 
     for (int i = 0; i < (int)NUM_ELEMS(s_commands); i++) {
@@ -2748,10 +3786,41 @@ RIL_register (const RIL_RadioFunctions *callbacks) {
 #endif
 
 
-    /* note: non-persistent so we can accept only one connection at a time */
+    for (int i = 0; i < MAX_COMMAND_CLIENTS; i++) {
+        s_clients[i].fd = -1;
+    }
+
+    property_get(PROPERTY_DISPATCH_THREADS, dispatchProp, "0");
+    s_numDispatchThreads = atoi(dispatchProp);
+    if (s_numDispatchThreads > MAX_DISPATCH_THREADS) {
+        s_numDispatchThreads = MAX_DISPATCH_THREADS;
+    }
+    for (int i = 0; i < s_numDispatchThreads; i++) {
+        pthread_t tid;
+        pthread_attr_t attr;
+
+        pthread_attr_init (&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        if (pthread_create(&tid, &attr, dispatchLoop, NULL) != 0) {
+            LOGE("Failed to create dispatch thread %d", i);
+            s_numDispatchThreads = i;
+            break;
+        }
+    }
+    if (s_numDispatchThreads > 0) {
+        LOGI("RIL_register: %d dispatch threads", s_numDispatchThreads);
+    }
+
+    if (property_get(PROPERTY_RECORD_COMMANDS, recordProp, "") > 0) {
+        startRecording(recordProp);
+    }
+
+    /* note: non-persistent so we can stop accepting once all client
+     * slots are taken */
     ril_event_set (&s_listen_event, s_fdListen, false,
                 listenCallback, NULL);
 
+    s_listening = 1;
     rilEventAddWakeup (&s_listen_event);
 
 #if 1
@@ -2789,16 +3858,9 @@ checkAndDequeueRequestInfo(struct RequestInfo *pRI) {
 
     pthread_mutex_lock(&s_pendingRequestsMutex);
 
-    for(RequestInfo **ppCur = &s_pendingRequests
-        ; *ppCur != NULL
-        ; ppCur = &((*ppCur)->p_next)
-    ) {
-        if (pRI == *ppCur) {
-            ret = 1;
-
-            *ppCur = (*ppCur)->p_next;
-            break;
-        }
+    ret = removePendingRequest(pRI);
+    if (ret) {
+        recordRequestLatency(pRI);
     }
 
     pthread_mutex_unlock(&s_pendingRequestsMutex);
@@ -2832,7 +3894,7 @@ RIL_onRequestComplete(RIL_Token t, RIL_Errno e, void *response, size_t responsel
         pRI->token, requestToString(pRI->pCI->requestNumber));
 
     if (pRI->cancelled == 0) {
-        Parcel p;
+        Parcel &p = *obtainResponseParcel();
 
         p.writeInt32 (RESPONSE_SOLICITED);
         p.writeInt32 (pRI->token);
@@ -2855,14 +3917,14 @@ RIL_onRequestComplete(RIL_Token t, RIL_Errno e, void *response, size_t responsel
             appendPrintBuf("%s fails by %s", printBuf, failCauseToString(e));
         }
 
-        if (s_fdCommand < 0) {
+        if (sendResponse(p, pRI->client, pRI->clientGeneration) != 0) {
             LOGD ("RIL onRequestComplete: Command channel closed");
         }
-        sendResponse(p);
+        releaseResponseParcel(&p);
     }
 
 done:
-    free(pRI);
+    freeRequestInfo(pRI);
 }
 
 
@@ -2881,8 +3943,15 @@ releaseWakeLock() {
  */
 static void
 wakeTimeoutCallback (void *param) {
+    int batchHoldsLock;
+
+    // the coalescing batch releases its own wake lock when it is flushed
+    pthread_mutex_lock(&s_unsolBatchMutex);
+    batchHoldsLock = s_unsolBatchWakeLock;
+    pthread_mutex_unlock(&s_unsolBatchMutex);
+
     // We're using "param != NULL" as a cancellation mechanism
-    if (param == NULL) {
+    if (param == NULL && !batchHoldsLock) {
         //LOGD("wakeTimeout: releasing wake lock");
 
         releaseWakeLock();
@@ -2891,14 +3960,207 @@ wakeTimeoutCallback (void *param) {
     }
 }
 
-extern "C"
-void RIL_onUnsolicitedResponse(int unsolResponse, void *data,
-                                size_t datalen)
+/**
+ * Release the partial wake lock after TIMEVAL_WAKE_TIMEOUT, replacing
+ * any release that was already scheduled
+ */
+static void
+scheduleWakeTimeout() {
+    // Cancel the previous request
+    if (s_last_wake_timeout_info != NULL) {
+        s_last_wake_timeout_info->userParam = (void *)1;
+    }
+
+    s_last_wake_timeout_info
+        = internalRequestTimedCallback(wakeTimeoutCallback, NULL,
+                                        &TIMEVAL_WAKE_TIMEOUT);
+}
+
+/** Cancel a pending wake lock release without scheduling another */
+static void
+cancelWakeTimeout() {
+    if (s_last_wake_timeout_info != NULL) {
+        s_last_wake_timeout_info->userParam = (void *)1;
+        s_last_wake_timeout_info = NULL;
+    }
+}
+
+/**
+ * Send everything in the coalescing batch with a single write
+ * Called with s_unsolBatchMutex held, returns with it released. The
+ * batch is taken under the lock and written after it is dropped, so
+ * reporters never wait on the socket. s_writeMutex is taken before the
+ * batch lock is let go so a later flush can't overtake this one.
+ */
+static void
+flushUnsolBatchAndUnlock() {
+    BatchedUnsolResponse batch[MAX_COALESCED_UNSOL];
+    struct iovec iov[MAX_COALESCED_UNSOL];
+    int count = s_unsolBatchCount;
+    int wakeLock = s_unsolBatchWakeLock;
+    int iovcnt = 0;
+    int wakeup = 0;
+    int ret = -1;
+
+    if (count == 0) {
+        pthread_mutex_unlock(&s_unsolBatchMutex);
+        return;
+    }
+
+    memcpy(batch, s_unsolBatch, count * sizeof(batch[0]));
+    s_unsolBatchCount = 0;
+    // the next batch grabs the wake lock again for itself
+    s_unsolBatchWakeLock = 0;
+
+    pthread_mutex_lock(&s_writeMutex);
+    pthread_mutex_unlock(&s_unsolBatchMutex);
+
+    for (int i = 0; i < count; i++) {
+        Parcel *p = batch[i].p;
+
+        if (finishResponseFrame(*p) == 0) {
+            iov[iovcnt].iov_base = (void *)p->data();
+            iov[iovcnt].iov_len = p->dataSize();
+            iovcnt++;
+        }
+    }
+
+    if (iovcnt > 0) {
+        ret = writeToClientsLocked(iov, iovcnt, NULL, 0, &wakeup);
+    }
+
+    pthread_mutex_unlock(&s_writeMutex);
+
+    if (wakeup) {
+        triggerEvLoop();
+    }
+
+    if (ret == 0) {
+        pthread_mutex_lock(&s_unsolBatchMutex);
+        s_unsolWrites++;
+        pthread_mutex_unlock(&s_unsolBatchMutex);
+    }
+
+    for (int i = 0; i < count; i++) {
+        releaseResponseParcel(batch[i].p);
+    }
+
+    // For now, we automatically go back to sleep after TIMEVAL_WAKE_TIMEOUT
+    if (wakeLock) {
+        scheduleWakeTimeout();
+    }
+}
+
+/** Send everything in the coalescing batch with a single write */
+static void
+flushUnsolBatch() {
+    pthread_mutex_lock(&s_unsolBatchMutex);
+    flushUnsolBatchAndUnlock();
+}
+
+static void
+flushUnsolBatchCallback(void *param) {
+    pthread_mutex_lock(&s_unsolBatchMutex);
+    s_unsolFlushScheduled = 0;
+    flushUnsolBatchAndUnlock();
+}
+
+/**
+ * Hold a marshalled unsolicited response until the coalescing window
+ * expires. Takes ownership of p.
+ */
+static void
+queueUnsolResponse(int unsolResponseIndex, Parcel *p) {
+    UnsolResponseInfo *pUI = &s_unsolResponses[unsolResponseIndex];
+    int scheduleFlush = 0;
+
+    pthread_mutex_lock(&s_unsolBatchMutex);
+
+    s_unsolReceived++;
+
+    if (pUI->coalesceType == SUPERSEDE) {
+        for (int i = 0; i < s_unsolBatchCount; i++) {
+            if (s_unsolBatch[i].unsolResponse == pUI->requestNumber) {
+                releaseResponseParcel(s_unsolBatch[i].p);
+                memmove(&s_unsolBatch[i], &s_unsolBatch[i + 1],
+                        (s_unsolBatchCount - i - 1) * sizeof(s_unsolBatch[0]));
+                s_unsolBatchCount--;
+                s_unsolSuperseded++;
+                break;
+            }
+        }
+    }
+
+    // others can fill it up again while a full batch is written
+    while (s_unsolBatchCount == MAX_COALESCED_UNSOL) {
+        flushUnsolBatchAndUnlock();
+        pthread_mutex_lock(&s_unsolBatchMutex);
+    }
+
+    s_unsolBatch[s_unsolBatchCount].unsolResponse = pUI->requestNumber;
+    s_unsolBatch[s_unsolBatchCount].p = p;
+    s_unsolBatchCount++;
+
+    // one wake lock covers the whole batch, and only flushUnsolBatch()
+    // lets it go: a release scheduled earlier must not drop it while
+    // indications are still queued
+    if (pUI->wakeType == WAKE_PARTIAL && !s_unsolBatchWakeLock) {
+        grabPartialWakeLock();
+        cancelWakeTimeout();
+        s_unsolBatchWakeLock = 1;
+    }
+
+    if (!s_unsolFlushScheduled) {
+        s_unsolFlushScheduled = 1;
+        scheduleFlush = 1;
+    }
+
+    pthread_mutex_unlock(&s_unsolBatchMutex);
+
+    if (scheduleFlush) {
+        internalRequestTimedCallback(flushUnsolBatchCallback, NULL,
+                &s_unsolCoalesceWindow);
+    }
+}
+
+static void
+dumpUnsolStats(int fd) {
+    char line[256];
+    int len;
+
+    pthread_mutex_lock(&s_unsolBatchMutex);
+
+    len = snprintf(line, sizeof(line),
+            "unsol coalescing: window=%ldms received=%u superseded=%u "
+            "writes=%u ratio=%u.%02u\n",
+            s_unsolCoalesceWindow.tv_sec * 1000
+                + s_unsolCoalesceWindow.tv_usec / 1000,
+            s_unsolReceived, s_unsolSuperseded, s_unsolWrites,
+            s_unsolWrites == 0 ? 0 : s_unsolReceived / s_unsolWrites,
+            s_unsolWrites == 0 ? 0
+                : (s_unsolReceived % s_unsolWrites) * 100 / s_unsolWrites);
+
+    pthread_mutex_unlock(&s_unsolBatchMutex);
+
+    if (len >= (int)sizeof(line)) {
+        len = sizeof(line) - 1;
+    }
+    write(fd, line, len);
+}
+
+/**
+ * Marshal and send an unsolicited response to pClient, or to every
+ * connected client (subject to coalescing) if pClient is NULL
+ */
+static void
+sendUnsolicitedResponse(int unsolResponse, void *data, size_t datalen,
+                                RilClient *pClient)
 {
     int unsolResponseIndex;
     int ret;
     int64_t timeReceived = 0;
     bool shouldScheduleTimeout = false;
+    bool coalesce;
 
     if (s_registerCalled == 0) {
         // Ignore RIL_onUnsolicitedResponse before RIL_register
@@ -2914,20 +4176,30 @@ void RIL_onUnsolicitedResponse(int unsolResponse, void *data,
         return;
     }
 
-    // Grab a wake lock if needed for this reponse,
-    // as we exit we'll either release it immediately
-    // or set a timer to release it later.
-    switch (s_unsolResponses[unsolResponseIndex].wakeType) {
-        case WAKE_PARTIAL:
-            grabPartialWakeLock();
-            shouldScheduleTimeout = true;
-        break;
+    coalesce = s_unsolCoalesceEnabled && pClient == NULL
+            && s_unsolResponses[unsolResponseIndex].coalesceType != SEND_NOW;
 
-        case DONT_WAKE:
-        default:
-            // No wake lock is grabed so don't set timeout
-            shouldScheduleTimeout = false;
+    if (coalesce) {
+        // queueUnsolResponse() takes care of the wake lock
+    } else {
+        // anything held back has to go out first to keep the order
+        flushUnsolBatch();
+
+        // Grab a wake lock if needed for this reponse,
+        // as we exit we'll either release it immediately
+        // or set a timer to release it later.
+        switch (s_unsolResponses[unsolResponseIndex].wakeType) {
+            case WAKE_PARTIAL:
+                grabPartialWakeLock();
+                shouldScheduleTimeout = true;
             break;
+
+            case DONT_WAKE:
+            default:
+                // No wake lock is grabed so don't set timeout
+                shouldScheduleTimeout = false;
+                break;
+        }
     }
 
     // Mark the time this was received, doing this
@@ -2940,7 +4212,7 @@ void RIL_onUnsolicitedResponse(int unsolResponse, void *data,
 
     appendPrintBuf("[UNSL]< %s", requestToString(unsolResponse));
 
-    Parcel p;
+    Parcel &p = *obtainResponseParcel();
 
     p.writeInt32 (RESPONSE_UNSOLICITED);
     p.writeInt32 (unsolResponse);
@@ -2949,6 +4221,7 @@ void RIL_onUnsolicitedResponse(int unsolResponse, void *data,
                 .responseFunction(p, data, datalen);
     if (ret != 0) {
         // Problem with the response. Don't continue;
+        releaseResponseParcel(&p);
         goto error_exit;
     }
 
@@ -2971,8 +4244,14 @@ void RIL_onUnsolicitedResponse(int unsolResponse, void *data,
         break;
     }
 
-    ret = sendResponse(p);
-    if (ret != 0 && unsolResponse == RIL_UNSOL_NITZ_TIME_RECEIVED) {
+    if (coalesce) {
+        queueUnsolResponse(unsolResponseIndex, &p);
+        return;
+    }
+
+    ret = sendResponse(p, pClient, pClient == NULL ? 0 : pClient->generation);
+    if ((ret != 0 || !primaryClientConnected()) && pClient == NULL
+            && unsolResponse == RIL_UNSOL_NITZ_TIME_RECEIVED) {
 
         // Unfortunately, NITZ time is not poll/update like everything
         // else in the system. So, if the upstream client isn't connected,
@@ -2984,23 +4263,20 @@ void RIL_onUnsolicitedResponse(int unsolResponse, void *data,
             s_lastNITZTimeData = NULL;
         }
 
-        s_lastNITZTimeData = malloc(p.dataSize());
-        s_lastNITZTimeDataSize = p.dataSize();
-        memcpy(s_lastNITZTimeData, p.data(), p.dataSize());
+        // sendResponseRaw() supplies its own header
+        s_lastNITZTimeDataSize = p.dataSize() - RESPONSE_HEADER_SIZE;
+        s_lastNITZTimeData = malloc(s_lastNITZTimeDataSize);
+        memcpy(s_lastNITZTimeData, p.data() + RESPONSE_HEADER_SIZE,
+                s_lastNITZTimeDataSize);
     }
 
+    releaseResponseParcel(&p);
+
     // For now, we automatically go back to sleep after TIMEVAL_WAKE_TIMEOUT
     // FIXME The java code should handshake here to release wake lock
 
     if (shouldScheduleTimeout) {
-        // Cancel the previous request
-        if (s_last_wake_timeout_info != NULL) {
-            s_last_wake_timeout_info->userParam = (void *)1;
-        }
-
-        s_last_wake_timeout_info
-            = internalRequestTimedCallback(wakeTimeoutCallback, NULL,
-                                            &TIMEVAL_WAKE_TIMEOUT);
+        scheduleWakeTimeout();
     }
 
     // Normal exit
@@ -3012,6 +4288,13 @@ error_exit:
     }
 }
 
+extern "C"
+void RIL_onUnsolicitedResponse(int unsolResponse, void *data,
+                                size_t datalen)
+{
+    sendUnsolicitedResponse(unsolResponse, data, datalen, NULL);
+}
+
 /** FIXME generalize this if you track UserCAllbackInfo, clear it
     when the callback occurs
 */
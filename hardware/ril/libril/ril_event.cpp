@@ -66,6 +66,7 @@ static pthread_mutex_t listMutex;
 #endif
 
 static fd_set readFds;
+static fd_set writeFds;
 static int nfds = 0;
 
 static struct ril_event * watch_table[MAX_FD_EVENTS];
@@ -140,6 +141,7 @@ static void removeWatch(struct ril_event * ev, int index)
     ev->index = -1;
 
     FD_CLR(ev->fd, &readFds);
+    FD_CLR(ev->fd, &writeFds);
 
     if (ev->fd+1 == nfds) {
         int n = 0;
@@ -180,19 +182,30 @@ static void processTimeouts()
     dlog("~~~~ -processTimeouts ~~~~");
 }
 
-static void processReadReadies(fd_set * rfds, int n)
+static void processReadReadies(fd_set * rfds, fd_set * wfds, int n)
 {
     dlog("~~~~ +processReadReadies (%d) ~~~~", n);
     MUTEX_ACQUIRE();
 
     for (int i = 0; (i < MAX_FD_EVENTS) && (n > 0); i++) {
         struct ril_event * rev = watch_table[i];
-        if (rev != NULL && FD_ISSET(rev->fd, rfds)) {
+        if (rev == NULL) {
+            continue;
+        }
+        rev->ready = 0;
+        if (FD_ISSET(rev->fd, rfds)) {
+            rev->ready |= RIL_EVENT_READ;
+            n--;
+        }
+        if (FD_ISSET(rev->fd, wfds)) {
+            rev->ready |= RIL_EVENT_WRITE;
+            n--;
+        }
+        if (rev->ready != 0) {
             addToList(rev, &pending_list);
             if (rev->persist == false) {
                 removeWatch(rev, i);
             }
-            n--;
         }
     }
 
@@ -207,7 +220,7 @@ static void firePending()
     while (ev != &pending_list) {
         struct ril_event * next = ev->next;
         removeFromList(ev);
-        ev->func(ev->fd, 0, ev->param);
+        ev->func(ev->fd, ev->ready, ev->param);
         ev = next;
     }
     dlog("~~~~ -firePending ~~~~");
@@ -244,6 +257,7 @@ void ril_event_init()
     MUTEX_INIT();
 
     FD_ZERO(&readFds);
+    FD_ZERO(&writeFds);
     init_list(&timer_list);
     init_list(&pending_list);
     memset(watch_table, 0, sizeof(watch_table));
@@ -274,6 +288,7 @@ void ril_event_add(struct ril_event * ev)
             dlog("~~~~ added at %d ~~~~", i);
             dump_event(ev);
             FD_SET(ev->fd, &readFds);
+            if (ev->wantWrite) FD_SET(ev->fd, &writeFds);
             if (ev->fd >= nfds) nfds = ev->fd+1;
             dlog("~~~~ nfds = %d ~~~~", nfds);
             break;
@@ -329,6 +344,20 @@ void ril_event_del(struct ril_event * ev)
     dlog("~~~~ -ril_event_del ~~~~");
 }
 
+void ril_event_want_write(struct ril_event * ev, bool want)
+{
+    MUTEX_ACQUIRE();
+    ev->wantWrite = want;
+    if (ev->index >= 0 && ev->index < MAX_FD_EVENTS) {
+        if (want) {
+            FD_SET(ev->fd, &writeFds);
+        } else {
+            FD_CLR(ev->fd, &writeFds);
+        }
+    }
+    MUTEX_RELEASE();
+}
+
 #if DEBUG
 static void printReadies(fd_set * rfds)
 {
@@ -347,14 +376,18 @@ void ril_event_loop()
 {
     int n;
     fd_set rfds;
+    fd_set wfds;
     struct timeval tv;
     struct timeval * ptv;
 
 
     for (;;) {
 
-        // make local copy of read fd_set
+        // make local copies of the fd_sets
+        MUTEX_ACQUIRE();
         memcpy(&rfds, &readFds, sizeof(fd_set));
+        memcpy(&wfds, &writeFds, sizeof(fd_set));
+        MUTEX_RELEASE();
         if (-1 == calcNextTimeout(&tv)) {
             // no pending timers; block indefinitely
             dlog("~~~~ no timers; blocking indefinitely ~~~~");
@@ -364,7 +397,7 @@ void ril_event_loop()
             ptv = &tv;
         }
         printReadies(&rfds);
-        n = select(nfds, &rfds, NULL, NULL, ptv);
+        n = select(nfds, &rfds, &wfds, NULL, ptv);
         printReadies(&rfds);
         dlog("~~~~ %d events fired ~~~~", n);
         if (n < 0) {
@@ -378,7 +411,7 @@ void ril_event_loop()
         // Check for timeouts
         processTimeouts();
         // Check for read-ready
-        processReadReadies(&rfds, n);
+        processReadReadies(&rfds, &wfds, n);
         // Fire away
         firePending();
     }
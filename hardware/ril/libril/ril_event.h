@@ -16,7 +16,15 @@
 */
 
 // Max number of fd's we watch at any one time.  Increase if necessary.
+// Only the select() backend (ril_event.cpp) is bounded by this.
+#ifndef MAX_FD_EVENTS
 #define MAX_FD_EVENTS 8
+#endif
+
+// What a watched fd was ready for, passed to the callback as events.
+// Timer callbacks get 0.
+#define RIL_EVENT_READ  1
+#define RIL_EVENT_WRITE 2
 
 typedef void (*ril_event_cb)(int fd, short events, void *userdata);
 
@@ -27,6 +35,8 @@ struct ril_event {
     int fd;
     int index;
     bool persist;
+    bool wantWrite;
+    short ready;
     struct timeval timeout;
     ril_event_cb func;
     void *param;
@@ -47,6 +57,11 @@ void ril_timer_add(struct ril_event * ev, struct timeval * tv);
 // Remove event from watch list
 void ril_event_del(struct ril_event * ev);
 
+// Also fire a watched event while its fd can take output, or stop.
+// May be called before the event is added; the loop has to be woken
+// for the change to take effect.
+void ril_event_want_write(struct ril_event * ev, bool want);
+
 // Event loop
 void ril_event_loop();
 
@@ -0,0 +1,273 @@
+/* //device/libs/telephony/ril_event_bench.cpp
+**
+** Copyright 2008, The Android Open Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+/*
+ * Host microbenchmark for the ril_event backends.
+ *
+ * Registers a number of persistent pipe watches and keeps a population
+ * of one-shot timers alive (each timer re-arms itself when it fires,
+ * like RIL_requestTimedCallback users polling the modem).  The main
+ * thread then pokes random pipes and the watch callbacks record the
+ * time from write() to dispatch.  Timer lateness is recorded as well.
+ *
+ * The same source is linked against ril_event.cpp and
+ * ril_event_epoll.cpp, producing ril_event_bench_select and
+ * ril_event_bench_epoll.
+ *
+ * usage: ril_event_bench [-f fds] [-t timers] [-n samples] [-m max_timer_ms]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include <ril_event.h>
+
+#define DEFAULT_FDS 256
+#define DEFAULT_TIMERS 4096
+#define DEFAULT_SAMPLES 1000
+#define DEFAULT_MAX_TIMER_MS 50
+
+static int s_numFds = DEFAULT_FDS;
+static int s_numTimers = DEFAULT_TIMERS;
+static int s_numSamples = DEFAULT_SAMPLES;
+static int s_maxTimerMs = DEFAULT_MAX_TIMER_MS;
+
+static int (*s_pipes)[2];
+static struct ril_event *s_fdEvents;
+static struct ril_event *s_timerEvents;
+
+static pthread_mutex_t s_sampleMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t s_sampleCond = PTHREAD_COND_INITIALIZER;
+static int s_fdSamplesTaken = 0;
+static int s_dispatchDone = 0;
+
+static long long *s_fdLatencyNs;
+static long long *s_timerLatenessNs;
+static int s_timerSamplesTaken = 0;
+
+static long long nowNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void randomTimeout(struct timeval *tv)
+{
+    int us = rand() % (s_maxTimerMs * 1000 + 1);
+    tv->tv_sec = us / 1000000;
+    tv->tv_usec = us % 1000000;
+}
+
+static void fdCallback(int fd, short flags, void *param)
+{
+    long long stamp;
+    ssize_t ret;
+
+    ret = read(fd, &stamp, sizeof(stamp));
+    if (ret != sizeof(stamp)) {
+        return;
+    }
+
+    long long latency = nowNs() - stamp;
+
+    pthread_mutex_lock(&s_sampleMutex);
+    if (s_fdSamplesTaken < s_numSamples) {
+        s_fdLatencyNs[s_fdSamplesTaken++] = latency;
+    }
+    s_dispatchDone = 1;
+    pthread_cond_broadcast(&s_sampleCond);
+    pthread_mutex_unlock(&s_sampleMutex);
+}
+
+static void timerCallback(int fd, short flags, void *param)
+{
+    struct ril_event *ev = (struct ril_event *) param;
+    struct timeval tv;
+    long long deadline = (long long)ev->timeout.tv_sec * 1000000000LL
+            + (long long)ev->timeout.tv_usec * 1000LL;
+
+    // timer callbacks run on the loop thread; no lock needed
+    if (s_timerSamplesTaken < s_numSamples) {
+        s_timerLatenessNs[s_timerSamplesTaken++] = nowNs() - deadline;
+    }
+
+    ril_event_set(ev, -1, false, timerCallback, ev);
+    randomTimeout(&tv);
+    ril_timer_add(ev, &tv);
+}
+
+static void *loopThread(void *param)
+{
+    ril_event_loop();
+    fprintf(stderr, "ril_event_loop returned (%d)\n", errno);
+    exit(1);
+    return NULL;
+}
+
+static int compareLL(const void *a, const void *b)
+{
+    long long x = *(const long long *)a;
+    long long y = *(const long long *)b;
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+static void report(const char *what, long long *samples, int n)
+{
+    long long sum = 0;
+
+    if (n == 0) {
+        printf("%-16s no samples\n", what);
+        return;
+    }
+
+    qsort(samples, n, sizeof(long long), compareLL);
+    for (int i = 0; i < n; i++) {
+        sum += samples[i];
+    }
+
+    printf("%-16s n=%d mean=%lldus p50=%lldus p99=%lldus max=%lldus\n",
+            what, n, sum / n / 1000,
+            samples[n / 2] / 1000,
+            samples[(int)(n * 0.99)] / 1000,
+            samples[n - 1] / 1000);
+}
+
+static void usage(const char *argv0)
+{
+    fprintf(stderr,
+            "usage: %s [-f fds] [-t timers] [-n samples] [-m max_timer_ms]\n",
+            argv0);
+    exit(-1);
+}
+
+int main(int argc, char **argv)
+{
+    int opt;
+    pthread_t tid;
+    struct rlimit rl;
+    struct timeval tv;
+    struct rusage before, after;
+
+    while (-1 != (opt = getopt(argc, argv, "f:t:n:m:"))) {
+        switch (opt) {
+            case 'f': s_numFds = atoi(optarg); break;
+            case 't': s_numTimers = atoi(optarg); break;
+            case 'n': s_numSamples = atoi(optarg); break;
+            case 'm': s_maxTimerMs = atoi(optarg); break;
+            default: usage(argv[0]);
+        }
+    }
+
+    if (s_numFds <= 0 || s_numTimers < 0 || s_numSamples <= 0
+            || s_maxTimerMs <= 0) {
+        usage(argv[0]);
+    }
+
+    if (s_numFds > MAX_FD_EVENTS) {
+        fprintf(stderr, "%d fds requested but this backend watches at most %d\n",
+                s_numFds, MAX_FD_EVENTS);
+        return 1;
+    }
+
+    // two fds per pipe, plus headroom
+    getrlimit(RLIMIT_NOFILE, &rl);
+    if (rl.rlim_cur < (rlim_t)(s_numFds * 2 + 16)) {
+        rl.rlim_cur = s_numFds * 2 + 16;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+    s_pipes = (int (*)[2]) calloc(s_numFds, sizeof(*s_pipes));
+    s_fdEvents = (struct ril_event *) calloc(s_numFds, sizeof(struct ril_event));
+    s_timerEvents = (struct ril_event *) calloc(s_numTimers + 1, sizeof(struct ril_event));
+    s_fdLatencyNs = (long long *) calloc(s_numSamples, sizeof(long long));
+    s_timerLatenessNs = (long long *) calloc(s_numSamples, sizeof(long long));
+
+    ril_event_init();
+
+    for (int i = 0; i < s_numFds; i++) {
+        if (pipe(s_pipes[i]) < 0) {
+            fprintf(stderr, "pipe() failed at %d (%d)\n", i, errno);
+            return 1;
+        }
+        ril_event_set(&s_fdEvents[i], s_pipes[i][0], true, fdCallback, NULL);
+        ril_event_add(&s_fdEvents[i]);
+    }
+
+    for (int i = 0; i < s_numTimers; i++) {
+        ril_event_set(&s_timerEvents[i], -1, false, timerCallback,
+                &s_timerEvents[i]);
+        randomTimeout(&tv);
+        ril_timer_add(&s_timerEvents[i], &tv);
+    }
+
+    printf("ril_event_bench: %d fds, %d timers (0-%dms), %d samples\n",
+            s_numFds, s_numTimers, s_maxTimerMs, s_numSamples);
+
+    getrusage(RUSAGE_SELF, &before);
+    long long start = nowNs();
+
+    pthread_create(&tid, NULL, loopThread, NULL);
+
+    // one write in flight at a time, so each sample measures a single
+    // wakeup rather than queueing behind earlier writes
+    for (int i = 0; i < s_numSamples; i++) {
+        int target = rand() % s_numFds;
+        long long stamp;
+
+        pthread_mutex_lock(&s_sampleMutex);
+        s_dispatchDone = 0;
+        pthread_mutex_unlock(&s_sampleMutex);
+
+        stamp = nowNs();
+        if (write(s_pipes[target][1], &stamp, sizeof(stamp)) != sizeof(stamp)) {
+            fprintf(stderr, "write() failed (%d)\n", errno);
+            return 1;
+        }
+
+        pthread_mutex_lock(&s_sampleMutex);
+        while (!s_dispatchDone) {
+            pthread_cond_wait(&s_sampleCond, &s_sampleMutex);
+        }
+        pthread_mutex_unlock(&s_sampleMutex);
+    }
+
+    long long elapsed = nowNs() - start;
+    getrusage(RUSAGE_SELF, &after);
+
+    // the loop thread never exits; take the timer samples as they stand
+    int timerSamples = s_timerSamplesTaken;
+
+    report("fd dispatch", s_fdLatencyNs, s_fdSamplesTaken);
+    report("timer lateness", s_timerLatenessNs, timerSamples);
+    printf("%-16s wall=%lldms user=%ldms sys=%ldms\n", "total",
+            elapsed / 1000000,
+            (after.ru_utime.tv_sec - before.ru_utime.tv_sec) * 1000
+                + (after.ru_utime.tv_usec - before.ru_utime.tv_usec) / 1000,
+            (after.ru_stime.tv_sec - before.ru_stime.tv_sec) * 1000
+                + (after.ru_stime.tv_usec - before.ru_stime.tv_usec) / 1000);
+
+    return 0;
+}
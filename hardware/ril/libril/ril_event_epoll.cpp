@@ -0,0 +1,483 @@
+/* //device/libs/telephony/ril_event_epoll.cpp
+**
+** Copyright 2008, The Android Open Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+/*
+ * epoll/timerfd implementation of the ril_event API.
+ *
+ * This is a drop-in replacement for ril_event.cpp, selected at build
+ * time with RIL_EVENT_USE_EPOLL := true.  Watched fds are registered
+ * with an epoll instance, so the cost of a wakeup is proportional to
+ * the number of ready fds rather than to the size of the watch table.
+ * Timers live in a binary min-heap (O(log n) insert/expire) and the
+ * earliest deadline is programmed into a single timerfd that is itself
+ * watched by the epoll instance.
+ *
+ * For timer events, ev->index holds the event's position in the heap.
+ * For fd events, ev->index is 0 while the fd is registered and -1
+ * otherwise.
+ */
+
+#define LOG_TAG "RILC"
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <utils/Log.h>
+#include <ril_event.h>
+#include <string.h>
+#include <sys/time.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <time.h>
+
+#include <pthread.h>
+static pthread_mutex_t listMutex;
+#define MUTEX_ACQUIRE() pthread_mutex_lock(&listMutex)
+#define MUTEX_RELEASE() pthread_mutex_unlock(&listMutex)
+#define MUTEX_INIT() pthread_mutex_init(&listMutex, NULL)
+#define MUTEX_DESTROY() pthread_mutex_destroy(&listMutex)
+
+#ifndef timeradd
+#define timeradd(tvp, uvp, vvp)						\
+	do {								\
+		(vvp)->tv_sec = (tvp)->tv_sec + (uvp)->tv_sec;		\
+		(vvp)->tv_usec = (tvp)->tv_usec + (uvp)->tv_usec;       \
+		if ((vvp)->tv_usec >= 1000000) {			\
+			(vvp)->tv_sec++;				\
+			(vvp)->tv_usec -= 1000000;			\
+		}							\
+	} while (0)
+#endif
+
+#ifndef timercmp
+#define timercmp(a, b, op)               \
+        ((a)->tv_sec == (b)->tv_sec      \
+        ? (a)->tv_usec op (b)->tv_usec   \
+        : (a)->tv_sec op (b)->tv_sec)
+#endif
+
+// Number of epoll events harvested per epoll_wait() call
+#define MAX_EPOLL_EVENTS 32
+
+// Initial capacity of the timer heap; it grows by doubling
+#define TIMER_HEAP_INITIAL 64
+
+static int epollFd = -1;
+static int timerFd = -1;
+
+// Marker stored in epoll_event.data.ptr for the timerfd
+static struct ril_event timerfd_event;
+
+static struct ril_event ** timer_heap = NULL;
+static int timer_heap_size = 0;
+static int timer_heap_capacity = 0;
+
+static struct ril_event pending_list;
+
+#define DEBUG 0
+
+#if DEBUG
+#define dlog(x...) LOGD( x )
+static void dump_event(struct ril_event * ev)
+{
+    dlog("~~~~ Event %x ~~~~", (unsigned int)ev);
+    dlog("     next    = %x", (unsigned int)ev->next);
+    dlog("     prev    = %x", (unsigned int)ev->prev);
+    dlog("     fd      = %d", ev->fd);
+    dlog("     index   = %d", ev->index);
+    dlog("     pers    = %d", ev->persist);
+    dlog("     timeout = %ds + %dus", (int)ev->timeout.tv_sec, (int)ev->timeout.tv_usec);
+    dlog("     func    = %x", (unsigned int)ev->func);
+    dlog("     param   = %x", (unsigned int)ev->param);
+    dlog("~~~~~~~~~~~~~~~~~~");
+}
+#else
+#define dlog(x...) do {} while(0)
+#define dump_event(x) do {} while(0)
+#endif
+
+// timerfd is armed against CLOCK_MONOTONIC, so timeouts must be too
+static void getNow(struct timeval * tv)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    tv->tv_sec = ts.tv_sec;
+    tv->tv_usec = ts.tv_nsec/1000;
+}
+
+static void init_list(struct ril_event * list)
+{
+    memset(list, 0, sizeof(struct ril_event));
+    list->next = list;
+    list->prev = list;
+    list->fd = -1;
+}
+
+static void addToList(struct ril_event * ev, struct ril_event * list)
+{
+    ev->next = list;
+    ev->prev = list->prev;
+    ev->prev->next = ev;
+    list->prev = ev;
+    dump_event(ev);
+}
+
+static void removeFromList(struct ril_event * ev)
+{
+    dlog("~~~~ Removing event ~~~~");
+    dump_event(ev);
+
+    ev->next->prev = ev->prev;
+    ev->prev->next = ev->next;
+    ev->next = NULL;
+    ev->prev = NULL;
+}
+
+/*************************** timer heap ****************************/
+
+static inline bool heapLess(int a, int b)
+{
+    return timercmp(&timer_heap[a]->timeout, &timer_heap[b]->timeout, <);
+}
+
+static inline void heapSwap(int a, int b)
+{
+    struct ril_event * tmp = timer_heap[a];
+    timer_heap[a] = timer_heap[b];
+    timer_heap[b] = tmp;
+    timer_heap[a]->index = a;
+    timer_heap[b]->index = b;
+}
+
+static void heapSiftUp(int i)
+{
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (!heapLess(i, parent)) {
+            break;
+        }
+        heapSwap(i, parent);
+        i = parent;
+    }
+}
+
+static void heapSiftDown(int i)
+{
+    for (;;) {
+        int left = 2 * i + 1;
+        int right = left + 1;
+        int smallest = i;
+
+        if (left < timer_heap_size && heapLess(left, smallest)) {
+            smallest = left;
+        }
+        if (right < timer_heap_size && heapLess(right, smallest)) {
+            smallest = right;
+        }
+        if (smallest == i) {
+            break;
+        }
+        heapSwap(i, smallest);
+        i = smallest;
+    }
+}
+
+static bool heapPush(struct ril_event * ev)
+{
+    if (timer_heap_size == timer_heap_capacity) {
+        int capacity = timer_heap_capacity == 0
+                ? TIMER_HEAP_INITIAL : timer_heap_capacity * 2;
+        struct ril_event ** heap = (struct ril_event **)
+                realloc(timer_heap, capacity * sizeof(struct ril_event *));
+        if (heap == NULL) {
+            LOGE("ril_event: unable to grow timer heap to %d", capacity);
+            return false;
+        }
+        timer_heap = heap;
+        timer_heap_capacity = capacity;
+    }
+
+    ev->index = timer_heap_size;
+    timer_heap[timer_heap_size++] = ev;
+    heapSiftUp(ev->index);
+    return true;
+}
+
+static struct ril_event * heapPop()
+{
+    struct ril_event * top = timer_heap[0];
+
+    timer_heap_size--;
+    if (timer_heap_size > 0) {
+        timer_heap[0] = timer_heap[timer_heap_size];
+        timer_heap[0]->index = 0;
+        heapSiftDown(0);
+    }
+    top->index = -1;
+    return top;
+}
+
+// Program the timerfd with the earliest deadline, or disarm it.
+// Must be called with listMutex held.
+static void rearmTimer()
+{
+    struct itimerspec its;
+
+    memset(&its, 0, sizeof(its));
+    if (timer_heap_size > 0) {
+        struct ril_event * tev = timer_heap[0];
+        its.it_value.tv_sec = tev->timeout.tv_sec;
+        its.it_value.tv_nsec = tev->timeout.tv_usec * 1000;
+    }
+
+    if (timerfd_settime(timerFd, TFD_TIMER_ABSTIME, &its, NULL) < 0) {
+        LOGE("ril_event: timerfd_settime error (%d)", errno);
+    }
+}
+
+/*******************************************************************/
+
+static void processTimeouts()
+{
+    dlog("~~~~ +processTimeouts ~~~~");
+    MUTEX_ACQUIRE();
+    struct timeval now;
+    uint64_t expirations;
+
+    // drain the timerfd so it stops reporting readable
+    while (read(timerFd, &expirations, sizeof(expirations)) < 0
+            && errno == EINTR);
+
+    getNow(&now);
+
+    dlog("~~~~ Looking for timers <= %ds + %dus ~~~~", (int)now.tv_sec, (int)now.tv_usec);
+    while (timer_heap_size > 0
+            && !timercmp(&timer_heap[0]->timeout, &now, >)) {
+        // Timer expired
+        dlog("~~~~ firing timer ~~~~");
+        addToList(heapPop(), &pending_list);
+    }
+
+    rearmTimer();
+    MUTEX_RELEASE();
+    dlog("~~~~ -processTimeouts ~~~~");
+}
+
+static void processReadReadies(struct epoll_event * events, int n)
+{
+    dlog("~~~~ +processReadReadies (%d) ~~~~", n);
+    MUTEX_ACQUIRE();
+
+    for (int i = 0; i < n; i++) {
+        struct ril_event * rev = (struct ril_event *) events[i].data.ptr;
+
+        // skip the timerfd, and fds removed since epoll_wait() returned
+        if (rev == &timerfd_event || rev->index < 0) {
+            continue;
+        }
+
+        // a hangup or error is reported as readable, the read sees it
+        rev->ready = 0;
+        if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+            rev->ready |= RIL_EVENT_READ;
+        }
+        if (events[i].events & EPOLLOUT) {
+            rev->ready |= RIL_EVENT_WRITE;
+        }
+        addToList(rev, &pending_list);
+        if (rev->persist == false) {
+            epoll_ctl(epollFd, EPOLL_CTL_DEL, rev->fd, NULL);
+            rev->index = -1;
+        }
+    }
+
+    MUTEX_RELEASE();
+    dlog("~~~~ -processReadReadies (%d) ~~~~", n);
+}
+
+static void firePending()
+{
+    dlog("~~~~ +firePending ~~~~");
+    struct ril_event * ev = pending_list.next;
+    while (ev != &pending_list) {
+        struct ril_event * next = ev->next;
+        removeFromList(ev);
+        ev->func(ev->fd, ev->ready, ev->param);
+        ev = next;
+    }
+    dlog("~~~~ -firePending ~~~~");
+}
+
+// Initialize internal data structs
+void ril_event_init()
+{
+    struct epoll_event eev;
+
+    MUTEX_INIT();
+
+    init_list(&pending_list);
+    init_list(&timerfd_event);
+
+    epollFd = epoll_create(MAX_EPOLL_EVENTS);
+    if (epollFd < 0) {
+        LOGE("ril_event: epoll_create error (%d)", errno);
+        return;
+    }
+    fcntl(epollFd, F_SETFD, FD_CLOEXEC);
+
+    timerFd = timerfd_create(CLOCK_MONOTONIC, 0);
+    if (timerFd < 0) {
+        LOGE("ril_event: timerfd_create error (%d)", errno);
+        return;
+    }
+    fcntl(timerFd, F_SETFL, O_NONBLOCK);
+    fcntl(timerFd, F_SETFD, FD_CLOEXEC);
+
+    memset(&eev, 0, sizeof(eev));
+    eev.events = EPOLLIN;
+    eev.data.ptr = &timerfd_event;
+    if (epoll_ctl(epollFd, EPOLL_CTL_ADD, timerFd, &eev) < 0) {
+        LOGE("ril_event: unable to watch timerfd (%d)", errno);
+    }
+}
+
+// Initialize an event
+void ril_event_set(struct ril_event * ev, int fd, bool persist, ril_event_cb func, void * param)
+{
+    dlog("~~~~ ril_event_set %x ~~~~", (unsigned int)ev);
+    memset(ev, 0, sizeof(struct ril_event));
+    ev->fd = fd;
+    ev->index = -1;
+    ev->persist = persist;
+    ev->func = func;
+    ev->param = param;
+    if (fd >= 0) {
+        fcntl(fd, F_SETFL, O_NONBLOCK);
+    }
+}
+
+// Add event to watch list
+void ril_event_add(struct ril_event * ev)
+{
+    struct epoll_event eev;
+
+    dlog("~~~~ +ril_event_add ~~~~");
+    MUTEX_ACQUIRE();
+
+    memset(&eev, 0, sizeof(eev));
+    eev.events = ev->wantWrite ? EPOLLIN | EPOLLOUT : EPOLLIN;
+    eev.data.ptr = ev;
+    if (epoll_ctl(epollFd, EPOLL_CTL_ADD, ev->fd, &eev) == 0) {
+        ev->index = 0;
+        dlog("~~~~ added fd %d ~~~~", ev->fd);
+        dump_event(ev);
+    } else {
+        LOGE("ril_event: unable to watch fd %d (%d)", ev->fd, errno);
+    }
+
+    MUTEX_RELEASE();
+    dlog("~~~~ -ril_event_add ~~~~");
+}
+
+// Add timer event
+void ril_timer_add(struct ril_event * ev, struct timeval * tv)
+{
+    dlog("~~~~ +ril_timer_add ~~~~");
+    MUTEX_ACQUIRE();
+
+    if (tv != NULL) {
+        ev->fd = -1; // make sure fd is invalid
+
+        struct timeval now;
+        getNow(&now);
+        timeradd(&now, tv, &ev->timeout);
+
+        // only touch the timerfd when the earliest deadline changes;
+        // doing so also wakes the loop if it is blocked in epoll_wait()
+        if (heapPush(ev) && ev->index == 0) {
+            rearmTimer();
+        }
+    }
+
+    MUTEX_RELEASE();
+    dlog("~~~~ -ril_timer_add ~~~~");
+}
+
+// Remove event from watch list
+void ril_event_del(struct ril_event * ev)
+{
+    dlog("~~~~ +ril_event_del ~~~~");
+    MUTEX_ACQUIRE();
+
+    // as with the select() backend, timers cannot be cancelled
+    if (ev->index < 0 || ev->fd < 0) {
+        MUTEX_RELEASE();
+        return;
+    }
+
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, ev->fd, NULL);
+    ev->index = -1;
+
+    MUTEX_RELEASE();
+    dlog("~~~~ -ril_event_del ~~~~");
+}
+
+void ril_event_want_write(struct ril_event * ev, bool want)
+{
+    struct epoll_event eev;
+
+    MUTEX_ACQUIRE();
+    ev->wantWrite = want;
+    if (ev->index >= 0 && ev->fd >= 0) {
+        memset(&eev, 0, sizeof(eev));
+        eev.events = want ? EPOLLIN | EPOLLOUT : EPOLLIN;
+        eev.data.ptr = ev;
+        epoll_ctl(epollFd, EPOLL_CTL_MOD, ev->fd, &eev);
+    }
+    MUTEX_RELEASE();
+}
+
+void ril_event_loop()
+{
+    int n;
+    struct epoll_event events[MAX_EPOLL_EVENTS];
+
+    for (;;) {
+        n = epoll_wait(epollFd, events, MAX_EPOLL_EVENTS, -1);
+        dlog("~~~~ %d events fired ~~~~", n);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+
+            LOGE("ril_event: epoll_wait error (%d)", errno);
+            // bail?
+            return;
+        }
+
+        // Check for timeouts, but only if the timerfd went off
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.ptr == &timerfd_event) {
+                processTimeouts();
+                break;
+            }
+        }
+        // Check for read-ready
+        processReadReadies(events, n);
+        // Fire away
+        firePending();
+    }
+}
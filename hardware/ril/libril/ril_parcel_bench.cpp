@@ -0,0 +1,343 @@
+/* //device/libs/telephony/ril_parcel_bench.cpp
+**
+** Copyright 2006, The Android Open Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+/*
+ * Benchmark for the libril response marshalling path.
+ *
+ * Replays a set of recorded responses (the field sequence that
+ * responseCellList, responseDataCallList, responseSIM_IO and
+ * responseCdmaSms write for typical reference-ril payloads) through
+ * two implementations of the send path and reports time and bytes
+ * copied per response:
+ *
+ *   before: fresh Parcel per response, strings via strdup8to16() and
+ *           writeString16(), header and payload written separately
+ *   after:  recycled Parcel with the frame header reserved up front,
+ *           strings converted in place, one write per frame
+ *
+ * Frames are written to a socketpair that a second thread drains, so
+ * the syscall cost is included.
+ *
+ * usage: ril_parcel_bench [-n iterations]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include <binder/Parcel.h>
+#include <cutils/jstring.h>
+#include <utils/Timers.h>
+
+using namespace android;
+
+#define NUM_ELEMS(a)     (sizeof (a) / sizeof (a)[0])
+
+#define DEFAULT_ITERATIONS 20000
+
+enum FieldType { F_INT, F_STRING, F_BYTES, F_END };
+
+typedef struct {
+    FieldType type;
+    int value;              // F_INT, or length for F_BYTES
+    const char *string;     // F_STRING, or data for F_BYTES
+} Field;
+
+typedef struct {
+    const char *name;
+    const Field *fields;
+} Recording;
+
+#define INT(x)      { F_INT, (x), NULL }
+#define STR(s)      { F_STRING, 0, (s) }
+#define BYTES(n, d) { F_BYTES, (n), (d) }
+#define END         { F_END, 0, NULL }
+
+#define CELL(cid, rssi) INT(rssi), STR(cid)
+
+// RIL_REQUEST_GET_NEIGHBORING_CELL_IDS, 16 cells
+static const Field s_cellList[] = {
+    INT(0), INT(1), INT(0),
+    INT(16),
+    CELL("0000a1b2", 12), CELL("0000a1b3", 9), CELL("0000a1c0", 20),
+    CELL("0000a1c1", 4), CELL("0000a1d7", 14), CELL("0000a1d8", 7),
+    CELL("0000a201", 31), CELL("0000a202", 2), CELL("0000a2f0", 17),
+    CELL("0000a2f1", 11), CELL("0000a310", 6), CELL("0000a311", 25),
+    CELL("0000a3aa", 3), CELL("0000a3ab", 19), CELL("0000a4c5", 8),
+    CELL("0000a4c6", 13),
+    END
+};
+
+#define DATA_CALL(cid) \
+    INT(0), INT(-1), INT(cid), INT(2), STR("IP"), STR("rmnet0"), \
+    STR("10.0.2.15/24 fe80::5054:ff:fe12:3456/64"), \
+    STR("10.0.2.3 8.8.8.8 2001:4860:4860::8888"), STR("10.0.2.2")
+
+// RIL_UNSOL_DATA_CALL_LIST_CHANGED, 4 contexts
+static const Field s_dataCallList[] = {
+    INT(1), INT(1009),
+    INT(6), INT(4),
+    DATA_CALL(1), DATA_CALL(2), DATA_CALL(3), DATA_CALL(4),
+    END
+};
+
+// RIL_REQUEST_SIM_IO, READ BINARY of a 256 byte EF
+static const Field s_simIo[] = {
+    INT(0), INT(2), INT(0),
+    INT(0x90), INT(0x00),
+    STR("62178202412183026F3AA5038001718A01058B036F06048002"
+        "00FA880110FFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFF"
+        "FFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFF"
+        "FFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFF"
+        "FFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFF"
+        "FFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFF"
+        "FFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFF"
+        "FFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFF"
+        "FFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFF"
+        "FFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFF"
+        "FFFFFFFFFFFF"),
+    END
+};
+
+static const char s_bearerData[] =
+    "\x00\x03\x20\x10\x10\x01\x1a\x10\x9b\x8e\xb0\xcb\xb6\x65\x41\xd3"
+    "\x0f\x45\x97\x3a\x75\xd2\x06\x9d\x9e\x83\x48\xc3\xa1\x06\x83\x4b"
+    "\x31\x01\x06\x03\x12\x04\x21\x14\x30\x00\x08\x01\x00";
+
+// RIL_UNSOL_RESPONSE_CDMA_NEW_SMS
+static const Field s_cdmaSms[] = {
+    INT(1), INT(1008),
+    INT(4098), BYTES(1, "\x01"), INT(0),
+    INT(0), INT(0), INT(0), INT(0),
+    BYTES(1, "\x0a"),
+    BYTES(1, "\x06"), BYTES(1, "\x05"), BYTES(1, "\x05"), BYTES(1, "\x05"),
+    BYTES(1, "\x05"), BYTES(1, "\x05"), BYTES(1, "\x05"), BYTES(1, "\x05"),
+    BYTES(1, "\x05"), BYTES(1, "\x05"),
+    INT(0), BYTES(1, "\x00"), BYTES(1, "\x00"),
+    INT(sizeof(s_bearerData) - 1),
+    BYTES(sizeof(s_bearerData) - 1, s_bearerData),
+    END
+};
+
+static const Recording s_recordings[] = {
+    { "cell list", s_cellList },
+    { "data call list", s_dataCallList },
+    { "SIM IO", s_simIo },
+    { "CDMA SMS", s_cdmaSms },
+};
+
+static size_t s_bytesCopied;
+static unsigned int s_writes;
+
+static int
+blockingWrite(int fd, const void *buffer, size_t len) {
+    size_t writeOffset = 0;
+    const uint8_t *toWrite = (const uint8_t *)buffer;
+
+    while (writeOffset < len) {
+        ssize_t written;
+        do {
+            written = write (fd, toWrite + writeOffset, len - writeOffset);
+        } while (written < 0 && errno == EINTR);
+
+        if (written < 0) {
+            return -1;
+        }
+        writeOffset += written;
+        s_writes++;
+    }
+
+    return 0;
+}
+
+/*************************** before ****************************/
+
+static void
+writeStringBefore(Parcel &p, const char *s) {
+    char16_t *s16;
+    size_t s16_len;
+    s16 = strdup8to16(s, &s16_len);
+    p.writeString16(s16, s16_len);
+    free(s16);
+
+    // into the temporary, then into the parcel
+    s_bytesCopied += sizeof(int32_t) + 2 * (s16_len + 1) * sizeof(char16_t);
+}
+
+static int
+sendBefore(int fd, const Recording *r) {
+    Parcel p;
+    uint32_t header;
+
+    for (const Field *f = r->fields; f->type != F_END; f++) {
+        switch (f->type) {
+            case F_INT:
+                p.writeInt32(f->value);
+                s_bytesCopied += sizeof(int32_t);
+                break;
+            case F_STRING:
+                writeStringBefore(p, f->string);
+                break;
+            case F_BYTES:
+                p.write(f->string, f->value);
+                s_bytesCopied += f->value;
+                break;
+            default:
+                break;
+        }
+    }
+
+    header = htonl(p.dataSize());
+    if (blockingWrite(fd, &header, sizeof(header)) < 0) {
+        return -1;
+    }
+    return blockingWrite(fd, p.data(), p.dataSize());
+}
+
+/*************************** after ****************************/
+
+static Parcel s_recycled;
+
+static void
+writeStringAfter(Parcel &p, const char *s) {
+    char16_t *s16;
+    size_t s16_len;
+
+    s16_len = strlen8to16(s);
+    p.writeInt32(s16_len);
+    s16 = (char16_t *)p.writeInplace((s16_len + 1) * sizeof(char16_t));
+    if (s16 != NULL) {
+        strcpy8to16(s16, s, &s16_len);
+        s16[s16_len] = 0;
+    }
+
+    s_bytesCopied += sizeof(int32_t) + (s16_len + 1) * sizeof(char16_t);
+}
+
+static int
+sendAfter(int fd, const Recording *r) {
+    Parcel &p = s_recycled;
+    int ret;
+
+    p.writeInt32(0);
+
+    for (const Field *f = r->fields; f->type != F_END; f++) {
+        switch (f->type) {
+            case F_INT:
+                p.writeInt32(f->value);
+                s_bytesCopied += sizeof(int32_t);
+                break;
+            case F_STRING:
+                writeStringAfter(p, f->string);
+                break;
+            case F_BYTES:
+                p.write(f->string, f->value);
+                s_bytesCopied += f->value;
+                break;
+            default:
+                break;
+        }
+    }
+
+    *(uint32_t *)p.data() = htonl(p.dataSize() - sizeof(uint32_t));
+    ret = blockingWrite(fd, p.data(), p.dataSize());
+
+    p.setDataSize(0);
+    p.setDataPosition(0);
+
+    return ret;
+}
+
+/*******************************************************************/
+
+static void *
+drainThread(void *param) {
+    int fd = (int)(intptr_t)param;
+    char buf[8192];
+
+    while (read(fd, buf, sizeof(buf)) > 0) {
+    }
+
+    return NULL;
+}
+
+static void
+run(const char *label, int (*send)(int, const Recording *),
+        int fd, const Recording *r, int iterations) {
+    s_bytesCopied = 0;
+    s_writes = 0;
+
+    nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+    for (int i = 0; i < iterations; i++) {
+        if (send(fd, r) < 0) {
+            fprintf(stderr, "write failed (%d)\n", errno);
+            exit(1);
+        }
+    }
+    nsecs_t elapsed = systemTime(SYSTEM_TIME_MONOTONIC) - start;
+
+    printf("  %-7s %6lld ns/response  %5u bytes copied  %.1f writes\n",
+            label, (long long)(elapsed / iterations),
+            (unsigned int)(s_bytesCopied / iterations),
+            (double)s_writes / iterations);
+}
+
+int main(int argc, char **argv) {
+    int iterations = DEFAULT_ITERATIONS;
+    int fds[2];
+    int opt;
+    pthread_t tid;
+
+    while (-1 != (opt = getopt(argc, argv, "n:"))) {
+        switch (opt) {
+            case 'n': iterations = atoi(optarg); break;
+            default:
+                fprintf(stderr, "usage: %s [-n iterations]\n", argv[0]);
+                return -1;
+        }
+    }
+
+    if (iterations <= 0) {
+        fprintf(stderr, "iterations must be positive\n");
+        return -1;
+    }
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+        fprintf(stderr, "socketpair failed (%d)\n", errno);
+        return 1;
+    }
+
+    pthread_create(&tid, NULL, drainThread, (void *)(intptr_t)fds[1]);
+
+    for (size_t i = 0; i < NUM_ELEMS(s_recordings); i++) {
+        const Recording *r = &s_recordings[i];
+
+        printf("%s:\n", r->name);
+        run("before", sendBefore, fds[0], r, iterations);
+        run("after", sendAfter, fds[0], r, iterations);
+    }
+
+    close(fds[0]);
+    pthread_join(tid, NULL);
+
+    return 0;
+}
@@ -0,0 +1,706 @@
+/* //device/libs/telephony/ril_replay.cpp
+**
+** Copyright 2006, The Android Open Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+/*
+ * Record/replay harness for libril.
+ *
+ * Feeds a captured command stream into processCommandBuffer(), the same
+ * entry point the command socket uses, against a stub RIL that answers
+ * every request with a canned payload. Responses go out through the real
+ * RIL_onRequestComplete() path to a socketpair that a second thread
+ * drains. Reports, per request type and overall:
+ *
+ *   latency  processCommandBuffer() to the return of RIL_onRequestComplete()
+ *   allocs   malloc/calloc/realloc/new calls per request, in any library
+ *   copied   command bytes copied into request Parcels plus response
+ *            frame bytes written to the socket
+ *
+ * A capture is the socket byte stream: each command is a big-endian
+ * 32-bit length followed by the Parcel the framework wrote. On a
+ * debuggable build rild records one to /data/radio/<name> when
+ * ril.record_commands is set to <name>. Without -f a built-in stream
+ * modelled on a phone in a call with data up is used; -w saves it.
+ *
+ * ril.cpp is compiled into this program rather than linked from
+ * libril.so, since the functions replayed into are static.
+ *
+ * usage: ril_replay [-f capture] [-w out] [-n passes] [-d depth]
+ *   -d  complete requests from a separate thread with up to depth
+ *       outstanding, as a RIL talking to a modem does; the default of 0
+ *       completes them inside onRequest()
+ */
+
+#include "ril.cpp"
+
+#include <sys/socket.h>
+#include <cutils/atomic.h>
+
+using namespace android;
+
+#define DEFAULT_PASSES 200
+#define MAX_DEPTH 64
+
+/*************************** allocation counting ****************************/
+
+#ifdef HAVE_ANDROID_OS
+extern "C" void *dlmalloc(size_t);
+extern "C" void *dlcalloc(size_t, size_t);
+extern "C" void *dlrealloc(void *, size_t);
+extern "C" void dlfree(void *);
+#define REAL_MALLOC dlmalloc
+#define REAL_CALLOC dlcalloc
+#define REAL_REALLOC dlrealloc
+#define REAL_FREE dlfree
+#else
+extern "C" void *__libc_malloc(size_t);
+extern "C" void *__libc_calloc(size_t, size_t);
+extern "C" void *__libc_realloc(void *, size_t);
+extern "C" void __libc_free(void *);
+#define REAL_MALLOC __libc_malloc
+#define REAL_CALLOC __libc_calloc
+#define REAL_REALLOC __libc_realloc
+#define REAL_FREE __libc_free
+#endif
+
+static volatile int32_t s_allocs = 0;
+
+extern "C" void *malloc(size_t size) {
+    android_atomic_inc(&s_allocs);
+    return REAL_MALLOC(size);
+}
+
+extern "C" void *calloc(size_t n, size_t size) {
+    android_atomic_inc(&s_allocs);
+    return REAL_CALLOC(n, size);
+}
+
+extern "C" void *realloc(void *ptr, size_t size) {
+    android_atomic_inc(&s_allocs);
+    return REAL_REALLOC(ptr, size);
+}
+
+extern "C" void free(void *ptr) {
+    REAL_FREE(ptr);
+}
+
+void *operator new(size_t size) { return malloc(size); }
+void *operator new[](size_t size) { return malloc(size); }
+void operator delete(void *ptr) { free(ptr); }
+void operator delete[](void *ptr) { free(ptr); }
+
+/*************************** stub RIL ****************************/
+
+typedef struct {
+    int request;
+    nsecs_t latency;
+} Sample;
+
+static Sample *s_samples;
+static nsecs_t *s_dispatchTimes;    // indexed by token
+static int s_numSamples;
+static volatile int32_t s_completed = 0;
+
+static int s_depth = 0;
+static RIL_Token s_completions[MAX_DEPTH];
+static int s_compHead, s_compCount;
+static pthread_mutex_t s_compMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t s_compCond = PTHREAD_COND_INITIALIZER;
+
+// canned payloads, roughly what reference-ril returns
+static RIL_Call s_call = {
+    RIL_CALL_ACTIVE, 1, 129, 0, 0, 0, 1, 0, (char *)"6505550100", 0,
+    NULL, 0, NULL
+};
+static RIL_Call *s_calls[] = { &s_call };
+
+static RIL_SignalStrength_v6 s_signal;
+
+static const char *s_operator[] = { "T-Mobile", "T-Mobile", "310260" };
+
+static const char *s_voiceReg[] = {
+    "1", "1A2B", "00A1B2C3", "3", NULL, NULL, NULL, NULL, NULL, NULL,
+    NULL, NULL, NULL, "0"
+};
+
+static const char *s_dataReg[] = { "1", "1A2B", "00A1B2C3", "3", NULL, "4" };
+
+static RIL_SIM_IO_Response s_simIo = {
+    0x90, 0x00,
+    (char *)"0000000A2FE2040000000A0102"
+};
+
+static RIL_SMS_Response s_sms = { 17, NULL, -1 };
+
+static RIL_Data_Call_Response_v6 s_dataCall = {
+    0, 0, 1, 2, (char *)"IP", (char *)"rmnet0", (char *)"10.0.2.15/24",
+    (char *)"10.0.2.3", (char *)"10.0.2.2"
+};
+
+static void
+completeRequest(RIL_Token t) {
+    RequestInfo *pRI = (RequestInfo *)t;
+    int request = pRI->pCI->requestNumber;
+    int token = pRI->token;
+    void *response = NULL;
+    size_t responselen = 0;
+    nsecs_t now;
+
+    switch (request) {
+        case RIL_REQUEST_GET_CURRENT_CALLS:
+            response = s_calls;
+            responselen = sizeof(s_calls);
+            break;
+        case RIL_REQUEST_SIGNAL_STRENGTH:
+            response = &s_signal;
+            responselen = sizeof(s_signal);
+            break;
+        case RIL_REQUEST_OPERATOR:
+            response = s_operator;
+            responselen = sizeof(s_operator);
+            break;
+        case RIL_REQUEST_VOICE_REGISTRATION_STATE:
+            response = s_voiceReg;
+            responselen = sizeof(s_voiceReg);
+            break;
+        case RIL_REQUEST_DATA_REGISTRATION_STATE:
+            response = s_dataReg;
+            responselen = sizeof(s_dataReg);
+            break;
+        case RIL_REQUEST_SIM_IO:
+            response = &s_simIo;
+            responselen = sizeof(s_simIo);
+            break;
+        case RIL_REQUEST_SEND_SMS:
+            response = &s_sms;
+            responselen = sizeof(s_sms);
+            break;
+        case RIL_REQUEST_SETUP_DATA_CALL:
+            response = &s_dataCall;
+            responselen = sizeof(s_dataCall);
+            break;
+    }
+
+    // RIL_onRequestComplete() hands t back to the pool; read it first
+    RIL_onRequestComplete(t, RIL_E_SUCCESS, response, responselen);
+
+    now = systemTime(SYSTEM_TIME_MONOTONIC);
+    android_atomic_inc(&s_completed);
+
+    if (token >= 0 && token < s_numSamples) {
+        s_samples[token].request = request;
+        s_samples[token].latency = now - s_dispatchTimes[token];
+    }
+}
+
+static void
+onRequestStub(int request, void *data, size_t datalen, RIL_Token t) {
+    if (s_depth == 0) {
+        completeRequest(t);
+        return;
+    }
+
+    pthread_mutex_lock(&s_compMutex);
+    s_completions[(s_compHead + s_compCount) % MAX_DEPTH] = t;
+    s_compCount++;
+    pthread_cond_broadcast(&s_compCond);
+    pthread_mutex_unlock(&s_compMutex);
+}
+
+static void *
+completionLoop(void *param) {
+    for (;;) {
+        RIL_Token t;
+
+        pthread_mutex_lock(&s_compMutex);
+        while (s_compCount == 0) {
+            pthread_cond_wait(&s_compCond, &s_compMutex);
+        }
+        t = s_completions[s_compHead];
+        pthread_mutex_unlock(&s_compMutex);
+
+        completeRequest(t);
+
+        // only now does the slot free up for the replay thread
+        pthread_mutex_lock(&s_compMutex);
+        s_compHead = (s_compHead + 1) % MAX_DEPTH;
+        s_compCount--;
+        pthread_cond_broadcast(&s_compCond);
+        pthread_mutex_unlock(&s_compMutex);
+    }
+
+    return NULL;
+}
+
+static RIL_RadioState currentStateStub() { return RADIO_STATE_SIM_READY; }
+static int onSupportsStub(int requestCode) { return 1; }
+static void onCancelStub(RIL_Token t) { }
+static const char *getVersionStub() { return "ril_replay"; }
+
+static const RIL_RadioFunctions s_stubCallbacks = {
+    RIL_VERSION,
+    onRequestStub,
+    currentStateStub,
+    onSupportsStub,
+    onCancelStub,
+    getVersionStub
+};
+
+/*************************** response drain ****************************/
+
+static volatile int32_t s_bytesOut = 0;
+static volatile int32_t s_framesOut = 0;
+
+/** Counts response bytes and complete frames until EOF */
+static void *
+drainLoop(void *param) {
+    int fd = (int)(intptr_t)param;
+    uint8_t buf[16 * 1024];
+    uint8_t header[RESPONSE_HEADER_SIZE];
+    size_t headerLen = 0;
+    size_t payloadLeft = 0;
+    ssize_t count;
+
+    while ((count = read(fd, buf, sizeof(buf))) != 0) {
+        if (count < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+
+        for (ssize_t i = 0; i < count; ) {
+            if (headerLen < sizeof(header)) {
+                header[headerLen++] = buf[i++];
+                if (headerLen == sizeof(header)) {
+                    payloadLeft = ((size_t)header[0] << 24)
+                            | (header[1] << 16) | (header[2] << 8) | header[3];
+                }
+            } else {
+                size_t n = MIN((size_t)(count - i), payloadLeft);
+                i += n;
+                payloadLeft -= n;
+            }
+
+            if (headerLen == sizeof(header) && payloadLeft == 0) {
+                headerLen = 0;
+                android_atomic_inc(&s_framesOut);
+            }
+        }
+
+        android_atomic_add(count, &s_bytesOut);
+    }
+
+    return NULL;
+}
+
+/**
+ * Write out whatever the socket didn't take. There is no event loop
+ * here to retry it, see main().
+ */
+static void
+flushClientOutput() {
+    size_t pending;
+
+    do {
+        pthread_mutex_lock(&s_writeMutex);
+        drainClientOutput(&s_clients[0]);
+        pending = s_clients[0].outLen;
+        pthread_mutex_unlock(&s_writeMutex);
+        if (pending > 0) {
+            usleep(1000);
+        }
+    } while (pending > 0);
+}
+
+/** Waits until the drain thread has seen frames responses in total */
+static void
+waitForFrames(int32_t frames) {
+    while (android_atomic_acquire_load(&s_framesOut) < frames) {
+        flushClientOutput();
+        usleep(1000);
+    }
+}
+
+/*************************** command streams ****************************/
+
+typedef struct {
+    uint8_t *data;
+    size_t len;
+} Command;
+
+static Command *s_commandsIn;
+static int s_numCommands;
+
+static void
+addCommand(const void *data, size_t len) {
+    s_commandsIn = (Command *)REAL_REALLOC(s_commandsIn,
+            (s_numCommands + 1) * sizeof(Command));
+    s_commandsIn[s_numCommands].data = (uint8_t *)REAL_MALLOC(len);
+    memcpy(s_commandsIn[s_numCommands].data, data, len);
+    s_commandsIn[s_numCommands].len = len;
+    s_numCommands++;
+}
+
+static int
+loadCapture(const char *path) {
+    FILE *f = fopen(path, "rb");
+    uint8_t header[4];
+    uint8_t *buf;
+
+    if (f == NULL) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    buf = (uint8_t *)REAL_MALLOC(MAX_COMMAND_BYTES);
+
+    while (fread(header, sizeof(header), 1, f) == 1) {
+        size_t len = ((size_t)header[0] << 24) | (header[1] << 16)
+                | (header[2] << 8) | header[3];
+
+        if (len > MAX_COMMAND_BYTES || fread(buf, len, 1, f) != 1) {
+            fprintf(stderr, "%s: truncated or corrupt record %d\n",
+                    path, s_numCommands);
+            break;
+        }
+        addCommand(buf, len);
+    }
+
+    REAL_FREE(buf);
+    fclose(f);
+
+    return s_numCommands > 0 ? 0 : -1;
+}
+
+static void
+writeString(Parcel &p, const char *s) {
+    if (s == NULL) {
+        p.writeString16(NULL, 0);
+    } else {
+        String16 s16(s);
+        p.writeString16(s16);
+    }
+}
+
+static void
+addBuiltinCommand(Parcel &p) {
+    addCommand(p.data(), p.dataSize());
+    p.setDataSize(0);
+    p.setDataPosition(0);
+}
+
+/** One period of a call in progress with data up: mostly polling */
+static void
+buildBuiltinStream() {
+    Parcel p;
+    int serial = 0;
+
+    for (int i = 0; i < 4; i++) {
+        p.writeInt32(RIL_REQUEST_SIGNAL_STRENGTH);
+        p.writeInt32(serial++);
+        addBuiltinCommand(p);
+
+        p.writeInt32(RIL_REQUEST_GET_CURRENT_CALLS);
+        p.writeInt32(serial++);
+        addBuiltinCommand(p);
+    }
+
+    p.writeInt32(RIL_REQUEST_VOICE_REGISTRATION_STATE);
+    p.writeInt32(serial++);
+    addBuiltinCommand(p);
+
+    p.writeInt32(RIL_REQUEST_DATA_REGISTRATION_STATE);
+    p.writeInt32(serial++);
+    addBuiltinCommand(p);
+
+    p.writeInt32(RIL_REQUEST_OPERATOR);
+    p.writeInt32(serial++);
+    addBuiltinCommand(p);
+
+    for (int i = 0; i < 2; i++) {
+        p.writeInt32(RIL_REQUEST_SIM_IO);
+        p.writeInt32(serial++);
+        p.writeInt32(0xb0);             // READ BINARY
+        p.writeInt32(0x6f46);           // EF_SPN
+        writeString(p, "3F007F20");
+        p.writeInt32(0);
+        p.writeInt32(0);
+        p.writeInt32(17);
+        writeString(p, NULL);
+        writeString(p, NULL);
+        writeString(p, NULL);
+        addBuiltinCommand(p);
+    }
+
+    p.writeInt32(RIL_REQUEST_SEND_SMS);
+    p.writeInt32(serial++);
+    p.writeInt32(2);
+    writeString(p, NULL);
+    writeString(p, "01000B916105551001F00000"
+            "0AE8329BFD4697D9EC37");
+    addBuiltinCommand(p);
+
+    p.writeInt32(RIL_REQUEST_SETUP_DATA_CALL);
+    p.writeInt32(serial++);
+    p.writeInt32(7);
+    writeString(p, "1");                // radio technology: GSM/UMTS
+    writeString(p, "0");                // profile
+    writeString(p, "epc.tmobile.com");
+    writeString(p, NULL);
+    writeString(p, NULL);
+    writeString(p, "0");                // auth type
+    writeString(p, "IP");
+    addBuiltinCommand(p);
+
+    p.writeInt32(RIL_REQUEST_SCREEN_STATE);
+    p.writeInt32(serial++);
+    p.writeInt32(1);
+    p.writeInt32(0);
+    addBuiltinCommand(p);
+}
+
+static int
+saveStream(const char *path) {
+    FILE *f = fopen(path, "wb");
+
+    if (f == NULL) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    for (int i = 0; i < s_numCommands; i++) {
+        uint32_t header = htonl(s_commandsIn[i].len);
+
+        fwrite(&header, sizeof(header), 1, f);
+        fwrite(s_commandsIn[i].data, s_commandsIn[i].len, 1, f);
+    }
+
+    fclose(f);
+
+    return 0;
+}
+
+/*************************** replay ****************************/
+
+static void
+waitForCompletions(int maxOutstanding) {
+    pthread_mutex_lock(&s_compMutex);
+    while (s_compCount > maxOutstanding) {
+        pthread_cond_wait(&s_compCond, &s_compMutex);
+    }
+    pthread_mutex_unlock(&s_compMutex);
+}
+
+/**
+ * Replays the stream passes times; tokens are rewritten to a running
+ * sequence number starting at firstToken so each response can be
+ * matched to its dispatch time. Returns bytes copied in.
+ */
+static long long
+replay(int passes, int firstToken) {
+    uint8_t buf[MAX_COMMAND_BYTES];
+    long long bytesIn = 0;
+    int token = firstToken;
+
+    for (int pass = 0; pass < passes; pass++) {
+        for (int i = 0; i < s_numCommands; i++) {
+            size_t len = s_commandsIn[i].len;
+            int32_t t = token++;
+
+            // the record stream hands processCommandBuffer its own buffer
+            memcpy(buf, s_commandsIn[i].data, len);
+            if (len >= 2 * sizeof(int32_t)) {
+                memcpy(buf + sizeof(int32_t), &t, sizeof(t));
+            }
+
+            if (s_depth > 0) {
+                waitForCompletions(s_depth - 1);
+            }
+
+            if (t < s_numSamples) {
+                s_dispatchTimes[t] = systemTime(SYSTEM_TIME_MONOTONIC);
+            }
+            processCommandBuffer(buf, len, &s_clients[0]);
+            bytesIn += len;
+        }
+    }
+
+    if (s_depth > 0) {
+        waitForCompletions(0);
+    }
+
+    return bytesIn;
+}
+
+static int
+compareSamples(const void *a, const void *b) {
+    const Sample *sa = (const Sample *)a;
+    const Sample *sb = (const Sample *)b;
+
+    if (sa->request != sb->request) {
+        return sa->request - sb->request;
+    }
+    return sa->latency < sb->latency ? -1 : sa->latency > sb->latency;
+}
+
+static int
+compareLatency(const void *a, const void *b) {
+    nsecs_t la = *(const nsecs_t *)a;
+    nsecs_t lb = *(const nsecs_t *)b;
+
+    return la < lb ? -1 : la > lb;
+}
+
+static void
+printLatencyRow(const char *name, int count, nsecs_t p50, nsecs_t p99,
+        nsecs_t max) {
+    printf("  %-36s %7d %8.1f %8.1f %8.1f\n", name, count,
+            p50 / 1000.0, p99 / 1000.0, max / 1000.0);
+}
+
+static void
+usage(const char *argv0) {
+    fprintf(stderr,
+            "usage: %s [-f capture] [-w out] [-n passes] [-d depth]\n", argv0);
+    exit(-1);
+}
+
+int
+main(int argc, char **argv) {
+    const char *capturePath = NULL;
+    const char *outPath = NULL;
+    int passes = DEFAULT_PASSES;
+    int sv[2];
+    pthread_t drainTid;
+    pthread_t completionTid;
+    int32_t allocsBefore, allocsAfter;
+    long long bytesIn;
+    nsecs_t start, elapsed;
+    nsecs_t *all;
+    int requests;
+    int opt;
+
+    while (-1 != (opt = getopt(argc, argv, "f:w:n:d:"))) {
+        switch (opt) {
+            case 'f': capturePath = optarg; break;
+            case 'w': outPath = optarg; break;
+            case 'n': passes = atoi(optarg); break;
+            case 'd': s_depth = atoi(optarg); break;
+            default: usage(argv[0]);
+        }
+    }
+
+    if (passes <= 0 || s_depth < 0 || s_depth > MAX_DEPTH) {
+        usage(argv[0]);
+    }
+
+    if (capturePath != NULL) {
+        if (loadCapture(capturePath) < 0) {
+            return 1;
+        }
+    } else {
+        buildBuiltinStream();
+    }
+
+    if (outPath != NULL && saveStream(outPath) < 0) {
+        return 1;
+    }
+
+    // what RIL_register() would do, minus the sockets and event loop
+    memcpy(&s_callbacks, &s_stubCallbacks, sizeof(s_callbacks));
+    s_registerCalled = 1;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+        perror("socketpair");
+        return 1;
+    }
+
+    for (int i = 0; i < MAX_COMMAND_CLIENTS; i++) {
+        s_clients[i].fd = -1;
+    }
+    s_clients[0].fd = sv[0];
+    s_clients[0].generation = 1;
+    s_clients[0].primary = 1;
+    s_numClients = 1;
+    // no event loop watches for POLLOUT; flushClientOutput() stands in
+    // for it, and nothing clears this
+    s_clients[0].writeWatched = 1;
+
+    pthread_create(&drainTid, NULL, drainLoop, (void *)(intptr_t)sv[1]);
+    if (s_depth > 0) {
+        pthread_create(&completionTid, NULL, completionLoop, NULL);
+    }
+
+    requests = passes * s_numCommands;
+    s_numSamples = requests;
+    s_samples = (Sample *)REAL_CALLOC(requests, sizeof(Sample));
+    s_dispatchTimes = (nsecs_t *)REAL_CALLOC(requests, sizeof(nsecs_t));
+    all = (nsecs_t *)REAL_CALLOC(requests, sizeof(nsecs_t));
+
+    // warm up the RequestInfo pool and response parcels; not measured.
+    // Each completed request sends one frame.
+    replay(1, requests);
+    waitForFrames(android_atomic_acquire_load(&s_completed));
+
+    allocsBefore = android_atomic_acquire_load(&s_allocs);
+    android_atomic_release_store(0, &s_bytesOut);
+    start = systemTime(SYSTEM_TIME_MONOTONIC);
+
+    bytesIn = replay(passes, 0);
+
+    elapsed = systemTime(SYSTEM_TIME_MONOTONIC) - start;
+    allocsAfter = android_atomic_acquire_load(&s_allocs);
+
+    // let the drain thread catch up before reading s_bytesOut
+    flushClientOutput();
+    shutdown(sv[0], SHUT_WR);
+    pthread_join(drainTid, NULL);
+
+    for (int i = 0; i < requests; i++) {
+        all[i] = s_samples[i].latency;
+    }
+    qsort(all, requests, sizeof(nsecs_t), compareLatency);
+    qsort(s_samples, requests, sizeof(Sample), compareSamples);
+
+    printf("ril_replay: %d commands x %d passes, %s completion\n",
+            s_numCommands, passes,
+            s_depth == 0 ? "synchronous" : "threaded");
+    printf("  %-36s %7s %8s %8s %8s\n", "latency (us)", "count",
+            "p50", "p99", "max");
+
+    for (int i = 0; i < requests; ) {
+        int j = i;
+
+        while (j < requests && s_samples[j].request == s_samples[i].request) {
+            j++;
+        }
+        printLatencyRow(requestToString(s_samples[i].request), j - i,
+                s_samples[i + (j - i) / 2].latency,
+                s_samples[i + (j - i) * 99 / 100].latency,
+                s_samples[j - 1].latency);
+        i = j;
+    }
+    printLatencyRow("all", requests, all[requests / 2],
+            all[requests * 99 / 100], all[requests - 1]);
+
+    printf("  %.0f requests/s\n", requests / (elapsed / 1e9));
+    printf("  %.2f allocations/request\n",
+            (double)(allocsAfter - allocsBefore) / requests);
+    printf("  %.0f bytes copied/request (%.0f in, %.0f out)\n",
+            (double)(bytesIn + s_bytesOut) / requests,
+            (double)bytesIn / requests, (double)s_bytesOut / requests);
+
+    return 0;
+}
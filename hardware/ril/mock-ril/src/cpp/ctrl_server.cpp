@@ -15,6 +15,9 @@
  */
 
 #include <alloca.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <pthread.h>
 #include <stdio.h>
 #include <string.h>
@@ -23,6 +26,9 @@
 #include <sys/socket.h>
 #include <unistd.h>
 
+#include <map>
+#include <vector>
+
 #include <cutils/sockets.h>
 
 #include "logging.h"
@@ -55,140 +61,379 @@ using communication::MsgHeader;
 class CtrlServerThread;
 static CtrlServerThread *g_ctrl_server;
 
+#define CTRL_SERVER_MAX_CLIENTS     16
+#define CTRL_SERVER_MAX_HEADER      1024
+#define CTRL_SERVER_MAX_DATA        (1024 * 1024)
+// Output a client may have waiting before it is taken to have stopped
+// reading and is closed. A single message is always accepted.
+#define CTRL_SERVER_MAX_OUTPUT      (256 * 1024)
+
+/**
+ * A control connection.
+ *
+ * Messages are read a piece at a time as bytes arrive, so a slow client
+ * never holds up the others: the little endian header length, the
+ * MsgHeader and then length_data bytes of data. The header object and
+ * the byte buffers live as long as the connection and are reused for
+ * every message.
+ */
+struct CtrlClient {
+    enum ReadState {
+        READ_LENGTH,
+        READ_HEADER,
+        READ_DATA
+    };
+
+    int fd_;                        // -1 if this slot is free
+    int32_t id_;                    // slot and generation, see OpenClient
+    ReadState state_;
+    uint8_t *read_ptr_;             // where the next bytes go
+    uint32_t read_left_;            // and how many are still needed
+    uint32_t len_msg_header_;
+    std::vector<uint8_t> msg_header_raw_;
+    MsgHeader mh_;
+    Buffer *buffer_;                // data of the message being read
+
+    // Guarded by CtrlServerThread::out_mutex_
+    std::vector<uint8_t> out_;
+    size_t out_offset_;
+};
+
+/**
+ * A request passed to mock-ril.js. Clients choose their own tokens and
+ * may have any number of requests outstanding, so each request gets a
+ * server token that the completion is routed back by.
+ */
+struct CtrlPending {
+    int32_t client_id;
+    uint64_t client_token;
+};
+
 class CtrlServerThread : public WorkerThread {
   private:
     #define SOCKET_NAME_MOCK_RIL_CST_STOPPER "mock-ril-cst-stopper"
     v8::Handle<v8::Context> context_;
     int server_accept_socket_;
-    int server_to_client_socket_;
     int stop_server_fd_;
     int stop_client_fd_;
     int stopper_fd_;
-    fd_set rd_fds_;
-    fd_set wr_fds_;
     bool done_;
 
+    CtrlClient clients_[CTRL_SERVER_MAX_CLIENTS];
+    int32_t generation_;
+
+    // Guards the clients' output and pending_, which completions
+    // coming from other threads touch. Never held while calling JS.
+    pthread_mutex_t out_mutex_;
+    std::map<uint64_t, CtrlPending> pending_;
+    uint64_t next_token_;
+
     Buffer *ObtainBuffer(int length) {
         Buffer *b = Buffer::New(length);
         return b;
     }
 
-    int WriteAll(int s, void *data, int length) {
-        int ret_value;
-        uint8_t *bytes = (uint8_t *)data;
-        int count = length;
+    static int SetNonBlocking(int fd) {
+        int flags = fcntl(fd, F_GETFL);
+        if ((flags < 0) || (fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)) {
+            return STATUS_ERR;
+        }
+        return STATUS_OK;
+    }
+
+    void ExpectLength(CtrlClient *c) {
+        c->state_ = CtrlClient::READ_LENGTH;
+        c->read_ptr_ = (uint8_t *)&c->len_msg_header_;
+        c->read_left_ = sizeof(c->len_msg_header_);
+        c->buffer_ = NULL;
+    }
 
-        while (length > 0) {
-            ret_value = send(s, bytes, length, 0);
-            if (ret_value < 0) {
-                return STATUS_ERR;
+    void OpenClient(int fd) {
+        for (int i = 0; i < CTRL_SERVER_MAX_CLIENTS; i++) {
+            CtrlClient *c = &clients_[i];
+            if (c->fd_ >= 0) {
+                continue;
             }
-            if (ret_value == 0) {
-                return STATUS_CLIENT_CLOSED_CONNECTION;
+            if (SetNonBlocking(fd) != STATUS_OK) {
+                LOGE("CtrlServerThread: could not make client non-blocking '%s'",
+                        strerror(errno));
+                break;
+            }
+            generation_ += 1;
+            pthread_mutex_lock(&out_mutex_);
+            c->fd_ = fd;
+            c->id_ = (generation_ << 8) | i;
+            c->out_.clear();
+            c->out_offset_ = 0;
+            pthread_mutex_unlock(&out_mutex_);
+            ExpectLength(c);
+            DBG("CtrlServerThread: client %d id=%d fd=%d connected", i, c->id_, fd);
+            return;
+        }
+        LOGE("CtrlServerThread: refusing client, %d already connected",
+                CTRL_SERVER_MAX_CLIENTS);
+        close(fd);
+    }
+
+    void CloseClient(CtrlClient *c) {
+        DBG("CtrlServerThread: client id=%d fd=%d closed", c->id_, c->fd_);
+        pthread_mutex_lock(&out_mutex_);
+        close(c->fd_);
+        c->fd_ = -1;
+        c->out_.clear();
+        c->out_offset_ = 0;
+        // Completions for it have nowhere to go
+        std::map<uint64_t, CtrlPending>::iterator itr = pending_.begin();
+        while (itr != pending_.end()) {
+            if (itr->second.client_id == c->id_) {
+                pending_.erase(itr++);
+            } else {
+                ++itr;
             }
-            bytes += ret_value;
-            length -= ret_value;
         }
+        pthread_mutex_unlock(&out_mutex_);
+        c->buffer_ = NULL;
+    }
 
+    /**
+     * Send as much queued output as the socket takes.
+     * assumes out_mutex_ is held
+     */
+    int FlushLocked(CtrlClient *c) {
+        while (c->out_offset_ < c->out_.size()) {
+            ssize_t n = send(c->fd_, &c->out_[c->out_offset_],
+                    c->out_.size() - c->out_offset_, MSG_NOSIGNAL);
+            if (n < 0) {
+                if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+                    // Drop what was sent, so a client that always stays
+                    // a little behind doesn't grow the buffer forever
+                    if (c->out_offset_ >= c->out_.size() / 2) {
+                        c->out_.erase(c->out_.begin(),
+                                c->out_.begin() + c->out_offset_);
+                        c->out_offset_ = 0;
+                    }
+                    return STATUS_OK;
+                }
+                if (errno == EINTR) {
+                    continue;
+                }
+                return STATUS_ERR;
+            }
+            c->out_offset_ += n;
+        }
+        c->out_.clear();
+        c->out_offset_ = 0;
         return STATUS_OK;
     }
 
-    int ReadAll(int s, void *data, int length) {
-        int ret_value;
-        uint8_t *bytes = (uint8_t *)data;
-        int count = length;
+    /**
+     * Queue a message for c and try to send it straight away. Wakes
+     * the poll loop if some of it has to wait for the socket.
+     * assumes out_mutex_ is held
+     */
+    int WriteMessageLocked(CtrlClient *c, MsgHeader *mh, Buffer *buffer) {
+        // Set length of data
+        if (buffer == NULL) {
+            mh->set_length_data(0);
+        } else {
+            mh->set_length_data(buffer->length());
+        }
+
+        // Length in little endian, the header and the data, all serialized
+        // straight into the output buffer
+        uint32_t len_msg_header = mh->ByteSize();
+        uint32_t i = htole32(len_msg_header);
+        size_t waiting = c->out_.size() - c->out_offset_;
+        size_t len_msg = sizeof(i) + len_msg_header + mh->length_data();
+        if ((waiting > 0) && (waiting + len_msg > CTRL_SERVER_MAX_OUTPUT)) {
+            LOGE("CtrlServerThread: client id=%d stopped reading, closing",
+                    c->id_);
+            c->out_.clear();
+            c->out_offset_ = 0;
+            // The poll loop sees the hangup and closes it
+            shutdown(c->fd_, SHUT_RDWR);
+            return STATUS_ERR;
+        }
+        bool was_idle = (waiting == 0);
+        size_t offset = c->out_.size();
+        c->out_.resize(offset + len_msg);
+        memcpy(&c->out_[offset], &i, sizeof(i));
+        offset += sizeof(i);
+        mh->SerializeWithCachedSizesToArray(&c->out_[offset]);
+        offset += len_msg_header;
+        if (mh->length_data() > 0) {
+            memcpy(&c->out_[offset], buffer->data(), buffer->length());
+        }
+        DBG("wm: id=%d len_msg_header=%d length_data=%d",
+                c->id_, len_msg_header, mh->length_data());
+
+        int status = FlushLocked(c);
+        if ((status == STATUS_OK) && was_idle && (c->out_offset_ < c->out_.size())) {
+            Wake();
+        }
+        return status;
+    }
+
+    void Wake() {
+        char b = 0;
+        if (send(stop_client_fd_, &b, sizeof(b), MSG_DONTWAIT) < 0
+                && errno != EAGAIN && errno != EWOULDBLOCK) {
+            LOGE("CtrlServerThread::Wake failed '%s'", strerror(errno));
+        }
+    }
 
-        while (length != 0) {
-            ret_value = recv(s, bytes, length, 0);
-            if (ret_value < 0) {
+    /**
+     * Take whatever has arrived on c, handling each message as it
+     * completes. Returns other than STATUS_OK if c should be closed.
+     */
+    int ReadClient(CtrlClient *c) {
+        while (isRunning()) {
+            ssize_t n = recv(c->fd_, c->read_ptr_, c->read_left_, 0);
+            if (n < 0) {
+                if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+                    return STATUS_OK;
+                }
+                if (errno == EINTR) {
+                    continue;
+                }
                 return STATUS_ERR;
             }
-            if (ret_value == 0) {
+            if (n == 0) {
                 return STATUS_CLIENT_CLOSED_CONNECTION;
             }
-            bytes += ret_value;
-            length -= ret_value;
+            c->read_ptr_ += n;
+            c->read_left_ -= n;
+            if (c->read_left_ == 0) {
+                int status = ReadComplete(c);
+                if (status != STATUS_OK) {
+                    return status;
+                }
+            }
         }
-
         return STATUS_OK;
     }
 
-    int ReadMessage(MsgHeader *mh, Buffer **pBuffer) {
+    int ReadComplete(CtrlClient *c) {
+        switch (c->state_) {
+            case CtrlClient::READ_LENGTH:
+                c->len_msg_header_ = letoh32(c->len_msg_header_);
+                DBG("rm: id=%d len_msg_header=%d", c->id_, c->len_msg_header_);
+                if (c->len_msg_header_ > CTRL_SERVER_MAX_HEADER) {
+                    LOGE("CtrlServerThread: header of %d bytes, closing",
+                            c->len_msg_header_);
+                    return STATUS_BAD_DATA;
+                }
+                c->msg_header_raw_.resize(c->len_msg_header_);
+                c->state_ = CtrlClient::READ_HEADER;
+                c->read_ptr_ = c->msg_header_raw_.empty() ? NULL : &c->msg_header_raw_[0];
+                c->read_left_ = c->len_msg_header_;
+                if (c->read_left_ != 0) {
+                    return STATUS_OK;
+                }
+                // FALL THROUGH, an empty header
+
+            case CtrlClient::READ_HEADER:
+                c->mh_.Clear();
+                c->mh_.ParseFromArray(c->msg_header_raw_.empty() ?
+                        NULL : &c->msg_header_raw_[0], c->len_msg_header_);
+                DBG("rm: id=%d cmd=%d length_data=%d",
+                        c->id_, c->mh_.cmd(), c->mh_.length_data());
+                if (c->mh_.length_data() > CTRL_SERVER_MAX_DATA) {
+                    LOGE("CtrlServerThread: data of %d bytes, closing",
+                            c->mh_.length_data());
+                    return STATUS_BAD_DATA;
+                }
+                if (c->mh_.length_data() > 0) {
+                    c->buffer_ = ObtainBuffer(c->mh_.length_data());
+                    c->state_ = CtrlClient::READ_DATA;
+                    c->read_ptr_ = (uint8_t *)c->buffer_->data();
+                    c->read_left_ = c->buffer_->length();
+                    return STATUS_OK;
+                }
+                break;
+
+            case CtrlClient::READ_DATA:
+                DBG("rm: id=%d read protobuf", c->id_);
+                break;
+        }
+
+        Buffer *buffer = c->buffer_;
+        ExpectLength(c);
+        return HandleMessage(c, &c->mh_, buffer);
+    }
+
+    int HandleMessage(CtrlClient *c, MsgHeader *mh, Buffer *buffer) {
         int status;
-        int32_t len_msg_header;
-
-        // Reader header length
-        status = ReadAll(server_to_client_socket_, &len_msg_header, sizeof(len_msg_header));
-        len_msg_header = letoh32(len_msg_header);
-        DBG("rm: read len_msg_header=%d  status=%d", len_msg_header, status);
-        if (status != STATUS_OK) return status;
-
-        // Read header into an array allocated on the stack and unmarshall
-        uint8_t *msg_header_raw = (uint8_t *)alloca(len_msg_header);
-        status = ReadAll(server_to_client_socket_, msg_header_raw, len_msg_header);
-        DBG("rm: read msg_header_raw=%p  status=%d", msg_header_raw, status);
-        if (status != STATUS_OK) return status;
-        mh->ParseFromArray(msg_header_raw, len_msg_header);
-
-        // Read auxillary data
-        Buffer *buffer;
-        if (mh->length_data() > 0) {
-            buffer = ObtainBuffer(mh->length_data());
-            status = ReadAll(server_to_client_socket_, buffer->data(), buffer->length());
-            DBG("rm: read protobuf status=%d", status);
-            if (status != STATUS_OK) return status;
-        } else {
-            DBG("rm: NO protobuf");
-            buffer = NULL;
+
+        if (mh->cmd() == ril_proto::CTRL_CMD_ECHO) {
+            LOGD("CtrlServerThread::Worker echo");
+            pthread_mutex_lock(&out_mutex_);
+            status = WriteMessageLocked(c, mh, buffer);
+            pthread_mutex_unlock(&out_mutex_);
+            return status;
         }
 
-        *pBuffer = buffer;
+        CtrlPending pending;
+        pending.client_id = c->id_;
+        pending.client_token = mh->token();
+        pthread_mutex_lock(&out_mutex_);
+        uint64_t token = next_token_++;
+        pending_[token] = pending;
+        pthread_mutex_unlock(&out_mutex_);
+        mh->set_token(token);
+
+        DBG("CtrlServerThread::Worker sendToCtrlServer id=%d token=%lld",
+                c->id_, token);
+        sendToCtrlServer(mh, buffer);
+
+        // A failing command was already answered; the client lives on
         return STATUS_OK;
     }
 
   public:
+    /**
+     * Send the response to a request, to whichever client made it.
+     */
     int WriteMessage(MsgHeader *mh, Buffer *buffer) {
-        int status;
-        uint32_t i;
-        uint64_t l;
+        int status = STATUS_OK;
 
-        // Set length of data
-        if (buffer == NULL) {
-            mh->set_length_data(0);
-        } else {
-            mh->set_length_data(buffer->length());
+        pthread_mutex_lock(&out_mutex_);
+        std::map<uint64_t, CtrlPending>::iterator itr = pending_.find(mh->token());
+        if (itr == pending_.end()) {
+            DBG("WriteMessage: no client for token=%lld", mh->token());
+            pthread_mutex_unlock(&out_mutex_);
+            return STATUS_ERR;
         }
-
-        // Serialize header
-        uint32_t len_msg_header = mh->ByteSize();
-        uint8_t *msg_header_raw = (uint8_t *)alloca(len_msg_header);
-        mh->SerializeToArray(msg_header_raw, len_msg_header);
-
-        // Write length in little endian followed by the header
-        i = htole32(len_msg_header);
-        status = WriteAll(server_to_client_socket_, &i, 4);
-        DBG("wm: write len_msg_header=%d status=%d", len_msg_header, status);
-        if (status != 0) return status;
-        status = WriteAll(server_to_client_socket_, msg_header_raw, len_msg_header);
-        DBG("wm: write msg_header_raw=%p  status=%d", msg_header_raw, status);
-        if (status != 0) return status;
-
-        // Write data
-        if (mh->length_data() > 0) {
-            status = WriteAll(server_to_client_socket_, buffer->data(), buffer->length());
-            DBG("wm: protobuf data=%p len=%d status=%d",
-                    buffer->data(), buffer->length(), status);
-            if (status != 0) return status;
+        CtrlPending pending = itr->second;
+        pending_.erase(itr);
+
+        CtrlClient *c = &clients_[pending.client_id & 0xff];
+        if ((c->fd_ >= 0) && (c->id_ == pending.client_id)) {
+            mh->set_token(pending.client_token);
+            status = WriteMessageLocked(c, mh, buffer);
+            if (status != STATUS_OK) {
+                // Let the poll loop notice and close it
+                Wake();
+            }
         }
+        pthread_mutex_unlock(&out_mutex_);
 
-        return STATUS_OK;
+        return status;
     }
 
     CtrlServerThread(v8::Handle<v8::Context> context) :
             context_(context),
             server_accept_socket_(-1),
-            server_to_client_socket_(-1),
-            done_(false) {
+            done_(false),
+            generation_(0),
+            next_token_(1) {
+        for (int i = 0; i < CTRL_SERVER_MAX_CLIENTS; i++) {
+            clients_[i].fd_ = -1;
+            clients_[i].id_ = -1;
+            clients_[i].buffer_ = NULL;
+            clients_[i].out_offset_ = 0;
+        }
+        pthread_mutex_init(&out_mutex_, NULL);
     }
 
     virtual int Run() {
@@ -213,6 +458,7 @@ class CtrlServerThread : public WorkerThread {
         }
 
         // Create a client socket that will be used for sending a stop
+        // or waking the poll loop to send queued responses
         stop_client_fd_ = socket_loopback_client(
                 MOCK_RIL_CONTROL_SERVER_STOPPING_SOCKET, SOCK_STREAM);
         if (stop_client_fd_ < 0) {
@@ -229,6 +475,13 @@ class CtrlServerThread : public WorkerThread {
             return STATUS_ERR;
         }
 
+        if ((SetNonBlocking(server_accept_socket_) != STATUS_OK)
+                || (SetNonBlocking(stopper_fd_) != STATUS_OK)) {
+            LOGE("CtrlServerThread::Run error making sockets non-blocking '%s'",
+                    strerror(errno));
+            return STATUS_ERR;
+        }
+
         // Run the new thread
         int ret_value = WorkerThread::Run(NULL);
         DBG("CtrlServerThread::Run X");
@@ -250,20 +503,7 @@ class CtrlServerThread : public WorkerThread {
     }
 
     virtual bool isRunning() {
-        bool rv = done_ || WorkerThread::isRunning();
-        return rv;
-    }
-
-    int WaitOnSocketOrStopping(fd_set *rfds, int s) {
-        DBG("WaitOnSocketOrStopping E s=%d stopper_fd_=%d", s, stopper_fd_);
-        FD_ZERO(rfds);
-        FD_SET(s, rfds);
-        FD_SET(stopper_fd_, rfds);
-        int fd_number = s > stopper_fd_ ? s + 1 : stopper_fd_ + 1;
-        v8::Unlocker unlocker;
-        int rv = select(fd_number, rfds, NULL, NULL, NULL);
-        v8::Locker locker;
-        DBG("WaitOnSocketOrStopping X rv=%d s=%d stopper_fd_=%d", rv, s, stopper_fd_);
+        bool rv = !done_ && WorkerThread::isRunning();
         return rv;
     }
 
@@ -312,7 +552,7 @@ class CtrlServerThread : public WorkerThread {
             // An error report complete now
             mh->set_length_data(0);
             mh->set_status(ril_proto::CTRL_STATUS_ERR);
-            g_ctrl_server->WriteMessage(mh, NULL);
+            WriteMessage(mh, NULL);
         }
 
         DBG("sendToCtrlServer X: status=%d", status);
@@ -327,48 +567,88 @@ class CtrlServerThread : public WorkerThread {
         v8::HandleScope handle_scope;
         v8::Context::Scope context_scope(context_);
 
+        struct pollfd fds[CTRL_SERVER_MAX_CLIENTS + 2];
+        CtrlClient *polled[CTRL_SERVER_MAX_CLIENTS];
+
         while (isRunning()) {
-            int ret_value;
+            int nfds = 0;
+
+            fds[nfds].fd = stopper_fd_;
+            fds[nfds++].events = POLLIN;
+            fds[nfds].fd = server_accept_socket_;
+            fds[nfds++].events = POLLIN;
+            pthread_mutex_lock(&out_mutex_);
+            for (int i = 0; i < CTRL_SERVER_MAX_CLIENTS; i++) {
+                CtrlClient *c = &clients_[i];
+                if (c->fd_ < 0) {
+                    continue;
+                }
+                polled[nfds - 2] = c;
+                fds[nfds].fd = c->fd_;
+                fds[nfds].events = POLLIN;
+                if (c->out_offset_ < c->out_.size()) {
+                    fds[nfds].events |= POLLOUT;
+                }
+                nfds++;
+            }
+            pthread_mutex_unlock(&out_mutex_);
 
-            // Wait on either server_accept_socket_ or stopping
-            DBG("CtrlServerThread::Worker wait on server for a client");
-            WaitOnSocketOrStopping(&rd_fds_, server_accept_socket_);
-            if (isRunning() != true) {
+            // Let JS run elsewhere while we wait
+            int rv;
+            {
+                v8::Unlocker unlocker;
+                rv = poll(fds, nfds, -1);
+            }
+            if ((rv < 0) && (errno != EINTR)) {
+                LOGE("CtrlServerThread::Worker poll failed '%s'", strerror(errno));
+                break;
+            }
+            if (!isRunning()) {
                 break;
             }
+            if (rv <= 0) {
+                continue;
+            }
 
-            if (FD_ISSET(server_accept_socket_, &rd_fds_)) {
-                server_to_client_socket_ = accept(server_accept_socket_, NULL, NULL);
-                DBG("CtrlServerThread::Worker accepted server_to_client_socket_=%d isRunning()=%d",
-                        server_to_client_socket_, isRunning());
-
-                int status;
-                Buffer *buffer;
-                MsgHeader mh;
-                while ((server_to_client_socket_ > 0) && isRunning()) {
-                    DBG("CtrlServerThread::Worker wait on client for message");
-                    WaitOnSocketOrStopping(&rd_fds_, server_to_client_socket_);
-                    if (isRunning() != true) {
-                        break;
-                    }
+            if (fds[0].revents & POLLIN) {
+                // Wakeups carry nothing, just drain them
+                char drain[64];
+                while (recv(stopper_fd_, drain, sizeof(drain), 0) > 0) {
+                }
+            }
 
-                    status = ReadMessage(&mh, &buffer);
-                    if (status != STATUS_OK) break;
-
-                    if (mh.cmd() == ril_proto::CTRL_CMD_ECHO) {
-                        LOGD("CtrlServerThread::Worker echo");
-                        status = WriteMessage(&mh, buffer);
-                        if (status != STATUS_OK) break;
-                    } else {
-                        DBG("CtrlServerThread::Worker sendToCtrlServer");
-                        status = sendToCtrlServer(&mh, buffer);
-                        if (status != STATUS_OK) break;
-                    }
+            for (int i = 2; i < nfds; i++) {
+                CtrlClient *c = polled[i - 2];
+                int status = STATUS_OK;
+
+                if (fds[i].revents & POLLOUT) {
+                    pthread_mutex_lock(&out_mutex_);
+                    status = FlushLocked(c);
+                    pthread_mutex_unlock(&out_mutex_);
+                }
+                if ((status == STATUS_OK)
+                        && (fds[i].revents & (POLLIN | POLLHUP | POLLERR))) {
+                    status = ReadClient(c);
+                }
+                if (status != STATUS_OK) {
+                    CloseClient(c);
+                }
+            }
+
+            if (fds[1].revents & POLLIN) {
+                int fd;
+                while ((fd = accept(server_accept_socket_, NULL, NULL)) >= 0) {
+                    OpenClient(fd);
                 }
-                close(server_to_client_socket_);
-                server_to_client_socket_ = -1;
             }
         }
+
+        for (int i = 0; i < CTRL_SERVER_MAX_CLIENTS; i++) {
+            if (clients_[i].fd_ >= 0) {
+                CloseClient(&clients_[i]);
+            }
+        }
+
         close(stop_server_fd_);
         stop_server_fd_ = -1;
 
@@ -341,6 +341,7 @@ const RIL_RadioFunctions *RIL_Init(const struct RIL_Env *env, int argc,
     experiments(context);
     testWorker();
     testWorkerV8(context);
+    testNodeBuffer(context);
     LOGD("RIL_Init tests completed ###############");
 #endif
 
@@ -31,9 +31,13 @@
 #include <v8.h>
 
 #include <string.h> // memcpy
+#include <time.h>
 
-#include <arpa/inet.h>  // htons, htonl
+#include <map>
+#include <string>
+#include <vector>
 
+#include "js_support.h"
 #include "logging.h"
 #include "node_util.h"
 #include "util.h"
@@ -160,6 +164,261 @@ class AsciiSliceExt: public String::ExternalAsciiStringResource {
 };
 #endif
 
+// A compiled buffer.unpack() format. Runs of the same format character
+// are folded into a single op, so decoding is one bounds check followed
+// by a tight loop per run instead of a switch and a bounds check per
+// character.
+class UnpackFormat {
+ public:
+  UnpackFormat() : size_(0), fields_(0) {}
+
+  // Returns false if the format has an unknown character
+  bool Compile(const char *format, int length) {
+    ops_.clear();
+    size_ = 0;
+    fields_ = 0;
+    for (int i = 0; i < length; i++) {
+      uint8_t width;
+      switch (format[i]) {
+        case 'N': width = 4; break;
+        case 'n': width = 2; break;
+        case 'o': width = 1; break;
+        default:
+          return false;
+      }
+      if (ops_.empty() || ops_.back().code != format[i]) {
+        Op op = { (uint8_t)format[i], width, 0 };
+        ops_.push_back(op);
+      }
+      ops_.back().count += 1;
+      size_ += width;
+      fields_ += 1;
+    }
+    return true;
+  }
+
+  // Number of bytes consumed by one decode
+  size_t size() const { return size_; }
+
+  // Number of array elements produced by one decode
+  int fields() const { return fields_; }
+
+  // Decode size() bytes at p into array, caller checks bounds
+  void Decode(const uint8_t *p, Handle<Array> array) const {
+    uint32_t index = 0;
+    for (size_t i = 0; i < ops_.size(); i++) {
+      const Op &op = ops_[i];
+      uint32_t n = op.count;
+      switch (op.code) {
+        // 32bit unsigned integer in network byte order
+        case 'N':
+          for (; n > 0; n--, p += 4) {
+            uint32_t v = ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16)
+                       | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+            array->Set(index++, Integer::NewFromUnsigned(v));
+          }
+          break;
+
+        // 16bit unsigned integer in network byte order
+        case 'n':
+          for (; n > 0; n--, p += 2) {
+            uint32_t v = ((uint32_t)p[0] << 8) | (uint32_t)p[1];
+            array->Set(index++, Integer::NewFromUnsigned(v));
+          }
+          break;
+
+        // a single octet, unsigned.
+        case 'o':
+          for (; n > 0; n--, p += 1) {
+            array->Set(index++, Integer::NewFromUnsigned(*p));
+          }
+          break;
+      }
+    }
+  }
+
+ private:
+  struct Op {
+    uint8_t code;
+    uint8_t width;
+    uint32_t count;
+  };
+
+  std::vector<Op> ops_;
+  size_t size_;
+  int fields_;
+};
+
+// Formats passed as strings to buffer.unpack() are compiled once and kept
+// here. Scripts use a handful of constant formats so entries are never
+// evicted; past the limit formats are compiled per call. Only touched by
+// the thread holding the v8::Locker.
+#define UNPACK_FORMAT_CACHE_MAX 64
+typedef std::map<std::string, UnpackFormat *> UnpackFormatCache;
+static UnpackFormatCache s_unpack_formats;
+
+/**
+ * Return the compiled form of format, using scratch when the cache is
+ * full. Returns NULL if the format is invalid.
+ */
+static const UnpackFormat *LookupUnpackFormat(const char *format, int length,
+                                              UnpackFormat *scratch) {
+  std::string key(format, length);
+  UnpackFormatCache::iterator it = s_unpack_formats.find(key);
+  if (it != s_unpack_formats.end()) {
+    return it->second;
+  }
+
+  if (s_unpack_formats.size() >= UNPACK_FORMAT_CACHE_MAX) {
+    DBG("LookupUnpackFormat cache full");
+    return scratch->Compile(format, length) ? scratch : NULL;
+  }
+
+  UnpackFormat *f = new UnpackFormat();
+  if (!f->Compile(format, length)) {
+    delete f;
+    return NULL;
+  }
+  s_unpack_formats[key] = f;
+  return f;
+}
+
+static Handle<Value> UnpackWith(Buffer *buffer, const UnpackFormat *format,
+                                uint32_t index) {
+  HandleScope scope;
+  size_t size = format->size();
+  if (size > 0 && (size > buffer->length() || index > buffer->length() - size)) {
+    return ThrowException(Exception::Error(String::New("Out of bounds")));
+  }
+
+  Local<Array> array = Array::New(format->fields());
+  format->Decode((const uint8_t *)buffer->data() + index, array);
+  return scope.Close(array);
+}
+
+
+// The object returned by Buffer.compile(format). It owns its compiled
+// format so it stays valid regardless of the format cache.
+class UnpackDecoder : public ObjectWrap {
+ public:
+  static Persistent<FunctionTemplate> constructor_template;
+
+  static void InitializeTemplate() {
+    HandleScope scope;
+    Local<FunctionTemplate> t = FunctionTemplate::New(UnpackDecoder::New);
+    constructor_template = Persistent<FunctionTemplate>::New(t);
+    constructor_template->InstanceTemplate()->SetInternalFieldCount(1);
+    constructor_template->SetClassName(String::NewSymbol("UnpackDecoder"));
+    SET_PROTOTYPE_METHOD(constructor_template, "unpack", UnpackDecoder::Unpack);
+  }
+
+  static inline bool HasInstance(Handle<Value> val) {
+    if (!val->IsObject()) return false;
+    return constructor_template->HasInstance(val->ToObject());
+  }
+
+  const UnpackFormat *format() const { return &format_; }
+
+ private:
+  // new UnpackDecoder(format)
+  static Handle<Value> New(const Arguments &args) {
+    DBG("UnpackDecoder::New(args) E");
+    HandleScope scope;
+
+    if (!args[0]->IsString()) {
+      DBG("UnpackDecoder::New(args) X arg[0] not string");
+      return ThrowException(Exception::TypeError(String::New(
+              "Argument must be a string")));
+    }
+
+    String::AsciiValue format(args[0]->ToString());
+    UnpackDecoder *decoder = new UnpackDecoder();
+    if (!decoder->format_.Compile(*format, format.length())) {
+      DBG("UnpackDecoder::New(args) X unknown format character");
+      delete decoder;
+      return ThrowException(Exception::Error(
+            String::New("Unknown format character")));
+    }
+
+    decoder->Wrap(args.This());
+    args.This()->Set(String::NewSymbol("size"),
+                     Integer::NewFromUnsigned(decoder->format_.size()));
+    DBG("UnpackDecoder::New(args) X");
+    return args.This();
+  }
+
+  // decoder.unpack(buffer, index)
+  static Handle<Value> Unpack(const Arguments &args) {
+    UnpackDecoder *decoder = ObjectWrap::Unwrap<UnpackDecoder>(args.This());
+    if (!Buffer::HasInstance(args[0])) {
+      return ThrowException(Exception::TypeError(String::New(
+              "Argument must be a Buffer")));
+    }
+    Buffer *buffer = ObjectWrap::Unwrap<Buffer>(args[0]->ToObject());
+    return UnpackWith(buffer, &decoder->format_, args[1]->Uint32Value());
+  }
+
+  UnpackFormat format_;
+};
+
+Persistent<FunctionTemplate> UnpackDecoder::constructor_template;
+
+
+// A typed view on part of a Blob, returned by buffer.view(). Indexed
+// access goes straight to the blob memory; the view holds a reference
+// so the blob outlives every view on it.
+class BufferView : public ObjectWrap {
+ public:
+  static Persistent<ObjectTemplate> object_template;
+
+  static void InitializeTemplate() {
+    HandleScope scope;
+    Local<ObjectTemplate> t = ObjectTemplate::New();
+    t->SetInternalFieldCount(1);
+    object_template = Persistent<ObjectTemplate>::New(t);
+  }
+
+  static Local<Object> New(Blob *blob, char *data, ExternalArrayType type,
+                           int elements) {
+    HandleScope scope;
+    Local<Object> obj = object_template->NewInstance();
+    BufferView *view = new BufferView(blob);
+    view->Wrap(obj);
+    obj->SetIndexedPropertiesToExternalArrayData(data, type, elements);
+    obj->Set(length_symbol, Integer::New(elements));
+    return scope.Close(obj);
+  }
+
+  ~BufferView() {
+    blob_unref(blob_);
+    V8::AdjustAmountOfExternalAllocatedMemory(
+        -static_cast<long int>(sizeof(BufferView)));
+  }
+
+ private:
+  BufferView(Blob *blob) : blob_(blob) {
+    blob_ref(blob_);
+    V8::AdjustAmountOfExternalAllocatedMemory(sizeof(BufferView));
+  }
+
+  Blob *blob_;
+};
+
+Persistent<ObjectTemplate> BufferView::object_template;
+
+static const struct {
+  const char *name;
+  ExternalArrayType type;
+  size_t width;
+} s_view_types[] = {
+  { "int8",   kExternalByteArray,          1 },
+  { "uint8",  kExternalUnsignedByteArray,  1 },
+  { "int16",  kExternalShortArray,         2 },
+  { "uint16", kExternalUnsignedShortArray, 2 },
+  { "int32",  kExternalIntArray,           4 },
+  { "uint32", kExternalUnsignedIntArray,   4 },
+};
+
 Buffer* Buffer::New(size_t size) {
   DBG("Buffer::New(size) E");
   HandleScope scope;
@@ -522,7 +781,8 @@ Handle<Value> Buffer::BinaryWrite(const Arguments &args) {
 
 // buffer.unpack(format, index);
 // Starting at 'index', unpacks binary from the buffer into an array.
-// 'format' is a string
+// 'format' is a string or a decoder returned by Buffer.compile(). String
+// formats are compiled on first use and cached.
 //
 //  FORMAT  RETURNS
 //    N     uint32_t   a 32bit unsigned integer in network byte order
@@ -532,6 +792,14 @@ Handle<Value> Buffer::Unpack(const Arguments &args) {
   DBG("Buffer::Unpack(args) E");
   HandleScope scope;
   Buffer *buffer = ObjectWrap::Unwrap<Buffer>(args.This());
+  uint32_t index = args[1]->Uint32Value();
+
+  if (UnpackDecoder::HasInstance(args[0])) {
+    UnpackDecoder *decoder =
+        ObjectWrap::Unwrap<UnpackDecoder>(args[0]->ToObject());
+    DBG("Buffer::Unpack(args) X decoder");
+    return scope.Close(UnpackWith(buffer, decoder->format(), index));
+  }
 
   if (!args[0]->IsString()) {
     DBG("Buffer::Unpack(args) X arg[0] not string");
@@ -540,51 +808,76 @@ Handle<Value> Buffer::Unpack(const Arguments &args) {
   }
 
   String::AsciiValue format(args[0]->ToString());
-  uint32_t index = args[1]->Uint32Value();
-
-#define OUT_OF_BOUNDS ThrowException(Exception::Error(String::New("Out of bounds")))
-
-  Local<Array> array = Array::New(format.length());
-
-  uint8_t  uint8;
-  uint16_t uint16;
-  uint32_t uint32;
-
-  for (int i = 0; i < format.length(); i++) {
-    switch ((*format)[i]) {
-      // 32bit unsigned integer in network byte order
-      case 'N':
-        if (index + 3 >= buffer->length_) return OUT_OF_BOUNDS;
-        uint32 = htonl(*(uint32_t*)(buffer->data() + index));
-        array->Set(Integer::New(i), Integer::NewFromUnsigned(uint32));
-        index += 4;
-        break;
-
-      // 16bit unsigned integer in network byte order
-      case 'n':
-        if (index + 1 >= buffer->length_) return OUT_OF_BOUNDS;
-        uint16 = htons(*(uint16_t*)(buffer->data() + index));
-        array->Set(Integer::New(i), Integer::NewFromUnsigned(uint16));
-        index += 2;
-        break;
-
-      // a single octet, unsigned.
-      case 'o':
-        if (index >= buffer->length_) return OUT_OF_BOUNDS;
-        uint8 = (uint8_t)buffer->data()[index];
-        array->Set(Integer::New(i), Integer::NewFromUnsigned(uint8));
-        index += 1;
-        break;
-
-      default:
-        DBG("Buffer::Unpack(args) X unknown format character");
-        return ThrowException(Exception::Error(
-              String::New("Unknown format character")));
-    }
+  UnpackFormat scratch;
+  const UnpackFormat *f =
+      LookupUnpackFormat(*format, format.length(), &scratch);
+  if (f == NULL) {
+    DBG("Buffer::Unpack(args) X unknown format character");
+    return ThrowException(Exception::Error(
+          String::New("Unknown format character")));
   }
 
   DBG("Buffer::Unpack(args) X");
-  return scope.Close(array);
+  return scope.Close(UnpackWith(buffer, f, index));
+}
+
+
+// var decoder = Buffer.compile(format);
+// Compiles an unpack format once, decoder.unpack(buffer, index) and
+// buffer.unpack(decoder, index) then skip parsing the format entirely.
+// decoder.size is the number of bytes one unpack consumes.
+Handle<Value> Buffer::Compile(const Arguments &args) {
+  DBG("Buffer::Compile(args) E");
+  HandleScope scope;
+  Local<Value> arg = args[0];
+  Local<Object> decoder =
+      UnpackDecoder::constructor_template->GetFunction()->NewInstance(1, &arg);
+  DBG("Buffer::Compile(args) X");
+  return scope.Close(decoder);
+}
+
+
+// var view = buffer.view(type, start, end);
+// Returns a view on bytes [start, end) of the buffer as an array of
+// 'type' elements: int8, uint8, int16, uint16, int32 or uint32. Nothing
+// is copied, writes through the view change the buffer. Elements are in
+// host byte order and start must be aligned to the element size.
+Handle<Value> Buffer::View(const Arguments &args) {
+  DBG("Buffer::View(args) E");
+  HandleScope scope;
+  Buffer *parent = ObjectWrap::Unwrap<Buffer>(args.This());
+
+  if (!args[0]->IsString()) {
+    DBG("Buffer::View(args) X arg[0] not string");
+    return ThrowException(Exception::TypeError(String::New(
+            "Argument must be a string")));
+  }
+
+  String::AsciiValue type(args[0]->ToString());
+  size_t t;
+  for (t = 0; t < sizeof(s_view_types) / sizeof(s_view_types[0]); t++) {
+    if (strcmp(*type, s_view_types[t].name) == 0) break;
+  }
+  if (t == sizeof(s_view_types) / sizeof(s_view_types[0])) {
+    DBG("Buffer::View(args) X unknown type");
+    return ThrowException(Exception::Error(String::New("Unknown view type")));
+  }
+
+  SLICE_ARGS(args[1], args[2])
+
+  size_t width = s_view_types[t].width;
+  char *data = parent->data() + start;
+  if ((((uintptr_t)data) % width) != 0 || ((end - start) % width) != 0) {
+    DBG("Buffer::View(args) X unaligned");
+    return ThrowException(Exception::Error(String::New(
+            "View must be aligned to the element size")));
+  }
+
+  Local<Object> view = BufferView::New(parent->blob_, data,
+      s_view_types[t].type, (end - start) / width);
+
+  DBG("Buffer::View(args) X");
+  return scope.Close(view);
 }
 
 
@@ -633,10 +926,86 @@ void Buffer::InitializeObjectTemplate(Handle<ObjectTemplate> target) {
   SET_PROTOTYPE_METHOD(constructor_template, "asciiWrite", Buffer::AsciiWrite);
   SET_PROTOTYPE_METHOD(constructor_template, "binaryWrite", Buffer::BinaryWrite);
   SET_PROTOTYPE_METHOD(constructor_template, "unpack", Buffer::Unpack);
+  SET_PROTOTYPE_METHOD(constructor_template, "view", Buffer::View);
   SET_PROTOTYPE_METHOD(constructor_template, "copy", Buffer::Copy);
 
   SET_PROTOTYPE_METHOD(constructor_template, "byteLength", Buffer::ByteLength);
 
+  constructor_template->Set(String::NewSymbol("compile"),
+                            FunctionTemplate::New(Buffer::Compile));
+
+  UnpackDecoder::InitializeTemplate();
+  BufferView::InitializeTemplate();
+
   target->Set(String::NewSymbol("Buffer"), constructor_template);
   DBG("InitializeObjectTemplate(target) X:");
 }
+
+static int64_t testNowNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/**
+ * Microbenchmark of the unpack paths. The native part compares parsing
+ * the format on every call, as unpack used to, with the cached compiled
+ * format. The script part decodes an SMS PDU sized record by indexing
+ * bytes, with unpack, with a compiled decoder and with a typed view.
+ */
+void testNodeBuffer(v8::Handle<v8::Context> context) {
+  LOGD("testNodeBuffer E: ********");
+  v8::HandleScope handle_scope;
+
+  static const char format[] = "oooonnnnNNNNoooonnnnNNNNoooonnnnNNNN";
+  static const int iterations = 100000;
+
+  int64_t start = testNowNs();
+  for (int i = 0; i < iterations; i++) {
+    UnpackFormat f;
+    f.Compile(format, sizeof(format) - 1);
+  }
+  int64_t parse_ns = testNowNs() - start;
+
+  UnpackFormat scratch;
+  start = testNowNs();
+  for (int i = 0; i < iterations; i++) {
+    LookupUnpackFormat(format, sizeof(format) - 1, &scratch);
+  }
+  int64_t cached_ns = testNowNs() - start;
+
+  LOGD("testNodeBuffer format parse=%lldns/call cached=%lldns/call",
+       (long long)(parse_ns / iterations), (long long)(cached_ns / iterations));
+
+  v8::TryCatch try_catch;
+  try_catch.SetVerbose(true);
+
+  runJs(context, &try_catch, "local-string",
+    "var N = 20000;\n"
+    "var b = new Buffer(176);\n"
+    "for (var i = 0; i < b.length; i++) b[i] = i;\n"
+    "var fmt = '';\n"
+    "for (var i = 0; i < 44; i++) fmt += 'N';\n"
+    "var d = Buffer.compile(fmt);\n"
+    "function bench(name, f) {\n"
+    "  var t = Date.now();\n"
+    "  for (var i = 0; i < N; i++) f();\n"
+    "  print('testNodeBuffer ' + name + ': ' + (Date.now() - t) + 'ms');\n"
+    "}\n"
+    "bench('bytes', function () {\n"
+    "  var a = new Array(44);\n"
+    "  for (var j = 0; j < 44; j++) {\n"
+    "    var k = j * 4;\n"
+    "    a[j] = ((b[k] << 24) | (b[k+1] << 16) | (b[k+2] << 8) | b[k+3]) >>> 0;\n"
+    "  }\n"
+    "});\n"
+    "bench('unpack', function () { b.unpack(fmt, 0); });\n"
+    "bench('decoder', function () { d.unpack(b, 0); });\n"
+    "bench('view', function () {\n"
+    "  var v = b.view('uint32', 0, 176);\n"
+    "  var s = 0;\n"
+    "  for (var j = 0; j < v.length; j++) s += v[j];\n"
+    "});\n"
+  );
+  LOGD("testNodeBuffer X: ********");
+}
@@ -46,6 +46,14 @@
  * case that buffer->root == NULL) or slice objects (in which case
  * buffer->root != NULL).  A root buffer is only GCed once all its slices
  * are GCed.
+ *
+ * // returns a uint16 view on bytes 4..20 - no memory is copied, elements
+ * // are in host byte order
+ * buffer.view('uint16', 4, 20)
+ *
+ * // compiles a format once and decodes many records with it
+ * var record = Buffer.compile('nnoN');
+ * record.unpack(buffer, index)
  */
 
 
@@ -85,6 +93,8 @@ class Buffer : public ObjectWrap {
   static v8::Handle<v8::Value> Utf8Write(const v8::Arguments &args);
   static v8::Handle<v8::Value> ByteLength(const v8::Arguments &args);
   static v8::Handle<v8::Value> Unpack(const v8::Arguments &args);
+  static v8::Handle<v8::Value> Compile(const v8::Arguments &args);
+  static v8::Handle<v8::Value> View(const v8::Arguments &args);
   static v8::Handle<v8::Value> Copy(const v8::Arguments &args);
 
   Buffer(size_t length);
@@ -95,4 +105,6 @@ class Buffer : public ObjectWrap {
   struct Blob_ *blob_;
 };
 
+extern void testNodeBuffer(v8::Handle<v8::Context> context);
+
 #endif  // MOCK_RIL_NODE_BUFFER_H_
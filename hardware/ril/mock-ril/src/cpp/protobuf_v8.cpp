@@ -16,6 +16,7 @@
 
 #include <map>
 #include <string>
+#include <vector>
 #include <iostream>
 #include <sstream>
 
@@ -118,10 +119,25 @@ namespace protobuf_v8 {
     public:
       Schema* schema_;
       const Descriptor* descriptor_;
+      // Looked up once rather than on every parse and serialize
+      const Message* prototype_;
+      mutable std::vector<Type*> child_types_;
 
       Message* NewMessage() const {
         DBG("Type::NewMessage() EX:");
-        return schema_->NewMessage(descriptor_);
+        return prototype_->New();
+      }
+
+      // Type of message field i, created on first use as types may nest
+      const Type* ChildType(int i) const {
+        const FieldDescriptor* field = descriptor_->field(i);
+        if (field->cpp_type() != FieldDescriptor::CPPTYPE_MESSAGE) {
+          return NULL;
+        }
+        if (child_types_[i] == NULL) {
+          child_types_[i] = schema_->GetType(field->message_type());
+        }
+        return child_types_[i];
       }
 
       Handle<Function> Constructor() const {
@@ -135,7 +151,9 @@ namespace protobuf_v8 {
       }
 
       Type(Schema* schema, const Descriptor* descriptor, Handle<Object> self)
-        : schema_(schema), descriptor_(descriptor) {
+        : schema_(schema), descriptor_(descriptor),
+          prototype_(schema->factory_.GetPrototype(descriptor)),
+          child_types_(descriptor->field_count(), (Type*)NULL) {
         DBG("Type::Type(schema, descriptor, self) E:");
         // Generate functions for bulk conversion between a JS object
         // and an array in descriptor order:
@@ -256,9 +274,7 @@ namespace protobuf_v8 {
             continue;
           }
 
-          const Type* child_type =
-            (field->cpp_type() == FieldDescriptor::CPPTYPE_MESSAGE) ?
-            schema_->GetType(field->message_type()) : NULL;
+          const Type* child_type = ChildType(i);
 
           Handle<Value> value;
           if (field->is_repeated()) {
@@ -408,9 +424,7 @@ namespace protobuf_v8 {
           if (value->IsUndefined()) continue;
 
           const FieldDescriptor* field = descriptor_->field(i);
-          const Type* child_type =
-            (field->cpp_type() == FieldDescriptor::CPPTYPE_MESSAGE) ?
-            schema_->GetType(field->message_type()) : NULL;
+          const Type* child_type = ChildType(i);
           if (field->is_repeated()) {
             if(!value->IsArray()) {
               ok = ToProto(instance, field, value, child_type, true);
@@ -480,19 +494,33 @@ namespace protobuf_v8 {
 
     const DescriptorPool* pool_;
     map<const Descriptor*, Type*> types_;
+    // schema['name'] runs for every request, skip the pool lookup
+    map<string, Type*> types_by_name_;
     DynamicMessageFactory factory_;
 
     static Handle<Value> GetType(const Local<String> name,
                                  const AccessorInfo& args) {
       DBG("Schema::GetType(name, args) E:");
       Schema* schema = UnwrapThis<Schema>(args);
-      const Descriptor* descriptor =
-        schema->pool_->FindMessageTypeByName(*String::AsciiValue(name));
+      String::AsciiValue ascii(name);
+      string key(*ascii, ascii.length());
+
+      map<string, Type*>::iterator itr = schema->types_by_name_.find(key);
+      if (itr != schema->types_by_name_.end()) {
+        DBG("Schema::GetType(name, args) X: cached");
+        return itr->second->Constructor();
+      }
+
+      const Descriptor* descriptor = schema->pool_->FindMessageTypeByName(key);
+      if (!descriptor) {
+        DBG("Schema::GetType(name, args) X: not a type");
+        return Handle<Function>();
+      }
 
+      Type* type = schema->GetType(descriptor);
+      schema->types_by_name_[key] = type;
       DBG("Schema::GetType(name, args) X:");
-      return descriptor ?
-        schema->GetType(descriptor)->Constructor() :
-        Handle<Function>();
+      return type->Constructor();
     }
 
     static Handle<Value> NewSchema(const Arguments& args) {
@@ -15,7 +15,10 @@
  */
 
 #include <map>
+#include <stdlib.h>
+#include <time.h>
 
+#include <cutils/properties.h>
 #include <v8.h>
 #include "ril.h"
 
@@ -268,6 +271,114 @@ typedef int (*ReqConversion)(Buffer** pBuffer, const void *data,
 typedef std::map<int, ReqConversion> ReqConversionMap;
 ReqConversionMap rilReqConversionMap;
 
+/**
+ * Native handlers indexed by cmd. Read without a lock on every request,
+ * so it is an array of pointers, which are stored atomically, rather
+ * than a map. A handler only points at code, so there's nothing else
+ * whose publication needs ordering.
+ */
+static ReqNativeHandler volatile rilReqNativeHandlers[REQUEST_TABLE_SIZE];
+
+void requestsSetNativeHandler(const int request, ReqNativeHandler handler) {
+    if ((request < 0) || (request >= REQUEST_TABLE_SIZE)) {
+        LOGE("requestsSetNativeHandler: request %d out of range", request);
+        return;
+    }
+    rilReqNativeHandlers[request] = handler;
+}
+
+static int s_screenState = 1;
+
+/**
+ * RIL_REQUEST_SCREEN_STATE  // 61
+ *
+ * simulated_radio.js just records the state, which nothing reads back,
+ * and always succeeds, so there's no need to wake up V8 for it.
+ */
+bool NativeScreenState(const int request, const void *data,
+        const size_t datalen, const RIL_Token t) {
+    if (datalen < sizeof(int)) {
+        // Let ReqScreenState report it
+        return false;
+    }
+    s_screenState = ((int *)data)[0];
+    DBG("NativeScreenState: state=%d", s_screenState);
+    s_rilenv->OnRequestComplete(t, RIL_E_SUCCESS, NULL, 0);
+    return true;
+}
+
+/**
+ * Where the time goes for each request type, in nanoseconds.
+ * Lock wait is the time to get the v8::Locker, both when converting
+ * and when processing.
+ */
+struct RequestProfile {
+    int count;
+    int native_count;
+    int64_t convert_ns;
+    int64_t lock_wait_ns;
+    int64_t js_ns;
+    int64_t js_max_ns;
+};
+
+static RequestProfile s_profile[REQUEST_TABLE_SIZE];
+static pthread_mutex_t s_profile_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int s_profile_interval;          // ril.mock.profile_interval
+static int s_profile_processed;
+
+static int64_t profileNowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void profileAdd(int request, bool native, int64_t convert_ns,
+        int64_t lock_wait_ns, int64_t js_ns) {
+    if ((request < 0) || (request >= REQUEST_TABLE_SIZE)) {
+        return;
+    }
+    pthread_mutex_lock(&s_profile_mutex);
+    RequestProfile *p = &s_profile[request];
+    if (native) {
+        p->native_count += 1;
+    }
+    p->convert_ns += convert_ns;
+    p->lock_wait_ns += lock_wait_ns;
+    if (js_ns >= 0) {
+        p->count += 1;
+        p->js_ns += js_ns;
+        if (js_ns > p->js_max_ns) {
+            p->js_max_ns = js_ns;
+        }
+    }
+    pthread_mutex_unlock(&s_profile_mutex);
+}
+
+void requestsLogProfile() {
+    pthread_mutex_lock(&s_profile_mutex);
+    LOGD("request profile: req   count  native  convert/us  lock/us  js/us  js max/us");
+    for (int i = 0; i < REQUEST_TABLE_SIZE; i++) {
+        RequestProfile *p = &s_profile[i];
+        if ((p->count == 0) && (p->native_count == 0)) {
+            continue;
+        }
+        int n = p->count + p->native_count;
+        LOGD("request profile: %3d %7d %7d %11lld %8lld %6lld %9lld",
+                i, p->count, p->native_count,
+                (long long)(p->convert_ns / n / 1000),
+                (long long)(p->lock_wait_ns / n / 1000),
+                (long long)(p->count ? p->js_ns / p->count / 1000 : 0),
+                (long long)(p->js_max_ns / 1000));
+    }
+    pthread_mutex_unlock(&s_profile_mutex);
+}
+
+/**
+ * onRilRequest is looked up once, the scripts don't replace it.
+ * Must be called with the v8::Locker held.
+ */
+static v8::Persistent<v8::Function> s_onRilRequest;
+
 int callOnRilRequest(v8::Handle<v8::Context> context, int cmd,
                    const void *buffer, RIL_Token t) {
     DBG("callOnRilRequest E: cmd=%d", cmd);
@@ -277,10 +388,17 @@ int callOnRilRequest(v8::Handle<v8::Context> context, int cmd,
     v8::TryCatch try_catch;
 
     // Get the onRilRequest Function
-    v8::Handle<v8::String> name = v8::String::New("onRilRequest");
-    v8::Handle<v8::Value> onRilRequestFunctionValue = context->Global()->Get(name);
-    v8::Handle<v8::Function> onRilRequestFunction =
-        v8::Handle<v8::Function>::Cast(onRilRequestFunctionValue);
+    if (s_onRilRequest.IsEmpty()) {
+        v8::Handle<v8::String> name = v8::String::New("onRilRequest");
+        v8::Handle<v8::Value> onRilRequestFunctionValue = context->Global()->Get(name);
+        if (!onRilRequestFunctionValue->IsFunction()) {
+            LOGE("callOnRilRequest X: onRilRequest isn't a function");
+            return STATUS_ERR;
+        }
+        s_onRilRequest = v8::Persistent<v8::Function>::New(
+                v8::Handle<v8::Function>::Cast(onRilRequestFunctionValue));
+    }
+    v8::Handle<v8::Function> onRilRequestFunction = s_onRilRequest;
 
     // Create the cmd and token
     v8::Handle<v8::Value> v8RequestValue = v8::Number::New(cmd);
@@ -306,26 +424,19 @@ int callOnRilRequest(v8::Handle<v8::Context> context, int cmd,
     return status;
 }
 
-RilRequestWorkerQueue::RilRequestWorkerQueue(v8::Handle<v8::Context> context) {
+RilRequestWorkerQueue::RilRequestWorkerQueue(v8::Handle<v8::Context> context) :
+        WorkerQueue(LOCK_FREE) {
     DBG("RilRequestWorkerQueue E:");
 
     context_ = context;
-    pthread_mutex_init(&free_list_mutex_, NULL);
 
     DBG("RilRequestWorkerQueue X:");
 }
 
 RilRequestWorkerQueue::~RilRequestWorkerQueue() {
     DBG("~RilRequestWorkerQueue E:");
-    Request *req;
-    pthread_mutex_lock(&free_list_mutex_);
-    while(free_list_.size() != 0) {
-        req = free_list_.front();
-        delete req;
-        free_list_.pop();
-    }
-    pthread_mutex_unlock(&free_list_mutex_);
-    pthread_mutex_destroy(&free_list_mutex_);
+    // Stop before request_pool_ goes, the worker may be using a Request
+    Stop();
     DBG("~RilRequestWorkerQueue X:");
 }
 
@@ -337,7 +448,20 @@ void RilRequestWorkerQueue::AddRequest (const int request,
         const void *data, const size_t datalen, const RIL_Token token) {
     DBG("RilRequestWorkerQueue:AddRequest: %d E", request);
 
+    int64_t start_ns = profileNowNs();
+
+    // Fast path, straight from the RIL thread without V8
+    if ((request >= 0) && (request < REQUEST_TABLE_SIZE)) {
+        ReqNativeHandler handler = rilReqNativeHandlers[request];
+        if ((handler != NULL) && handler(request, data, datalen, token)) {
+            profileAdd(request, true, profileNowNs() - start_ns, 0, -1);
+            DBG("RilRequestWorkerQueue::AddRequest: X native request=%d", request);
+            return;
+        }
+    }
+
     v8::Locker locker;
+    int64_t locked_ns = profileNowNs();
     v8::HandleScope handle_scope;
     v8::Context::Scope context_scope(context_);
 
@@ -353,22 +477,19 @@ void RilRequestWorkerQueue::AddRequest (const int request,
         LOGE("RilRequestWorkerQueue:AddRequest: X unknown request %d", request);
         status = STATUS_UNSUPPORTED_REQUEST;
     }
+    profileAdd(request, false, profileNowNs() - locked_ns,
+            locked_ns - start_ns, -1);
 
     if (status == STATUS_OK) {
         // Add serialized request to the queue
         Request *req;
-        pthread_mutex_lock(&free_list_mutex_);
         DBG("RilRequestWorkerQueue:AddRequest: return ok, buffer = %p, buffer->length()=%d",
             buffer, buffer->length());
-        if (free_list_.size() == 0) {
-            req = new Request(request, buffer, token);
-            pthread_mutex_unlock(&free_list_mutex_);
-        } else {
-            req = free_list_.front();
-            free_list_.pop();
-            pthread_mutex_unlock(&free_list_mutex_);
-            req->Set(request, buffer, token);
+        // A heap Request once every pool id is in use, Process deletes it
+        if ((req = request_pool_.Obtain()) == NULL) {
+            req = new Request();
         }
+        req->Set(request, buffer, token);
         // add the request
         Add(req);
     } else {
@@ -391,15 +512,28 @@ void RilRequestWorkerQueue::Process(void *p) {
          " request=%d buffer=%p, bufferlen=%d t=%p",
             req->request_, req->buffer_, req->buffer_->length(), req->token_);
 
+    int64_t start_ns = profileNowNs();
     v8::Locker locker;
+    int64_t locked_ns = profileNowNs();
     v8::HandleScope handle_scope;
     v8::Context::Scope context_scope(context_);
     callOnRilRequest(context_, req->request_,
                           req->buffer_, req->token_);
+    profileAdd(req->request_, false, 0, locked_ns - start_ns,
+            profileNowNs() - locked_ns);
+
+    if ((s_profile_interval > 0)
+            && (++s_profile_processed % s_profile_interval == 0)) {
+        requestsLogProfile();
+    }
 
-    pthread_mutex_lock(&free_list_mutex_);
-    free_list_.push(req);
-    pthread_mutex_unlock(&free_list_mutex_);
+    if (req->pool_id_ != 0) {
+        request_pool_.Release(req);
+    } else {
+        // The Buffer is garbage collected by V8 and may be shared
+        req->buffer_ = NULL;
+        delete req;
+    }
 }
 
 int requestsInit(v8::Handle<v8::Context> context, RilRequestWorkerQueue **rwq) {
@@ -430,6 +564,12 @@ int requestsInit(v8::Handle<v8::Context> context, RilRequestWorkerQueue **rwq) {
     rilReqConversionMap[RIL_REQUEST_SET_MUTE] = ReqSetMute; // 53
     rilReqConversionMap[RIL_REQUEST_SCREEN_STATE] = ReqScreenState; // 61
 
+    requestsSetNativeHandler(RIL_REQUEST_SCREEN_STATE, NativeScreenState); // 61
+
+    char value[PROPERTY_VALUE_MAX];
+    property_get("ril.mock.profile_interval", value, "0");
+    s_profile_interval = atoi(value);
+
     *rwq = new RilRequestWorkerQueue(context);
     int status = (*rwq)->Run();
 
@@ -521,5 +661,6 @@ void testRequests(v8::Handle<v8::Context> context) {
         }
     }
 
+    requestsLogProfile();
     LOGD("testRequests X: ********\n");
 }
@@ -31,11 +31,23 @@ struct Request {
     int request_;
     Buffer *buffer_;
     RIL_Token token_;
+    int32_t pool_id_;           // see AtomicPool
+    int32_t pool_next_;
+
+    Request() :
+            request_(0),
+            buffer_(NULL),
+            token_(0),
+            pool_id_(0),
+            pool_next_(0) {
+    }
 
     Request(const int request, const Buffer *buffer, const RIL_Token token) :
             request_(0),
             buffer_(NULL),
-            token_(0) {
+            token_(0),
+            pool_id_(0),
+            pool_next_(0) {
         Set(request, buffer, token);
     }
 
@@ -59,9 +71,7 @@ struct Request {
 class RilRequestWorkerQueue : public WorkerQueue {
   private:
     v8::Handle<v8::Context> context_;
-    // TODO: Need a thread-safe queue
-    std::queue<Request *> free_list_;
-    pthread_mutex_t free_list_mutex_;
+    AtomicPool<Request> request_pool_;
 
   public:
     /**
@@ -86,6 +96,32 @@ class RilRequestWorkerQueue : public WorkerQueue {
     virtual void Process(void *p);
 };
 
+/**
+ * Requests numbered below this can have a native handler and are profiled
+ */
+#define REQUEST_TABLE_SIZE 256
+
+/**
+ * A native request handler, called on the RIL thread without V8.
+ * Returns true if it completed the request with s_rilenv->OnRequestComplete,
+ * false to have it converted and passed to mock-ril.js as usual.
+ */
+typedef bool (*ReqNativeHandler)(const int request, const void *data,
+        const size_t datalen, const RIL_Token t);
+
+/**
+ * Set or, with NULL, clear the native handler for a request.
+ * May be called at any time.
+ */
+void requestsSetNativeHandler(const int request, ReqNativeHandler handler);
+
+/**
+ * Log the time spent converting, waiting for the v8::Locker and in
+ * JavaScript for each request type. Also logged every
+ * ril.mock.profile_interval requests if that is set.
+ */
+void requestsLogProfile();
+
 /**
  * Initialize module
  *
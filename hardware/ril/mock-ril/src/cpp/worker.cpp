@@ -19,6 +19,7 @@
 #include "worker.h"
 
 #include <time.h>
+#include <sys/time.h>
 
 //#define WORKER_DEBUG
 #ifdef  WORKER_DEBUG
@@ -122,6 +123,157 @@ int WorkerThread::Run(void *workerParam) {
 }
 
 
+/**
+ * A FIFO of pool records linked through pool_next_, private to the
+ * LOCK_FREE worker thread.
+ */
+class RecordList {
+  private:
+    AtomicPool<WorkerQueue::Record> *pool_;
+    int32_t head_;
+    int32_t tail_;
+
+  public:
+    RecordList(AtomicPool<WorkerQueue::Record> *pool) :
+            pool_(pool), head_(0), tail_(0) {
+    }
+
+    bool IsEmpty() {
+        return head_ == 0;
+    }
+
+    void Append(WorkerQueue::Record *r) {
+        r->pool_next_ = 0;
+        if (tail_ == 0) {
+            head_ = r->pool_id_;
+        } else {
+            pool_->Get(tail_)->pool_next_ = r->pool_id_;
+        }
+        tail_ = r->pool_id_;
+    }
+
+    WorkerQueue::Record *Remove() {
+        if (head_ == 0) {
+            return NULL;
+        }
+        WorkerQueue::Record *r = pool_->Get(head_);
+        head_ = r->pool_next_;
+        if (head_ == 0) {
+            tail_ = 0;
+        }
+        return r;
+    }
+};
+
+#define WHEEL_SLOTS 1024        // one per millisecond, a power of two
+
+/**
+ * Hashed timer wheel holding the delayed records of a LOCK_FREE queue.
+ *
+ * A record due at time t (in elapsedRealtime milliseconds) hangs off
+ * slot t % WHEEL_SLOTS; records further out than one turn of the wheel
+ * share the slot and are skipped until their turn comes. Insert is
+ * O(1) and Expire only visits the slots passed since the last call, at
+ * most one turn's worth. Only the worker thread touches it.
+ */
+class TimerWheel {
+  private:
+    AtomicPool<WorkerQueue::Record> *pool_;
+    int32_t head_[WHEEL_SLOTS];
+    int32_t tail_[WHEEL_SLOTS];
+    int64_t time_;              // everything due by now has been expired
+    int count_;
+
+  public:
+    TimerWheel(AtomicPool<WorkerQueue::Record> *pool) :
+            pool_(pool), time_(0), count_(0) {
+        memset(head_, 0, sizeof(head_));
+        memset(tail_, 0, sizeof(tail_));
+    }
+
+    int Count() {
+        return count_;
+    }
+
+    /**
+     * Adds r, unless it is already due in which case false is returned.
+     * Expire must have been called with the current time first.
+     */
+    bool Insert(WorkerQueue::Record *r) {
+        if (r->time <= time_) {
+            return false;
+        }
+        int slot = r->time & (WHEEL_SLOTS - 1);
+        r->pool_next_ = 0;
+        if (tail_[slot] == 0) {
+            head_[slot] = r->pool_id_;
+        } else {
+            pool_->Get(tail_[slot])->pool_next_ = r->pool_id_;
+        }
+        tail_[slot] = r->pool_id_;
+        count_ += 1;
+        return true;
+    }
+
+    /**
+     * Moves every record due at or before now to ready, in order of
+     * their due time.
+     */
+    void Expire(int64_t now, RecordList *ready) {
+        int64_t steps = now - time_;
+        if (steps > WHEEL_SLOTS) {
+            steps = WHEEL_SLOTS;
+        }
+        for (int64_t t = time_ + 1; count_ > 0 && t <= time_ + steps; t++) {
+            int slot = t & (WHEEL_SLOTS - 1);
+            int32_t prev = 0;
+            int32_t id = head_[slot];
+            while (id != 0) {
+                WorkerQueue::Record *r = pool_->Get(id);
+                int32_t next = r->pool_next_;
+                if (r->time <= now) {
+                    if (prev == 0) {
+                        head_[slot] = next;
+                    } else {
+                        pool_->Get(prev)->pool_next_ = next;
+                    }
+                    if (tail_[slot] == id) {
+                        tail_[slot] = prev;
+                    }
+                    count_ -= 1;
+                    ready->Append(r);
+                } else {
+                    prev = id;
+                }
+                id = next;
+            }
+        }
+        if (now > time_) {
+            time_ = now;
+        }
+    }
+
+    /**
+     * Returns the milliseconds from now until the next record is due,
+     * at most one turn of the wheel, or -1 if it is empty. Expire must
+     * have been called with now first.
+     */
+    int64_t NextTimeout(int64_t now) {
+        if (count_ == 0) {
+            return -1;
+        }
+        for (int64_t t = time_ + 1; t <= time_ + WHEEL_SLOTS; t++) {
+            for (int32_t id = head_[t & (WHEEL_SLOTS - 1)]; id != 0;
+                    id = pool_->Get(id)->pool_next_) {
+                if (pool_->Get(id)->time == t) {
+                    return t - now;
+                }
+            }
+        }
+        return WHEEL_SLOTS;
+    }
+};
+
 class WorkerQueueThread : public WorkerThread {
   private:
     friend class WorkerQueue;
@@ -138,6 +290,10 @@ class WorkerQueueThread : public WorkerThread {
         DBG("WorkerQueueThread::Worker E");
         WorkerQueue *wq = (WorkerQueue *)param;
 
+        if (wq->type_ == WorkerQueue::LOCK_FREE) {
+            return WorkLockFree(wq);
+        }
+
         // Do the work until we're told to stop
         while (isRunning()) {
             pthread_mutex_lock(&mutex_);
@@ -181,7 +337,7 @@ class WorkerQueueThread : public WorkerThread {
                 void *p = r->p;
                 wq->release_record(r);
                 pthread_mutex_unlock(&mutex_);
-                wq->Process(r->p);
+                wq->Process(p);
             } else {
                 pthread_mutex_unlock(&mutex_);
             }
@@ -189,11 +345,104 @@ class WorkerQueueThread : public WorkerThread {
         DBG("WorkerQueueThread::Worker X");
         return NULL;
     }
+
+    /**
+     * Worker for a LOCK_FREE queue. Producers only ever push onto the
+     * inbox; everything else here is private to this thread.
+     */
+    void * WorkLockFree(WorkerQueue *wq) {
+        DBG("WorkerQueueThread::WorkLockFree E");
+        RecordList ready(wq->pool_);
+        TimerWheel *wheel = wq->wheel_;
+
+        while (isRunning()) {
+            // The inbox comes newest first, reverse it into arrival order
+            int32_t id = wq->inbox_.TakeAll();
+            int32_t arrived = 0;
+            while (id != 0) {
+                struct WorkerQueue::Record *r = wq->pool_->Get(id);
+                id = r->pool_next_;
+                r->pool_next_ = arrived;
+                arrived = r->pool_id_;
+            }
+
+            int64_t now = 0;
+            while (arrived != 0) {
+                struct WorkerQueue::Record *r = wq->pool_->Get(arrived);
+                arrived = r->pool_next_;
+                if (r->time == 0) {
+                    ready.Append(r);
+                    continue;
+                }
+                if (now == 0) {
+                    now = android::elapsedRealtime();
+                    wheel->Expire(now, &ready);
+                }
+                if (!wheel->Insert(r)) {
+                    ready.Append(r);
+                }
+            }
+            if (now == 0 && wheel->Count() != 0) {
+                now = android::elapsedRealtime();
+                wheel->Expire(now, &ready);
+            }
+
+            if (!ready.IsEmpty()) {
+                struct WorkerQueue::Record *r;
+                while (isRunning() && (r = ready.Remove()) != NULL) {
+                    void *p = r->p;
+                    wq->free_record(r);
+                    wq->Process(p);
+                }
+                continue;
+            }
+
+            int64_t delay_ms = wheel->NextTimeout(now);
+
+            pthread_mutex_lock(&mutex_);
+            android_atomic_release_store(1, &wq->sleeping_);
+            // Pairs with the barrier in push_record: either we see its
+            // record or it sees us sleeping and signals.
+            android_memory_barrier();
+            if (isRunning() && wq->inbox_.IsEmpty()) {
+                if (delay_ms < 0) {
+                    pthread_cond_wait(&cond_, &mutex_);
+                } else {
+                    struct timeval tv;
+                    struct timespec ts;
+                    gettimeofday(&tv, NULL);
+                    ts.tv_sec = tv.tv_sec + (delay_ms / 1000);
+                    ts.tv_nsec = (tv.tv_usec + ((delay_ms % 1000) * 1000)) * 1000;
+                    if (ts.tv_nsec >= 1000000000) {
+                        ts.tv_sec += 1;
+                        ts.tv_nsec -= 1000000000;
+                    }
+                    pthread_cond_timedwait(&cond_, &mutex_, &ts);
+                }
+            }
+            android_atomic_release_store(0, &wq->sleeping_);
+            pthread_mutex_unlock(&mutex_);
+        }
+        DBG("WorkerQueueThread::WorkLockFree X");
+        return NULL;
+    }
 };
 
-WorkerQueue::WorkerQueue() {
-    DBG("WorkerQueue::WorkerQueue E");
+WorkerQueue::WorkerQueue(Type type) {
+    DBG("WorkerQueue::WorkerQueue E type=%d", type);
     wqt_ = new WorkerQueueThread();
+    type_ = type;
+    sleeping_ = 0;
+    pool_waiters_ = 0;
+    pthread_mutex_init(&pool_mutex_, NULL);
+    pthread_cond_init(&pool_cond_, NULL);
+    if (type_ == LOCK_FREE) {
+        pool_ = new AtomicPool<struct Record>();
+        wheel_ = new TimerWheel(pool_);
+    } else {
+        pool_ = NULL;
+        wheel_ = NULL;
+    }
     DBG("WorkerQueue::WorkerQueue X");
 }
 
@@ -217,6 +466,12 @@ WorkerQueue::~WorkerQueue() {
     }
     pthread_mutex_unlock(&wqt_->mutex_);
 
+    // Records still in the inbox or the wheel belong to the pool
+    delete wheel_;
+    delete pool_;
+    pthread_cond_destroy(&pool_cond_);
+    pthread_mutex_destroy(&pool_mutex_);
+
     delete wqt_;
     DBG("WorkerQueue::~WorkerQueue X");
 }
@@ -260,18 +515,80 @@ void WorkerQueue::release_record(struct Record *r) {
     free_list_.push_front(r);
 }
 
+/**
+ * Block until the worker frees a record, for when every record id of
+ * a LOCK_FREE queue is in use.
+ */
+struct WorkerQueue::Record *WorkerQueue::wait_record() {
+    struct Record *r;
+    DBG("WorkerQueue::wait_record all records in use, waiting");
+    pthread_mutex_lock(&pool_mutex_);
+    // Pairs with the barrier in free_record: either we get its record
+    // or it sees us waiting and signals.
+    android_atomic_inc(&pool_waiters_);
+    while ((r = pool_->Obtain()) == NULL) {
+        pthread_cond_wait(&pool_cond_, &pool_mutex_);
+    }
+    android_atomic_dec(&pool_waiters_);
+    pthread_mutex_unlock(&pool_mutex_);
+    return r;
+}
+
+/**
+ * Give a LOCK_FREE record back to the pool, waking a producer waiting in
+ * wait_record.
+ */
+void WorkerQueue::free_record(struct Record *r) {
+    pool_->Release(r);
+    android_memory_barrier();
+    if (android_atomic_acquire_load(&pool_waiters_)) {
+        pthread_mutex_lock(&pool_mutex_);
+        pthread_cond_signal(&pool_cond_);
+        pthread_mutex_unlock(&pool_mutex_);
+    }
+}
+
+/**
+ * Hand a record to a LOCK_FREE queue's worker, waking it if it sleeps.
+ * Only blocks if every record id is in use.
+ */
+void WorkerQueue::push_record(void *p, int delay_in_ms) {
+    struct Record *r = pool_->Obtain();
+    if (r == NULL) {
+        r = wait_record();
+    }
+    r->p = p;
+    if (delay_in_ms != 0) {
+        r->time = android::elapsedRealtime() + delay_in_ms;
+    } else {
+        r->time = 0;
+    }
+    inbox_.Push(r);
+    android_memory_barrier();
+    if (android_atomic_acquire_load(&sleeping_)) {
+        DBG("WorkerQueue::push_record signal");
+        pthread_mutex_lock(&wqt_->mutex_);
+        pthread_cond_signal(&wqt_->cond_);
+        pthread_mutex_unlock(&wqt_->mutex_);
+    }
+}
+
 /**
  * Add a record to processing queue q_
  */
 void WorkerQueue::Add(void *p) {
     DBG("WorkerQueue::Add E:");
-    pthread_mutex_lock(&wqt_->mutex_);
-    struct Record *r = obtain_record(p, 0);
-    q_.push_back(r);
-    if (q_.size() == 1) {
-        pthread_cond_signal(&wqt_->cond_);
+    if (type_ == LOCK_FREE) {
+        push_record(p, 0);
+    } else {
+        pthread_mutex_lock(&wqt_->mutex_);
+        struct Record *r = obtain_record(p, 0);
+        q_.push_back(r);
+        if (q_.size() == 1) {
+            pthread_cond_signal(&wqt_->cond_);
+        }
+        pthread_mutex_unlock(&wqt_->mutex_);
     }
-    pthread_mutex_unlock(&wqt_->mutex_);
     DBG("WorkerQueue::Add X:");
 }
 
@@ -279,6 +596,8 @@ void WorkerQueue::AddDelayed(void *p, int delay_in_ms) {
     DBG("WorkerQueue::AddDelayed E:");
     if (delay_in_ms <= 0) {
         Add(p);
+    } else if (type_ == LOCK_FREE) {
+        push_record(p, delay_in_ms);
     } else {
         pthread_mutex_lock(&wqt_->mutex_);
         struct Record *r = obtain_record(p, delay_in_ms);
@@ -305,6 +624,10 @@ void WorkerQueue::AddDelayed(void *p, int delay_in_ms) {
 
 
 class TestWorkerQueue : public WorkerQueue {
+  public:
+    TestWorkerQueue(Type type) : WorkerQueue(type) {
+    }
+
     virtual void Process(void *p) {
         LOGD("TestWorkerQueue::Process: EX p=%p", p);
     }
@@ -341,6 +664,113 @@ class TesterThread : public WorkerThread {
     }
 };
 
+#define BENCH_ITEMS_PER_PRODUCER    200000
+#define BENCH_MAX_PRODUCERS         4
+#define BENCH_DELAYED_ITEMS         2000
+#define BENCH_MAX_DELAY_MS          50
+
+/**
+ * Counts what it is given. Items with a non NULL p are delayed and point
+ * at the time they were due, so we can tell how late they ran.
+ */
+class BenchWorkerQueue : public WorkerQueue {
+  public:
+    int32_t processed_;
+    int early_;
+    int64_t late_ms_total_;
+    int64_t late_ms_max_;
+
+    BenchWorkerQueue(Type type) : WorkerQueue(type),
+            processed_(0), early_(0), late_ms_total_(0), late_ms_max_(0) {
+    }
+
+    virtual void Process(void *p) {
+        if (p != NULL) {
+            int64_t late_ms = android::elapsedRealtime() - *(int64_t *)p;
+            if (late_ms < 0) {
+                early_ += 1;
+            } else {
+                late_ms_total_ += late_ms;
+                if (late_ms > late_ms_max_) {
+                    late_ms_max_ = late_ms;
+                }
+            }
+        }
+        android_atomic_inc(&processed_);
+    }
+
+    void WaitFor(int32_t count) {
+        while (android_atomic_acquire_load(&processed_) < count) {
+            usleep(1000);
+        }
+    }
+};
+
+static void *benchProducer(void *param) {
+    WorkerQueue *wq = (WorkerQueue *)param;
+    for (int i = 0; i < BENCH_ITEMS_PER_PRODUCER; i++) {
+        wq->Add(NULL);
+    }
+    return NULL;
+}
+
+static int64_t benchNowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/**
+ * Time producers Add()ing as fast as they can until the worker has
+ * processed everything, then check a spread of AddDelayed items
+ * neither ran early nor late by more than scheduling noise.
+ */
+static void benchWorkerQueue(WorkerQueue::Type type, int producers) {
+    const char *name = (type == WorkerQueue::LOCK_FREE) ? "lock-free" : "locked";
+    pthread_t tids[BENCH_MAX_PRODUCERS];
+    static int64_t due[BENCH_DELAYED_ITEMS];
+    int32_t total = producers * BENCH_ITEMS_PER_PRODUCER;
+    int started = 0;
+
+    BenchWorkerQueue *wq = new BenchWorkerQueue(type);
+    if (wq->Run() != STATUS_OK) {
+        LOGE("testWorker: bench %s could not run", name);
+        delete wq;
+        return;
+    }
+
+    int64_t start = benchNowNs();
+    for (; started < producers; started++) {
+        if (pthread_create(&tids[started], NULL, benchProducer, wq) != 0) {
+            LOGE("testWorker: bench %s pthread_create failed", name);
+            break;
+        }
+    }
+    for (int i = 0; i < started; i++) {
+        pthread_join(tids[i], NULL);
+    }
+    total = started * BENCH_ITEMS_PER_PRODUCER;
+    wq->WaitFor(total);
+    int64_t elapsed_ns = benchNowNs() - start;
+
+    for (int i = 0; i < BENCH_DELAYED_ITEMS; i++) {
+        int delay_ms = 1 + (i * 7) % BENCH_MAX_DELAY_MS;
+        due[i] = android::elapsedRealtime() + delay_ms;
+        wq->AddDelayed(&due[i], delay_ms);
+    }
+    wq->WaitFor(total + BENCH_DELAYED_ITEMS);
+
+    LOGD("testWorker: bench %-9s %d producer(s) %8lld items/s,"
+         " delayed %d early, late avg %lldms max %lldms",
+            name, started,
+            elapsed_ns > 0 ? (long long)total * 1000000000LL / elapsed_ns : 0LL,
+            wq->early_, (long long)(wq->late_ms_total_ / BENCH_DELAYED_ITEMS),
+            (long long)wq->late_ms_max_);
+
+    wq->Stop();
+    delete wq;
+}
+
 void testWorker() {
     LOGD("testWorker E: ********");
 
@@ -348,20 +778,34 @@ void testWorker() {
     TesterThread *tester = new TesterThread();
     delete tester;
 
-    TestWorkerQueue *wq = new TestWorkerQueue();
-    if (wq->Run() == STATUS_OK) {
-        LOGD("testWorker WorkerQueue %p running", wq);
-
-        // Test we can run a thread, stop it then delete it
-        tester = new TesterThread();
-        tester->Run(wq);
-        LOGD("testWorker tester %p running", tester);
-        sleep(10);
-        LOGD("testWorker tester %p stopping", tester);
-        tester->Stop();
-        LOGD("testWorker tester %p stopped", tester);
-        wq->Stop();
-        LOGD("testWorker wq %p stopped", wq);
+    static const WorkerQueue::Type types[] = {
+        WorkerQueue::LOCKED, WorkerQueue::LOCK_FREE
+    };
+    for (size_t t = 0; t < sizeof(types) / sizeof(types[0]); t++) {
+        TestWorkerQueue *wq = new TestWorkerQueue(types[t]);
+        if (wq->Run() == STATUS_OK) {
+            LOGD("testWorker WorkerQueue %p type=%d running", wq, types[t]);
+
+            // Test we can run a thread, stop it then delete it
+            tester = new TesterThread();
+            tester->Run(wq);
+            LOGD("testWorker tester %p running", tester);
+            sleep(10);
+            LOGD("testWorker tester %p stopping", tester);
+            tester->Stop();
+            LOGD("testWorker tester %p stopped", tester);
+            delete tester;
+            wq->Stop();
+            LOGD("testWorker wq %p stopped", wq);
+        }
+        delete wq;
+    }
+
+    // Throughput of both variants under increasing contention
+    for (int producers = 1; producers <= BENCH_MAX_PRODUCERS; producers *= 2) {
+        for (size_t t = 0; t < sizeof(types) / sizeof(types[0]); t++) {
+            benchWorkerQueue(types[t], producers);
+        }
     }
     LOGD("testWorker X: ********\n");
 }
@@ -21,7 +21,10 @@
 #include <list>
 #include <vector>
 #include <pthread.h>
+#include <sched.h>
+#include <string.h>
 #include <cutils/atomic.h>
+#include <cutils/atomic-inline.h>
 #include <utils/SystemClock.h>
 
 /**
@@ -91,6 +94,141 @@ class WorkerThread {
 };
 
 
+#define ATOMIC_POOL_CHUNK_SHIFT 8
+#define ATOMIC_POOL_CHUNK_SIZE  (1 << ATOMIC_POOL_CHUNK_SHIFT)
+#define ATOMIC_POOL_MAX_ID      0xffff
+#define ATOMIC_POOL_TAG_ONE     0x10000
+
+/**
+ * A pool of T shared by any number of threads without locking.
+ *
+ * T must be default constructible and have int32_t members pool_id_
+ * and pool_next_. Objects are named by ids from 1 to ATOMIC_POOL_MAX_ID
+ * (0 is "none") and linked through pool_next_, which lets the free list
+ * head carry a tag next to the id that changes on every update. A pop
+ * that raced with another pop and push of the same object then fails
+ * its compare and swap instead of installing a stale next (the ABA
+ * problem), without needing a double word CAS.
+ *
+ * Objects are allocated ATOMIC_POOL_CHUNK_SIZE at a time, are never
+ * freed before the pool and so may be looked at after they have been
+ * handed to someone else. Obtain() returns NULL once all ids are in use.
+ */
+template <class T>
+class AtomicPool {
+  private:
+    T *chunks_[(ATOMIC_POOL_MAX_ID >> ATOMIC_POOL_CHUNK_SHIFT) + 1];
+    int32_t allocated_;             // ids handed out, guarded by chunk_mutex_
+    volatile int32_t free_;         // tag | id of the first free object
+    pthread_mutex_t chunk_mutex_;
+
+    // the tag wraps around, which only matters after 65536 updates
+    // between one thread's load and its compare and swap
+    static int32_t Retag(int32_t head, int32_t id) {
+        return (int32_t)(((uint32_t)head & ~ATOMIC_POOL_MAX_ID)
+                + ATOMIC_POOL_TAG_ONE) | id;
+    }
+
+    T *Allocate() {
+        T *t = NULL;
+        pthread_mutex_lock(&chunk_mutex_);
+        if (allocated_ < ATOMIC_POOL_MAX_ID) {
+            int32_t id = ++allocated_;
+            int32_t chunk = (id - 1) >> ATOMIC_POOL_CHUNK_SHIFT;
+            if (chunks_[chunk] == NULL) {
+                T *c = new T[ATOMIC_POOL_CHUNK_SIZE];
+                for (int i = 0; i < ATOMIC_POOL_CHUNK_SIZE; i++) {
+                    c[i].pool_id_ = (chunk << ATOMIC_POOL_CHUNK_SHIFT) + i + 1;
+                    c[i].pool_next_ = 0;
+                }
+                chunks_[chunk] = c;
+            }
+            t = Get(id);
+        }
+        pthread_mutex_unlock(&chunk_mutex_);
+        return t;
+    }
+
+  public:
+    AtomicPool() : allocated_(0), free_(0) {
+        memset(chunks_, 0, sizeof(chunks_));
+        pthread_mutex_init(&chunk_mutex_, NULL);
+    }
+
+    ~AtomicPool() {
+        for (size_t i = 0; i < sizeof(chunks_) / sizeof(chunks_[0]); i++) {
+            delete [] chunks_[i];
+        }
+        pthread_mutex_destroy(&chunk_mutex_);
+    }
+
+    T *Get(int32_t id) {
+        return &chunks_[(id - 1) >> ATOMIC_POOL_CHUNK_SHIFT]
+                       [(id - 1) & (ATOMIC_POOL_CHUNK_SIZE - 1)];
+    }
+
+    T *Obtain() {
+        int32_t head, id;
+        do {
+            head = android_atomic_acquire_load(&free_);
+            id = head & ATOMIC_POOL_MAX_ID;
+            if (id == 0) {
+                return Allocate();
+            }
+        } while (android_atomic_acquire_cas(head,
+                    Retag(head, Get(id)->pool_next_), &free_) != 0);
+        return Get(id);
+    }
+
+    void Release(T *t) {
+        int32_t head;
+        do {
+            head = android_atomic_acquire_load(&free_);
+            t->pool_next_ = head & ATOMIC_POOL_MAX_ID;
+        } while (android_atomic_release_cas(head,
+                    Retag(head, t->pool_id_), &free_) != 0);
+    }
+};
+
+/**
+ * Hands objects of an AtomicPool from any number of producers to one
+ * consumer. Push() is a plain lock-free stack push; the consumer takes
+ * everything at once with TakeAll(), which never follows a link and so
+ * needs no tag. The chain comes back newest first.
+ */
+template <class T>
+class AtomicInbox {
+  private:
+    volatile int32_t head_;         // id of the newest object, 0 if empty
+
+  public:
+    AtomicInbox() : head_(0) {}
+
+    void Push(T *t) {
+        int32_t head;
+        do {
+            head = android_atomic_acquire_load(&head_);
+            t->pool_next_ = head;
+        } while (android_atomic_release_cas(head, t->pool_id_, &head_) != 0);
+    }
+
+    int32_t TakeAll() {
+        int32_t head;
+        do {
+            head = android_atomic_acquire_load(&head_);
+            if (head == 0) {
+                return 0;
+            }
+        } while (android_atomic_acquire_cas(head, 0, &head_) != 0);
+        return head;
+    }
+
+    bool IsEmpty() {
+        return android_atomic_acquire_load(&head_) == 0;
+    }
+};
+
+
 /**
  * A WorkerQueue.
  *
@@ -99,14 +237,30 @@ class WorkerThread {
  * 2) Call Run.
  * 3) Call Add, passing a pointer which is added to a queue
  * 4) Process will be called with a pointer as work can be done.
+ *
+ * A LOCKED queue keeps everything behind one mutex. A LOCK_FREE queue
+ * takes records from an AtomicPool and passes them to the worker through
+ * an AtomicInbox, so Add and AddDelayed never block; the worker keeps
+ * delayed records in a timer wheel that only it touches, and producers
+ * only take the mutex to wake it when it is asleep.
  */
 class WorkerQueue {
+  public:
+    enum Type {
+        LOCKED,
+        LOCK_FREE
+    };
+
   private:
     friend class WorkerQueueThread;
+    friend class TimerWheel;
+    friend class RecordList;
 
     struct Record {
         int64_t time;
         void *p;
+        int32_t pool_id_;           // LOCK_FREE only, see AtomicPool
+        int32_t pool_next_;
     };
 
     class record_compare {
@@ -123,13 +277,26 @@ class WorkerQueue {
                                                   // list of records that are delayed
     class WorkerQueueThread *wqt_;
 
+    Type type_;
+    AtomicPool<struct Record> *pool_;             // LOCK_FREE only
+    AtomicInbox<struct Record> inbox_;
+    volatile int32_t sleeping_;                   // worker waits on wqt_->cond_
+    volatile int32_t pool_waiters_;               // producers waiting for a record
+    pthread_mutex_t pool_mutex_;
+    pthread_cond_t pool_cond_;
+    class TimerWheel *wheel_;                     // owned by the worker thread
+
+    void push_record(void *p, int delay_in_ms);
+    struct Record *wait_record();
+    void free_record(struct Record *r);
+
   protected:
     struct Record *obtain_record(void *p, int delay_in_ms);
 
     void release_record(struct Record *r);
 
   public:
-    WorkerQueue();
+    WorkerQueue(Type type = LOCKED);
 
     virtual ~WorkerQueue();
 
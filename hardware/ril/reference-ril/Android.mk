@@ -11,6 +11,9 @@ include $(CLEAR_VARS)
 LOCAL_SRC_FILES:= \
     reference-ril.c \
     atchannel.c \
+    at_reader.c \
+    at_pattern.c \
+    poll_scheduler.c \
     misc.c \
     runtime_port.c \
     fcp_parser.c \
@@ -56,5 +59,71 @@ else
   include $(BUILD_EXECUTABLE)
 endif
 
+# Host harnesses for the AT channel
+# =================================
+ifeq ($(HOST_OS),linux)
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES:= \
+    at_reader.c \
+    at_reader_bench.c
+
+LOCAL_STATIC_LIBRARIES := \
+    libcutils \
+    liblog
+
+LOCAL_CFLAGS := -D_GNU_SOURCE
+
+LOCAL_MODULE:= at_reader_bench
+
+LOCAL_MODULE_TAGS := optional
+
+LOCAL_LDLIBS += -lpthread -lrt
+
+include $(BUILD_HOST_EXECUTABLE)
+
+# Pipelined AT channel against a mock modem on a pty
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES:= \
+    at_pipeline_bench.c \
+    atchannel.c \
+    at_reader.c \
+    at_tok.c \
+    misc.c
+
+LOCAL_STATIC_LIBRARIES := \
+    libcutils \
+    liblog
+
+LOCAL_CFLAGS := -D_GNU_SOURCE
+
+LOCAL_MODULE:= at_pipeline_bench
+
+LOCAL_MODULE_TAGS := optional
+
+LOCAL_LDLIBS += -lpthread -lrt
+
+include $(BUILD_HOST_EXECUTABLE)
+
+# at_tok versus compiled response patterns
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES:= \
+    at_pattern_bench.c \
+    at_pattern.c \
+    at_tok.c
+
+LOCAL_CFLAGS := -D_GNU_SOURCE
+
+LOCAL_MODULE:= at_pattern_bench
+
+LOCAL_MODULE_TAGS := optional
+
+LOCAL_LDLIBS += -lrt
+
+include $(BUILD_HOST_EXECUTABLE)
+endif # HOST_OS == linux
+
 endif
 endif
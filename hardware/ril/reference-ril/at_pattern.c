@@ -0,0 +1,187 @@
+/* //device/system/reference-ril/at_pattern.c
+**
+** Copyright 2006, The Android Open Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#include "at_pattern.h"
+
+#include <stdarg.h>
+#include <string.h>
+
+int at_pattern_compile(ATPattern *p_pattern, const char *format)
+{
+    const char *p = format;
+    int optional = 0;
+    int len;
+
+    memset(p_pattern, 0, sizeof(*p_pattern));
+
+    /* literal prefix, up to the first field, without trailing blanks */
+    while (*p != '\0' && *p != '%' && *p != '[') {
+        p++;
+    }
+    len = p - format;
+    while (len > 0 && format[len - 1] == ' ') {
+        len--;
+    }
+    if (len >= AT_PATTERN_MAX_PREFIX) {
+        return -1;
+    }
+    memcpy(p_pattern->prefix, format, len);
+    p_pattern->prefixLen = len;
+
+    while (*p != '\0') {
+        switch (*p) {
+            case '[':
+                if (optional) return -1;
+                optional = 1;
+                p_pattern->numRequired = p_pattern->numFields;
+                p++;
+                break;
+            case ']':
+            case ',':
+            case ' ':
+                p++;
+                break;
+            case '%':
+                if (p[1] != 'd' && p[1] != 'x' && p[1] != 'b' && p[1] != 's') {
+                    return -1;
+                }
+                if (p_pattern->numFields == AT_PATTERN_MAX_FIELDS) {
+                    return -1;
+                }
+                p_pattern->types[p_pattern->numFields++] = p[1];
+                p += 2;
+                break;
+            default:
+                return -1;
+        }
+    }
+
+    if (!optional) {
+        p_pattern->numRequired = p_pattern->numFields;
+    }
+
+    return 0;
+}
+
+static int hexValue(char c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+int at_pattern_match(const ATPattern *p_pattern, char *line, ...)
+{
+    va_list ap;
+    char *p;
+    int i;
+
+    if (line == NULL
+        || strncmp(line, p_pattern->prefix, p_pattern->prefixLen) != 0
+    ) {
+        return -1;
+    }
+
+    p = line + p_pattern->prefixLen;
+
+    va_start(ap, line);
+
+    for (i = 0 ; i < p_pattern->numFields ; i++) {
+        char type = p_pattern->types[i];
+        int quoted = 0;
+
+        if (p == NULL || (*p == '\0' && i >= p_pattern->numRequired)) {
+            /* ran out of fields; see at_tok_hasmore() */
+            break;
+        }
+
+        while (*p == ' ' || *p == '\t') p++;
+
+        if (*p == '"') {
+            quoted = 1;
+            p++;
+        }
+
+        if (type == 's') {
+            char **p_out = va_arg(ap, char **);
+            char *end;
+
+            *p_out = p;
+            if (quoted) {
+                while (*p != '\0' && *p != '"') p++;
+                end = p;
+                /* anything up to the comma is dropped, like at_tok */
+                while (*p != '\0' && *p != ',') p++;
+            } else {
+                while (*p != '\0' && *p != ',') p++;
+                end = p;
+            }
+            p = (*p == ',') ? p + 1 : NULL;
+            *end = '\0';
+        } else {
+            unsigned int value = 0;
+            int negative = 0;
+            int digits = 0;
+            int d;
+
+            if (type != 'x' && *p == '-') {
+                negative = 1;
+                p++;
+            }
+
+            if (type == 'x') {
+                while ((d = hexValue(*p)) >= 0) {
+                    value = value * 16 + d;
+                    p++;
+                    digits++;
+                }
+            } else {
+                while (*p >= '0' && *p <= '9') {
+                    value = value * 10 + (*p - '0');
+                    p++;
+                    digits++;
+                }
+            }
+
+            if (digits == 0) {
+                goto error;
+            }
+
+            /* trailing junk in the field is ignored, as strtol does */
+            while (*p != '\0' && *p != ',') p++;
+            p = (*p == ',') ? p + 1 : NULL;
+
+            if (type == 'b') {
+                if (negative || value > 1) {
+                    goto error;
+                }
+                *va_arg(ap, char *) = (char) value;
+            } else {
+                *va_arg(ap, int *) = negative ? -(int) value : (int) value;
+            }
+        }
+    }
+
+    va_end(ap);
+
+    return i >= p_pattern->numRequired ? i : -1;
+
+error:
+    va_end(ap);
+    return -1;
+}
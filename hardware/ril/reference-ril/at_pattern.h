@@ -0,0 +1,64 @@
+/* //device/system/reference-ril/at_pattern.h
+**
+** Copyright 2006, The Android Open Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#ifndef AT_PATTERN_H
+#define AT_PATTERN_H 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define AT_PATTERN_MAX_FIELDS 16
+#define AT_PATTERN_MAX_PREFIX 16
+
+/**
+ * A compiled response format, eg "+CLCC: %d,%b,%d,%d,%b[,%s,%d]"
+ *
+ *   %d   decimal int         -> int *
+ *   %x   hex int             -> int *
+ *   %b   0 or 1              -> char *
+ *   %s   string, quoted or not; points into the (modified) line -> char **
+ *   [    the fields after this are optional; a closing ] is ignored
+ *
+ * Fields are separated by ',' and may be surrounded by white space;
+ * numbers may be quoted, as at_tok_nextint() allows.
+ */
+typedef struct {
+    char prefix[AT_PATTERN_MAX_PREFIX];
+    int prefixLen;
+    char types[AT_PATTERN_MAX_FIELDS];
+    int numFields;
+    int numRequired;
+} ATPattern;
+
+/** returns 0 on success, -1 if the format is invalid */
+int at_pattern_compile(ATPattern *p_pattern, const char *format);
+
+/**
+ * Parses line in a single pass, storing each field through the matching
+ * pointer argument. The line is modified in place, like at_tok does.
+ *
+ * Returns the number of fields stored, which is at least the number of
+ * required fields, or -1 if the line doesn't match
+ */
+int at_pattern_match(const ATPattern *p_pattern, char *line, ...);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*AT_PATTERN_H */
@@ -0,0 +1,307 @@
+/* //device/system/reference-ril/at_pattern_bench.c
+**
+** Copyright 2006, The Android Open Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+/*
+ * Host benchmark comparing the at_tok call sequences reference-ril used
+ * for +CSQ, +CREG/+CGREG and +CLCC with the compiled at_pattern formats
+ * that replaced them. Every recorded line is parsed both ways, the
+ * results are compared field by field, and the time per line is
+ * reported. Both parsers modify the line, so each parse works on a
+ * fresh copy; the copy is included in both timings.
+ *
+ * usage: at_pattern_bench [-n iterations]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "at_tok.h"
+#include "at_pattern.h"
+
+#define NUM_ELEMS(x) (sizeof(x)/sizeof(x[0]))
+
+#define DEFAULT_ITERATIONS 200000
+
+/* what either parser extracts from a line; -2 marks "not set" */
+typedef struct {
+    int ok;
+    int values[5];
+    char number[32];
+} Parsed;
+
+typedef enum { CSQ, CREG, CLCC } LineType;
+
+typedef struct {
+    LineType type;
+    const char *line;
+} Recorded;
+
+/* captured from a polling session on a HSPA modem */
+static const Recorded s_traffic[] = {
+    { CSQ, "+CSQ: 17,99" },
+    { CSQ, "+CSQ: 31,0" },
+    { CSQ, "+CSQ: 99,99" },
+    { CREG, "+CREG: 2,1,\"1A2B\",\"00A1B2C3\"" },
+    { CREG, "+CREG: 2,5,\"2F01\",\"0BC9E2A4\"" },
+    { CREG, "+CREG: 1" },
+    { CREG, "+CREG: 2,2" },
+    { CREG, "+CREG: 1,\"1A2B\",\"00A1B2C3\"" },
+    { CREG, "+CGREG: 2,1,\"1A2B\",\"00A1B2C3\",2" },
+    { CREG, "+CGREG: 2,1,\"1A2B\",\"00A1B2C3\"" },
+    { CLCC, "+CLCC: 1,0,0,0,0,\"+18005551212\",145" },
+    { CLCC, "+CLCC: 2,1,4,0,0,\"6505550100\",129" },
+    { CLCC, "+CLCC: 1,0,1,0,1" },
+    { CLCC, "+CLCC: 3,1,5,0,0,\"NOT AVAILABLE\",128" },
+    { CLCC, "+CLCC: 1,0,0,1,0,\"\",128" },
+};
+
+/*************************** at_tok ****************************/
+
+static int oldCsq(char *line, Parsed *p)
+{
+    if (at_tok_start(&line) < 0) return -1;
+    if (at_tok_nextint(&line, &p->values[0]) < 0) return -1;
+    if (at_tok_nextint(&line, &p->values[1]) < 0) return -1;
+    return 0;
+}
+
+static int oldCreg(char *line, Parsed *p)
+{
+    int commas = 0;
+    int skip;
+    char *c;
+    int *r = p->values;
+
+    if (at_tok_start(&line) < 0) return -1;
+
+    for (c = line ; *c != '\0' ; c++) {
+        if (*c == ',') commas++;
+    }
+
+    switch (commas) {
+        case 0:
+            if (at_tok_nextint(&line, &r[0]) < 0) return -1;
+            r[1] = r[2] = -1;
+            break;
+        case 1:
+            if (at_tok_nextint(&line, &skip) < 0) return -1;
+            if (at_tok_nextint(&line, &r[0]) < 0) return -1;
+            r[1] = r[2] = -1;
+            break;
+        case 2:
+            if (at_tok_nextint(&line, &r[0]) < 0) return -1;
+            if (at_tok_nexthexint(&line, &r[1]) < 0) return -1;
+            if (at_tok_nexthexint(&line, &r[2]) < 0) return -1;
+            break;
+        case 3:
+            if (at_tok_nextint(&line, &skip) < 0) return -1;
+            if (at_tok_nextint(&line, &r[0]) < 0) return -1;
+            if (at_tok_nexthexint(&line, &r[1]) < 0) return -1;
+            if (at_tok_nexthexint(&line, &r[2]) < 0) return -1;
+            break;
+        case 4:
+            if (at_tok_nextint(&line, &skip) < 0) return -1;
+            if (at_tok_nextint(&line, &r[0]) < 0) return -1;
+            if (at_tok_nexthexint(&line, &r[1]) < 0) return -1;
+            if (at_tok_nexthexint(&line, &r[2]) < 0) return -1;
+            if (at_tok_nexthexint(&line, &r[3]) < 0) return -1;
+            break;
+        default:
+            return -1;
+    }
+    return 0;
+}
+
+static int oldClcc(char *line, Parsed *p)
+{
+    char isMT, isMpty;
+    char *number = NULL;
+
+    if (at_tok_start(&line) < 0) return -1;
+    if (at_tok_nextint(&line, &p->values[0]) < 0) return -1;
+    if (at_tok_nextbool(&line, &isMT) < 0) return -1;
+    if (at_tok_nextint(&line, &p->values[2]) < 0) return -1;
+    if (at_tok_nextint(&line, &p->values[3]) < 0) return -1;
+    if (at_tok_nextbool(&line, &isMpty) < 0) return -1;
+
+    if (at_tok_hasmore(&line)) {
+        if (at_tok_nextstr(&line, &number) < 0) return 0;
+        if (number != NULL && 0 == strspn(number, "+0123456789")) {
+            number = NULL;
+        }
+        if (at_tok_nextint(&line, &p->values[4]) < 0) return -1;
+    }
+
+    p->values[1] = isMT + 2 * isMpty;
+    if (number != NULL) {
+        strncpy(p->number, number, sizeof(p->number) - 1);
+    }
+    return 0;
+}
+
+/*************************** at_pattern ****************************/
+
+static ATPattern s_csqPattern;
+static ATPattern s_cregPattern;
+static ATPattern s_cgregPattern;
+static ATPattern s_clccPattern;
+
+static int newCsq(char *line, Parsed *p)
+{
+    return at_pattern_match(&s_csqPattern, line,
+            &p->values[0], &p->values[1]) < 0 ? -1 : 0;
+}
+
+static int newCreg(char *line, Parsed *p)
+{
+    int f[5];
+    int *r = p->values;
+    const ATPattern *pattern = line[2] == 'G' ? &s_cgregPattern : &s_cregPattern;
+
+    switch (at_pattern_match(pattern, line, &f[0], &f[1], &f[2], &f[3], &f[4])) {
+        case 1: r[0] = f[0]; r[1] = r[2] = -1; break;
+        case 2: r[0] = f[1]; r[1] = r[2] = -1; break;
+        case 3: r[0] = f[0]; r[1] = f[1]; r[2] = f[2]; break;
+        case 4: r[0] = f[1]; r[1] = f[2]; r[2] = f[3]; break;
+        case 5: r[0] = f[1]; r[1] = f[2]; r[2] = f[3]; r[3] = f[4]; break;
+        default: return -1;
+    }
+    return 0;
+}
+
+static int newClcc(char *line, Parsed *p)
+{
+    char isMT, isMpty;
+    char *number = NULL;
+    int count;
+
+    count = at_pattern_match(&s_clccPattern, line, &p->values[0], &isMT,
+            &p->values[2], &p->values[3], &isMpty, &number, &p->values[4]);
+    if (count != 5 && count != 7) return -1;
+
+    if (number != NULL && 0 == strspn(number, "+0123456789")) {
+        number = NULL;
+    }
+
+    p->values[1] = isMT + 2 * isMpty;
+    if (number != NULL) {
+        strncpy(p->number, number, sizeof(p->number) - 1);
+    }
+    return 0;
+}
+
+/*******************************************************************/
+
+typedef int (*ParseFn)(char *line, Parsed *p);
+
+static const ParseFn s_old[] = { oldCsq, oldCreg, oldClcc };
+static const ParseFn s_new[] = { newCsq, newCreg, newClcc };
+
+static void parse(ParseFn fn, const char *line, Parsed *p)
+{
+    char copy[128];
+
+    memset(p, 0, sizeof(*p));
+    memset(p->values, 0xfe, sizeof(p->values));
+    strncpy(copy, line, sizeof(copy) - 1);
+    copy[sizeof(copy) - 1] = '\0';
+    p->ok = fn(copy, p) == 0;
+}
+
+static long long nowNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static long long timeParser(const ParseFn *fns, int iterations)
+{
+    long long start = nowNs();
+    volatile int sink = 0;
+    Parsed p;
+    size_t i;
+    int n;
+
+    for (n = 0; n < iterations; n++) {
+        for (i = 0; i < NUM_ELEMS(s_traffic); i++) {
+            parse(fns[s_traffic[i].type], s_traffic[i].line, &p);
+            sink += p.values[0];
+        }
+    }
+
+    return nowNs() - start;
+}
+
+int main(int argc, char **argv)
+{
+    int iterations = DEFAULT_ITERATIONS;
+    int mismatches = 0;
+    long long oldNs, newNs;
+    size_t lines;
+    size_t i;
+    int opt;
+
+    while (-1 != (opt = getopt(argc, argv, "n:"))) {
+        switch (opt) {
+            case 'n': iterations = atoi(optarg); break;
+            default:
+                fprintf(stderr, "usage: %s [-n iterations]\n", argv[0]);
+                return -1;
+        }
+    }
+
+    if (iterations <= 0) {
+        fprintf(stderr, "iterations must be positive\n");
+        return -1;
+    }
+
+    if (at_pattern_compile(&s_csqPattern, "+CSQ: %d,%d") < 0
+        || at_pattern_compile(&s_cregPattern, "+CREG: %d[,%x,%x,%x,%x]") < 0
+        || at_pattern_compile(&s_cgregPattern, "+CGREG: %d[,%x,%x,%x,%x]") < 0
+        || at_pattern_compile(&s_clccPattern, "+CLCC: %d,%b,%d,%d,%b[,%s,%d]") < 0
+    ) {
+        fprintf(stderr, "pattern failed to compile\n");
+        return 1;
+    }
+
+    for (i = 0; i < NUM_ELEMS(s_traffic); i++) {
+        Parsed a, b;
+
+        parse(s_old[s_traffic[i].type], s_traffic[i].line, &a);
+        parse(s_new[s_traffic[i].type], s_traffic[i].line, &b);
+
+        if (memcmp(&a, &b, sizeof(a)) != 0) {
+            printf("mismatch: %s\n", s_traffic[i].line);
+            mismatches++;
+        }
+    }
+
+    lines = (size_t) iterations * NUM_ELEMS(s_traffic);
+    oldNs = timeParser(s_old, iterations);
+    newNs = timeParser(s_new, iterations);
+
+    printf("at_pattern_bench: %zu lines\n", lines);
+    printf("  at_tok     %6.1f ns/line\n", (double) oldNs / lines);
+    printf("  at_pattern %6.1f ns/line\n", (double) newNs / lines);
+    printf("%s\n", mismatches ? "FAILED" : "PASSED");
+
+    return mismatches ? 1 : 0;
+}
@@ -0,0 +1,521 @@
+/* //device/system/reference-ril/at_pipeline_bench.c
+**
+** Copyright 2006, The Android Open Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+/*
+ * Host benchmark for the pipelined AT channel.
+ *
+ * A mock modem runs on the master side of a pty and atchannel is opened
+ * on the slave side. The modem answers commands strictly in order: the
+ * response to a command is sent "turnaround" after the command arrived
+ * (the link / firmware round trip) but no sooner than "process" after the
+ * previous response (the modem's own serial work). It also injects an
+ * unsolicited +CMTI before every Nth response.
+ *
+ * A polling mix of AT+CSQ, AT+CREG?, AT+COPS? and AT+CPIN? (which fails
+ * with +CME ERROR) is issued first with blocking at_send_command_*() and
+ * then with at_send_command_async() at increasing pipeline depths. Each
+ * answer carries the modem's command sequence number, so responses
+ * attributed to the wrong command are detected.
+ *
+ * usage: at_pipeline_bench [-n commands] [-t turnaround_us] [-p process_us]
+ *                          [-u unsol_every]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <pthread.h>
+#include <termios.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "atchannel.h"
+#include "at_tok.h"
+#include "misc.h"
+
+#define NUM_ELEMS(x) (sizeof(x)/sizeof(x[0]))
+
+#define DEFAULT_COMMANDS 2000
+#define DEFAULT_TURNAROUND_US 4000
+#define DEFAULT_PROCESS_US 300
+#define DEFAULT_UNSOL_EVERY 7
+
+/* kept below atchannel's queue limit */
+#define SUBMIT_WINDOW 24
+
+#define MAX_MODEM_QUEUE 64
+
+static int s_numCommands = DEFAULT_COMMANDS;
+static long long s_turnaroundNs = DEFAULT_TURNAROUND_US * 1000LL;
+static long long s_processNs = DEFAULT_PROCESS_US * 1000LL;
+static int s_unsolEvery = DEFAULT_UNSOL_EVERY;
+
+static long long nowNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/*************************** mock modem ****************************/
+
+typedef struct {
+    char command[64];
+    long long arrival;
+} ModemCommand;
+
+static int s_modemSeq = 0;
+static pthread_mutex_t s_unsolMutex = PTHREAD_MUTEX_INITIALIZER;
+static int s_unsolSent = 0;
+static int s_unsolSeen = 0;
+
+static void modemWrite(int fd, const char *s)
+{
+    size_t len = strlen(s);
+
+    while (len > 0) {
+        ssize_t written = write(fd, s, len);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return;
+        }
+        s += written;
+        len -= written;
+    }
+}
+
+static void modemRespond(int fd, const char *command)
+{
+    char buf[256];
+    int seq = s_modemSeq++;
+
+    if (s_unsolEvery > 0 && seq % s_unsolEvery == s_unsolEvery - 1) {
+        pthread_mutex_lock(&s_unsolMutex);
+        s_unsolSent++;
+        pthread_mutex_unlock(&s_unsolMutex);
+        snprintf(buf, sizeof(buf), "\r\n+CMTI: \"SM\",%d\r\n", seq);
+        modemWrite(fd, buf);
+    }
+
+    if (0 == strcmp(command, "AT+CSQ")) {
+        snprintf(buf, sizeof(buf), "\r\n+CSQ: %d,99\r\n\r\nOK\r\n", seq);
+    } else if (0 == strcmp(command, "AT+CREG?")) {
+        snprintf(buf, sizeof(buf), "\r\n+CREG: %d,1\r\n\r\nOK\r\n", seq);
+    } else if (0 == strcmp(command, "AT+COPS?")) {
+        snprintf(buf, sizeof(buf), "\r\n+COPS: %d,0,\"Mock\"\r\n\r\nOK\r\n", seq);
+    } else if (0 == strcmp(command, "AT+CPIN?")) {
+        snprintf(buf, sizeof(buf), "\r\n+CME ERROR: 10\r\n");
+    } else {
+        snprintf(buf, sizeof(buf), "\r\nOK\r\n");
+    }
+
+    modemWrite(fd, buf);
+}
+
+static void *modemThread(void *param)
+{
+    int fd = (int)(intptr_t)param;
+    ModemCommand queue[MAX_MODEM_QUEUE];
+    int head = 0, count = 0;
+    char line[64];
+    size_t lineLen = 0;
+    long long lastResponse = 0;
+
+    for (;;) {
+        struct pollfd pfd;
+        int timeoutMs = -1;
+        long long due = 0;
+
+        if (count > 0) {
+            due = queue[head].arrival + s_turnaroundNs;
+            if (due < lastResponse + s_processNs) {
+                due = lastResponse + s_processNs;
+            }
+            long long wait = due - nowNs();
+            timeoutMs = wait > 0 ? (int)((wait + 999999) / 1000000) : 0;
+            /* poll() only has ms resolution; spin the last millisecond */
+            if (wait > 0 && wait < 1000000) {
+                timeoutMs = 0;
+            }
+        }
+
+        pfd.fd = fd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+
+        if (poll(&pfd, 1, timeoutMs) < 0 && errno != EINTR) {
+            return NULL;
+        }
+
+        if (pfd.revents & (POLLERR | POLLHUP)) {
+            return NULL;
+        }
+
+        if (pfd.revents & POLLIN) {
+            char buf[512];
+            ssize_t n = read(fd, buf, sizeof(buf));
+            ssize_t i;
+
+            if (n <= 0) {
+                return NULL;
+            }
+
+            for (i = 0; i < n; i++) {
+                if (buf[i] != '\r') {
+                    if (lineLen < sizeof(line) - 1) {
+                        line[lineLen++] = buf[i];
+                    }
+                    continue;
+                }
+                line[lineLen] = '\0';
+                lineLen = 0;
+
+                if (count == MAX_MODEM_QUEUE) {
+                    fprintf(stderr, "mock modem: command queue overflow\n");
+                    exit(1);
+                }
+                ModemCommand *p_cmd = &queue[(head + count) % MAX_MODEM_QUEUE];
+                strcpy(p_cmd->command, line);
+                p_cmd->arrival = nowNs();
+                count++;
+            }
+        }
+
+        while (count > 0) {
+            due = queue[head].arrival + s_turnaroundNs;
+            if (due < lastResponse + s_processNs) {
+                due = lastResponse + s_processNs;
+            }
+            if (nowNs() < due) {
+                break;
+            }
+            modemRespond(fd, queue[head].command);
+            lastResponse = nowNs();
+            head = (head + 1) % MAX_MODEM_QUEUE;
+            count--;
+        }
+    }
+}
+
+/*************************** client ****************************/
+
+typedef struct {
+    const char *command;
+    ATCommandType type;
+    const char *prefix;
+    int expectError;
+} PollCommand;
+
+static const PollCommand s_mix[] = {
+    { "AT+CSQ", SINGLELINE, "+CSQ:", 0 },
+    { "AT+CREG?", SINGLELINE, "+CREG:", 0 },
+    { "AT+COPS?", SINGLELINE, "+COPS:", 0 },
+    { "AT+CPIN?", NO_RESULT, NULL, 1 },
+};
+
+typedef struct {
+    int index;
+    int seq;            /* sequence number the modem should answer with */
+    long long submitted;
+} Sample;
+
+static Sample *s_samples;
+static long long *s_latencyNs;
+static int s_misattributed;
+static int s_failed;
+
+static pthread_mutex_t s_doneMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t s_doneCond = PTHREAD_COND_INITIALIZER;
+static int s_outstanding;
+static int s_completed;
+
+static void onUnsolicited(const char *s, const char *sms_pdu)
+{
+    if (strStartsWith(s, "+CMTI:")) {
+        pthread_mutex_lock(&s_unsolMutex);
+        s_unsolSeen++;
+        pthread_mutex_unlock(&s_unsolMutex);
+    }
+}
+
+/* atchannel.c calls into reference-ril when pppd goes down */
+void onDeactiveDataCallList()
+{
+}
+
+/** returns 1 if p_response is the answer to command s->index */
+static int checkResponse(const Sample *s, int err, ATResponse *p_response)
+{
+    const PollCommand *p_poll = &s_mix[s->index % NUM_ELEMS(s_mix)];
+    char *line;
+    int seq;
+
+    if (err < 0 || p_response == NULL) {
+        return 0;
+    }
+
+    if (p_poll->expectError) {
+        return p_response->success == 0
+            && strStartsWith(p_response->finalResponse, "+CME ERROR:");
+    }
+
+    if (p_response->success == 0 || p_response->p_intermediates == NULL) {
+        return 0;
+    }
+
+    line = p_response->p_intermediates->line;
+    if (!strStartsWith(line, p_poll->prefix)
+        || at_tok_start(&line) < 0
+        || at_tok_nextint(&line, &seq) < 0
+    ) {
+        return 0;
+    }
+
+    return seq == s->seq;
+}
+
+static void record(Sample *s, int err, ATResponse *p_response)
+{
+    long long latency = nowNs() - s->submitted;
+
+    if (err < 0) {
+        s_failed++;
+    } else if (!checkResponse(s, err, p_response)) {
+        s_misattributed++;
+    }
+    s_latencyNs[s->index] = latency;
+}
+
+static void onComplete(int err, ATResponse *p_response, void *param)
+{
+    Sample *s = (Sample *) param;
+
+    pthread_mutex_lock(&s_doneMutex);
+    record(s, err, p_response);
+    s_outstanding--;
+    s_completed++;
+    pthread_cond_signal(&s_doneCond);
+    pthread_mutex_unlock(&s_doneMutex);
+
+    at_response_free(p_response);
+}
+
+static int compareLL(const void *a, const void *b)
+{
+    long long x = *(const long long *)a;
+    long long y = *(const long long *)b;
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+static void report(const char *label, long long elapsed)
+{
+    int n = s_numCommands;
+    int unsolSent, unsolSeen;
+
+    qsort(s_latencyNs, n, sizeof(long long), compareLL);
+
+    pthread_mutex_lock(&s_unsolMutex);
+    unsolSent = s_unsolSent;
+    unsolSeen = s_unsolSeen;
+    pthread_mutex_unlock(&s_unsolMutex);
+
+    printf("%-10s %7.0f cmd/s  p50=%6lldus p99=%6lldus max=%6lldus  "
+            "misattributed=%d failed=%d unsol=%d/%d\n",
+            label, n * 1e9 / elapsed,
+            s_latencyNs[n / 2] / 1000,
+            s_latencyNs[(int)(n * 0.99)] / 1000,
+            s_latencyNs[n - 1] / 1000,
+            s_misattributed, s_failed, unsolSeen, unsolSent);
+}
+
+static void resetRun()
+{
+    s_misattributed = 0;
+    s_failed = 0;
+    s_completed = 0;
+    s_outstanding = 0;
+    memset(s_latencyNs, 0, s_numCommands * sizeof(long long));
+}
+
+static void runSync(int *p_seq)
+{
+    long long start = nowNs();
+    int i;
+
+    resetRun();
+
+    for (i = 0; i < s_numCommands; i++) {
+        const PollCommand *p_poll = &s_mix[i % NUM_ELEMS(s_mix)];
+        ATResponse *p_response = NULL;
+        Sample *s = &s_samples[i];
+        int err;
+
+        s->index = i;
+        s->seq = (*p_seq)++;
+        s->submitted = nowNs();
+
+        if (p_poll->type == SINGLELINE) {
+            err = at_send_command_singleline(p_poll->command, p_poll->prefix,
+                    &p_response);
+        } else {
+            err = at_send_command(p_poll->command, &p_response);
+        }
+
+        record(s, err, p_response);
+        at_response_free(p_response);
+    }
+
+    report("sync", nowNs() - start);
+}
+
+static void runAsync(int depth, int *p_seq)
+{
+    char label[32];
+    long long start;
+    int i;
+
+    resetRun();
+    at_set_pipeline_depth(depth);
+
+    start = nowNs();
+
+    for (i = 0; i < s_numCommands; i++) {
+        const PollCommand *p_poll = &s_mix[i % NUM_ELEMS(s_mix)];
+        Sample *s = &s_samples[i];
+        int err;
+
+        pthread_mutex_lock(&s_doneMutex);
+        while (s_outstanding >= SUBMIT_WINDOW) {
+            pthread_cond_wait(&s_doneCond, &s_doneMutex);
+        }
+        s_outstanding++;
+        pthread_mutex_unlock(&s_doneMutex);
+
+        s->index = i;
+        s->seq = (*p_seq)++;
+        s->submitted = nowNs();
+
+        err = at_send_command_async(p_poll->command, p_poll->type,
+                p_poll->prefix, onComplete, s);
+
+        if (err < 0) {
+            fprintf(stderr, "at_send_command_async failed (%d)\n", err);
+            exit(1);
+        }
+    }
+
+    pthread_mutex_lock(&s_doneMutex);
+    while (s_completed < s_numCommands) {
+        pthread_cond_wait(&s_doneCond, &s_doneMutex);
+    }
+    pthread_mutex_unlock(&s_doneMutex);
+
+    snprintf(label, sizeof(label), "async/%d", depth);
+    report(label, nowNs() - start);
+}
+
+/** atchannel's pppd watcher wants an init-provided control socket */
+static void setupPppSocket()
+{
+    struct sockaddr_un addr;
+    char value[16];
+    int fd;
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path + 1, sizeof(addr.sun_path) - 1,
+            "at_pipeline_bench.%d", getpid());
+    if (fd < 0 || bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+        fprintf(stderr, "can't create rild-ppp socket (%d)\n", errno);
+        exit(1);
+    }
+
+    snprintf(value, sizeof(value), "%d", fd);
+    setenv("ANDROID_SOCKET_rild-ppp", value, 1);
+}
+
+int main(int argc, char **argv)
+{
+    static const int depths[] = { 1, 2, 4, 8 };
+    struct termios ios;
+    pthread_t tid;
+    int master, slave;
+    int seq = 0;
+    int opt;
+    size_t i;
+
+    while (-1 != (opt = getopt(argc, argv, "n:t:p:u:"))) {
+        switch (opt) {
+            case 'n': s_numCommands = atoi(optarg); break;
+            case 't': s_turnaroundNs = atoll(optarg) * 1000LL; break;
+            case 'p': s_processNs = atoll(optarg) * 1000LL; break;
+            case 'u': s_unsolEvery = atoi(optarg); break;
+            default:
+                fprintf(stderr, "usage: %s [-n commands] [-t turnaround_us] "
+                        "[-p process_us] [-u unsol_every]\n", argv[0]);
+                return -1;
+        }
+    }
+
+    if (s_numCommands <= 0 || s_turnaroundNs < 0 || s_processNs < 0) {
+        fprintf(stderr, "bad arguments\n");
+        return -1;
+    }
+
+    master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master < 0 || grantpt(master) < 0 || unlockpt(master) < 0
+        || (slave = open(ptsname(master), O_RDWR | O_NOCTTY)) < 0
+    ) {
+        fprintf(stderr, "can't open pty (%d)\n", errno);
+        return 1;
+    }
+
+    tcgetattr(slave, &ios);
+    cfmakeraw(&ios);
+    tcsetattr(slave, TCSANOW, &ios);
+
+    s_samples = (Sample *) calloc(s_numCommands, sizeof(Sample));
+    s_latencyNs = (long long *) calloc(s_numCommands, sizeof(long long));
+
+    setupPppSocket();
+
+    pthread_create(&tid, NULL, modemThread, (void *)(intptr_t)master);
+
+    if (at_open(slave, onUnsolicited) < 0) {
+        fprintf(stderr, "at_open failed\n");
+        return 1;
+    }
+
+    printf("at_pipeline_bench: %d commands, turnaround %lldus, "
+            "process %lldus, unsolicited every %d\n",
+            s_numCommands, s_turnaroundNs / 1000, s_processNs / 1000,
+            s_unsolEvery);
+
+    runSync(&seq);
+
+    for (i = 0; i < NUM_ELEMS(depths); i++) {
+        runAsync(depths[i], &seq);
+    }
+
+    return 0;
+}
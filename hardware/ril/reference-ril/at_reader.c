@@ -0,0 +1,247 @@
+/* //device/system/reference-ril/at_reader.c
+**
+** Copyright 2006, The Android Open Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#include "at_reader.h"
+#include "atchannel.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#define LOG_TAG "AT"
+#include <utils/Log.h>
+
+#define RING_MASK (AT_READER_RING_SIZE - 1)
+#define RING_AT(r, i) ((r)->ring[(i) & RING_MASK])
+
+void at_reader_init(ATReader *p_reader)
+{
+    memset(p_reader, 0, sizeof(*p_reader));
+}
+
+void at_reader_reset(ATReader *p_reader)
+{
+    p_reader->head = 0;
+    p_reader->tail = 0;
+    p_reader->scan = 0;
+    p_reader->lineLen = 0;
+}
+
+void at_reader_destroy(ATReader *p_reader)
+{
+    free(p_reader->line);
+    at_reader_init(p_reader);
+}
+
+static int isEOL(char c)
+{
+    return c == '\r' || c == '\n';
+}
+
+/**
+ * Appends ring bytes [from, to) to the spill buffer.
+ * Returns -1 if the line would exceed AT_READER_MAX_LINE.
+ */
+static int spill(ATReader *r, unsigned int from, unsigned int to)
+{
+    size_t len = to - from;
+    size_t need = r->lineLen + len + 1;
+    size_t start = from & RING_MASK;
+    size_t first;
+
+    if (need > AT_READER_MAX_LINE + 1) {
+        return -1;
+    }
+
+    if (need > r->lineSize) {
+        size_t size = r->lineSize != 0 ? r->lineSize : AT_READER_RING_SIZE;
+        char *p_new;
+
+        while (size < need) {
+            size *= 2;
+        }
+
+        p_new = (char *) realloc(r->line, size);
+        if (p_new == NULL) {
+            return -1;
+        }
+        r->line = p_new;
+        r->lineSize = size;
+    }
+
+    first = AT_READER_RING_SIZE - start;
+    if (first > len) {
+        first = len;
+    }
+
+    memcpy(r->line + r->lineLen, r->ring + start, first);
+    memcpy(r->line + r->lineLen + first, r->ring, len - first);
+    r->lineLen += len;
+
+    return 0;
+}
+
+/**
+ * r->scan points at the \r or \n ending the current line.
+ * Returns the line, or NULL if it had to be dropped.
+ */
+static const char *finishLine(ATReader *r)
+{
+    size_t len = r->scan - r->tail;
+    size_t start = r->tail & RING_MASK;
+    const char *ret;
+
+    if (r->lineLen == 0 && start + len < AT_READER_RING_SIZE) {
+        /* contiguous: terminate it in place over the EOL */
+        r->ring[start + len] = '\0';
+        ret = r->ring + start;
+    } else if (spill(r, r->tail, r->scan) == 0) {
+        r->line[r->lineLen] = '\0';
+        ret = r->line;
+    } else {
+        LOGE("ERROR: Input line exceeded buffer\n");
+        ret = NULL;
+    }
+
+    r->lineLen = 0;
+    r->tail = r->scan + 1;
+    r->scan = r->tail;
+
+    return ret;
+}
+
+static ssize_t readRing(ATReader *r, int fd)
+{
+    struct iovec iov[2];
+    size_t space = AT_READER_RING_SIZE - (r->head - r->tail);
+    size_t start = r->head & RING_MASK;
+    size_t first = AT_READER_RING_SIZE - start;
+    ssize_t count;
+
+    if (first > space) {
+        first = space;
+    }
+
+    iov[0].iov_base = r->ring + start;
+    iov[0].iov_len = first;
+    iov[1].iov_base = r->ring;
+    iov[1].iov_len = space - first;
+
+    do {
+        count = readv(fd, iov, space > first ? 2 : 1);
+    } while (count < 0 && errno == EINTR);
+
+    if (count > 0) {
+        if ((size_t) count <= first) {
+            AT_DUMP( "<< ", r->ring + start, count );
+        } else {
+            AT_DUMP( "<< ", r->ring + start, first );
+            AT_DUMP( "<< ", r->ring, count - first );
+        }
+        r->head += count;
+    }
+
+    return count;
+}
+
+const char *at_reader_readline(ATReader *p_reader, int fd, int *p_readCount)
+{
+    ATReader *r = p_reader;
+    ssize_t count;
+
+    for (;;) {
+        if (r->lineLen == 0) {
+            // skip over leading newlines
+            while (r->tail != r->head && isEOL(RING_AT(r, r->tail))) {
+                r->tail++;
+            }
+            if ((int) (r->scan - r->tail) < 0) {
+                r->scan = r->tail;
+            }
+        }
+
+        while (r->scan != r->head) {
+            /* scan the contiguous run up to head or the end of the ring */
+            size_t start = r->scan & RING_MASK;
+            size_t len = r->head - r->scan;
+            const char *p_cur, *p_end;
+
+            if (len > AT_READER_RING_SIZE - start) {
+                len = AT_READER_RING_SIZE - start;
+            }
+
+            p_cur = r->ring + start;
+            p_end = p_cur + len;
+            while (p_cur != p_end && !isEOL(*p_cur)) p_cur++;
+
+            r->scan += p_cur - (r->ring + start);
+
+            if (p_cur != p_end) {
+                const char *ret = finishLine(r);
+
+                if (ret != NULL) {
+                    return ret;
+                }
+                break;
+            }
+        }
+
+        if (r->scan != r->head) {
+            /* dropped an oversized line; look at what follows it */
+            continue;
+        }
+
+        if (r->lineLen == 0 && r->head - r->tail == 2
+                && RING_AT(r, r->tail) == '>' && RING_AT(r, r->tail + 1) == ' ') {
+            /* SMS prompt character...not \r terminated */
+            r->tail = r->scan = r->head;
+            return "> ";
+        }
+
+        if (r->tail == r->head) {
+            /* nothing buffered: start over at the front of the ring so
+               the next line is likely to be returned in place */
+            r->head = r->tail = r->scan = 0;
+        } else if (r->head - r->tail == AT_READER_RING_SIZE) {
+            /* the ring holds a single partial line; move it aside */
+            if (spill(r, r->tail, r->head) < 0) {
+                LOGE("ERROR: Input line exceeded buffer\n");
+                /* ditch the line and start over again */
+                r->lineLen = 0;
+            }
+            r->head = r->tail = r->scan = 0;
+        }
+
+        count = readRing(r, fd);
+
+        if (count <= 0) {
+            /* read error encountered or EOF reached */
+            if (count == 0) {
+                LOGD("atchannel: EOF reached");
+            } else {
+                LOGD("atchannel: read error %s", strerror(errno));
+            }
+            return NULL;
+        }
+
+        if (p_readCount != NULL) {
+            *p_readCount += count;
+        }
+    }
+}
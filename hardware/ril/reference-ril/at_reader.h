@@ -0,0 +1,73 @@
+/* //device/system/reference-ril/at_reader.h
+**
+** Copyright 2006, The Android Open Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#ifndef AT_READER_H
+#define AT_READER_H 1
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* must be a power of two */
+#define AT_READER_RING_SIZE (8 * 1024)
+
+/* lines longer than this are dropped, as the old 8k buffer used to do */
+#define AT_READER_MAX_LINE (256 * 1024)
+
+/**
+ * Line tokenizer for the AT channel.
+ *
+ * Input is read into a ring buffer and scanned once for \r / \n. A line
+ * that lies contiguously in the ring is returned in place; a line that
+ * wraps, or that is longer than the ring, is gathered into a separate
+ * growable buffer. Nothing is ever moved inside the ring.
+ */
+typedef struct {
+    char ring[AT_READER_RING_SIZE];
+    unsigned int head;      /* total bytes read into the ring */
+    unsigned int tail;      /* first byte of the current line */
+    unsigned int scan;      /* first byte not yet checked for EOL */
+
+    char *line;             /* spill buffer for wrapped / long lines */
+    size_t lineLen;
+    size_t lineSize;
+} ATReader;
+
+void at_reader_init(ATReader *p_reader);
+
+/** drops buffered input; keeps the spill buffer for reuse */
+void at_reader_reset(ATReader *p_reader);
+
+void at_reader_destroy(ATReader *p_reader);
+
+/**
+ * Reads the next line from fd, skipping empty lines.
+ * Special-cases the "> " SMS prompt, which is not \r terminated.
+ *
+ * Returns NULL on EOF or read error. The line is valid only until the
+ * next call. If p_readCount is not NULL, the number of bytes read from
+ * fd is added to it.
+ */
+const char *at_reader_readline(ATReader *p_reader, int fd, int *p_readCount);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*AT_READER_H */
@@ -0,0 +1,558 @@
+/* //device/system/reference-ril/at_reader_bench.c
+**
+** Copyright 2006, The Android Open Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+/*
+ * Host fuzz / throughput harness for the AT line tokenizer.
+ *
+ * Modem transcripts (built in, or raw captures given on the command line)
+ * are written into the master side of a pty in randomly sized chunks by
+ * a writer thread, and read back line by line from the raw slave side,
+ * the same way atchannel's reader thread reads the modem tty.
+ *
+ * Each transcript is run through
+ *
+ *   old: the previous readline() - linear 8k buffer, rescan from the
+ *        start of the line after every read, memmove of partial lines
+ *   new: at_reader_readline() - ring buffer, single scan, spill buffer
+ *        for lines that wrap or outgrow the ring
+ *
+ * and the lines produced are checked against a straightforward split of
+ * the transcript. Lines longer than 8k are expected to break "old".
+ *
+ * usage: at_reader_bench [-n iterations] [-c max_chunk] [-s seed] [file...]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <termios.h>
+
+#include "at_reader.h"
+
+#define NUM_ELEMS(x) (sizeof(x)/sizeof(x[0]))
+
+#define DEFAULT_ITERATIONS 20
+#define DEFAULT_MAX_CHUNK 512
+
+#define END_MARKER "AT_READER_BENCH_END"
+
+typedef struct {
+    const char *name;
+    char *data;
+    size_t len;
+} Transcript;
+
+static int s_maxChunk = DEFAULT_MAX_CHUNK;
+
+/*************************** transcripts ****************************/
+
+typedef struct {
+    char *data;
+    size_t len;
+    size_t size;
+} Buf;
+
+static void bufAppend(Buf *b, const char *s, size_t len)
+{
+    if (b->len + len + 1 > b->size) {
+        b->size = (b->len + len + 1) * 2;
+        b->data = (char *) realloc(b->data, b->size);
+    }
+    memcpy(b->data + b->len, s, len);
+    b->len += len;
+    b->data[b->len] = '\0';
+}
+
+static void bufPrintf(Buf *b, const char *fmt, ...)
+{
+    char tmp[1024];
+    va_list ap;
+    int len;
+
+    va_start(ap, fmt);
+    len = vsnprintf(tmp, sizeof(tmp), fmt, ap);
+    va_end(ap);
+
+    bufAppend(b, tmp, len);
+}
+
+/** a short power-on and registration session */
+static void makeSession(Buf *b)
+{
+    int i;
+
+    bufPrintf(b, "\r\nOK\r\n\r\nOK\r\n");
+    bufPrintf(b, "\r\n+CPIN: READY\r\n\r\nOK\r\n");
+    bufPrintf(b, "\r\n+CFUN: 1\r\n\r\nOK\r\n");
+    for (i = 0; i < 200; i++) {
+        bufPrintf(b, "\r\n+CSQ: %d,99\r\n\r\nOK\r\n", i % 32);
+        bufPrintf(b, "\r\n+CREG: 2,1,\"%04X\",\"%08X\",2\r\n", 0x1a2b + i, 0xa1b2c3 + i);
+        bufPrintf(b, "\r\n+CGREG: 2,1,\"%04X\",\"%08X\",2\r\n\r\nOK\r\n", 0x1a2b + i, 0xa1b2c3 + i);
+        bufPrintf(b, "\r\n+CLCC: 1,0,0,0,0,\"+15551234%03d\",145\r\n"
+                "+CLCC: 2,1,1,0,0,\"+15559876%03d\",145\r\n\r\nOK\r\n", i, i);
+        bufPrintf(b, "\r\nRING\r\n");
+    }
+}
+
+/** +CMGL listing of a full SIM: two lines per message */
+static void makeCmgl(Buf *b)
+{
+    static const char pdu[] =
+        "07911326040000F0040B911346610089F60000208062917314080CC8F71D14969741F977FD07";
+    int i;
+
+    bufPrintf(b, "\r\n");
+    for (i = 1; i <= 255; i++) {
+        bufPrintf(b, "+CMGL: %d,1,,%d\r\n%s\r\n", i, (int)(sizeof(pdu) - 1) / 2 - 8, pdu);
+    }
+    bufPrintf(b, "\r\nOK\r\n");
+}
+
+/** +COPS=? in a border area with many PLMNs and access technologies */
+static void makeCops(Buf *b)
+{
+    int i;
+
+    bufPrintf(b, "\r\n+COPS: ");
+    for (i = 0; i < 240; i++) {
+        bufPrintf(b, "%s(%d,\"Operator %03d Long Name\",\"OP%03d\",\"%03d%02d\",%d)",
+                i == 0 ? "" : ",", 1 + i % 3, i, i, 200 + i % 700, i % 100, (i % 3) * 2);
+    }
+    bufPrintf(b, ",,(0,1,2,3,4),(0,1,2)\r\n\r\nOK\r\n");
+}
+
+/** random printable lines with random \r / \n runs, no '>' */
+static void makeNoise(Buf *b)
+{
+    int i, j;
+
+    for (i = 0; i < 4000; i++) {
+        int len = rand() % 300;
+        int eols = 1 + rand() % 3;
+
+        for (j = 0; j < len; j++) {
+            char c = ' ' + 1 + rand() % ('~' - ' ');
+            if (c == '>') c = '<';
+            bufAppend(b, &c, 1);
+        }
+        for (j = 0; j < eols; j++) {
+            bufAppend(b, rand() & 1 ? "\r" : "\n", 1);
+        }
+    }
+}
+
+static void addTranscript(Transcript *t, const char *name, Buf *b)
+{
+    t->name = name;
+    t->data = b->data;
+    t->len = b->len;
+}
+
+static int loadTranscript(Transcript *t, const char *path)
+{
+    Buf b;
+    char tmp[4096];
+    ssize_t count;
+    int fd;
+
+    memset(&b, 0, sizeof(b));
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "can't open %s (%d)\n", path, errno);
+        return -1;
+    }
+    while ((count = read(fd, tmp, sizeof(tmp))) > 0) {
+        bufAppend(&b, tmp, count);
+    }
+    close(fd);
+
+    if (b.data == NULL) {
+        bufAppend(&b, "", 0);
+    }
+    addTranscript(t, path, &b);
+    return 0;
+}
+
+/**
+ * Splits a transcript the way the tokenizer should: runs of \r / \n
+ * separate lines, empty lines are skipped. The copy is modified in place.
+ */
+static char **expectedLines(const Transcript *t, int *p_count)
+{
+    char *copy = (char *) malloc(t->len + 1);
+    char **lines = NULL;
+    int count = 0, size = 0;
+    char *p = copy, *end = copy + t->len;
+
+    memcpy(copy, t->data, t->len);
+    copy[t->len] = '\0';
+
+    while (p < end) {
+        char *start;
+
+        while (p < end && (*p == '\r' || *p == '\n')) p++;
+        if (p == end) break;
+        start = p;
+        while (p < end && *p != '\r' && *p != '\n') p++;
+        if (p == end) break;    /* not terminated: never returned */
+        *p++ = '\0';
+
+        if (count == size) {
+            size = size ? size * 2 : 256;
+            lines = (char **) realloc(lines, size * sizeof(char *));
+        }
+        lines[count++] = start;
+    }
+
+    *p_count = count;
+    return lines;
+}
+
+/*************************** old tokenizer ****************************/
+
+#define OLD_MAX_AT_RESPONSE (8 * 1024)
+
+static char s_ATBuffer[OLD_MAX_AT_RESPONSE+1];
+static char *s_ATBufferCur = s_ATBuffer;
+
+static char * findNextEOL(char *cur)
+{
+    if (cur[0] == '>' && cur[1] == ' ' && cur[2] == '\0') {
+        return cur+2;
+    }
+
+    while (*cur != '\0' && *cur != '\r' && *cur != '\n') cur++;
+
+    return *cur == '\0' ? NULL : cur;
+}
+
+static const char *oldReadline(int fd)
+{
+    ssize_t count;
+    char *p_read = NULL;
+    char *p_eol = NULL;
+    char *ret;
+
+    if (*s_ATBufferCur == '\0') {
+        s_ATBufferCur = s_ATBuffer;
+        *s_ATBufferCur = '\0';
+        p_read = s_ATBuffer;
+    } else {
+        while (*s_ATBufferCur == '\r' || *s_ATBufferCur == '\n')
+            s_ATBufferCur++;
+
+        p_eol = findNextEOL(s_ATBufferCur);
+
+        if (p_eol == NULL) {
+            size_t len;
+
+            len = strlen(s_ATBufferCur);
+
+            memmove(s_ATBuffer, s_ATBufferCur, len + 1);
+            p_read = s_ATBuffer + len;
+            s_ATBufferCur = s_ATBuffer;
+        }
+    }
+
+    while (p_eol == NULL) {
+        if (0 == OLD_MAX_AT_RESPONSE - (p_read - s_ATBuffer)) {
+            s_ATBufferCur = s_ATBuffer;
+            *s_ATBufferCur = '\0';
+            p_read = s_ATBuffer;
+        }
+
+        do {
+            count = read(fd, p_read,
+                            OLD_MAX_AT_RESPONSE - (p_read - s_ATBuffer));
+        } while (count < 0 && errno == EINTR);
+
+        if (count <= 0) {
+            return NULL;
+        }
+
+        p_read[count] = '\0';
+
+        while (*s_ATBufferCur == '\r' || *s_ATBufferCur == '\n')
+            s_ATBufferCur++;
+
+        p_eol = findNextEOL(s_ATBufferCur);
+        p_read += count;
+    }
+
+    ret = s_ATBufferCur;
+    *p_eol = '\0';
+    s_ATBufferCur = p_eol + 1;
+
+    return ret;
+}
+
+/*************************** driver ****************************/
+
+static ATReader s_reader;
+
+static const char *newReadline(int fd)
+{
+    return at_reader_readline(&s_reader, fd, NULL);
+}
+
+typedef struct {
+    int fd;
+    const Transcript *t;
+    unsigned int seed;
+} WriterArgs;
+
+static int writeAll(int fd, const char *p, size_t len)
+{
+    while (len > 0) {
+        ssize_t written = write(fd, p, len);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        p += written;
+        len -= written;
+    }
+    return 0;
+}
+
+static void *writerThread(void *param)
+{
+    WriterArgs *args = (WriterArgs *) param;
+    const Transcript *t = args->t;
+    size_t off = 0;
+
+    while (off < t->len) {
+        size_t chunk = 1 + rand_r(&args->seed) % s_maxChunk;
+        if (chunk > t->len - off) {
+            chunk = t->len - off;
+        }
+        if (writeAll(args->fd, t->data + off, chunk) < 0) {
+            fprintf(stderr, "pty write failed (%d)\n", errno);
+            exit(1);
+        }
+        off += chunk;
+    }
+
+    writeAll(args->fd, "\r\n" END_MARKER "\r\n", sizeof(END_MARKER) + 3);
+
+    return NULL;
+}
+
+static int openPty(int *p_master, int *p_slave)
+{
+    struct termios ios;
+    int master, slave;
+
+    master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master < 0 || grantpt(master) < 0 || unlockpt(master) < 0) {
+        return -1;
+    }
+
+    slave = open(ptsname(master), O_RDWR | O_NOCTTY);
+    if (slave < 0) {
+        close(master);
+        return -1;
+    }
+
+    /* the modem tty is raw; don't let the line discipline touch \r */
+    tcgetattr(slave, &ios);
+    cfmakeraw(&ios);
+    tcsetattr(slave, TCSANOW, &ios);
+
+    *p_master = master;
+    *p_slave = slave;
+    return 0;
+}
+
+static long long nowNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/**
+ * Feeds one transcript through the pty and checks every line.
+ * Returns the number of mismatched lines; adds the read time to *p_ns.
+ */
+static int runOnce(const Transcript *t, const char *(*readline)(int),
+        char **expected, int numExpected, unsigned int seed, long long *p_ns)
+{
+    WriterArgs args;
+    pthread_t tid;
+    int master, slave;
+    int i = 0, errors = 0;
+    const char *line;
+    long long start;
+
+    if (openPty(&master, &slave) < 0) {
+        fprintf(stderr, "can't open pty (%d)\n", errno);
+        exit(1);
+    }
+
+    args.fd = master;
+    args.t = t;
+    args.seed = seed;
+
+    start = nowNs();
+    pthread_create(&tid, NULL, writerThread, &args);
+
+    while ((line = readline(slave)) != NULL) {
+        if (0 == strcmp(line, END_MARKER)) {
+            break;
+        }
+        if (i >= numExpected || 0 != strcmp(line, expected[i])) {
+            errors++;
+        }
+        i++;
+    }
+    *p_ns += nowNs() - start;
+
+    if (line == NULL) {
+        fprintf(stderr, "%s: stream ended early\n", t->name);
+        errors++;
+    }
+    if (i != numExpected) {
+        errors += i > numExpected ? i - numExpected : numExpected - i;
+    }
+
+    pthread_join(tid, NULL);
+    close(slave);
+    close(master);
+
+    return errors;
+}
+
+/** "> " is only a line if it arrives on its own, as the modem sends it */
+static int checkPrompt()
+{
+    int master, slave;
+    const char *line;
+    int ok;
+
+    if (openPty(&master, &slave) < 0) {
+        return -1;
+    }
+
+    at_reader_reset(&s_reader);
+    writeAll(master, "\r\n> ", 4);
+    line = at_reader_readline(&s_reader, slave, NULL);
+    ok = line != NULL && 0 == strcmp(line, "> ");
+
+    close(slave);
+    close(master);
+
+    return ok ? 0 : -1;
+}
+
+int main(int argc, char **argv)
+{
+    Transcript transcripts[16];
+    int numTranscripts = 0;
+    int iterations = DEFAULT_ITERATIONS;
+    unsigned int seed = (unsigned int) time(NULL);
+    int failed = 0;
+    int opt;
+    int i, n;
+    Buf b;
+
+    while (-1 != (opt = getopt(argc, argv, "n:c:s:"))) {
+        switch (opt) {
+            case 'n': iterations = atoi(optarg); break;
+            case 'c': s_maxChunk = atoi(optarg); break;
+            case 's': seed = strtoul(optarg, NULL, 0); break;
+            default:
+                fprintf(stderr, "usage: %s [-n iterations] [-c max_chunk] "
+                        "[-s seed] [file...]\n", argv[0]);
+                return -1;
+        }
+    }
+
+    if (iterations <= 0 || s_maxChunk <= 0) {
+        fprintf(stderr, "iterations and max_chunk must be positive\n");
+        return -1;
+    }
+
+    srand(seed);
+    printf("at_reader_bench: seed %u, %d iterations, chunks of 1-%d bytes\n",
+            seed, iterations, s_maxChunk);
+
+    memset(&b, 0, sizeof(b)); makeSession(&b);
+    addTranscript(&transcripts[numTranscripts++], "session", &b);
+    memset(&b, 0, sizeof(b)); makeCmgl(&b);
+    addTranscript(&transcripts[numTranscripts++], "+CMGL", &b);
+    memset(&b, 0, sizeof(b)); makeCops(&b);
+    addTranscript(&transcripts[numTranscripts++], "+COPS=?", &b);
+    memset(&b, 0, sizeof(b)); makeNoise(&b);
+    addTranscript(&transcripts[numTranscripts++], "noise", &b);
+
+    for (; optind < argc && numTranscripts < (int) NUM_ELEMS(transcripts); optind++) {
+        if (loadTranscript(&transcripts[numTranscripts], argv[optind]) == 0) {
+            numTranscripts++;
+        }
+    }
+
+    at_reader_init(&s_reader);
+
+    for (i = 0; i < numTranscripts; i++) {
+        const Transcript *t = &transcripts[i];
+        char **expected;
+        int numExpected;
+        int errorsOld = 0, errorsNew = 0;
+        long long nsOld = 0, nsNew = 0;
+
+        expected = expectedLines(t, &numExpected);
+
+        for (n = 0; n < iterations; n++) {
+            unsigned int runSeed = rand();
+
+            s_ATBufferCur = s_ATBuffer;
+            *s_ATBufferCur = '\0';
+            errorsOld += runOnce(t, oldReadline, expected, numExpected, runSeed, &nsOld);
+
+            at_reader_reset(&s_reader);
+            errorsNew += runOnce(t, newReadline, expected, numExpected, runSeed, &nsNew);
+        }
+
+        printf("%s: %zu bytes, %d lines\n", t->name, t->len, numExpected);
+        printf("  old %8.1f MB/s %10.0f lines/s  %d bad lines\n",
+                (double) t->len * iterations * 1000.0 / nsOld,
+                (double) numExpected * iterations * 1e9 / nsOld, errorsOld);
+        printf("  new %8.1f MB/s %10.0f lines/s  %d bad lines\n",
+                (double) t->len * iterations * 1000.0 / nsNew,
+                (double) numExpected * iterations * 1e9 / nsNew, errorsNew);
+
+        if (errorsNew != 0) {
+            failed = 1;
+        }
+    }
+
+    if (checkPrompt() < 0) {
+        printf("SMS prompt: not recognized\n");
+        failed = 1;
+    }
+
+    printf("%s\n", failed ? "FAILED" : "PASSED");
+    return failed;
+}
@@ -18,6 +18,7 @@
 
 #include "atchannel.h"
 #include "at_tok.h"
+#include "at_reader.h"
 
 #include <cutils/sockets.h>
 #include <stdio.h>
@@ -52,7 +53,10 @@
 
 #define NUM_ELEMS(x) (sizeof(x)/sizeof(x[0]))
 
-#define MAX_AT_RESPONSE (8 * 1024)
+#define MAX_PIPELINE_DEPTH 8
+#define MAX_QUEUED_COMMANDS 32
+#define LINE_POOL_SIZE 64
+#define LINE_POOL_DATA_SIZE 120
 #define HANDSHAKE_RETRY_COUNT 8
 #define HANDSHAKE_TIMEOUT_MSEC 250
 
@@ -64,8 +68,7 @@ static ATUnsolHandler s_unsolHandler;
 
 /* for input buffering */
 
-static char s_ATBuffer[MAX_AT_RESPONSE+1];
-static char *s_ATBufferCur = s_ATBuffer;
+static ATReader s_reader;
 
 static int s_ackPowerIoctl; /* true if TTY has android byte-count
                                 handshake for low power*/
@@ -88,10 +91,41 @@ void  AT_DUMP(const char*  prefix, const char*  buff, int  len)
 static pthread_mutex_t s_commandmutex = PTHREAD_MUTEX_INITIALIZER;
 static pthread_cond_t s_commandcond = PTHREAD_COND_INITIALIZER;
 
-static ATCommandType s_type;
-static const char *s_responsePrefix = NULL;
-static const char *s_smsPDU = NULL;
-static ATResponse *sp_response = NULL;
+/*
+ * Commands queued for, or being answered by, the modem.
+ *
+ * The modem answers commands in the order they were written, so
+ * intermediate and final responses always belong to s_cmdHead. The first
+ * s_cmdWritten entries of the queue have been written; at most
+ * s_pipelineDepth commands are written ahead of their final response.
+ */
+typedef struct ATCommand {
+    struct ATCommand *p_next;
+    const char *command;
+    ATCommandType type;
+    const char *responsePrefix;
+    const char *smsPDU;
+    ATResponse *p_response;
+
+    int async;                  /* completed through callback, then freed */
+    ATCommandCallback callback;
+    void *param;
+
+    int done;
+    int err;
+} ATCommand;
+
+static ATCommand *s_cmdHead = NULL;
+static ATCommand *s_cmdTail = NULL;
+static int s_cmdQueued = 0;
+static int s_cmdWritten = 0;
+static int s_pipelineDepth = 1;
+
+/* completed async commands whose callbacks have not run yet */
+static ATCommand *s_doneHead = NULL;
+static ATCommand *s_doneTail = NULL;
+
+static int s_inUnsolicited; /* only touched on the reader thread */
 
 static void (*s_onTimeout)(void) = NULL;
 static void (*s_onReaderClosed)(void) = NULL;
@@ -100,6 +134,8 @@ static int s_readerClosed;
 static void onReaderClosed();
 static int writeCtrlZ (const char *s);
 static int writeline (const char *s);
+static ATResponse * at_response_new();
+static void reverseIntermediates(ATResponse *p_response);
 
 #ifndef USE_NP
 static void setTimespecRelative(struct timespec *p_ts, long long msec)
@@ -131,20 +167,103 @@ static void sleepMsec(long long msec)
 
 
 
-/** add an intermediate response to sp_response*/
-static void addIntermediate(const char *line)
+/**
+ * Intermediate lines come from a fixed pool of ATLine's with inline
+ * storage, so a +CLCC or +CMGL listing doesn't cost two mallocs per line.
+ * Lines longer than the inline storage get a malloc'd copy; entries are
+ * malloc'd outright only once the pool is exhausted.
+ */
+typedef struct {
+    ATLine atline;              /* must be first */
+    char data[LINE_POOL_DATA_SIZE];
+} PooledLine;
+
+static PooledLine s_linePool[LINE_POOL_SIZE];
+static ATLine *s_linePoolFree;
+static int s_linePoolInit;
+static pthread_mutex_t s_linePoolMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int isPooledLine(const ATLine *p_line)
 {
-    ATLine *p_new;
+    return (const PooledLine *) p_line >= s_linePool
+        && (const PooledLine *) p_line < s_linePool + LINE_POOL_SIZE;
+}
+
+static ATLine *allocLine(const char *line)
+{
+    PooledLine *p_new = NULL;
+    size_t len = strlen(line);
 
-    p_new = (ATLine  *) malloc(sizeof(ATLine));
+    pthread_mutex_lock(&s_linePoolMutex);
+
+    if (!s_linePoolInit) {
+        size_t i;
+        for (i = 0 ; i < LINE_POOL_SIZE ; i++) {
+            s_linePool[i].atline.p_next = s_linePoolFree;
+            s_linePoolFree = &s_linePool[i].atline;
+        }
+        s_linePoolInit = 1;
+    }
+
+    if (s_linePoolFree != NULL) {
+        p_new = (PooledLine *) s_linePoolFree;
+        s_linePoolFree = s_linePoolFree->p_next;
+    }
+
+    pthread_mutex_unlock(&s_linePoolMutex);
+
+    if (p_new == NULL) {
+        p_new = (PooledLine *) malloc(sizeof(PooledLine));
+    }
+
+    if (len < sizeof(p_new->data)) {
+        memcpy(p_new->data, line, len + 1);
+        p_new->atline.line = p_new->data;
+    } else {
+        p_new->atline.line = strdup(line);
+    }
+
+    return &p_new->atline;
+}
+
+/** frees a whole list of intermediates, taking the pool lock once */
+static void freeLines(ATLine *p_line)
+{
+    ATLine *p_toFree;
 
-    p_new->line = strdup(line);
+    pthread_mutex_lock(&s_linePoolMutex);
+
+    while (p_line != NULL) {
+        p_toFree = p_line;
+        p_line = p_line->p_next;
+
+        if (p_toFree->line != ((PooledLine *) p_toFree)->data) {
+            free(p_toFree->line);
+        }
+
+        if (isPooledLine(p_toFree)) {
+            p_toFree->p_next = s_linePoolFree;
+            s_linePoolFree = p_toFree;
+        } else {
+            free(p_toFree);
+        }
+    }
+
+    pthread_mutex_unlock(&s_linePoolMutex);
+}
+
+/** add an intermediate response to p_response */
+static void addIntermediate(ATResponse *p_response, const char *line)
+{
+    ATLine *p_new;
+
+    p_new = allocLine(line);
 
     /* note: this adds to the head of the list, so the list
        will be in reverse order of lines received. the order is flipped
        again before passing on to the command issuer */
-    p_new->p_next = sp_response->p_intermediates;
-    sp_response->p_intermediates = p_new;
+    p_new->p_next = p_response->p_intermediates;
+    p_response->p_intermediates = p_new;
 }
 
 
@@ -231,47 +350,229 @@ static int isSMSUnsolicited(const char *line)
 
 
 /** assumes s_commandmutex is held */
-static void handleFinalResponse(const char *line)
+static void removeCommand(ATCommand *p_cmd)
+{
+    ATCommand **pp_cur;
+    ATCommand *p_prev = NULL;
+    int i = 0;
+
+    for (pp_cur = &s_cmdHead; *pp_cur != NULL; pp_cur = &(*pp_cur)->p_next) {
+        if (*pp_cur == p_cmd) {
+            *pp_cur = p_cmd->p_next;
+            if (s_cmdTail == p_cmd) {
+                s_cmdTail = p_prev;
+            }
+            if (i < s_cmdWritten) {
+                s_cmdWritten--;
+            }
+            s_cmdQueued--;
+            p_cmd->p_next = NULL;
+            return;
+        }
+        p_prev = *pp_cur;
+        i++;
+    }
+}
+
+/**
+ * assumes s_commandmutex is held and p_cmd has been removed.
+ * Synchronous callers are woken; async commands go on the done list
+ * and their callbacks run once the lock has been dropped.
+ */
+static void completeCommand(ATCommand *p_cmd, int err)
+{
+    p_cmd->done = 1;
+    p_cmd->err = err;
+
+    if (p_cmd->async) {
+        if (s_doneTail != NULL) {
+            s_doneTail->p_next = p_cmd;
+        } else {
+            s_doneHead = p_cmd;
+        }
+        s_doneTail = p_cmd;
+    } else {
+        pthread_cond_broadcast(&s_commandcond);
+    }
+}
+
+/** assumes s_commandmutex is held */
+static ATCommand *takeCompleted()
+{
+    ATCommand *p_done = s_doneHead;
+
+    s_doneHead = s_doneTail = NULL;
+
+    return p_done;
+}
+
+/** must be called without s_commandmutex held */
+static void runCallbacks(ATCommand *p_cmd)
+{
+    ATCommand *p_next;
+
+    while (p_cmd != NULL) {
+        p_next = p_cmd->p_next;
+
+        if (p_cmd->err == 0) {
+            /* line reader stores intermediate responses in reverse order */
+            reverseIntermediates(p_cmd->p_response);
+        } else {
+            at_response_free(p_cmd->p_response);
+            p_cmd->p_response = NULL;
+        }
+
+        if (p_cmd->callback != NULL) {
+            p_cmd->callback(p_cmd->err, p_cmd->p_response, p_cmd->param);
+        } else {
+            at_response_free(p_cmd->p_response);
+        }
+
+        free(p_cmd);
+        p_cmd = p_next;
+    }
+}
+
+/**
+ * Writes queued commands until the pipeline is full.
+ * assumes s_commandmutex is held
+ */
+static void writePendingCommands()
+{
+    ATCommand *p_cmd;
+    int err;
+    int i;
+
+    while (s_cmdWritten < s_pipelineDepth) {
+        p_cmd = s_cmdHead;
+        for (i = 0 ; i < s_cmdWritten && p_cmd != NULL ; i++) {
+            p_cmd = p_cmd->p_next;
+        }
+
+        if (p_cmd == NULL) {
+            return;
+        }
+
+        /* a command with an SMS PDU needs the "> " prompt to itself */
+        if (s_cmdWritten > 0
+            && (p_cmd->smsPDU != NULL || s_cmdHead->smsPDU != NULL)
+        ) {
+            return;
+        }
+
+        err = writeline (p_cmd->command);
+
+        if (err < 0) {
+            removeCommand(p_cmd);
+            completeCommand(p_cmd, err);
+            continue;
+        }
+
+        s_cmdWritten++;
+    }
+}
+
+/**
+ * Appends p_cmd to the queue and writes it if the pipeline has room.
+ * A command that can't be written is completed with the error.
+ * assumes s_commandmutex is held
+ */
+static int queueCommand(ATCommand *p_cmd)
+{
+    if (s_fd < 0 || s_readerClosed > 0) {
+        return AT_ERROR_CHANNEL_CLOSED;
+    }
+
+    if (s_cmdQueued >= MAX_QUEUED_COMMANDS) {
+        return AT_ERROR_COMMAND_PENDING;
+    }
+
+    p_cmd->p_next = NULL;
+    p_cmd->p_response = at_response_new();
+
+    if (s_cmdTail != NULL) {
+        s_cmdTail->p_next = p_cmd;
+    } else {
+        s_cmdHead = p_cmd;
+    }
+    s_cmdTail = p_cmd;
+    s_cmdQueued++;
+
+    writePendingCommands();
+
+    return 0;
+}
+
+/**
+ * Completes every queued command with err.
+ * assumes s_commandmutex is held
+ */
+static void failPendingCommands(int err)
+{
+    ATCommand *p_cmd;
+
+    while ((p_cmd = s_cmdHead) != NULL) {
+        removeCommand(p_cmd);
+        completeCommand(p_cmd, err);
+    }
+}
+
+/** assumes s_commandmutex is held */
+static void handleFinalResponse(ATCommand *p_cmd, const char *line)
 {
-    sp_response->finalResponse = strdup(line);
+    p_cmd->p_response->finalResponse = strdup(line);
+
+    removeCommand(p_cmd);
 
-    pthread_cond_signal(&s_commandcond);
+    /* keep the modem busy before waking anyone up */
+    writePendingCommands();
+
+    completeCommand(p_cmd, 0);
 }
 
 static void handleUnsolicited(const char *line)
 {
     if (s_unsolHandler != NULL) {
+        s_inUnsolicited = 1;
         s_unsolHandler(line, NULL);
+        s_inUnsolicited = 0;
     }
 }
 
 static void processLine(const char *line)
 {
+    ATCommand *p_cmd;
+    ATResponse *p_response;
+    ATCommand *p_done;
+
     pthread_mutex_lock(&s_commandmutex);
 
-    if (sp_response == NULL) {
+    p_cmd = s_cmdWritten > 0 ? s_cmdHead : NULL;
+    p_response = p_cmd != NULL ? p_cmd->p_response : NULL;
+
+    if (p_cmd == NULL) {
         /* no command pending */
         handleUnsolicited(line);
     } else if (isFinalResponseSuccess(line)) {
-        sp_response->success = 1;
-        handleFinalResponse(line);
+        p_response->success = 1;
+        handleFinalResponse(p_cmd, line);
     } else if (isFinalResponseError(line)) {
-        sp_response->success = 0;
-        handleFinalResponse(line);
-    } else if (s_smsPDU != NULL && 0 == strcmp(line, "> ")) {
+        p_response->success = 0;
+        handleFinalResponse(p_cmd, line);
+    } else if (p_cmd->smsPDU != NULL && 0 == strcmp(line, "> ")) {
         // See eg. TS 27.005 4.3
         // Commands like AT+CMGS have a "> " prompt
-        writeCtrlZ(s_smsPDU);
-        s_smsPDU = NULL;
-    } else switch (s_type) {
+        writeCtrlZ(p_cmd->smsPDU);
+        p_cmd->smsPDU = NULL;
+    } else switch (p_cmd->type) {
         case NO_RESULT:
             handleUnsolicited(line);
             break;
         case NUMERIC:
-            if (sp_response->p_intermediates == NULL
+            if (p_response->p_intermediates == NULL
                 && isdigit(line[0])
             ) {
-                addIntermediate(line);
+                addIntermediate(p_response, line);
             } else {
                 /* either we already have an intermediate response or
                    the line doesn't begin with a digit */
@@ -279,25 +580,25 @@ static void processLine(const char *line)
             }
             break;
         case SINGLELINE:
-            if (sp_response->p_intermediates == NULL
-                && strStartsWith (line, s_responsePrefix)
+            if (p_response->p_intermediates == NULL
+                && strStartsWith (line, p_cmd->responsePrefix)
             ) {
-                addIntermediate(line);
+                addIntermediate(p_response, line);
             } else {
                 /* we already have an intermediate response */
                 handleUnsolicited(line);
             }
             break;
         case MULTILINE:
-            if (strStartsWith (line, s_responsePrefix)) {
-                addIntermediate(line);
+            if (strStartsWith (line, p_cmd->responsePrefix)) {
+                addIntermediate(p_response, line);
             } else {
                 //handle the case of read sms
                 //<CR><LF>+CMGR:
                 //<stat>,[<reserved>],<length><CR><LF><pdu><CR><LF><C
                 //R><LF>OK<CR><LF>
-                if(!strcmp(s_responsePrefix,"+CMGR:")&& sp_response->p_intermediates && sp_response->p_intermediates->line ) {
-                    addIntermediate(line);
+                if(!strcmp(p_cmd->responsePrefix,"+CMGR:")&& p_response->p_intermediates && p_response->p_intermediates->line ) {
+                    addIntermediate(p_response, line);
                 }
                 else{
                     handleUnsolicited(line);
@@ -307,32 +608,16 @@ static void processLine(const char *line)
         break;
 
         default: /* this should never be reached */
-            LOGE("Unsupported AT command type %d\n", s_type);
+            LOGE("Unsupported AT command type %d\n", p_cmd->type);
             handleUnsolicited(line);
         break;
     }
 
-    pthread_mutex_unlock(&s_commandmutex);
-}
-
-
-/**
- * Returns a pointer to the end of the next line
- * special-cases the "> " SMS prompt
- *
- * returns NULL if there is no complete line
- */
-static char * findNextEOL(char *cur)
-{
-    if (cur[0] == '>' && cur[1] == ' ' && cur[2] == '\0') {
-        /* SMS prompt character...not \r terminated */
-        return cur+2;
-    }
+    p_done = takeCompleted();
 
-    // Find next newline
-    while (*cur != '\0' && *cur != '\r' && *cur != '\n') cur++;
+    pthread_mutex_unlock(&s_commandmutex);
 
-    return *cur == '\0' ? NULL : cur;
+    runCallbacks(p_done);
 }
 
 
@@ -348,95 +633,29 @@ static char * findNextEOL(char *cur)
 
 static const char *readline()
 {
-    ssize_t count;
-
-    char *p_read = NULL;
-    char *p_eol = NULL;
-    char *ret;
-
-    /* this is a little odd. I use *s_ATBufferCur == 0 to
-     * mean "buffer consumed completely". If it points to a character, than
-     * the buffer continues until a \0
-     */
-    if (*s_ATBufferCur == '\0') {
-        /* empty buffer */
-        s_ATBufferCur = s_ATBuffer;
-        *s_ATBufferCur = '\0';
-        p_read = s_ATBuffer;
-    } else {   /* *s_ATBufferCur != '\0' */
-        /* there's data in the buffer from the last read */
-
-        // skip over leading newlines
-        while (*s_ATBufferCur == '\r' || *s_ATBufferCur == '\n')
-            s_ATBufferCur++;
-
-        p_eol = findNextEOL(s_ATBufferCur);
-
-        if (p_eol == NULL) {
-            /* a partial line. move it up and prepare to read more */
-            size_t len;
-
-            len = strlen(s_ATBufferCur);
-
-            memmove(s_ATBuffer, s_ATBufferCur, len + 1);
-            p_read = s_ATBuffer + len;
-            s_ATBufferCur = s_ATBuffer;
-        }
-        /* Otherwise, (p_eol !- NULL) there is a complete line  */
-        /* that will be returned the while () loop below        */
-    }
+    const char *ret;
 
-    while (p_eol == NULL) {
-        if (0 == MAX_AT_RESPONSE - (p_read - s_ATBuffer)) {
-            LOGE("ERROR: Input line exceeded buffer\n");
-            /* ditch buffer and start over again */
-            s_ATBufferCur = s_ATBuffer;
-            *s_ATBufferCur = '\0';
-            p_read = s_ATBuffer;
-        }
+    ret = at_reader_readline(&s_reader, s_fd, &s_readCount);
 
-        do {
-            count = read(s_fd, p_read,
-                            MAX_AT_RESPONSE - (p_read - s_ATBuffer));
-        } while (count < 0 && errno == EINTR);
-
-        if (count > 0) {
-            AT_DUMP( "<< ", p_read, count );
-            s_readCount += count;
-
-            p_read[count] = '\0';
-
-            // skip over leading newlines
-            while (*s_ATBufferCur == '\r' || *s_ATBufferCur == '\n')
-                s_ATBufferCur++;
-
-            p_eol = findNextEOL(s_ATBufferCur);
-            p_read += count;
-        } else if (count <= 0) {
-            /* read error encountered or EOF reached */
-            if(count == 0) {
-                LOGD("atchannel: EOF reached");
-            } else {
-                LOGD("atchannel: read error %s", strerror(errno));
-            }
-            return NULL;
-        }
+    if (ret != NULL) {
+        LOGD("AT< %s\n", ret);
     }
-
-    /* a full line in the buffer. Place a \0 over the \r and return */
-
-    ret = s_ATBufferCur;
-    *p_eol = '\0';
-    s_ATBufferCur = p_eol + 1; /* this will always be <= p_read,    */
-                              /* and there will be a \0 at *p_read */
-
-    LOGD("AT< %s\n", ret);
     return ret;
 }
 
 
 static void onReaderClosed()
 {
+    ATCommand *p_done;
+
+    /* nothing more will be answered */
+    pthread_mutex_lock(&s_commandmutex);
+    failPendingCommands(AT_ERROR_CHANNEL_CLOSED);
+    p_done = takeCompleted();
+    pthread_mutex_unlock(&s_commandmutex);
+
+    runCallbacks(p_done);
+
     if (s_onReaderClosed != NULL && s_readerClosed == 0) {
 
         pthread_mutex_lock(&s_commandmutex);
@@ -661,17 +880,6 @@ static int writeCtrlZ (const char *s)
     return 0;
 }
 
-static void clearPendingCommand()
-{
-    if (sp_response != NULL) {
-        at_response_free(sp_response);
-    }
-
-    sp_response = NULL;
-    s_responsePrefix = NULL;
-    s_smsPDU = NULL;
-}
-
 
 /**
  * Starts AT handler on stream "fd'
@@ -687,9 +895,11 @@ int at_open(int fd, ATUnsolHandler h)
     s_unsolHandler = h;
     s_readerClosed = 0;
 
-    s_responsePrefix = NULL;
-    s_smsPDU = NULL;
-    sp_response = NULL;
+    s_cmdHead = s_cmdTail = NULL;
+    s_cmdQueued = 0;
+    s_cmdWritten = 0;
+
+    at_reader_reset(&s_reader);
 
     /* Android power control ioctl */
 #ifdef HAVE_ANDROID_OS
@@ -751,6 +961,8 @@ int at_open(int fd, ATUnsolHandler h)
 /* FIXME is it ok to call this from the reader and the command thread? */
 void at_close()
 {
+    ATCommand *p_done;
+
     if (s_fd >= 0) {
         close(s_fd);
     }
@@ -760,10 +972,15 @@ void at_close()
 
     s_readerClosed = 1;
 
-    pthread_cond_signal(&s_commandcond);
+    failPendingCommands(AT_ERROR_CHANNEL_CLOSED);
+    p_done = takeCompleted();
+
+    pthread_cond_broadcast(&s_commandcond);
 
     pthread_mutex_unlock(&s_commandmutex);
 
+    runCallbacks(p_done);
+
     /* the reader thread should eventually die */
 }
 
@@ -774,21 +991,9 @@ static ATResponse * at_response_new()
 
 void at_response_free(ATResponse *p_response)
 {
-    ATLine *p_line;
-
     if (p_response == NULL) return;
 
-    p_line = p_response->p_intermediates;
-
-    while (p_line != NULL) {
-        ATLine *p_toFree;
-
-        p_toFree = p_line;
-        p_line = p_line->p_next;
-
-        free(p_toFree->line);
-        free(p_toFree);
-    }
+    freeLines(p_response->p_intermediates);
 
     free (p_response->finalResponse);
     free (p_response);
@@ -825,33 +1030,31 @@ static int at_send_command_full_nolock (const char *command, ATCommandType type,
                     long long timeoutMsec, ATResponse **pp_outResponse)
 {
     int err = 0;
+    ATCommand cmd;
 #ifndef USE_NP
     struct timespec ts;
 #endif /*USE_NP*/
 
-    if(sp_response != NULL) {
-        err = AT_ERROR_COMMAND_PENDING;
-        goto error;
-    }
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.command = command;
+    cmd.type = type;
+    cmd.responsePrefix = responsePrefix;
+    cmd.smsPDU = smspdu;
 
-    err = writeline (command);
+    err = queueCommand(&cmd);
 
     if (err < 0) {
-        goto error;
+        return err;
     }
 
-    s_type = type;
-    s_responsePrefix = responsePrefix;
-    s_smsPDU = smspdu;
-    sp_response = at_response_new();
-
 #ifndef USE_NP
     if (timeoutMsec != 0) {
         setTimespecRelative(&ts, timeoutMsec);
     }
 #endif /*USE_NP*/
 
-    while (sp_response->finalResponse == NULL && s_readerClosed == 0) {
+    /* earlier commands in the pipeline may be answered first */
+    while (!cmd.done && s_readerClosed == 0) {
         if (timeoutMsec != 0) {
 #ifdef USE_NP
             err = pthread_cond_timeout_np(&s_commandcond, &s_commandmutex, timeoutMsec);
@@ -862,30 +1065,41 @@ static int at_send_command_full_nolock (const char *command, ATCommandType type,
             err = pthread_cond_wait(&s_commandcond, &s_commandmutex);
         }
 
-        if (err == ETIMEDOUT) {
+        if (err == ETIMEDOUT && !cmd.done) {
             err = AT_ERROR_TIMEOUT;
             goto error;
         }
     }
 
-    if (pp_outResponse == NULL) {
-        at_response_free(sp_response);
-    } else {
-        /* line reader stores intermediate responses in reverse order */
-        reverseIntermediates(sp_response);
-        *pp_outResponse = sp_response;
+    if (!cmd.done) {
+        err = AT_ERROR_CHANNEL_CLOSED;
+        goto error;
     }
 
-    sp_response = NULL;
+    err = cmd.err;
 
-    if(s_readerClosed > 0) {
-        err = AT_ERROR_CHANNEL_CLOSED;
+    if (err < 0) {
         goto error;
     }
 
-    err = 0;
+    if (pp_outResponse == NULL) {
+        at_response_free(cmd.p_response);
+    } else {
+        /* line reader stores intermediate responses in reverse order */
+        reverseIntermediates(cmd.p_response);
+        *pp_outResponse = cmd.p_response;
+    }
+
+    return 0;
+
 error:
-    clearPendingCommand();
+    if (!cmd.done) {
+        /* late responses will be treated as unsolicited, or attributed
+           to the next command, as before pipelining */
+        removeCommand(&cmd);
+        writePendingCommands();
+    }
+    at_response_free(cmd.p_response);
 
     return err;
 }
@@ -900,6 +1114,7 @@ static int at_send_command_full (const char *command, ATCommandType type,
                     long long timeoutMsec, ATResponse **pp_outResponse)
 {
     int err;
+    ATCommand *p_done;
 
     if (0 != pthread_equal(s_tid_reader, pthread_self())) {
         /* cannot be called from reader thread */
@@ -912,8 +1127,12 @@ static int at_send_command_full (const char *command, ATCommandType type,
                     responsePrefix, smspdu,
                     timeoutMsec, pp_outResponse);
 
+    p_done = takeCompleted();
+
     pthread_mutex_unlock(&s_commandmutex);
 
+    runCallbacks(p_done);
+
     if (err == AT_ERROR_TIMEOUT && s_onTimeout != NULL) {
         s_onTimeout();
     }
@@ -922,6 +1141,88 @@ static int at_send_command_full (const char *command, ATCommandType type,
 }
 
 
+/**
+ * Queue a command without waiting for its response
+ *
+ * "command" should not include \r; command and responsePrefix are copied
+ * callback may be NULL
+ *
+ * Returns 0 if the command was queued, AT_ERROR_COMMAND_PENDING if the
+ * queue is full
+ */
+int at_send_command_async (const char *command, ATCommandType type,
+                    const char *responsePrefix,
+                    ATCommandCallback callback, void *param)
+{
+    ATCommand *p_cmd;
+    ATCommand *p_done;
+    size_t commandLen = strlen(command) + 1;
+    size_t prefixLen = responsePrefix != NULL ? strlen(responsePrefix) + 1 : 0;
+    char *p_strings;
+    int err;
+
+    if (s_inUnsolicited && 0 != pthread_equal(s_tid_reader, pthread_self())) {
+        /* s_commandmutex is held around the unsolicited handler */
+        return AT_ERROR_INVALID_THREAD;
+    }
+
+    p_cmd = (ATCommand *) calloc(1, sizeof(ATCommand) + commandLen + prefixLen);
+    if (p_cmd == NULL) {
+        return AT_ERROR_GENERIC;
+    }
+
+    p_strings = (char *) (p_cmd + 1);
+    memcpy(p_strings, command, commandLen);
+    p_cmd->command = p_strings;
+    if (responsePrefix != NULL) {
+        memcpy(p_strings + commandLen, responsePrefix, prefixLen);
+        p_cmd->responsePrefix = p_strings + commandLen;
+    }
+    p_cmd->type = type;
+    p_cmd->async = 1;
+    p_cmd->callback = callback;
+    p_cmd->param = param;
+
+    pthread_mutex_lock(&s_commandmutex);
+
+    err = queueCommand(p_cmd);
+    p_done = takeCompleted();
+
+    pthread_mutex_unlock(&s_commandmutex);
+
+    if (err < 0) {
+        free(p_cmd);
+    }
+
+    /* includes p_cmd if it could not be written */
+    runCallbacks(p_done);
+
+    return err;
+}
+
+
+void at_set_pipeline_depth(int depth)
+{
+    ATCommand *p_done;
+
+    if (depth < 1) {
+        depth = 1;
+    } else if (depth > MAX_PIPELINE_DEPTH) {
+        depth = MAX_PIPELINE_DEPTH;
+    }
+
+    pthread_mutex_lock(&s_commandmutex);
+
+    s_pipelineDepth = depth;
+    writePendingCommands();
+    p_done = takeCompleted();
+
+    pthread_mutex_unlock(&s_commandmutex);
+
+    runCallbacks(p_done);
+}
+
+
 /**
  * Issue a single normal AT command with no intermediate response expected
  *
@@ -1052,6 +1353,7 @@ int at_handshake()
 {
     int i;
     int err = 0;
+    ATCommand *p_done;
 
     if (0 != pthread_equal(s_tid_reader, pthread_self())) {
         /* cannot be called from reader thread */
@@ -1077,8 +1379,12 @@ int at_handshake()
         sleepMsec(HANDSHAKE_TIMEOUT_MSEC);
     }
 
+    p_done = takeCompleted();
+
     pthread_mutex_unlock(&s_commandmutex);
 
+    runCallbacks(p_done);
+
     return err;
 }
 
@@ -109,6 +109,41 @@ int at_send_command_sms (const char *command, const char *pdu,
 
 void at_response_free(ATResponse *p_response);
 
+/**
+ * Completion callback for at_send_command_async
+ *
+ * err is 0 or one of AT_ERROR_*. On success p_response is the complete
+ * response and must be freed with at_response_free; on error it is NULL.
+ *
+ * Invoked without the channel lock held, usually on the reader thread,
+ * but possibly on a thread that submits a command or calls at_close()
+ */
+typedef void (*ATCommandCallback)(int err, ATResponse *p_response,
+                                    void *param);
+
+/**
+ * Queues a command and returns without waiting for the response
+ *
+ * Commands, async or not, are written in the order they were issued and
+ * up to the pipeline depth of them may be outstanding at the modem.
+ * Async commands have no timeout of their own; they fail with
+ * AT_ERROR_CHANNEL_CLOSED when the channel closes.
+ *
+ * May be called from a completion callback but not from the unsolicited
+ * handler. Returns AT_ERROR_COMMAND_PENDING if too many commands are
+ * already queued.
+ */
+int at_send_command_async (const char *command, ATCommandType type,
+                            const char *responsePrefix,
+                            ATCommandCallback callback, void *param);
+
+/**
+ * Number of commands written ahead of their final response (1 - 8)
+ * The default of 1 is safe for any modem; raise it only for modems that
+ * buffer and answer queued commands in order
+ */
+void at_set_pipeline_depth(int depth);
+
 typedef enum {
     CME_ERROR_NON_CME = -1,
     CME_SUCCESS = 0,
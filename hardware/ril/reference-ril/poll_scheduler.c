@@ -0,0 +1,383 @@
+/* //device/system/reference-ril/poll_scheduler.c
+**
+** Copyright 2006, The Android Open Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+/*
+ * Every periodic query reference-ril makes goes through here, so that
+ * polls that fall due close together share one wakeup and go out to the
+ * modem as one pipelined batch, and so that nothing polls faster than
+ * its results actually change.
+ *
+ * Timed callbacks can't be cancelled, so the scheduler remembers the
+ * deadlines it has already asked for and only arms another one when none
+ * of them would run the next task within its slack.
+ */
+
+#include "poll_scheduler.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <cutils/properties.h>
+
+#define LOG_TAG "RIL"
+#include <utils/Log.h>
+
+#define PROPERTY_POLL_WAKEUPS "ril.poll.wakeups_per_hour"
+
+/* timers in flight; more than this and the extras go untracked */
+#define MAX_POLL_TIMERS 8
+
+/* a task may run this fraction of its interval early to share a wakeup */
+#define POLL_SLACK_DIVISOR 4
+
+#define STATS_PUBLISH_MSEC (5 * 60 * 1000)
+#define MSEC_PER_HOUR (60 * 60 * 1000LL)
+
+static pthread_mutex_t s_pollMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t s_pollCond = PTHREAD_COND_INITIALIZER;
+
+static PollTimerFunc s_requestTimedCallback;
+static PollTask *s_tasks;
+static long long s_timers[MAX_POLL_TIMERS];    /* deadlines; 0 is free */
+static int s_screenOn = 1;
+static int s_pendingResponses;
+
+static PollStats s_stats;
+static long long s_startMs;
+static long long s_publishedMs;
+
+static long long nowMsec()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int effectiveInterval(const PollTask *p_task)
+{
+    if (!s_screenOn && p_task->screenOffScale > 1) {
+        return p_task->intervalMs * p_task->screenOffScale;
+    }
+    return p_task->intervalMs;
+}
+
+static void addTask(PollTask *p_task)
+{
+    PollTask *p_cur;
+
+    for (p_cur = s_tasks ; p_cur != NULL ; p_cur = p_cur->p_next) {
+        if (p_cur == p_task) {
+            return;
+        }
+    }
+
+    p_task->p_next = s_tasks;
+    s_tasks = p_task;
+}
+
+static void onPollTimer(void *param);
+
+/**
+ * Makes sure a timer will fire for the task due first.
+ * assumes s_pollMutex is held
+ */
+static void armLocked(long long now)
+{
+    PollTask *p_first = NULL;
+    PollTask *p_cur;
+    long long deadline;
+    long long earliest;
+    struct timeval tv;
+    int i;
+    int slot = -1;
+
+    for (p_cur = s_tasks ; p_cur != NULL ; p_cur = p_cur->p_next) {
+        if (p_cur->active && !p_cur->running
+                && (p_first == NULL || p_cur->dueMs < p_first->dueMs)) {
+            p_first = p_cur;
+        }
+    }
+
+    if (p_first == NULL || s_requestTimedCallback == NULL) {
+        return;
+    }
+
+    deadline = p_first->dueMs > now ? p_first->dueMs : now;
+    earliest = p_first->dueMs - effectiveInterval(p_first) / POLL_SLACK_DIVISOR;
+
+    for (i = 0 ; i < MAX_POLL_TIMERS ; i++) {
+        if (s_timers[i] == 0) {
+            if (slot < 0) slot = i;
+        } else if (s_timers[i] >= earliest && s_timers[i] <= deadline) {
+            /* a timer already asked for will pick it up */
+            return;
+        }
+    }
+
+    tv.tv_sec = (deadline - now) / 1000;
+    tv.tv_usec = ((deadline - now) % 1000) * 1000;
+
+    if (slot >= 0) {
+        s_timers[slot] = deadline;
+        s_requestTimedCallback(onPollTimer, &s_timers[slot], &tv);
+    } else {
+        LOGW("poll: out of timer slots");
+        s_requestTimedCallback(onPollTimer, NULL, &tv);
+    }
+}
+
+/** assumes s_pollMutex is held */
+static void publishStatsLocked(long long now)
+{
+    char value[PROPERTY_VALUE_MAX];
+
+    s_stats.elapsedMs = now - s_startMs;
+    if (s_stats.elapsedMs > 0) {
+        s_stats.wakeupsPerHour =
+                (int) (s_stats.wakeups * MSEC_PER_HOUR / s_stats.elapsedMs);
+    }
+
+    if (now - s_publishedMs < STATS_PUBLISH_MSEC) {
+        return;
+    }
+    s_publishedMs = now;
+
+    snprintf(value, sizeof(value), "%d", s_stats.wakeupsPerHour);
+    property_set(PROPERTY_POLL_WAKEUPS, value);
+
+    LOGI("poll: %d wakeups/hour (%d wakeups, %d polls, %d merged)",
+            s_stats.wakeupsPerHour, s_stats.wakeups,
+            s_stats.polls, s_stats.merged);
+}
+
+/** at_send_command_async callback; runs on the reader thread */
+static void onPollResponse(int err, ATResponse *p_response, void *param)
+{
+    PollTask *p_task = (PollTask *) param;
+
+    pthread_mutex_lock(&s_pollMutex);
+
+    p_task->err = err;
+    p_task->p_response = p_response;
+
+    if (--s_pendingResponses == 0) {
+        pthread_cond_broadcast(&s_pollCond);
+    }
+
+    pthread_mutex_unlock(&s_pollMutex);
+}
+
+static void finishTaskLocked(PollTask *p_task, PollResult result, long long now)
+{
+    p_task->running = 0;
+
+    if (!p_task->active || p_task->rescheduled) {
+        /* cancelled or restarted by someone else meanwhile */
+        p_task->rescheduled = 0;
+        return;
+    }
+
+    switch (result) {
+        case POLL_CHANGED:
+            p_task->intervalMs = p_task->minIntervalMs;
+            break;
+
+        case POLL_UNCHANGED:
+            p_task->intervalMs *= 2;
+            if (p_task->intervalMs > p_task->maxIntervalMs) {
+                p_task->intervalMs = p_task->maxIntervalMs;
+            }
+            break;
+
+        case POLL_DONE:
+        default:
+            p_task->active = 0;
+            return;
+    }
+
+    p_task->dueMs = now + effectiveInterval(p_task);
+}
+
+static void onPollTimer(void *param)
+{
+    PollTask *p_batch = NULL;
+    PollTask **pp_last = &p_batch;
+    PollTask *p_cur;
+    long long now;
+    int count = 0;
+    int err;
+
+    pthread_mutex_lock(&s_pollMutex);
+
+    if (param != NULL) {
+        *(long long *) param = 0;
+    }
+
+    now = nowMsec();
+    s_stats.wakeups++;
+
+    for (p_cur = s_tasks ; p_cur != NULL ; p_cur = p_cur->p_next) {
+        if (!p_cur->active || p_cur->running) {
+            continue;
+        }
+        if (p_cur->dueMs - effectiveInterval(p_cur) / POLL_SLACK_DIVISOR > now) {
+            continue;
+        }
+
+        p_cur->running = 1;
+        p_cur->lastRunMs = now;
+        p_cur->err = 0;
+        p_cur->p_response = NULL;
+        p_cur->p_batchNext = NULL;
+        *pp_last = p_cur;
+        pp_last = &p_cur->p_batchNext;
+
+        if (p_cur->command != NULL) {
+            s_pendingResponses++;
+        }
+        count++;
+    }
+
+    if (count > 0) {
+        s_stats.batches++;
+        s_stats.polls += count;
+        if (count > 1) {
+            s_stats.merged += count;
+        }
+    }
+
+    pthread_mutex_unlock(&s_pollMutex);
+
+    /* queue every command first, so they reach the modem back to back */
+    for (p_cur = p_batch ; p_cur != NULL ; p_cur = p_cur->p_batchNext) {
+        if (p_cur->command == NULL) {
+            continue;
+        }
+
+        err = at_send_command_async(p_cur->command, p_cur->type,
+                p_cur->responsePrefix, onPollResponse, p_cur);
+
+        if (err < 0) {
+            /* never queued, so the callback won't run */
+            onPollResponse(err, NULL, p_cur);
+        }
+    }
+
+    pthread_mutex_lock(&s_pollMutex);
+    while (s_pendingResponses > 0) {
+        pthread_cond_wait(&s_pollCond, &s_pollMutex);
+    }
+    pthread_mutex_unlock(&s_pollMutex);
+
+    for (p_cur = p_batch ; p_cur != NULL ; p_cur = p_cur->p_batchNext) {
+        PollResult result;
+
+        result = p_cur->handler(p_cur->err, p_cur->p_response, p_cur->param);
+        at_response_free(p_cur->p_response);
+        p_cur->p_response = NULL;
+
+        pthread_mutex_lock(&s_pollMutex);
+        finishTaskLocked(p_cur, result, nowMsec());
+        pthread_mutex_unlock(&s_pollMutex);
+    }
+
+    pthread_mutex_lock(&s_pollMutex);
+    now = nowMsec();
+    publishStatsLocked(now);
+    armLocked(now);
+    pthread_mutex_unlock(&s_pollMutex);
+}
+
+void poll_scheduler_init(PollTimerFunc requestTimedCallback)
+{
+    pthread_mutex_lock(&s_pollMutex);
+
+    s_requestTimedCallback = requestTimedCallback;
+    if (s_startMs == 0) {
+        s_startMs = s_publishedMs = nowMsec();
+    }
+
+    pthread_mutex_unlock(&s_pollMutex);
+}
+
+void poll_schedule(PollTask *p_task, int delayMs)
+{
+    long long now;
+
+    pthread_mutex_lock(&s_pollMutex);
+
+    now = nowMsec();
+    addTask(p_task);
+
+    p_task->active = 1;
+    p_task->intervalMs = p_task->minIntervalMs;
+    p_task->dueMs = now + delayMs;
+    if (p_task->running) {
+        p_task->rescheduled = 1;
+    }
+
+    armLocked(now);
+
+    pthread_mutex_unlock(&s_pollMutex);
+}
+
+void poll_cancel(PollTask *p_task)
+{
+    pthread_mutex_lock(&s_pollMutex);
+    p_task->active = 0;
+    p_task->rescheduled = 0;
+    pthread_mutex_unlock(&s_pollMutex);
+}
+
+void poll_set_screen_state(int on)
+{
+    PollTask *p_cur;
+    long long now;
+
+    pthread_mutex_lock(&s_pollMutex);
+
+    on = (on != 0);
+    if (on == s_screenOn) {
+        pthread_mutex_unlock(&s_pollMutex);
+        return;
+    }
+    s_screenOn = on;
+
+    now = nowMsec();
+
+    /* stretch or shrink whatever is pending from its last poll */
+    for (p_cur = s_tasks ; p_cur != NULL ; p_cur = p_cur->p_next) {
+        if (p_cur->active && !p_cur->running && p_cur->lastRunMs != 0) {
+            p_cur->dueMs = p_cur->lastRunMs + effectiveInterval(p_cur);
+        }
+    }
+
+    armLocked(now);
+
+    pthread_mutex_unlock(&s_pollMutex);
+}
+
+void poll_get_stats(PollStats *p_stats)
+{
+    pthread_mutex_lock(&s_pollMutex);
+    publishStatsLocked(nowMsec());
+    *p_stats = s_stats;
+    pthread_mutex_unlock(&s_pollMutex);
+}
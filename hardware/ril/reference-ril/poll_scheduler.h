@@ -0,0 +1,108 @@
+/* //device/system/reference-ril/poll_scheduler.h
+**
+** Copyright 2006, The Android Open Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#ifndef POLL_SCHEDULER_H
+#define POLL_SCHEDULER_H 1
+
+#include <sys/time.h>
+
+#include "atchannel.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    POLL_UNCHANGED,     /* back off towards maxIntervalMs */
+    POLL_CHANGED,       /* poll again after minIntervalMs */
+    POLL_DONE           /* stop until poll_schedule() is called again */
+} PollResult;
+
+/**
+ * Called on the timed callback thread once the whole batch has completed,
+ * so it may issue further AT commands. err and p_response are as for
+ * at_send_command_full(); p_response is freed by the scheduler.
+ * Tasks without a command get err 0 and a NULL p_response.
+ */
+typedef PollResult (*PollHandler)(int err, ATResponse *p_response, void *param);
+
+/** RIL_Env's RequestTimedCallback */
+typedef void (*PollTimerFunc)(void (*callback)(void *param), void *param,
+                              const struct timeval *relativeTime);
+
+/**
+ * A periodic query. The first block is filled in by the owner, usually
+ * in a static initializer; the rest belongs to the scheduler.
+ *
+ * The interval starts at minIntervalMs, doubles each time the handler
+ * reports POLL_UNCHANGED up to maxIntervalMs, and drops back to
+ * minIntervalMs on POLL_CHANGED. While the screen is off it is further
+ * multiplied by screenOffScale (0 or 1 to poll at the same rate).
+ */
+typedef struct PollTask {
+    const char *name;
+    const char *command;            /* NULL to just call the handler */
+    ATCommandType type;
+    const char *responsePrefix;
+    PollHandler handler;
+    void *param;
+    int minIntervalMs;
+    int maxIntervalMs;
+    int screenOffScale;
+
+    struct PollTask *p_next;        /* all tasks ever scheduled */
+    struct PollTask *p_batchNext;
+    int active;
+    int running;
+    int rescheduled;                /* poll_schedule() while running */
+    int intervalMs;
+    long long lastRunMs;
+    long long dueMs;
+    int err;
+    ATResponse *p_response;
+} PollTask;
+
+typedef struct {
+    long long elapsedMs;            /* since poll_scheduler_init() */
+    int wakeups;                    /* timer expiries */
+    int batches;                    /* wakeups that ran at least one task */
+    int merged;                     /* tasks that shared a batch with another */
+    int polls;
+    int wakeupsPerHour;
+} PollStats;
+
+void poll_scheduler_init(PollTimerFunc requestTimedCallback);
+
+/**
+ * Starts polling p_task, or restarts it at minIntervalMs if it was
+ * already being polled. The first poll happens after delayMs.
+ */
+void poll_schedule(PollTask *p_task, int delayMs);
+
+/** Stops polling p_task; a poll already in flight still completes */
+void poll_cancel(PollTask *p_task);
+
+/** From RIL_REQUEST_SCREEN_STATE: 1 on, 0 off */
+void poll_set_screen_state(int on);
+
+void poll_get_stats(PollStats *p_stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*POLL_SCHEDULER_H */
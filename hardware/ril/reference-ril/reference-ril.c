@@ -28,6 +28,8 @@
 #include <alloca.h>
 #include "atchannel.h"
 #include "at_tok.h"
+#include "at_pattern.h"
+#include "poll_scheduler.h"
 #include "misc.h"
 #include <getopt.h>
 #include <sys/socket.h>
@@ -56,6 +58,8 @@
 #define PPP_OPERSTATE_PATH "/sys/class/net/ppp0/operstate"
 #define SERVICE_PPPD_GPRS "pppd_gprs"
 #define PROPERTY_PPPD_EXIT_CODE "net.gprs.ppp-exit"
+/* number of AT commands the modem may be sent ahead of their responses */
+#define PROPERTY_AT_PIPELINE_DEPTH "ro.ril.at_pipeline_depth"
 // Max wait time to 2*10 secondes for ppp enable
 #define POLL_PPP_SYSFS_SECONDS 2
 #define POLL_PPP_SYSFS_RETRY   10
@@ -147,8 +151,8 @@ static int smsStorageIndex = 0;
 //"SM", "ME", "SR"
 static char smsReadStorage[3];
 
-static const struct timeval TIMEVAL_SIMPOLL = {1,0};
-static const struct timeval TIMEVAL_CALLSTATEPOLL = {0,500000};
+/* first call state poll after a call list with calls in transition */
+#define CALLSTATE_POLL_DELAY_MSEC 500
 static const struct timeval TIMEVAL_0 = {0,0};
 static struct timeval TIMEVAL_DELAYINIT = {0,0}; // will be set according to property value
 
@@ -168,8 +172,23 @@ static int s_expectAnswer = 0;
 static int sUnsolictedCREG_failed = 0;
 static int sUnsolictedCGREG_failed = 0;
 
-static void pollSIMState (void *param);
 static void setRadioState(RIL_RadioState newState);
+static PollResult onSIMPolled(int err, ATResponse *p_response, void *param);
+static PollResult onCallsPolled(int err, ATResponse *p_response, void *param);
+
+/* the periodic queries, run by poll_scheduler. The SIM poll only runs
+ * until the SIM is ready, every second as before, so it doesn't back off */
+static PollTask s_simPoll = {
+    "sim", "AT+CPIN?", SINGLELINE, "+CPIN:", onSIMPolled, NULL,
+    1000, 1000, 1
+};
+static PollTask s_callStatePoll = {
+    "calls", "AT+CLCC", MULTILINE, "+CLCC:", onCallsPolled, NULL,
+    500, 2000, 1
+};
+
+/* call list as last reported, see callListSignature() */
+static unsigned int s_callListSignature;
 
 static int clccStateToRILState(int state, RIL_CallState *p_state)
 
@@ -185,6 +204,105 @@ static int clccStateToRILState(int state, RIL_CallState *p_state)
     }
 }
 
+/* response formats of the polled queries, compiled by compilePatterns() */
+static ATPattern s_clccPattern;
+static ATPattern s_csqPattern;
+static ATPattern s_cregPattern;
+static ATPattern s_cgregPattern;
+
+/* set once every pattern compiled, the matches below use at_tok otherwise */
+static int s_patternsCompiled;
+
+static int compilePattern(ATPattern *p_pattern, const char *format)
+{
+    int err;
+
+    err = at_pattern_compile(p_pattern, format);
+    if (err < 0) {
+        LOGE("can't compile response pattern \"%s\", parsing with at_tok", format);
+    }
+    return err;
+}
+
+static void compilePatterns()
+{
+    int err = 0;
+
+    err |= compilePattern(&s_clccPattern, "+CLCC: %d,%b,%d,%d,%b[,%s,%d]");
+    err |= compilePattern(&s_csqPattern, "+CSQ: %d,%d");
+    err |= compilePattern(&s_cregPattern, "+CREG: %d[,%x,%x,%x,%x]");
+    err |= compilePattern(&s_cgregPattern, "+CGREG: %d[,%x,%x,%x,%x]");
+
+    s_patternsCompiled = (err == 0);
+}
+
+/* at_tok versions of the pattern matches, same return values */
+static int matchCLCCWithTok(char *line, RIL_Call *p_call, int *p_state, int *p_mode)
+{
+    int err;
+
+    err = at_tok_start(&line);
+    if (err < 0) return -1;
+    err = at_tok_nextint(&line, &(p_call->index));
+    if (err < 0) return -1;
+    err = at_tok_nextbool(&line, &(p_call->isMT));
+    if (err < 0) return -1;
+    err = at_tok_nextint(&line, p_state);
+    if (err < 0) return -1;
+    err = at_tok_nextint(&line, p_mode);
+    if (err < 0) return -1;
+    err = at_tok_nextbool(&line, &(p_call->isMpty));
+    if (err < 0) return -1;
+
+    p_call->number = NULL;
+    if (!at_tok_hasmore(&line)) return 5;
+
+    /* tolerate null here */
+    err = at_tok_nextstr(&line, &(p_call->number));
+    if (err < 0) return 5;
+    err = at_tok_nextint(&line, &p_call->toa);
+    if (err < 0) return -1;
+    return 7;
+}
+
+static int matchCSQWithTok(char *line, int *response)
+{
+    int err;
+
+    err = at_tok_start(&line);
+    if (err < 0) return -1;
+    err = at_tok_nextint(&line, &response[0]);
+    if (err < 0) return -1;
+    err = at_tok_nextint(&line, &response[1]);
+    if (err < 0) return -1;
+    return 2;
+}
+
+static int matchRegistrationWithTok(char *line, int *fields)
+{
+    int err;
+    int count;
+
+    err = at_tok_start(&line);
+    if (err < 0) return -1;
+    err = at_tok_nextint(&line, &fields[0]);
+    if (err < 0) return -1;
+
+    for (count = 1; at_tok_hasmore(&line); count++) {
+        if (count == 5) return -1;
+        err = at_tok_nexthexint(&line, &fields[count]);
+        if (err < 0) return -1;
+    }
+    return count;
+}
+
+/** for poll_scheduler, which doesn't know about s_rilenv */
+static void requestTimedCallback(RIL_TimedCallback callback, void *param,
+                                 const struct timeval *relativeTime)
+{
+    RIL_requestTimedCallback(callback, param, relativeTime);
+}
+
 /**
  * Note: directly modified line and has *p_call point directly into
  * modified line
@@ -194,49 +312,33 @@ static int callFromCLCCLine(char *line, RIL_Call *p_call)
         //+CLCC: 1,0,2,0,0,\"+18005551212\",145
         //     index,isMT,state,mode,isMpty(,number,TOA)?
 
+    int count;
     int err;
     int state;
     int mode;
 
-    err = at_tok_start(&line);
-    if (err < 0) goto error;
-
-    err = at_tok_nextint(&line, &(p_call->index));
-    if (err < 0) goto error;
-
-    err = at_tok_nextbool(&line, &(p_call->isMT));
-    if (err < 0) goto error;
+    if (s_patternsCompiled) {
+        count = at_pattern_match(&s_clccPattern, line,
+                    &p_call->index, &p_call->isMT, &state, &mode,
+                    &p_call->isMpty, &p_call->number, &p_call->toa);
+    } else {
+        count = matchCLCCWithTok(line, p_call, &state, &mode);
+    }
 
-    err = at_tok_nextint(&line, &state);
-    if (err < 0) goto error;
+    /* a number must come with its TOA */
+    if (count != 5 && count != 7) goto error;
 
     err = clccStateToRILState(state, &(p_call->state));
     if (err < 0) goto error;
 
-    err = at_tok_nextint(&line, &mode);
-    if (err < 0) goto error;
-
     p_call->isVoice = (mode == 0);
 
-    err = at_tok_nextbool(&line, &(p_call->isMpty));
-    if (err < 0) goto error;
-
-    if (at_tok_hasmore(&line)) {
-        err = at_tok_nextstr(&line, &(p_call->number));
-
-        /* tolerate null here */
-        if (err < 0) return 0;
-
-        // Some lame implementations return strings
-        // like "NOT AVAILABLE" in the CLCC line
-        if (p_call->number != NULL
-            && 0 == strspn(p_call->number, "+0123456789")
-        ) {
-            p_call->number = NULL;
-        }
-
-        err = at_tok_nextint(&line, &p_call->toa);
-        if (err < 0) goto error;
+    // Some lame implementations return strings
+    // like "NOT AVAILABLE" in the CLCC line
+    if (p_call->number != NULL
+        && 0 == strspn(p_call->number, "+0123456789")
+    ) {
+        p_call->number = NULL;
     }
 
     p_call->uusInfo = NULL;
@@ -263,7 +365,7 @@ static void onRadioPowerOn()
     at_send_command("AT%CTZV=1", NULL);
 #endif
 
-    pollSIMState(NULL);
+    poll_schedule(&s_simPoll, 0);
 }
 
 /** do post- SIM ready initialization */
@@ -697,11 +799,67 @@ error:
     RIL_onRequestComplete(t, RIL_E_GENERIC_FAILURE, NULL, 0);
 }
 
-static void sendCallStateChanged(void *param)
+#define CALL_LIST_SIGNATURE_INIT 2166136261u
+
+/** folds the fields the framework reacts to into an FNV-1a hash */
+static unsigned int addCallToSignature(unsigned int signature,
+                                       const RIL_Call *p_call)
 {
+    int fields[4];
+    int i;
+
+    fields[0] = p_call->index;
+    fields[1] = p_call->state;
+    fields[2] = p_call->isMT;
+    fields[3] = p_call->isMpty;
+
+    for (i = 0 ; i < 4 ; i++) {
+        signature = (signature ^ (unsigned int) fields[i]) * 16777619u;
+    }
+
+    return signature;
+}
+
+/**
+ * Polls AT+CLCC while calls are in transition, and only tells the
+ * framework when the list differs from what it last saw, instead of
+ * on every poll
+ */
+static PollResult onCallsPolled(int err, ATResponse *p_response, void *param)
+{
+    unsigned int signature = CALL_LIST_SIGNATURE_INIT;
+    ATLine *p_cur;
+    RIL_Call call;
+
+    if (err != 0 || p_response->success == 0) {
+        /* let GET_CURRENT_CALLS sort it out */
+        RIL_onUnsolicitedResponse (
+            RIL_UNSOL_RESPONSE_CALL_STATE_CHANGED,
+            NULL, 0);
+        return POLL_DONE;
+    }
+
+    for (p_cur = p_response->p_intermediates
+            ; p_cur != NULL
+            ; p_cur = p_cur->p_next
+    ) {
+        memset(&call, 0, sizeof(call));
+        if (callFromCLCCLine(p_cur->line, &call) == 0) {
+            signature = addCallToSignature(signature, &call);
+        }
+    }
+
+    if (signature == s_callListSignature) {
+        return POLL_UNCHANGED;
+    }
+
+    s_callListSignature = signature;
+
     RIL_onUnsolicitedResponse (
         RIL_UNSOL_RESPONSE_CALL_STATE_CHANGED,
         NULL, 0);
+
+    return POLL_CHANGED;
 }
 
 static void requestGetCurrentCalls(void *data, size_t datalen, RIL_Token t)
@@ -715,6 +873,7 @@ static void requestGetCurrentCalls(void *data, size_t datalen, RIL_Token t)
     RIL_Call **pp_calls;
     int i;
     int needRepoll = 0;
+    unsigned int signature = CALL_LIST_SIGNATURE_INIT;
 
 #ifdef WORKAROUND_ERRONEOUS_ANSWER
     int prevIncomingOrWaitingLine;
@@ -773,6 +932,8 @@ static void requestGetCurrentCalls(void *data, size_t datalen, RIL_Token t)
             needRepoll = 1;
         }
 
+        signature = addCallToSignature(signature, p_calls + countValidCalls);
+
         countValidCalls++;
     }
 
@@ -812,13 +973,17 @@ static void requestGetCurrentCalls(void *data, size_t datalen, RIL_Token t)
 
     at_response_free(p_response);
 
+    s_callListSignature = signature;
+
 #ifdef POLL_CALL_STATE
     if (countValidCalls) {  // We don't seem to get a "NO CARRIER" message from
                             // smd, so we're forced to poll until the call ends.
 #else
     if (needRepoll) {
 #endif
-        RIL_requestTimedCallback (sendCallStateChanged, NULL, &TIMEVAL_CALLSTATEPOLL);
+        poll_schedule(&s_callStatePoll, CALLSTATE_POLL_DELAY_MSEC);
+    } else {
+        poll_cancel(&s_callStatePoll);
     }
 
     return;
@@ -955,13 +1120,11 @@ static void requestSignalStrength(void *data, size_t datalen, RIL_Token t)
 
     line = p_response->p_intermediates->line;
 
-    err = at_tok_start(&line);
-    if (err < 0) goto error;
-
-    err = at_tok_nextint(&line, &(response[0]));
-    if (err < 0) goto error;
-
-    err = at_tok_nextint(&line, &(response[1]));
+    if (s_patternsCompiled) {
+        err = at_pattern_match(&s_csqPattern, line, &response[0], &response[1]);
+    } else {
+        err = matchCSQWithTok(line, response);
+    }
     if (err < 0) goto error;
 
     RIL_onRequestComplete(t, RIL_E_SUCCESS, response, sizeof(response));
@@ -984,18 +1147,21 @@ static void requestRegistrationState(int request, void *data,
     ATResponse *p_response = NULL;
     const char *cmd;
     const char *prefix;
-    char *line, *p;
-    int commas;
-    int skip;
+    const ATPattern *pattern;
+    char *line;
+    int fields[5];
+    int numFields;
     int count = 3;
 
 
     if (request == RIL_REQUEST_VOICE_REGISTRATION_STATE) {
         cmd = "AT+CREG?";
         prefix = "+CREG:";
+        pattern = &s_cregPattern;
     } else if (request == RIL_REQUEST_DATA_REGISTRATION_STATE) {
         cmd = "AT+CGREG?";
         prefix = "+CGREG:";
+        pattern = &s_cgregPattern;
     } else {
         assert(0);
         goto error;
@@ -1007,9 +1173,6 @@ static void requestRegistrationState(int request, void *data,
 
     line = p_response->p_intermediates->line;
 
-    err = at_tok_start(&line);
-    if (err < 0) goto error;
-
     /* Ok you have to be careful here
      * The solicited version of the CREG response is
      * +CREG: n, stat, [lac, cid]
@@ -1029,64 +1192,49 @@ static void requestRegistrationState(int request, void *data,
      * to the network type, as in;
      *
      *   +CGREG: n, stat [,lac, cid [,networkType]]
+     *
+     * The pattern reads everything after the first value as hex, which
+     * is also right for <stat> since it is a single digit.
      */
 
-    /* count number of commas */
-    commas = 0;
-    for (p = line ; *p != '\0' ;p++) {
-        if (*p == ',') commas++;
+    if (s_patternsCompiled) {
+        numFields = at_pattern_match(pattern, line, &fields[0], &fields[1],
+                        &fields[2], &fields[3], &fields[4]);
+    } else {
+        numFields = matchRegistrationWithTok(line, fields);
     }
 
-    switch (commas) {
-        case 0: /* +CREG: <stat> */
-            err = at_tok_nextint(&line, &response[0]);
-            if (err < 0) goto error;
+    switch (numFields) {
+        case 1: /* +CREG: <stat> */
+            response[0] = fields[0];
             response[1] = -1;
             response[2] = -1;
         break;
 
-        case 1: /* +CREG: <n>, <stat> */
-            err = at_tok_nextint(&line, &skip);
-            if (err < 0) goto error;
-            err = at_tok_nextint(&line, &response[0]);
-            if (err < 0) goto error;
+        case 2: /* +CREG: <n>, <stat> */
+            response[0] = fields[1];
             response[1] = -1;
             response[2] = -1;
-            if (err < 0) goto error;
         break;
 
-        case 2: /* +CREG: <stat>, <lac>, <cid> */
-            err = at_tok_nextint(&line, &response[0]);
-            if (err < 0) goto error;
-            err = at_tok_nexthexint(&line, &response[1]);
-            if (err < 0) goto error;
-            err = at_tok_nexthexint(&line, &response[2]);
-            if (err < 0) goto error;
+        case 3: /* +CREG: <stat>, <lac>, <cid> */
+            response[0] = fields[0];
+            response[1] = fields[1];
+            response[2] = fields[2];
         break;
-        case 3: /* +CREG: <n>, <stat>, <lac>, <cid> */
-            err = at_tok_nextint(&line, &skip);
-            if (err < 0) goto error;
-            err = at_tok_nextint(&line, &response[0]);
-            if (err < 0) goto error;
-            err = at_tok_nexthexint(&line, &response[1]);
-            if (err < 0) goto error;
-            err = at_tok_nexthexint(&line, &response[2]);
-            if (err < 0) goto error;
+        case 4: /* +CREG: <n>, <stat>, <lac>, <cid> */
+            response[0] = fields[1];
+            response[1] = fields[2];
+            response[2] = fields[3];
         break;
         /* special case for CGREG, there is a fourth parameter
          * that is the network type (unknown/gprs/edge/umts)
          */
-        case 4: /* +CGREG: <n>, <stat>, <lac>, <cid>, <networkType> */
-            err = at_tok_nextint(&line, &skip);
-            if (err < 0) goto error;
-            err = at_tok_nextint(&line, &response[0]);
-            if (err < 0) goto error;
-            err = at_tok_nexthexint(&line, &response[1]);
-            if (err < 0) goto error;
-            err = at_tok_nexthexint(&line, &response[2]);
-            if (err < 0) goto error;
-            err = at_tok_nexthexint(&line, &response[3]);
-            if (err < 0) goto error;
+        case 5: /* +CGREG: <n>, <stat>, <lac>, <cid>, <networkType> */
+            response[0] = fields[1];
+            response[1] = fields[2];
+            response[2] = fields[3];
+            response[3] = fields[4];
             count = 4;
         break;
         default:
@@ -1821,21 +1969,24 @@ onRequest (int request, void *data, size_t datalen, RIL_Token t)
     LOGD("onRequest: %s", requestToString(request));
 
     /* Ignore all requests except RIL_REQUEST_GET_SIM_STATUS
+     * (and RIL_REQUEST_SCREEN_STATE, which only tunes polling)
      * when RADIO_STATE_UNAVAILABLE.
      */
     if (sState == RADIO_STATE_UNAVAILABLE
         && request != RIL_REQUEST_GET_SIM_STATUS
+        && request != RIL_REQUEST_SCREEN_STATE
     ) {
         RIL_onRequestComplete(t, RIL_E_RADIO_NOT_AVAILABLE, NULL, 0);
         return;
     }
 
     /* Ignore all non-power requests when RADIO_STATE_OFF
-     * (except RIL_REQUEST_GET_SIM_STATUS)
+     * (except RIL_REQUEST_GET_SIM_STATUS and RIL_REQUEST_SCREEN_STATE)
      */
     if (sState == RADIO_STATE_OFF
         && !(request == RIL_REQUEST_RADIO_POWER
-            || request == RIL_REQUEST_GET_SIM_STATUS)
+            || request == RIL_REQUEST_GET_SIM_STATUS
+            || request == RIL_REQUEST_SCREEN_STATE)
     ) {
         RIL_onRequestComplete(t, RIL_E_RADIO_NOT_AVAILABLE, NULL, 0);
         return;
@@ -2095,6 +2246,11 @@ onRequest (int request, void *data, size_t datalen, RIL_Token t)
             requestEnterSimPin(data, datalen, t);
             break;
 
+        case RIL_REQUEST_SCREEN_STATE:
+            poll_set_screen_state(((int *)data)[0]);
+            RIL_onRequestComplete(t, RIL_E_SUCCESS, NULL, 0);
+            break;
+
         case RIL_REQUEST_BASEBAND_VERSION:
             if (current_modem_type == HUAWEI_MODEM)
                 requestBasebandVersion(data, datalen, t);
@@ -2188,26 +2344,17 @@ setRadioState(RIL_RadioState newState)
     }
 }
 
-/** Returns SIM_NOT_READY on error */
-static SIM_Status
-getSIMStatus()
+/**
+ * Interprets the result of AT+CPIN?
+ * Returns SIM_NOT_READY on error
+ */
+static SIM_Status simStatusFromResponse(int err, ATResponse *p_response)
 {
-    ATResponse *p_response = NULL;
-    int err;
-    int ret;
     char *cpinLine;
     char *cpinResult;
 
-    if (sState == RADIO_STATE_OFF || sState == RADIO_STATE_UNAVAILABLE) {
-        ret = SIM_NOT_READY;
-        goto done;
-    }
-
-    err = at_send_command_singleline("AT+CPIN?", "+CPIN:", &p_response);
-
     if (err != 0) {
-        ret = SIM_NOT_READY;
-        goto done;
+        return SIM_NOT_READY;
     }
 
     switch (at_get_cme_error(p_response)) {
@@ -2215,12 +2362,10 @@ getSIMStatus()
             break;
 
         case CME_SIM_NOT_INSERTED:
-            ret = SIM_ABSENT;
-            goto done;
+            return SIM_ABSENT;
 
         default:
-            ret = SIM_NOT_READY;
-            goto done;
+            return SIM_NOT_READY;
     }
 
     /* CPIN? has succeeded, now look at the result */
@@ -2229,38 +2374,45 @@ getSIMStatus()
     err = at_tok_start (&cpinLine);
 
     if (err < 0) {
-        ret = SIM_NOT_READY;
-        goto done;
+        return SIM_NOT_READY;
     }
 
     err = at_tok_nextstr(&cpinLine, &cpinResult);
 
     if (err < 0) {
-        ret = SIM_NOT_READY;
-        goto done;
+        return SIM_NOT_READY;
     }
 
     if (0 == strcmp (cpinResult, "SIM PIN")) {
-        ret = SIM_PIN;
-        goto done;
+        return SIM_PIN;
     } else if (0 == strcmp (cpinResult, "SIM PUK")) {
-        ret = SIM_PUK;
-        goto done;
+        return SIM_PUK;
     } else if (0 == strcmp (cpinResult, "PH-NET PIN")) {
         return SIM_NETWORK_PERSONALIZATION;
     } else if (0 != strcmp (cpinResult, "READY"))  {
         /* we're treating unsupported lock types as "sim absent" */
-        ret = SIM_ABSENT;
-        goto done;
+        return SIM_ABSENT;
     }
 
-    at_response_free(p_response);
-    p_response = NULL;
-    cpinResult = NULL;
+    return SIM_READY;
+}
 
-    ret = SIM_READY;
+/** Returns SIM_NOT_READY on error */
+static SIM_Status
+getSIMStatus()
+{
+    ATResponse *p_response = NULL;
+    int err;
+    SIM_Status ret;
+
+    if (sState == RADIO_STATE_OFF || sState == RADIO_STATE_UNAVAILABLE) {
+        return SIM_NOT_READY;
+    }
+
+    err = at_send_command_singleline("AT+CPIN?", "+CPIN:", &p_response);
+
+    ret = simStatusFromResponse(err, p_response);
 
-done:
     at_response_free(p_response);
     return ret;
 }
@@ -2348,32 +2500,28 @@ static void freeCardStatus(RIL_CardStatus_v6 *p_card_status) {
  *  (all SMS-related commands)
  */
 
-static void pollSIMState (void *param)
+static PollResult onSIMPolled(int err, ATResponse *p_response, void *param)
 {
-    ATResponse *p_response;
-    int ret;
-
     if (sState != RADIO_STATE_SIM_NOT_READY) {
         // no longer valid to poll
-        return;
+        return POLL_DONE;
     }
 
-    switch(getSIMStatus()) {
+    switch(simStatusFromResponse(err, p_response)) {
         case SIM_ABSENT:
         case SIM_PIN:
         case SIM_PUK:
         case SIM_NETWORK_PERSONALIZATION:
         default:
             setRadioState(RADIO_STATE_SIM_LOCKED_OR_ABSENT);
-        return;
+        return POLL_DONE;
 
         case SIM_NOT_READY:
-            RIL_requestTimedCallback (pollSIMState, NULL, &TIMEVAL_SIMPOLL);
-        return;
+        return POLL_UNCHANGED;
 
         case SIM_READY:
             setRadioState(RADIO_STATE_SIM_READY);
-        return;
+        return POLL_DONE;
     }
 }
 
@@ -2426,15 +2574,18 @@ static void initializeCallback(void *param)
     /* note: we don't check errors here. Everything important will
        be handled in onATTimeout and onATReaderClosed */
 
+    /* Commands whose result we ignore are queued without waiting; they
+       are still written in order, ahead of the next synchronous one */
+
     /*  atchannel is tolerant of echo but it must */
     /*  have verbose result codes */
     at_send_command("ATE0Q0V1", NULL);
 
     /*  No auto-answer */
-    at_send_command("ATS0=0", NULL);
+    at_send_command_async("ATS0=0", NO_RESULT, NULL, NULL, NULL);
 
     /*  Extended errors */
-    at_send_command("AT+CMEE=1", NULL);
+    at_send_command_async("AT+CMEE=1", NO_RESULT, NULL, NULL, NULL);
 
     /*  Network registration events */
     err = at_send_command("AT+CREG=2", &p_response);
@@ -2467,31 +2618,31 @@ static void initializeCallback(void *param)
     at_response_free(p_response);
 
     /*  Call Waiting notifications */
-    at_send_command("AT+CCWA=1", NULL);
+    at_send_command_async("AT+CCWA=1", NO_RESULT, NULL, NULL, NULL);
 
     /*  Alternating voice/data off */
-    at_send_command("AT+CMOD=0", NULL);
+    at_send_command_async("AT+CMOD=0", NO_RESULT, NULL, NULL, NULL);
 
     /*  Not muted */
-    at_send_command("AT+CMUT=0", NULL);
+    at_send_command_async("AT+CMUT=0", NO_RESULT, NULL, NULL, NULL);
 
     /*  +CSSU unsolicited supp service notifications */
-    at_send_command("AT+CSSN=0,1", NULL);
+    at_send_command_async("AT+CSSN=0,1", NO_RESULT, NULL, NULL, NULL);
 
     /*  no connected line identification */
-    at_send_command("AT+COLP=0", NULL);
+    at_send_command_async("AT+COLP=0", NO_RESULT, NULL, NULL, NULL);
 
     /*  HEX character set */
-    at_send_command("AT+CSCS=\"HEX\"", NULL);
+    at_send_command_async("AT+CSCS=\"HEX\"", NO_RESULT, NULL, NULL, NULL);
 
     /*  USSD unsolicited */
-    at_send_command("AT+CUSD=1", NULL);
+    at_send_command_async("AT+CUSD=1", NO_RESULT, NULL, NULL, NULL);
 
     /*  Enable +CGEV GPRS event notifications, but don't buffer */
-    at_send_command("AT+CGEREP=1,0", NULL);
+    at_send_command_async("AT+CGEREP=1,0", NO_RESULT, NULL, NULL, NULL);
 
     /*  SMS PDU mode */
-    at_send_command("AT+CMGF=0", NULL);
+    at_send_command_async("AT+CMGF=0", NO_RESULT, NULL, NULL, NULL);
 
 #ifdef USE_TI_COMMANDS
 
@@ -2678,6 +2829,7 @@ mainLoop(void *param)
 #endif
     struct termios new_termios, old_termios;
     char delay_init[PROPERTY_VALUE_MAX];
+    char pipeline_depth[PROPERTY_VALUE_MAX];
     int delay;
 
     AT_DUMP("== ", "entering mainLoop()", -1 );
@@ -2764,6 +2916,10 @@ mainLoop(void *param)
 		}
 	}
         s_closed = 0;
+
+        property_get(PROPERTY_AT_PIPELINE_DEPTH, pipeline_depth, "1");
+        at_set_pipeline_depth(atoi(pipeline_depth));
+
         ret = at_open(fd, onUnsolicited);
 
         if (ret < 0) {
@@ -2856,6 +3012,9 @@ const RIL_RadioFunctions *RIL_Init(const struct RIL_Env *env, int argc, char **a
 
     pthread_attr_init (&attr);
     pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    compilePatterns();
+    poll_scheduler_init(requestTimedCallback);
+
     ret = pthread_create(&s_tid_mainloop, &attr, mainLoop, NULL);
 
     return &s_callbacks;
@@ -2897,6 +3056,9 @@ int main (int argc, char **argv)
         usage(argv[0]);
     }
 
+    compilePatterns();
+    poll_scheduler_init(requestTimedCallback);
+
     RIL_register(&s_callbacks);
 
     mainLoop(NULL);
@@ -34,6 +34,7 @@ enum options {
     DIAL_CALL,
     ANSWER_CALL,
     END_CALL,
+    DUMP_STATS,
 };
 
 
@@ -49,7 +50,8 @@ static void print_usage() {
            7 - DEACTIVE_PDP, \n\
            8 number - DIAL_CALL number, \n\
            9 - ANSWER_CALL, \n\
-           10 - END_CALL \n");
+           10 - END_CALL, \n\
+           11 - DUMP_STATS \n");
 }
 
 static int error_check(int argc, char * argv[]) {
@@ -57,7 +59,7 @@ static int error_check(int argc, char * argv[]) {
         return -1;
     }
     const int option = atoi(argv[1]);
-    if (option < 0 || option > 10) {
+    if (option < 0 || option > 11) {
         return 0;
     } else if ((option == DIAL_CALL || option == SETUP_PDP) && argc == 3) {
         return 0;
@@ -119,6 +121,14 @@ int main(int argc, char *argv[])
         }
     }
 
+    if (atoi(argv[1]) == DUMP_STATS) {
+        // rild writes the stats back as text and then closes the socket
+        char buf[1024];
+        while ((ret = recv(fd, buf, sizeof(buf), 0)) > 0) {
+            fwrite(buf, 1, ret, stdout);
+        }
+    }
+
     close(fd);
     return 0;
 }